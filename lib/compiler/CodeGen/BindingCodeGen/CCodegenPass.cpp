@@ -26,6 +26,7 @@
 #include "Module.hpp"
 
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MathExtras.h>
 #include <llvm/Support/Path.h>
 #include <llvm/Support/raw_ostream.h>
 
@@ -113,6 +114,21 @@ bool tyr::pass::CCodegenPass::runOnModule(tyr::Module &m) {
     out << "#include <tyr/rt/Base64.h>\n";
   }
 
+  if (rt::isCompressEnabled(m_rt_options_)) {
+    // Link Compress
+    out << "#include <tyr/rt/Compress.h>\n";
+  }
+
+  if (rt::isParallelEnabled(m_rt_options_)) {
+    // Link Parallel
+    out << "#include <tyr/rt/Parallel.h>\n";
+  }
+
+  if (rt::isAsyncEnabled(m_rt_options_)) {
+    // Link AsyncFile
+    out << "#include <tyr/rt/AsyncFile.h>\n";
+  }
+
   out << "\n";
 
   // Iterate over the structs and create the typedefs
@@ -120,6 +136,18 @@ bool tyr::pass::CCodegenPass::runOnModule(tyr::Module &m) {
     out << "typedef struct " << s.first() << " " << s.first() << "_t;\n";
   }
 
+  out << "\n";
+
+  // What the <name>_decoder_feed functions return, shared by every module
+  out << "#ifndef TYR_DECODE_STATUS\n"
+         "#define TYR_DECODE_STATUS\n"
+         "enum tyr_decode_status {\n"
+         "  TYR_DECODE_NEED_MORE = 0,\n"
+         "  TYR_DECODE_DONE = 1,\n"
+         "  TYR_DECODE_ERROR = 2,\n"
+         "};\n"
+         "#endif // TYR_DECODE_STATUS\n";
+
   out << "\n\n";
 
   for (const auto &s : m.getStructs()) {
@@ -127,7 +155,8 @@ bool tyr::pass::CCodegenPass::runOnModule(tyr::Module &m) {
 
     llvm::SmallVector<ir::Field *, 8> ConstructorFields;
     for (auto &f : s.second->getFields()) {
-      if (f->isCount) {
+      if (f->isCount || f->isBitStorage || f->isPending || f->isSizeHeader ||
+          f->isDirtyState) {
         continue;
       }
       out << "bool get_" << s.first() << "_" << f->name << "(" << PtrName
@@ -157,7 +186,9 @@ bool tyr::pass::CCodegenPass::runOnModule(tyr::Module &m) {
             << PtrName << "struct_ptr, uint64_t *count);\n";
       }
 
-      if (!f->isMutable) {
+      // Frozen structs can't grow, so they take their arrays and nested
+      // structs up front too
+      if (!f->isMutable || (f->isFrozen && (f->isRepeated || f->isStruct))) {
         ConstructorFields.push_back(f.get());
       }
     }
@@ -186,13 +217,112 @@ bool tyr::pass::CCodegenPass::runOnModule(tyr::Module &m) {
     out << "void destroy_" << s.first() << "(" << PtrName << "struct_ptr);\n";
 
     out << "typedef void *" << s.first() << "_ptr;\n";
+
+    // Field mask bits for deserialize_<name>_fields. Macros rather than an
+    // enum, enumerators have to fit in an int before C23.
+    out << "/* Bits for the mask of deserialize_" << s.first() << "_fields. "
+        << "Only the first 64 fields have one, any after that are always "
+        << "read. */\n";
+    for (auto &f : s.second->getFields()) {
+      const uint64_t Mask = s.second->getFieldMask(f.get());
+      if (f->isBitStorage || Mask == 0) {
+        continue;
+      }
+      out << "#define " << s.first() << "_field_" << f->name << " (1ull << "
+          << llvm::countTrailingZeros(Mask) << ")\n";
+    }
     // Serializer
     out << "uint8_t *serialize_" << s.first() << "(" << s.first()
         << "_ptr struct_ptr);\n";
 
+    if (rt::isB64Enabled(m_rt_options_)) {
+      // Serializes straight to base64url text. Returns the encoded length,
+      // the output is only written if that fits in cap.
+      out << "uint64_t serialize_" << s.first() << "_base64_into("
+          << s.first() << "_ptr struct_ptr, uint8_t *buf, uint64_t cap);\n";
+    }
+
+    if (rt::isFileEnabled(m_rt_options_)) {
+      // Writes the serialized struct to fd with writev, fields that are
+      // already in wire order go out straight from the struct
+      out << "bool serialize_" << s.first() << "_to_fd(" << s.first()
+          << "_ptr struct_ptr, int fd);\n";
+    }
+
     // Deserializer
+    if (s.second->isFrozen()) {
+      out << "/* " << s.first() << " is frozen: a " << s.first() << "_t * "
+          << "points at its own serialized form, in this machine's byte "
+          << "order. A buffer that passes validate_" << s.first() << " and "
+          << "is 8 byte aligned can be used as one as it is (but not "
+          << "destroyed). Getters hand out pointers into the struct. */\n";
+    }
+    if (s.second->isLazy()) {
+      out << "/* " << s.first() << " is lazy: its repeated fields are decoded "
+          << "from the serialized buffer on first use, so the buffer has to "
+          << "outlive the struct (or until every field has been read). The "
+          << "_eager deserializers decode everything up front instead. */\n";
+    }
     out << s.first() << "_ptr deserialize_" << s.first()
-        << "(uint8_t *serialized_struct);\n\n";
+        << "(uint8_t *serialized_struct);\n";
+
+    // Only reads the fields in the mask, the rest are left empty
+    out << s.first() << "_ptr deserialize_" << s.first()
+        << "_fields(const uint8_t *buf, uint64_t len, uint64_t mask);\n";
+
+    // Bounds-checked versions for untrusted input, nothing is allocated
+    // unless the whole buffer is well-formed
+    out << "bool validate_" << s.first()
+        << "(const uint8_t *buf, uint64_t len);\n";
+    out << s.first() << "_ptr deserialize_" << s.first()
+        << "_n(const uint8_t *buf, uint64_t len);\n";
+
+    if (s.second->isLazy()) {
+      // Everything decoded up front, for handing to the runtime helpers that
+      // free (or reuse) the buffer before they return
+      out << s.first() << "_ptr deserialize_" << s.first()
+          << "_eager(uint8_t *serialized_struct);\n";
+      out << s.first() << "_ptr deserialize_" << s.first()
+          << "_eager_n(const uint8_t *buf, uint64_t len);\n";
+    }
+
+    // Many structs behind one header. The serializer returns the size of the
+    // batch, and only writes it if that fits in cap. The deserializer returns
+    // a malloc'd array of n structs.
+    out << "uint64_t serialize_" << s.first() << "_batch(" << s.first()
+        << "_ptr *items, uint64_t n, uint8_t *buf, uint64_t cap);\n";
+    out << s.first() << "_ptr *deserialize_" << s.first()
+        << "_batch(const uint8_t *buf, uint64_t len, uint64_t *n);\n";
+
+    // Push decoder for messages that arrive in pieces. Each call consumes as
+    // much of buf as belongs to the current message; on TYR_DECODE_DONE the
+    // struct is in *out and the rest of buf starts the next message. After
+    // TYR_DECODE_ERROR the decoder only reports errors. Messages bigger than
+    // max_size (64MiB if it's 0) are errors too.
+    out << "typedef struct " << s.first() << "_decoder " << s.first()
+        << "_decoder_t;\n";
+    out << s.first() << "_decoder_t *create_" << s.first()
+        << "_decoder(uint64_t max_size);\n";
+    out << "enum tyr_decode_status " << s.first() << "_decoder_feed("
+        << s.first() << "_decoder_t *decoder, const uint8_t *buf, uint64_t "
+        << "len, uint64_t *consumed, " << s.first() << "_t **out);\n";
+    out << "void destroy_" << s.first() << "_decoder(" << s.first()
+        << "_decoder_t *decoder);\n";
+
+    if (s.second->isTracked()) {
+      // Only what was set since the last delta goes out, and the receiver's
+      // copy has to have been up to date with that one
+      out << "/* " << s.first() << " is tracked: serialize_" << s.first()
+          << "_delta sends what its setters changed since the last delta "
+          << "(and forgets it), apply_" << s.first() << "_delta applies that "
+          << "to a copy which was up to date with the last delta. Changes "
+          << "made through pointers handed out by getters aren't seen. */\n";
+      out << "uint8_t *serialize_" << s.first() << "_delta(" << s.first()
+          << "_ptr struct_ptr);\n";
+      out << "bool apply_" << s.first() << "_delta(" << s.first()
+          << "_ptr struct_ptr, const uint8_t *buf, uint64_t len);\n";
+    }
+    out << "\n";
   }
 
   out << "#ifdef __cplusplus\n";
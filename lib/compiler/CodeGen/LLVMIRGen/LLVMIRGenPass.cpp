@@ -23,8 +23,12 @@
 #include "LLVMIRGenPass.hpp"
 #include "IR.hpp"
 
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Support/MathExtras.h>
 #include <llvm/Transforms/Utils/Cloning.h>
 
+#include <functional>
+
 namespace { // Utilities
 // Returns the non-null block
 llvm::BasicBlock *insertNullCheck(llvm::ArrayRef<llvm::Value *> Ptrs,
@@ -56,6 +60,211 @@ llvm::BasicBlock *insertNullCheck(llvm::ArrayRef<llvm::Value *> Ptrs,
   return IsNotNull;
 }
 
+// Returns ReturnFail from the current function unless Cond holds, and leaves
+// the builder where it does
+void insertCheck(llvm::Value *Cond, llvm::Value *ReturnFail,
+                 llvm::IRBuilder<> &builder) {
+  llvm::LLVMContext &ctx = builder.getContext();
+  llvm::Function *Parent = builder.GetInsertBlock()->getParent();
+
+  llvm::BasicBlock *Failed = llvm::BasicBlock::Create(ctx, "", Parent);
+  llvm::BasicBlock *Passed = llvm::BasicBlock::Create(ctx, "", Parent);
+  builder.CreateCondBr(Cond, Passed, Failed);
+
+  builder.SetInsertPoint(Failed);
+  builder.CreateRet(ReturnFail);
+
+  builder.SetInsertPoint(Passed);
+}
+
+// What the validators return instead of a size for malformed input
+const uint64_t kInvalidSize = ~0ull;
+
+// A delta starts with its size, the mask of fields sent whole and the mask of
+// repeated fields sent as a range of items
+const uint64_t kDeltaHeaderSize = 3 * sizeof(uint64_t);
+
+// A batch starts with its size, the number of records, the fingerprint of the
+// struct and the size of every record (0 if they're each a serialized struct)
+const uint64_t kBatchHeaderSize = 4 * sizeof(uint64_t);
+
+// Validation rejects anything longer than this up front, which is far more
+// than can be addressed but keeps the bit and element arithmetic from
+// overflowing
+const uint64_t kMaxValidatedSize = 1ull << 56;
+
+// With the parallel runtime, repeated fields at least this big go to the wire
+// in chunks of about kParallelChunkSize bytes spread over the thread pool
+const uint64_t kParallelCopyThreshold = 1ull << 20;
+const uint64_t kParallelChunkSize = 1ull << 18;
+
+// Fields that have to be swapped on the way to a file descriptor are staged
+// this much at a time, which fits the runtime's staging buffer
+const uint64_t kFdChunkSize = 1ull << 15;
+
+// What <name>_decoder_feed returns, the same as enum tyr_decode_status in the
+// generated header
+const uint32_t kDecodeNeedMore = 0;
+const uint32_t kDecodeDone = 1;
+const uint32_t kDecodeError = 2;
+// The largest message a decoder takes when it's created with a limit of 0,
+// the same as for tyr_stream_reader
+const uint64_t kDefaultMaxMessage = 64ull << 20u;
+
+// Where things are in a <name>_decoder
+enum DecoderFields : unsigned {
+  kDecoderHave = 0,
+  kDecoderSize,
+  kDecoderBuf,
+  kDecoderFailed,
+  kDecoderMax,
+  kDecoderHeader,
+};
+
+// Loads an i64 length prefix from wherever it happens to be in a buffer
+llvm::Value *loadLength(llvm::Value *In, llvm::IRBuilder<> &builder) {
+  const uint32_t AddrSpace = In->getType()->getPointerAddressSpace();
+  return builder.CreateAlignedLoad(
+      builder.CreateBitCast(In, builder.getInt64Ty()->getPointerTo(AddrSpace)),
+      1);
+}
+
+// Stores an i64 length or offset to wherever it has to go in a buffer
+void storeLength(llvm::Value *Length, llvm::Value *Out,
+                 llvm::IRBuilder<> &builder) {
+  const uint32_t AddrSpace = Out->getType()->getPointerAddressSpace();
+  builder.CreateAlignedStore(
+      Length,
+      builder.CreateBitCast(Out, builder.getInt64Ty()->getPointerTo(AddrSpace)),
+      1);
+}
+
+// Whether the field takes up its own place on the wire. Counts go out with
+// their repeated field and bit packed fields with their storage.
+bool isOnWire(const tyr::ir::Field *f) {
+  return !f->isCount && f->storageField == nullptr && !f->isPending &&
+         !f->isDirtyState;
+}
+
+// An indexed struct follows the size header with the offset of each field on
+// the wire, in the order they are sent
+uint64_t getOffsetTableSize(const tyr::ir::Struct *s) {
+  if (!s->isIndexed()) {
+    return 0;
+  }
+  uint64_t NumFields = 0;
+  for (auto &entry : s->getFields()) {
+    NumFields += isOnWire(entry.get());
+  }
+  return NumFields * sizeof(uint64_t);
+}
+
+// Rounds Size up to a multiple of Align, which is a power of 2
+llvm::Value *alignUp(llvm::Value *Size, uint64_t Align,
+                     llvm::IRBuilder<> &builder) {
+  return builder.CreateAnd(builder.CreateAdd(Size, builder.getInt64(Align - 1)),
+                           builder.getInt64(~(Align - 1)));
+}
+
+// The field holding the size of a frozen struct, null for any other struct
+const tyr::ir::Field *getSizeHeader(const tyr::ir::Struct *s) {
+  for (auto &entry : s->getFields()) {
+    if (entry->isSizeHeader) {
+      return entry.get();
+    }
+  }
+  return nullptr;
+}
+
+// The dirty state of a tracked struct, null for any other struct
+const tyr::ir::Field *getDirtyState(const tyr::ir::Struct *s) {
+  for (auto &entry : s->getFields()) {
+    if (entry->isDirtyState) {
+      return entry.get();
+    }
+  }
+  return nullptr;
+}
+
+// Word IDX of a tracked struct's dirty state
+llvm::Value *getDirtyWord(const tyr::ir::Field *DirtyState,
+                          llvm::Value *Struct, uint32_t IDX,
+                          llvm::IRBuilder<> &builder) {
+  return builder.CreateConstGEP2_32(
+      DirtyState->type, builder.CreateStructGEP(Struct, DirtyState->offset), 0,
+      IDX);
+}
+
+// The size of every record of the struct in a batch, or 0 if they can differ.
+// Structs of plain scalars are sent without a header of their own.
+uint64_t getFixedRecordSize(const tyr::ir::Struct *s,
+                            const llvm::DataLayout &DL) {
+  if (s->isFrozen()) {
+    return 0;
+  }
+  uint64_t Size = 0;
+  for (auto &entry : s->getFields()) {
+    if (!isOnWire(entry.get())) {
+      continue;
+    }
+    if (entry->isRepeated || entry->isStruct ||
+        (entry->encoding & tyr::ir::kEncodingVarint)) {
+      return 0;
+    }
+    Size += DL.getTypeAllocSize(entry->type);
+  }
+  return Size;
+}
+
+// Whether a fixed size record is byte for byte the struct in memory: nothing
+// but the fields in it, no padding and no byte swapping
+bool isWireLayout(const tyr::ir::Struct *s, const llvm::DataLayout &DL) {
+  for (auto &entry : s->getFields()) {
+    if (entry->storageField == nullptr && !isOnWire(entry.get())) {
+      return false;
+    }
+  }
+  return DL.isLittleEndian() &&
+         DL.getTypeAllocSize(s->getType()) == getFixedRecordSize(s, DL);
+}
+
+// Records that the whole of the field was set, if its struct is tracked
+void markDirty(const tyr::ir::Field *f, llvm::Value *Struct,
+               llvm::IRBuilder<> &builder) {
+  if (f->dirtyField == nullptr) {
+    return;
+  }
+  llvm::Value *MaskPtr = getDirtyWord(f->dirtyField, Struct, 0, builder);
+  builder.CreateStore(builder.CreateOr(builder.CreateLoad(MaskPtr),
+                                       builder.getInt64(f->dirtyBit)),
+                      MaskPtr);
+}
+
+// Records that item IDX of the repeated field was set, by growing the range
+// of changed items to cover it
+void markDirtyItem(const tyr::ir::Field *f, llvm::Value *Struct,
+                   llvm::Value *IDX, llvm::IRBuilder<> &builder) {
+  if (f->dirtyField == nullptr) {
+    return;
+  }
+  llvm::Value *LoPtr =
+      getDirtyWord(f->dirtyField, Struct, f->dirtyRange, builder);
+  llvm::Value *HiPtr =
+      getDirtyWord(f->dirtyField, Struct, f->dirtyRange + 1, builder);
+  llvm::Value *Lo = builder.CreateLoad(LoPtr);
+  llvm::Value *Hi = builder.CreateLoad(HiPtr);
+  llvm::Value *End = builder.CreateAdd(IDX, builder.getInt64(1));
+
+  // An empty range is replaced rather than grown
+  llvm::Value *IsEmpty = builder.CreateICmpEQ(Lo, Hi);
+  llvm::Value *NewLo = builder.CreateSelect(
+      builder.CreateOr(IsEmpty, builder.CreateICmpULT(IDX, Lo)), IDX, Lo);
+  llvm::Value *NewHi = builder.CreateSelect(
+      builder.CreateOr(IsEmpty, builder.CreateICmpUGT(End, Hi)), End, Hi);
+  builder.CreateStore(NewLo, LoPtr);
+  builder.CreateStore(NewHi, HiPtr);
+}
+
 // Swap bytes to or from little endian (if it is little endian, then it's a
 // no-op)
 llvm::Value *swapBytes(llvm::Value *val, llvm::IRBuilder<> &builder) {
@@ -138,6 +347,601 @@ void swapArrayBytes(llvm::Value *ArrayPtr, llvm::Value *Count,
 
   builder.SetInsertPoint(nextBlock);
 }
+
+// Reads the bytes that cover [BitOffset, BitOffset + Width) into a single
+// integer. Bytes are assembled one at a time (byte 0 is the least significant)
+// so the bit layout does not depend on the target endianness.
+llvm::Value *loadCoveringBytes(llvm::Value *Storage, uint32_t BitOffset,
+                               uint32_t Width, llvm::IRBuilder<> &builder) {
+  const uint32_t FirstByte = BitOffset / 8;
+  const uint32_t NumBytes = (BitOffset % 8 + Width + 7) / 8;
+  llvm::Type *AccType = builder.getIntNTy(NumBytes * 8);
+
+  llvm::Value *Acc = llvm::ConstantInt::get(AccType, 0);
+  for (uint32_t i = 0; i < NumBytes; ++i) {
+    llvm::Value *Byte = builder.CreateLoad(
+        builder.CreateGEP(Storage, builder.getInt64(FirstByte + i)));
+    Acc = builder.CreateOr(
+        Acc, builder.CreateShl(builder.CreateZExt(Byte, AccType), i * 8));
+  }
+
+  return Acc;
+}
+
+// Extracts an iWidth integer from the bit packed byte array at Storage
+llvm::Value *loadBits(llvm::Value *Storage, uint32_t BitOffset, uint32_t Width,
+                      llvm::IRBuilder<> &builder) {
+  llvm::Value *Acc = loadCoveringBytes(Storage, BitOffset, Width, builder);
+  return builder.CreateTrunc(builder.CreateLShr(Acc, BitOffset % 8),
+                             builder.getIntNTy(Width));
+}
+
+// Inserts Val (an iWidth integer) into the bit packed byte array at Storage,
+// leaving the neighbouring bits untouched
+void storeBits(llvm::Value *Storage, uint32_t BitOffset, uint32_t Width,
+               llvm::Value *Val, llvm::IRBuilder<> &builder) {
+  const uint32_t FirstByte = BitOffset / 8;
+  const uint32_t Shift = BitOffset % 8;
+  const uint32_t NumBytes = (Shift + Width + 7) / 8;
+  llvm::Type *AccType = builder.getIntNTy(NumBytes * 8);
+
+  llvm::Value *Acc = loadCoveringBytes(Storage, BitOffset, Width, builder);
+  llvm::APInt Mask =
+      llvm::APInt::getBitsSet(NumBytes * 8, Shift, Shift + Width);
+  Acc = builder.CreateAnd(Acc, llvm::ConstantInt::get(AccType, ~Mask));
+  Acc = builder.CreateOr(
+      Acc, builder.CreateShl(builder.CreateZExt(Val, AccType), Shift));
+
+  for (uint32_t i = 0; i < NumBytes; ++i) {
+    llvm::Value *Byte =
+        builder.CreateTrunc(builder.CreateLShr(Acc, i * 8), builder.getInt8Ty());
+    builder.CreateStore(
+        Byte, builder.CreateGEP(Storage, builder.getInt64(FirstByte + i)));
+  }
+}
+// Emits for (i = 0; i < Count; ++i) { Body(i) } at the insert point, and leaves
+// the builder positioned after the loop. Body may create blocks of its own.
+void emitLoop(llvm::Value *Count, llvm::IRBuilder<> &builder,
+              const std::function<void(llvm::Value *)> &Body) {
+  llvm::LLVMContext &ctx = builder.getContext();
+  llvm::Function *ParentFunc = builder.GetInsertBlock()->getParent();
+  llvm::BasicBlock *PrevBlock = builder.GetInsertBlock();
+
+  llvm::BasicBlock *LoopBlock = llvm::BasicBlock::Create(ctx, "", ParentFunc);
+  llvm::BasicBlock *NextBlock = llvm::BasicBlock::Create(ctx, "", ParentFunc);
+
+  llvm::Value *Zero = llvm::ConstantInt::get(Count->getType(), 0);
+  builder.CreateCondBr(builder.CreateICmpEQ(Count, Zero), NextBlock,
+                       LoopBlock);
+
+  builder.SetInsertPoint(LoopBlock);
+  llvm::PHINode *Iter = builder.CreatePHI(Count->getType(), 2);
+  Iter->addIncoming(Zero, PrevBlock);
+
+  Body(Iter);
+
+  llvm::Value *NextIter = builder.CreateAdd(
+      Iter, llvm::ConstantInt::get(Count->getType(), 1));
+  Iter->addIncoming(NextIter, builder.GetInsertBlock());
+  builder.CreateCondBr(builder.CreateICmpEQ(NextIter, Count), NextBlock,
+                       LoopBlock);
+
+  builder.SetInsertPoint(NextBlock);
+}
+
+// Allocas go in the entry block so they are promoted to registers and don't
+// grow the stack if the function is inlined into a loop
+llvm::Value *createEntryAlloca(llvm::Type *Ty, llvm::IRBuilder<> &builder) {
+  llvm::Function *ParentFunc = builder.GetInsertBlock()->getParent();
+  llvm::BasicBlock &Entry = ParentFunc->getEntryBlock();
+  llvm::IRBuilder<> EntryBuilder(&Entry, Entry.begin());
+  return EntryBuilder.CreateAlloca(Ty);
+}
+
+// Loads In[Index - 1], or zero for the first element, without branching
+llvm::Value *loadPrevious(llvm::Value *In, llvm::Value *Index,
+                          llvm::IRBuilder<> &builder) {
+  llvm::Type *ElementType = In->getType()->getPointerElementType();
+  llvm::Value *Zero = llvm::ConstantInt::get(Index->getType(), 0);
+  llvm::Value *IsFirst = builder.CreateICmpEQ(Index, Zero);
+  llvm::Value *PrevIndex = builder.CreateSelect(
+      IsFirst, Zero,
+      builder.CreateSub(Index, llvm::ConstantInt::get(Index->getType(), 1)));
+  llvm::Value *Prev = builder.CreateLoad(builder.CreateGEP(In, PrevIndex));
+  return builder.CreateSelect(IsFirst, llvm::ConstantInt::get(ElementType, 0),
+                              Prev);
+}
+
+// Loads In[Index] the way it goes on the wire, which is the difference from
+// the previous element for delta encoded fields
+llvm::Value *loadWireElement(llvm::Value *In, llvm::Value *Index, bool Delta,
+                             llvm::IRBuilder<> &builder) {
+  llvm::Value *Elt = builder.CreateLoad(builder.CreateGEP(In, Index));
+  if (!Delta) {
+    return Elt;
+  }
+  return builder.CreateSub(Elt, loadPrevious(In, Index, builder));
+}
+
+// Undoes delta encoding in place, so Data[i] becomes the sum of Data[0..i].
+// When the elements fill their storage exactly, groups of 8 are scanned as a
+// vector in log2(8) shift-and-add steps and the running total is carried from
+// one group to the next; whatever is left is summed one element at a time.
+void prefixSumArray(llvm::Value *Data, llvm::Value *Count,
+                    llvm::IRBuilder<> &builder) {
+  const llvm::DataLayout &DL =
+      builder.GetInsertBlock()->getModule()->getDataLayout();
+  llvm::Type *ElementType = Data->getType()->getPointerElementType();
+
+  llvm::Value *CarryPtr = createEntryAlloca(ElementType, builder);
+  builder.CreateStore(llvm::ConstantInt::get(ElementType, 0), CarryPtr);
+
+  llvm::Value *TailStart = builder.getInt64(0);
+  if (DL.getTypeSizeInBits(ElementType) ==
+      DL.getTypeAllocSizeInBits(ElementType)) {
+    const unsigned int Alignment = DL.getABITypeAlignment(ElementType);
+    llvm::Type *VecType = llvm::VectorType::get(ElementType, 8);
+    llvm::Type *VecPtrType =
+        VecType->getPointerTo(Data->getType()->getPointerAddressSpace());
+    llvm::Value *Zero = llvm::Constant::getNullValue(VecType);
+
+    llvm::Value *NumGroups = builder.CreateLShr(Count, 3);
+    emitLoop(NumGroups, builder, [&](llvm::Value *Group) {
+      llvm::Value *GroupPtr = builder.CreateBitCast(
+          builder.CreateGEP(Data, builder.CreateShl(Group, 3)), VecPtrType);
+      llvm::Value *Vec = builder.CreateAlignedLoad(GroupPtr, Alignment);
+      for (uint32_t Shift = 1; Shift < 8; Shift <<= 1) {
+        // Lane i picks up lane i - Shift, or zero off the front
+        llvm::SmallVector<uint32_t, 8> Mask;
+        for (uint32_t lane = 0; lane < 8; ++lane) {
+          Mask.push_back(lane < Shift ? 0 : 8 + lane - Shift);
+        }
+        Vec = builder.CreateAdd(Vec,
+                                builder.CreateShuffleVector(Zero, Vec, Mask));
+      }
+      Vec = builder.CreateAdd(
+          Vec, builder.CreateVectorSplat(8, builder.CreateLoad(CarryPtr)));
+      builder.CreateAlignedStore(Vec, GroupPtr, Alignment);
+      builder.CreateStore(builder.CreateExtractElement(Vec, uint64_t(7)),
+                          CarryPtr);
+    });
+    TailStart = builder.CreateShl(NumGroups, 3);
+  }
+
+  emitLoop(builder.CreateSub(Count, TailStart), builder, [&](llvm::Value *i) {
+    llvm::Value *EltPtr =
+        builder.CreateGEP(Data, builder.CreateAdd(TailStart, i));
+    llvm::Value *Sum = builder.CreateAdd(builder.CreateLoad(CarryPtr),
+                                         builder.CreateLoad(EltPtr));
+    builder.CreateStore(Sum, EltPtr);
+    builder.CreateStore(Sum, CarryPtr);
+  });
+}
+
+// Number of bytes a bitstream of Count elements of Width bits occupies
+llvm::Value *getBitStreamSize(llvm::Value *Count, uint32_t Width,
+                              llvm::IRBuilder<> &builder) {
+  return builder.CreateLShr(
+      builder.CreateAdd(builder.CreateMul(Count, builder.getInt64(Width)),
+                        builder.getInt64(7)),
+      3);
+}
+
+// Packs Count elements of the iN array In into the bitstream at Out. Elements
+// are processed in groups of 8, and 8 elements of N bits are exactly N bytes,
+// so every group starts on a byte boundary and is assembled with constant
+// shifts and no per-element branches. The (at most 7 element) tail goes through
+// the same accumulator one element at a time. With Delta the differences
+// between neighbours are packed instead of the elements.
+void packBitArray(llvm::Value *In, llvm::Value *Count, llvm::Value *Out,
+                  bool Delta, llvm::IRBuilder<> &builder) {
+  llvm::Type *ElementType = In->getType()->getPointerElementType();
+  const uint32_t Width = ElementType->getIntegerBitWidth();
+  llvm::Type *GroupType = builder.getIntNTy(8 * Width);
+
+  llvm::Value *NumGroups = builder.CreateLShr(Count, 3);
+  emitLoop(NumGroups, builder, [&](llvm::Value *Group) {
+    llvm::Value *GroupIn = builder.CreateGEP(In, builder.CreateShl(Group, 3));
+    llvm::Value *GroupOut = builder.CreateGEP(
+        Out, builder.CreateMul(Group, builder.getInt64(Width)));
+
+    llvm::Value *Acc = llvm::ConstantInt::get(GroupType, 0);
+    llvm::Value *Prev = Delta ? loadPrevious(In, builder.CreateShl(Group, 3),
+                                             builder)
+                              : nullptr;
+    for (uint32_t lane = 0; lane < 8; ++lane) {
+      llvm::Value *Elt = builder.CreateLoad(
+          builder.CreateGEP(GroupIn, builder.getInt64(lane)));
+      llvm::Value *WireElt = Delta ? builder.CreateSub(Elt, Prev) : Elt;
+      Prev = Elt;
+      llvm::Value *Wide = builder.CreateZExt(WireElt, GroupType);
+      Acc = builder.CreateOr(Acc, builder.CreateShl(Wide, lane * Width));
+    }
+    for (uint32_t i = 0; i < Width; ++i) {
+      llvm::Value *Byte = builder.CreateTrunc(builder.CreateLShr(Acc, i * 8),
+                                              builder.getInt8Ty());
+      builder.CreateStore(Byte,
+                          builder.CreateGEP(GroupOut, builder.getInt64(i)));
+    }
+  });
+
+  // The tail
+  llvm::Value *TailStart = builder.CreateShl(NumGroups, 3);
+  llvm::Value *TailCount = builder.CreateSub(Count, TailStart);
+  llvm::Value *TailOut = builder.CreateGEP(
+      Out, builder.CreateMul(NumGroups, builder.getInt64(Width)));
+
+  llvm::Value *AccPtr = createEntryAlloca(GroupType, builder);
+  builder.CreateStore(llvm::ConstantInt::get(GroupType, 0), AccPtr);
+  emitLoop(TailCount, builder, [&](llvm::Value *i) {
+    llvm::Value *Elt =
+        loadWireElement(In, builder.CreateAdd(TailStart, i), Delta, builder);
+    llvm::Value *Shift = builder.CreateZExtOrTrunc(
+        builder.CreateMul(i, builder.getInt64(Width)), GroupType);
+    builder.CreateStore(
+        builder.CreateOr(builder.CreateLoad(AccPtr),
+                         builder.CreateShl(builder.CreateZExt(Elt, GroupType),
+                                           Shift)),
+        AccPtr);
+  });
+  emitLoop(getBitStreamSize(TailCount, Width, builder), builder,
+           [&](llvm::Value *i) {
+             llvm::Value *Shift = builder.CreateZExtOrTrunc(
+                 builder.CreateShl(i, 3), GroupType);
+             llvm::Value *Byte = builder.CreateTrunc(
+                 builder.CreateLShr(builder.CreateLoad(AccPtr), Shift),
+                 builder.getInt8Ty());
+             builder.CreateStore(Byte, builder.CreateGEP(TailOut, i));
+           });
+}
+
+// The inverse of packBitArray, unpacks Count elements from the bitstream at In
+// into the iN array Out
+void unpackBitArray(llvm::Value *In, llvm::Value *Count, llvm::Value *Out,
+                    llvm::IRBuilder<> &builder) {
+  llvm::Type *ElementType = Out->getType()->getPointerElementType();
+  const uint32_t Width = ElementType->getIntegerBitWidth();
+  llvm::Type *GroupType = builder.getIntNTy(8 * Width);
+
+  llvm::Value *NumGroups = builder.CreateLShr(Count, 3);
+  emitLoop(NumGroups, builder, [&](llvm::Value *Group) {
+    llvm::Value *GroupIn = builder.CreateGEP(
+        In, builder.CreateMul(Group, builder.getInt64(Width)));
+    llvm::Value *GroupOut = builder.CreateGEP(Out, builder.CreateShl(Group, 3));
+
+    llvm::Value *Acc = loadCoveringBytes(GroupIn, 0, 8 * Width, builder);
+    for (uint32_t lane = 0; lane < 8; ++lane) {
+      llvm::Value *Elt = builder.CreateTrunc(
+          builder.CreateLShr(Acc, lane * Width), ElementType);
+      builder.CreateStore(Elt,
+                          builder.CreateGEP(GroupOut, builder.getInt64(lane)));
+    }
+  });
+
+  // The tail
+  llvm::Value *TailStart = builder.CreateShl(NumGroups, 3);
+  llvm::Value *TailCount = builder.CreateSub(Count, TailStart);
+  llvm::Value *TailIn = builder.CreateGEP(
+      In, builder.CreateMul(NumGroups, builder.getInt64(Width)));
+  llvm::Value *TailOut = builder.CreateGEP(Out, TailStart);
+
+  llvm::Value *AccPtr = createEntryAlloca(GroupType, builder);
+  builder.CreateStore(llvm::ConstantInt::get(GroupType, 0), AccPtr);
+  emitLoop(getBitStreamSize(TailCount, Width, builder), builder,
+           [&](llvm::Value *i) {
+             llvm::Value *Shift = builder.CreateZExtOrTrunc(
+                 builder.CreateShl(i, 3), GroupType);
+             llvm::Value *Byte = builder.CreateZExt(
+                 builder.CreateLoad(builder.CreateGEP(TailIn, i)), GroupType);
+             builder.CreateStore(
+                 builder.CreateOr(builder.CreateLoad(AccPtr),
+                                  builder.CreateShl(Byte, Shift)),
+                 AccPtr);
+           });
+  emitLoop(TailCount, builder, [&](llvm::Value *i) {
+    llvm::Value *Shift = builder.CreateZExtOrTrunc(
+        builder.CreateMul(i, builder.getInt64(Width)), GroupType);
+    llvm::Value *Elt = builder.CreateTrunc(
+        builder.CreateLShr(builder.CreateLoad(AccPtr), Shift), ElementType);
+    builder.CreateStore(Elt, builder.CreateGEP(TailOut, i));
+  });
+}
+
+// Number of bytes the LEB128 encoding of the i64 Val takes, worked out from the
+// position of its highest set bit rather than by looping over the groups
+llvm::Value *getVarintSize(llvm::Value *Val, llvm::IRBuilder<> &builder) {
+  llvm::Module *m = builder.GetInsertBlock()->getParent()->getParent();
+  llvm::Function *ctlz = llvm::Intrinsic::getDeclaration(
+      m, llvm::Intrinsic::ctlz, {builder.getInt64Ty()});
+
+  // Or in a 1 so that zero still takes one byte
+  llvm::Value *HighBit = builder.CreateSub(
+      builder.getInt64(63),
+      builder.CreateCall(ctlz, {builder.CreateOr(Val, builder.getInt64(1)),
+                                builder.getTrue()}));
+  return builder.CreateAdd(builder.getInt64(1),
+                           builder.CreateUDiv(HighBit, builder.getInt64(7)));
+}
+
+// Maps an integer element of the field to the unsigned i64 that is written as
+// a varint
+llvm::Value *toVarint(const tyr::ir::Field *f, llvm::Value *Val,
+                      llvm::IRBuilder<> &builder) {
+  const uint32_t Width = Val->getType()->getIntegerBitWidth();
+  // Differences can go either way, so they are always zigzag mapped
+  const uint32_t Signed = tyr::ir::kEncodingZigZag | tyr::ir::kEncodingDelta;
+  if ((f->encoding & Signed) && Width > 1) {
+    Val = builder.CreateXor(builder.CreateShl(Val, 1),
+                            builder.CreateAShr(Val, Width - 1));
+  }
+  return builder.CreateZExt(Val, builder.getInt64Ty());
+}
+
+// The inverse of toVarint, turns the decoded i64 back into an element of type
+// Ty
+llvm::Value *fromVarint(const tyr::ir::Field *f, llvm::Value *Val,
+                        llvm::Type *Ty, llvm::IRBuilder<> &builder) {
+  Val = builder.CreateTrunc(Val, Ty);
+  const uint32_t Signed = tyr::ir::kEncodingZigZag | tyr::ir::kEncodingDelta;
+  if ((f->encoding & Signed) && Ty->getIntegerBitWidth() > 1) {
+    llvm::Value *Sign = builder.CreateNeg(
+        builder.CreateAnd(Val, llvm::ConstantInt::get(Ty, 1)));
+    Val = builder.CreateXor(builder.CreateLShr(Val, 1), Sign);
+  }
+  return Val;
+}
+
+// Appends the low N bits of the i64 V to the bitstream at Out, least
+// significant bit first like the other bitstreams. BitPosPtr holds the number
+// of bits written so far and AccPtr the bits of the partially written byte,
+// which is only stored once it fills up (or by flushBits).
+void writeBits(llvm::Value *Out, llvm::Value *BitPosPtr, llvm::Value *AccPtr,
+               llvm::Value *V, llvm::Value *N, llvm::IRBuilder<> &builder) {
+  llvm::Type *WideType = builder.getIntNTy(128);
+  llvm::Value *BitPos = builder.CreateLoad(BitPosPtr);
+  llvm::Value *Pending = builder.CreateAnd(BitPos, builder.getInt64(7));
+  llvm::Value *FirstByte = builder.CreateLShr(BitPos, 3);
+
+  llvm::Value *Mask = builder.CreateSub(
+      builder.CreateShl(llvm::ConstantInt::get(WideType, 1),
+                        builder.CreateZExt(N, WideType)),
+      llvm::ConstantInt::get(WideType, 1));
+  llvm::Value *Bits = builder.CreateAnd(builder.CreateZExt(V, WideType), Mask);
+  llvm::Value *Wide = builder.CreateOr(
+      builder.CreateZExt(builder.CreateLoad(AccPtr), WideType),
+      builder.CreateShl(Bits, builder.CreateZExt(Pending, WideType)));
+
+  llvm::Value *NumBytes = builder.CreateLShr(builder.CreateAdd(Pending, N), 3);
+  emitLoop(NumBytes, builder, [&](llvm::Value *i) {
+    llvm::Value *Shift = builder.CreateZExt(builder.CreateShl(i, 3), WideType);
+    llvm::Value *Byte = builder.CreateTrunc(builder.CreateLShr(Wide, Shift),
+                                            builder.getInt8Ty());
+    builder.CreateStore(
+        Byte, builder.CreateGEP(Out, builder.CreateAdd(FirstByte, i)));
+  });
+
+  llvm::Value *Rest = builder.CreateLShr(
+      Wide, builder.CreateZExt(builder.CreateShl(NumBytes, 3), WideType));
+  builder.CreateStore(builder.CreateTrunc(Rest, builder.getInt64Ty()), AccPtr);
+  builder.CreateStore(builder.CreateAdd(BitPos, N), BitPosPtr);
+}
+
+// Stores the partially written byte left over by writeBits, and returns the
+// total number of bytes in the bitstream
+llvm::Value *flushBits(llvm::Value *Out, llvm::Value *BitPosPtr,
+                       llvm::Value *AccPtr, llvm::IRBuilder<> &builder) {
+  llvm::Value *BitPos = builder.CreateLoad(BitPosPtr);
+  llvm::Value *HasPartial = builder.CreateZExt(
+      builder.CreateICmpNE(builder.CreateAnd(BitPos, builder.getInt64(7)),
+                           builder.getInt64(0)),
+      builder.getInt64Ty());
+  emitLoop(HasPartial, builder, [&](llvm::Value *) {
+    builder.CreateStore(
+        builder.CreateTrunc(builder.CreateLoad(AccPtr), builder.getInt8Ty()),
+        builder.CreateGEP(Out, builder.CreateLShr(BitPos, 3)));
+  });
+  return builder.CreateLShr(builder.CreateAdd(BitPos, builder.getInt64(7)), 3);
+}
+
+// Reads the next N (at most 64) bits of the bitstream at In, the inverse of
+// writeBits. Reading zero bits doesn't touch memory.
+llvm::Value *readBits(llvm::Value *In, llvm::Value *BitPosPtr, llvm::Value *N,
+                      llvm::IRBuilder<> &builder) {
+  llvm::Type *WideType = builder.getIntNTy(128);
+  llvm::Value *BitPos = builder.CreateLoad(BitPosPtr);
+  llvm::Value *Shift = builder.CreateAnd(BitPos, builder.getInt64(7));
+  llvm::Value *FirstByte = builder.CreateLShr(BitPos, 3);
+
+  llvm::Value *NumBytes = builder.CreateSelect(
+      builder.CreateICmpEQ(N, builder.getInt64(0)), builder.getInt64(0),
+      builder.CreateLShr(
+          builder.CreateAdd(builder.CreateAdd(Shift, N), builder.getInt64(7)),
+          3));
+
+  llvm::Value *AccPtr = createEntryAlloca(WideType, builder);
+  builder.CreateStore(llvm::ConstantInt::get(WideType, 0), AccPtr);
+  emitLoop(NumBytes, builder, [&](llvm::Value *i) {
+    llvm::Value *Byte = builder.CreateZExt(
+        builder.CreateLoad(
+            builder.CreateGEP(In, builder.CreateAdd(FirstByte, i))),
+        WideType);
+    llvm::Value *ByteShift =
+        builder.CreateZExt(builder.CreateShl(i, 3), WideType);
+    builder.CreateStore(builder.CreateOr(builder.CreateLoad(AccPtr),
+                                         builder.CreateShl(Byte, ByteShift)),
+                        AccPtr);
+  });
+
+  llvm::Value *Mask = builder.CreateSub(
+      builder.CreateShl(llvm::ConstantInt::get(WideType, 1),
+                        builder.CreateZExt(N, WideType)),
+      llvm::ConstantInt::get(WideType, 1));
+  llvm::Value *V = builder.CreateAnd(
+      builder.CreateLShr(builder.CreateLoad(AccPtr),
+                         builder.CreateZExt(Shift, WideType)),
+      Mask);
+  builder.CreateStore(builder.CreateAdd(BitPos, N), BitPosPtr);
+  return builder.CreateTrunc(V, builder.getInt64Ty());
+}
+
+// One value of a Gorilla style XOR stream, a control header followed by the
+// meaningful bits of the XOR with the previous value:
+//   0                                  - same as the previous value
+//   1 0 <bits>                         - fits the previous leading/trailing
+//                                        zero window
+//   1 1 <5 bit leading> <6 bit len-1> <bits> - opens a new window
+struct XorRecord {
+  llvm::Value *Header;
+  llvm::Value *HeaderLen;
+  llvm::Value *Payload;
+  llvm::Value *PayloadLen;
+};
+
+// Works out the record for Bits (a Width bit value widened to i64) from the
+// state at PrevPtr/LeadPtr/TrailPtr and updates the state. It is all selects,
+// so the encoder's only branches are its loops.
+XorRecord getXorRecord(llvm::Value *Bits, uint32_t Width, llvm::Value *PrevPtr,
+                       llvm::Value *LeadPtr, llvm::Value *TrailPtr,
+                       llvm::IRBuilder<> &builder) {
+  llvm::Module *m = builder.GetInsertBlock()->getModule();
+  llvm::Type *Int64Ty = builder.getInt64Ty();
+  llvm::Function *ctlz =
+      llvm::Intrinsic::getDeclaration(m, llvm::Intrinsic::ctlz, {Int64Ty});
+  llvm::Function *cttz =
+      llvm::Intrinsic::getDeclaration(m, llvm::Intrinsic::cttz, {Int64Ty});
+
+  llvm::Value *Xor = builder.CreateXor(Bits, builder.CreateLoad(PrevPtr));
+  builder.CreateStore(Bits, PrevPtr);
+
+  llvm::Value *IsZero = builder.CreateICmpEQ(Xor, builder.getInt64(0));
+  // Leading zeros within the Width bits, capped to fit in 5 bits
+  llvm::Value *Lead = builder.CreateSub(
+      builder.CreateCall(ctlz, {Xor, builder.getFalse()}),
+      builder.getInt64(64 - Width));
+  Lead = builder.CreateSelect(builder.CreateICmpUGT(Lead, builder.getInt64(31)),
+                              builder.getInt64(31), Lead);
+  llvm::Value *Trail = builder.CreateSelect(
+      IsZero, builder.getInt64(0),
+      builder.CreateCall(cttz, {Xor, builder.getFalse()}));
+
+  llvm::Value *PrevLead = builder.CreateLoad(LeadPtr);
+  llvm::Value *PrevTrail = builder.CreateLoad(TrailPtr);
+  llvm::Value *Reuse = builder.CreateAnd(
+      builder.CreateNot(IsZero),
+      builder.CreateAnd(builder.CreateICmpUGE(Lead, PrevLead),
+                        builder.CreateICmpUGE(Trail, PrevTrail)));
+  llvm::Value *NewWindow =
+      builder.CreateAnd(builder.CreateNot(IsZero), builder.CreateNot(Reuse));
+
+  llvm::Value *ReuseLen = builder.CreateSub(
+      builder.getInt64(Width), builder.CreateAdd(PrevLead, PrevTrail));
+  llvm::Value *NewLen = builder.CreateSub(builder.getInt64(Width),
+                                          builder.CreateAdd(Lead, Trail));
+  llvm::Value *NewHeader = builder.CreateOr(
+      builder.getInt64(3),
+      builder.CreateOr(builder.CreateShl(Lead, 2),
+                       builder.CreateShl(
+                           builder.CreateSub(NewLen, builder.getInt64(1)), 7)));
+
+  XorRecord Record;
+  Record.Header = builder.CreateSelect(
+      IsZero, builder.getInt64(0),
+      builder.CreateSelect(Reuse, builder.getInt64(1), NewHeader));
+  Record.HeaderLen = builder.CreateSelect(
+      IsZero, builder.getInt64(1),
+      builder.CreateSelect(Reuse, builder.getInt64(2), builder.getInt64(13)));
+  Record.Payload = builder.CreateLShr(
+      Xor, builder.CreateSelect(Reuse, PrevTrail, Trail));
+  Record.PayloadLen = builder.CreateSelect(
+      IsZero, builder.getInt64(0),
+      builder.CreateSelect(Reuse, ReuseLen, NewLen));
+
+  builder.CreateStore(builder.CreateSelect(NewWindow, Lead, PrevLead), LeadPtr);
+  builder.CreateStore(builder.CreateSelect(NewWindow, Trail, PrevTrail),
+                      TrailPtr);
+  return Record;
+}
+
+// The state shared by the XOR stream encoder, sizer and decoder. The previous
+// value starts at zero (so the first value opens a window like any other), and
+// the leading zero count starts out too large for any window to be reused.
+void initXorState(llvm::Value *&PrevPtr, llvm::Value *&LeadPtr,
+                  llvm::Value *&TrailPtr, llvm::IRBuilder<> &builder) {
+  PrevPtr = createEntryAlloca(builder.getInt64Ty(), builder);
+  LeadPtr = createEntryAlloca(builder.getInt64Ty(), builder);
+  TrailPtr = createEntryAlloca(builder.getInt64Ty(), builder);
+  builder.CreateStore(builder.getInt64(0), PrevPtr);
+  builder.CreateStore(builder.getInt64(64), LeadPtr);
+  builder.CreateStore(builder.getInt64(0), TrailPtr);
+}
+
+// Largest dictionary we build, so an index is never more than 8 bits
+const uint64_t kMaxDictSize = 256;
+
+llvm::Value *createUMin(llvm::Value *LHS, llvm::Value *RHS,
+                        llvm::IRBuilder<> &builder) {
+  return builder.CreateSelect(builder.CreateICmpULT(LHS, RHS), LHS, RHS);
+}
+
+// Index of V in the first Size entries of Dict, or Size if it isn't there.
+// Every entry is compared, there's no early exit to get in the way of
+// vectorizing the scan.
+llvm::Value *findInDict(llvm::Value *Dict, llvm::Value *Size, llvm::Value *V,
+                        llvm::IRBuilder<> &builder) {
+  llvm::Value *IndexPtr = createEntryAlloca(builder.getInt64Ty(), builder);
+  builder.CreateStore(Size, IndexPtr);
+  emitLoop(Size, builder, [&](llvm::Value *j) {
+    llvm::Value *Match =
+        builder.CreateICmpEQ(builder.CreateLoad(builder.CreateGEP(Dict, j)), V);
+    builder.CreateStore(
+        builder.CreateSelect(Match, j, builder.CreateLoad(IndexPtr)), IndexPtr);
+  });
+  return builder.CreateLoad(IndexPtr);
+}
+
+// Collects the distinct values of the Count elements of In into Dict (which
+// has room for kMaxDictSize of them), in order of first appearance. Returns
+// the number of distinct values, anything over kMaxDictSize means there were
+// too many and the contents of Dict are meaningless.
+llvm::Value *buildDict(llvm::Value *In, llvm::Value *Count, llvm::Value *Dict,
+                       llvm::IRBuilder<> &builder) {
+  llvm::Value *SizePtr = createEntryAlloca(builder.getInt64Ty(), builder);
+  builder.CreateStore(builder.getInt64(0), SizePtr);
+  emitLoop(Count, builder, [&](llvm::Value *i) {
+    llvm::Value *V = builder.CreateLoad(builder.CreateGEP(In, i));
+    llvm::Value *Size = builder.CreateLoad(SizePtr);
+    llvm::Value *Searched =
+        createUMin(Size, builder.getInt64(kMaxDictSize), builder);
+    llvm::Value *NotFound = builder.CreateICmpEQ(
+        findInDict(Dict, Searched, V, builder), Searched);
+
+    // Always store (the old value if it was found) rather than branch
+    llvm::Value *Slot = builder.CreateGEP(
+        Dict, createUMin(Size, builder.getInt64(kMaxDictSize - 1), builder));
+    builder.CreateStore(
+        builder.CreateSelect(NotFound, V, builder.CreateLoad(Slot)), Slot);
+    builder.CreateStore(
+        builder.CreateAdd(Size,
+                          builder.CreateZExt(NotFound, builder.getInt64Ty())),
+        SizePtr);
+  });
+  return builder.CreateLoad(SizePtr);
+}
+
+// Bits needed for an index into a dictionary of Size entries. Never less than
+// one, so the index stream always grows with the number of elements and a few
+// bytes can't stand for any number of them.
+llvm::Value *getDictIndexWidth(llvm::Value *Size, llvm::IRBuilder<> &builder) {
+  llvm::Module *m = builder.GetInsertBlock()->getModule();
+  llvm::Function *ctlz = llvm::Intrinsic::getDeclaration(
+      m, llvm::Intrinsic::ctlz, {builder.getInt64Ty()});
+  llvm::Value *Width = builder.CreateSub(
+      builder.getInt64(64),
+      builder.CreateCall(ctlz, {builder.CreateSub(Size, builder.getInt64(1)),
+                                builder.getFalse()}));
+  return builder.CreateSelect(builder.CreateICmpULE(Size, builder.getInt64(1)),
+                              builder.getInt64(1), Width);
+}
 } // namespace
 
 tyr::pass::LLVMIRGenPass::LLVMIRGenPass(llvm::Module *Parent,
@@ -157,20 +961,75 @@ bool tyr::pass::LLVMIRGenPass::runOnStruct(const tyr::ir::Struct &s) {
                  << s.getType()->getName() << " aborting\n";
     return false;
   }
+  if (!getBase64Serializer(&s)) {
+    llvm::errs() << "Get base64 serializer failed for struct "
+                 << s.getType()->getName() << " aborting\n";
+    return false;
+  }
+  if (!getFdSerializer(&s)) {
+    llvm::errs() << "Get fd serializer failed for struct "
+                 << s.getType()->getName() << " aborting\n";
+    return false;
+  }
   if (!getDeserializer(&s)) {
     llvm::errs() << "Get deserializer failed for struct "
                  << s.getType()->getName() << " aborting\n";
     return false;
   }
+  // The projected deserializer validates its input first
+  if (!getValidator(&s)) {
+    llvm::errs() << "Get validator failed for struct "
+                 << s.getType()->getName() << " aborting\n";
+    return false;
+  }
+  if (!getDeserializer(&s, true)) {
+    llvm::errs() << "Get projected deserializer failed for struct "
+                 << s.getType()->getName() << " aborting\n";
+    return false;
+  }
+  if (!getBoundedDeserializer(&s)) {
+    llvm::errs() << "Get bounded deserializer failed for struct "
+                 << s.getType()->getName() << " aborting\n";
+    return false;
+  }
+  if (s.isTracked() && !(getDeltaSerializer(&s) && getDeltaApplier(&s))) {
+    llvm::errs() << "Get delta functions failed for struct "
+                 << s.getType()->getName() << " aborting\n";
+    return false;
+  }
   if (!getDestructor(&s)) {
     llvm::errs() << "Get destructor failed for struct "
                  << s.getType()->getName() << " aborting\n";
     return false;
   }
+  if (!getBatchSerializer(&s) || !getBatchDeserializer(&s)) {
+    llvm::errs() << "Get batch functions failed for struct "
+                 << s.getType()->getName() << " aborting\n";
+    return false;
+  }
+  if (!getEagerDeserializer(&s)) {
+    llvm::errs() << "Get eager deserializer failed for struct "
+                 << s.getType()->getName() << " aborting\n";
+    return false;
+  }
+  if (!getDecoder(&s)) {
+    llvm::errs() << "Get decoder failed for struct " << s.getType()->getName()
+                 << " aborting\n";
+    return false;
+  }
   return true;
 }
 
 bool tyr::pass::LLVMIRGenPass::runOnField(const tyr::ir::Field &f) {
+  if (f.isBitStorage) { // internal, so it only needs (de)serializing
+    return getSerializer(&f) && getDeserializer(&f) && getValidator(&f);
+  }
+  if (f.isPending || f.isDirtyState) { // internal, and never goes on the wire
+    return true;
+  }
+  if (f.isSizeHeader) { // internal, and set once by the constructor
+    return true;
+  }
   if (!getGetter(&f)) {
     llvm::errs() << "Get getter failed for field " << f.name << " aborting\n";
     return false;
@@ -188,6 +1047,9 @@ bool tyr::pass::LLVMIRGenPass::runOnField(const tyr::ir::Field &f) {
     llvm::errs() << "Get setter failed for field " << f.name << " aborting\n";
     return false;
   }
+  if (f.isFrozen) { // the struct goes on the wire in one piece
+    return true;
+  }
   if (!getSerializer(&f)) {
     llvm::errs() << "Get field serializer failed for field " << f.name
                  << " aborting\n";
@@ -198,6 +1060,11 @@ bool tyr::pass::LLVMIRGenPass::runOnField(const tyr::ir::Field &f) {
                  << " aborting\n";
     return false;
   }
+  if (!getValidator(&f)) {
+    llvm::errs() << "Get field validator failed for field " << f.name
+                 << " aborting\n";
+    return false;
+  }
   return true;
 }
 
@@ -207,6 +1074,21 @@ tyr::pass::LLVMIRGenPass::getFieldAllocSize(const tyr::ir::Field *f,
                                             llvm::IRBuilder<> &builder) const {
   const llvm::DataLayout &DL = m_parent_->getDataLayout();
 
+  if (f->storageField != nullptr) {
+    // Accounted for by the storage field
+    return builder.getInt64(0);
+  }
+
+  if (f->isPending) {
+    // Only points into the buffer we deserialized from
+    return builder.getInt64(0);
+  }
+
+  if (f->isDirtyState) {
+    // Never leaves the struct
+    return builder.getInt64(0);
+  }
+
   if (f->isRepeated) {
     uint64_t FieldAllocSize =
         DL.getTypeAllocSize(f->type->getPointerElementType());
@@ -219,113 +1101,1003 @@ tyr::pass::LLVMIRGenPass::getFieldAllocSize(const tyr::ir::Field *f,
   return builder.getInt64(DL.getTypeAllocSize(f->type));
 }
 
-bool tyr::pass::LLVMIRGenPass::initField(const tyr::ir::Field *f,
-                                         llvm::Value *Struct,
-                                         llvm::Argument *Arg,
-                                         llvm::IRBuilder<> &builder) {
-  if (f->isMutable) {
-    // Initialize to zero (still works even if it's a pointer)
-    builder.CreateStore(
-        builder.CreateTruncOrBitCast(builder.getInt64(0), f->type),
-        builder.CreateStructGEP(Struct, f->offset));
-  } else {
-    if (Arg == nullptr) {
-      llvm::errs() << "Arg was null on a field that is immutable (and "
-                      "therefore needs an initializer), aborting\n";
-      return false;
-    }
-    // Initialize to the value in the constructor
-    if (f->type->isPointerTy()) {
-      // Immutable repeated field, so need to alloc memory for it
-      // Get the field alloc size
-      llvm::Value *FieldAllocSize = getFieldAllocSize(f, Struct, builder);
-      // Do the allocation
-      llvm::Value *AllocdMem = builder.CreateCall(
-          m_parent_->getFunction(m_builtin_names_.lookup("malloc")),
-          FieldAllocSize);
-      llvm::Function *Constructor = builder.GetInsertBlock()->getParent();
-      // Check that it succeeded
-      llvm::BasicBlock *AllocSucceeded = insertNullCheck(
-          {AllocdMem},
-          builder.CreateIntToPtr(builder.getInt64(0), Struct->getType()),
-          builder, Constructor);
-
-      // Now we can do the memcpy
-      builder.SetInsertPoint(AllocSucceeded);
-      unsigned int FieldAlignment =
-          m_parent_->getDataLayout().getABITypeAlignment(f->type);
-      builder.CreateMemCpy(AllocdMem, FieldAlignment, Arg, FieldAlignment,
-                           FieldAllocSize, false);
-      builder.CreateStore(builder.CreateBitCast(AllocdMem, f->type),
-                          builder.CreateStructGEP(Struct, f->offset));
-    } else {
-      builder.CreateStore(Arg, builder.CreateStructGEP(Struct, f->offset));
-    }
+llvm::Value *tyr::pass::LLVMIRGenPass::getFieldSerializedSize(
+    const tyr::ir::Field *f, llvm::Value *Struct,
+    llvm::IRBuilder<> &builder) const {
+  if (f->isRepeated && (f->encoding & ir::kEncodingBitPacked)) {
+    llvm::Value *Count = builder.CreateLoad(
+        builder.CreateStructGEP(Struct, f->countField->offset));
+    return getBitStreamSize(
+        Count, f->type->getPointerElementType()->getIntegerBitWidth(), builder);
   }
 
-  return true;
-}
+  if (f->isRepeated && (f->encoding & ir::kEncodingXor)) {
+    llvm::Value *Count = builder.CreateLoad(
+        builder.CreateStructGEP(Struct, f->countField->offset));
+    llvm::Value *Data =
+        builder.CreateLoad(builder.CreateStructGEP(Struct, f->offset));
+    return builder.CreateCall(
+        getXorCoder(f->type->getPointerElementType(), kCoderSize),
+        {Data, Count});
+  }
 
-bool tyr::pass::LLVMIRGenPass::destroyField(const tyr::ir::Field *f,
-                                            llvm::Value *Struct,
-                                            llvm::IRBuilder<> &builder) {
-  llvm::Value *FieldGEP = builder.CreateStructGEP(Struct, f->offset);
+  if (f->isRepeated && (f->encoding & ir::kEncodingDictionary)) {
+    llvm::Value *Count = builder.CreateLoad(
+        builder.CreateStructGEP(Struct, f->countField->offset));
+    llvm::Value *Data =
+        builder.CreateLoad(builder.CreateStructGEP(Struct, f->offset));
+    return builder.CreateCall(
+        getDictCoder(f->type->getPointerElementType(), kCoderSize),
+        {Data, Count});
+  }
 
-  const uint32_t AddrSpace =
-      m_parent_->getDataLayout().getProgramAddressSpace();
+  if (f->encoding & ir::kEncodingVarint) {
+    if (!f->isRepeated) {
+      return getVarintSize(toVarint(f, loadField(f, Struct, builder), builder),
+                           builder);
+    }
 
-  if (f->type->isPointerTy()) {
-    builder.CreateCall(m_parent_->getFunction(m_builtin_names_.lookup("free")),
-                       builder.CreateBitCast(builder.CreateLoad(FieldGEP),
-                                             builder.getInt8PtrTy(AddrSpace)));
+    llvm::Value *Count = builder.CreateLoad(
+        builder.CreateStructGEP(Struct, f->countField->offset));
+    llvm::Value *Data =
+        builder.CreateLoad(builder.CreateStructGEP(Struct, f->offset));
+    llvm::Value *SizePtr = createEntryAlloca(builder.getInt64Ty(), builder);
+    builder.CreateStore(builder.getInt64(0), SizePtr);
+    const bool Delta = f->encoding & ir::kEncodingDelta;
+    emitLoop(Count, builder, [&](llvm::Value *i) {
+      llvm::Value *Elt = loadWireElement(Data, i, Delta, builder);
+      builder.CreateStore(
+          builder.CreateAdd(builder.CreateLoad(SizePtr),
+                            getVarintSize(toVarint(f, Elt, builder), builder)),
+          SizePtr);
+    });
+    return builder.CreateLoad(SizePtr);
   }
 
-  return true;
+  return getFieldAllocSize(f, Struct, builder);
 }
 
-bool tyr::pass::LLVMIRGenPass::getGetter(const ir::Field *f) const {
+llvm::Function *tyr::pass::LLVMIRGenPass::getVarintWriter() const {
+  const std::string Name = "__tyr_write_varint";
+  if (llvm::Function *Writer = m_parent_->getFunction(Name)) {
+    return Writer;
+  }
+
   const uint32_t AddrSpace =
       m_parent_->getDataLayout().getProgramAddressSpace();
-
-  llvm::Type *StructPtrType = f->parentType->getPointerTo(AddrSpace);
-
-  // Get an alias to the context
   llvm::LLVMContext &ctx = m_parent_->getContext();
 
-  std::string GetterName =
-      "get_" + std::string(f->parentType->getName()) + "_" + f->name;
-  // Getter returns bool, returns the thing by reference
-  llvm::FunctionType *GetterType = llvm::FunctionType::get(
-      llvm::Type::getInt1Ty(ctx),
-      {StructPtrType, f->type->getPointerTo(AddrSpace)}, false);
+  // Writes the i64 in the first arg to the second, returns the bytes written
+  llvm::FunctionType *WriterType = llvm::FunctionType::get(
+      llvm::Type::getInt64Ty(ctx),
+      {llvm::Type::getInt64Ty(ctx), llvm::Type::getInt8PtrTy(ctx, AddrSpace)},
+      false);
 
-  // Create the function
-  llvm::Function *Getter = llvm::cast<llvm::Function>(
-      m_parent_->getOrInsertFunction(GetterName, GetterType));
-  Getter->addFnAttr(llvm::Attribute::InlineHint);
+  llvm::Function *Writer = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name, WriterType));
+  Writer->addFnAttr(llvm::Attribute::AlwaysInline);
+  Writer->setLinkage(llvm::GlobalValue::PrivateLinkage);
 
-  llvm::BasicBlock *GetterBlock = llvm::BasicBlock::Create(ctx, "", Getter);
-  llvm::IRBuilder<> builder(GetterBlock);
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Writer);
+  llvm::IRBuilder<> builder(EntryBlock);
 
-  // Get the first input to the function, the struct we're operating on
-  auto arg_iter = Getter->arg_begin();
-  llvm::Value *Self = &*arg_iter;
+  auto arg_iter = Writer->arg_begin();
+  llvm::Value *Val = &*arg_iter;
   ++arg_iter;
+  llvm::Value *OutBuf = &*arg_iter;
 
-  // Make sure it's not NULL
-  llvm::BasicBlock *SelfIsNotNull = insertNullCheck(
-      {Self, &*arg_iter}, builder.getInt1(false), builder, Getter);
+  // The length is known up front, so the only branch is the loop itself and
+  // the continuation bit is a select
+  llvm::Value *Size = getVarintSize(Val, builder);
+  emitLoop(Size, builder, [&](llvm::Value *i) {
+    llvm::Value *Bits = builder.CreateAnd(
+        builder.CreateLShr(Val, builder.CreateMul(i, builder.getInt64(7))),
+        builder.getInt64(0x7f));
+    llvm::Value *More =
+        builder.CreateICmpULT(builder.CreateAdd(i, builder.getInt64(1)), Size);
+    llvm::Value *Continue =
+        builder.CreateSelect(More, builder.getInt64(0x80), builder.getInt64(0));
+    llvm::Value *Byte = builder.CreateOr(Bits, Continue);
+    builder.CreateStore(builder.CreateTrunc(Byte, builder.getInt8Ty()),
+                        builder.CreateGEP(OutBuf, i));
+  });
+
+  builder.CreateRet(Size);
+
+  return Writer;
+}
+
+llvm::Function *tyr::pass::LLVMIRGenPass::getVarintReader() const {
+  const std::string Name = "__tyr_read_varint";
+  if (llvm::Function *Reader = m_parent_->getFunction(Name)) {
+    return Reader;
+  }
+
+  const uint32_t AddrSpace =
+      m_parent_->getDataLayout().getProgramAddressSpace();
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+
+  // Reads a varint from the first arg into the second, returns the bytes read
+  llvm::FunctionType *ReaderType = llvm::FunctionType::get(
+      llvm::Type::getInt64Ty(ctx),
+      {llvm::Type::getInt8PtrTy(ctx, AddrSpace),
+       llvm::Type::getInt64PtrTy(ctx, AddrSpace)},
+      false);
+
+  llvm::Function *Reader = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name, ReaderType));
+  Reader->addFnAttr(llvm::Attribute::AlwaysInline);
+  Reader->setLinkage(llvm::GlobalValue::PrivateLinkage);
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Reader);
+  llvm::BasicBlock *LoopBlock = llvm::BasicBlock::Create(ctx, "", Reader);
+  llvm::BasicBlock *DoneBlock = llvm::BasicBlock::Create(ctx, "", Reader);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  auto arg_iter = Reader->arg_begin();
+  llvm::Value *InBuf = &*arg_iter;
+  ++arg_iter;
+  llvm::Value *OutVal = &*arg_iter;
+
+  builder.CreateBr(LoopBlock);
+
+  // Each byte is merged in unconditionally, the continuation bit (and the 10
+  // byte limit of an i64) only decides whether we go around again
+  builder.SetInsertPoint(LoopBlock);
+  llvm::PHINode *Iter = builder.CreatePHI(builder.getInt64Ty(), 2);
+  llvm::PHINode *Acc = builder.CreatePHI(builder.getInt64Ty(), 2);
+  Iter->addIncoming(builder.getInt64(0), EntryBlock);
+  Acc->addIncoming(builder.getInt64(0), EntryBlock);
+
+  llvm::Value *Byte = builder.CreateZExt(
+      builder.CreateLoad(builder.CreateGEP(InBuf, Iter)), builder.getInt64Ty());
+  llvm::Value *NextAcc = builder.CreateOr(
+      Acc, builder.CreateShl(builder.CreateAnd(Byte, builder.getInt64(0x7f)),
+                             builder.CreateMul(Iter, builder.getInt64(7))));
+  llvm::Value *NextIter = builder.CreateAdd(Iter, builder.getInt64(1));
+  llvm::Value *More = builder.CreateAnd(
+      builder.CreateICmpNE(builder.CreateAnd(Byte, builder.getInt64(0x80)),
+                           builder.getInt64(0)),
+      builder.CreateICmpULT(NextIter, builder.getInt64(10)));
+  Iter->addIncoming(NextIter, LoopBlock);
+  Acc->addIncoming(NextAcc, LoopBlock);
+  builder.CreateCondBr(More, LoopBlock, DoneBlock);
+
+  builder.SetInsertPoint(DoneBlock);
+  builder.CreateStore(NextAcc, OutVal);
+  builder.CreateRet(NextIter);
+
+  return Reader;
+}
+
+llvm::Function *tyr::pass::LLVMIRGenPass::getVarintValidator() const {
+  const std::string Name = "__tyr_validate_varints";
+  if (llvm::Function *Validator = m_parent_->getFunction(Name)) {
+    return Validator;
+  }
+
+  const uint32_t AddrSpace =
+      m_parent_->getDataLayout().getProgramAddressSpace();
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+
+  // Walks the number of varints in the second arg through the first without
+  // stepping past the length in the third, returns the bytes they take up
+  llvm::FunctionType *ValidatorType = llvm::FunctionType::get(
+      llvm::Type::getInt64Ty(ctx),
+      {llvm::Type::getInt8PtrTy(ctx, AddrSpace), llvm::Type::getInt64Ty(ctx),
+       llvm::Type::getInt64Ty(ctx)},
+      false);
+
+  llvm::Function *Validator = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name, ValidatorType));
+  Validator->setLinkage(llvm::GlobalValue::PrivateLinkage);
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Validator);
+  llvm::BasicBlock *LoopBlock = llvm::BasicBlock::Create(ctx, "", Validator);
+  llvm::BasicBlock *DoneBlock = llvm::BasicBlock::Create(ctx, "", Validator);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  auto arg_iter = Validator->arg_begin();
+  llvm::Value *InBuf = &*arg_iter;
+  ++arg_iter;
+  llvm::Value *Count = &*arg_iter;
+  ++arg_iter;
+  llvm::Value *Len = &*arg_iter;
+
+  builder.CreateCondBr(builder.CreateICmpEQ(Count, builder.getInt64(0)),
+                       DoneBlock, LoopBlock);
+
+  // Same rules as the reader: a varint ends at the first byte without the
+  // continuation bit or after 10 bytes, whichever comes first
+  builder.SetInsertPoint(LoopBlock);
+  llvm::PHINode *Pos = builder.CreatePHI(builder.getInt64Ty(), 2);
+  llvm::PHINode *Iter = builder.CreatePHI(builder.getInt64Ty(), 2);
+  llvm::PHINode *Remaining = builder.CreatePHI(builder.getInt64Ty(), 2);
+  Pos->addIncoming(builder.getInt64(0), EntryBlock);
+  Iter->addIncoming(builder.getInt64(0), EntryBlock);
+  Remaining->addIncoming(Count, EntryBlock);
+
+  insertCheck(builder.CreateICmpULT(Pos, Len),
+              builder.getInt64(kInvalidSize), builder);
+  llvm::Value *Byte = builder.CreateLoad(builder.CreateGEP(InBuf, Pos));
+  llvm::Value *NextPos = builder.CreateAdd(Pos, builder.getInt64(1));
+  llvm::Value *NextIter = builder.CreateAdd(Iter, builder.getInt64(1));
+  llvm::Value *Ends = builder.CreateOr(
+      builder.CreateICmpSGE(Byte, builder.getInt8(0)),
+      builder.CreateICmpEQ(NextIter, builder.getInt64(10)));
+  llvm::Value *NextRemaining = builder.CreateSub(
+      Remaining, builder.CreateZExt(Ends, builder.getInt64Ty()));
+  Pos->addIncoming(NextPos, builder.GetInsertBlock());
+  Iter->addIncoming(
+      builder.CreateSelect(Ends, builder.getInt64(0), NextIter),
+      builder.GetInsertBlock());
+  Remaining->addIncoming(NextRemaining, builder.GetInsertBlock());
+  llvm::BasicBlock *LastBlock = builder.GetInsertBlock();
+  builder.CreateCondBr(
+      builder.CreateICmpNE(NextRemaining, builder.getInt64(0)), LoopBlock,
+      DoneBlock);
+
+  builder.SetInsertPoint(DoneBlock);
+  llvm::PHINode *Consumed = builder.CreatePHI(builder.getInt64Ty(), 2);
+  Consumed->addIncoming(builder.getInt64(0), EntryBlock);
+  Consumed->addIncoming(NextPos, LastBlock);
+  builder.CreateRet(Consumed);
+
+  return Validator;
+}
+
+llvm::Function *
+tyr::pass::LLVMIRGenPass::getXorCoder(llvm::Type *ElementType,
+                                      StreamCoderKind Kind) const {
+  static const char *Prefixes[] = {"__tyr_xor_size_", "__tyr_xor_encode_",
+                                   "__tyr_xor_decode_", "__tyr_xor_validate_"};
+  const std::string Name = std::string(Prefixes[Kind]) +
+                           (ElementType->isFloatTy() ? "float" : "double");
+  if (llvm::Function *Coder = m_parent_->getFunction(Name)) {
+    return Coder;
+  }
+
+  const llvm::DataLayout &DL = m_parent_->getDataLayout();
+  const uint32_t AddrSpace = DL.getProgramAddressSpace();
+  const uint32_t Width = DL.getTypeSizeInBits(ElementType);
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+  llvm::Type *ArrayType = ElementType->getPointerTo(AddrSpace);
+  llvm::Type *BufType = llvm::Type::getInt8PtrTy(ctx, AddrSpace);
+  llvm::Type *Int64Ty = llvm::Type::getInt64Ty(ctx);
+
+  // All of them take the array (or stream) and the number of elements, and
+  // return the size of the stream in bytes:
+  //   size(array, count)
+  //   encode(array, count, out)
+  //   decode(in, count, array)
+  //   validate(in, count, len) - kInvalidSize if the stream is malformed
+  llvm::FunctionType *CoderType;
+  if (Kind == kCoderSize) {
+    CoderType = llvm::FunctionType::get(Int64Ty, {ArrayType, Int64Ty}, false);
+  } else if (Kind == kCoderEncode) {
+    CoderType = llvm::FunctionType::get(Int64Ty, {ArrayType, Int64Ty, BufType},
+                                        false);
+  } else if (Kind == kCoderDecode) {
+    CoderType = llvm::FunctionType::get(Int64Ty, {BufType, Int64Ty, ArrayType},
+                                        false);
+  } else {
+    CoderType = llvm::FunctionType::get(Int64Ty, {BufType, Int64Ty, Int64Ty},
+                                        false);
+  }
+
+  llvm::Function *Coder = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name, CoderType));
+  Coder->setLinkage(llvm::GlobalValue::PrivateLinkage);
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Coder);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  auto arg_iter = Coder->arg_begin();
+  llvm::Value *First = &*arg_iter;
+  ++arg_iter;
+  llvm::Value *Count = &*arg_iter;
+  ++arg_iter;
+  llvm::Value *Last = Kind == kCoderSize ? nullptr : &*arg_iter;
+
+  llvm::Type *IntType = builder.getIntNTy(Width);
+  llvm::Value *PrevPtr, *LeadPtr, *TrailPtr;
+  initXorState(PrevPtr, LeadPtr, TrailPtr, builder);
+  llvm::Value *BitPosPtr = createEntryAlloca(Int64Ty, builder);
+  builder.CreateStore(builder.getInt64(0), BitPosPtr);
+
+  if (Kind == kCoderDecode || Kind == kCoderValidate) {
+    // Validating walks the records the same way, but makes sure each read
+    // stays inside the stream before it happens
+    llvm::Value *LenBits =
+        Kind == kCoderValidate ? builder.CreateShl(Last, 3) : nullptr;
+    auto read = [&](llvm::Value *N) {
+      if (Kind == kCoderValidate) {
+        insertCheck(
+            builder.CreateICmpULE(
+                builder.CreateAdd(builder.CreateLoad(BitPosPtr), N), LenBits),
+            builder.getInt64(kInvalidSize), builder);
+      }
+      return readBits(First, BitPosPtr, N, builder);
+    };
+
+    emitLoop(Count, builder, [&](llvm::Value *i) {
+      llvm::Value *Zero = builder.getInt64(0);
+      llvm::Value *B0 = read(builder.getInt64(1));
+      llvm::Value *B1 = read(B0);
+      llvm::Value *NewWindow =
+          builder.CreateICmpNE(builder.CreateAnd(B0, B1), Zero);
+      llvm::Value *Lead =
+          read(builder.CreateSelect(NewWindow, builder.getInt64(5), Zero));
+      llvm::Value *NewLen = builder.CreateAdd(
+          read(builder.CreateSelect(NewWindow, builder.getInt64(6), Zero)),
+          builder.getInt64(1));
+
+      llvm::Value *PrevLead = builder.CreateLoad(LeadPtr);
+      llvm::Value *PrevTrail = builder.CreateLoad(TrailPtr);
+      llvm::Value *ReuseLen = builder.CreateSub(
+          builder.getInt64(Width), builder.CreateAdd(PrevLead, PrevTrail));
+      llvm::Value *Len = builder.CreateSelect(
+          NewWindow, NewLen,
+          builder.CreateSelect(builder.CreateICmpNE(B0, Zero), ReuseLen, Zero));
+      // A corrupt stream can't make us read more than a value's worth of bits
+      Len = builder.CreateSelect(
+          builder.CreateICmpUGT(Len, builder.getInt64(Width)),
+          builder.getInt64(Width), Len);
+      llvm::Value *Trail = builder.CreateSelect(
+          NewWindow,
+          builder.CreateSub(builder.getInt64(Width),
+                            builder.CreateAdd(Lead, NewLen)),
+          PrevTrail);
+      Trail = builder.CreateAnd(Trail, builder.getInt64(63));
+
+      llvm::Value *Xor = builder.CreateShl(read(Len), Trail);
+      llvm::Value *Bits = builder.CreateXor(Xor, builder.CreateLoad(PrevPtr));
+      builder.CreateStore(Bits, PrevPtr);
+      builder.CreateStore(builder.CreateSelect(NewWindow, Lead, PrevLead),
+                          LeadPtr);
+      builder.CreateStore(Trail, TrailPtr);
+
+      if (Kind == kCoderDecode) {
+        llvm::Value *Elt = builder.CreateBitCast(
+            builder.CreateTrunc(Bits, IntType), ElementType);
+        builder.CreateStore(Elt, builder.CreateGEP(Last, i));
+      }
+    });
+    builder.CreateRet(builder.CreateLShr(
+        builder.CreateAdd(builder.CreateLoad(BitPosPtr), builder.getInt64(7)),
+        3));
+    return Coder;
+  }
+
+  llvm::Value *AccPtr = createEntryAlloca(Int64Ty, builder);
+  builder.CreateStore(builder.getInt64(0), AccPtr);
+  emitLoop(Count, builder, [&](llvm::Value *i) {
+    llvm::Value *Elt = builder.CreateLoad(builder.CreateGEP(First, i));
+    llvm::Value *Bits =
+        builder.CreateZExt(builder.CreateBitCast(Elt, IntType), Int64Ty);
+    XorRecord Record =
+        getXorRecord(Bits, Width, PrevPtr, LeadPtr, TrailPtr, builder);
+    if (Kind == kCoderSize) {
+      builder.CreateStore(
+          builder.CreateAdd(builder.CreateLoad(BitPosPtr),
+                            builder.CreateAdd(Record.HeaderLen,
+                                              Record.PayloadLen)),
+          BitPosPtr);
+    } else {
+      writeBits(Last, BitPosPtr, AccPtr, Record.Header, Record.HeaderLen,
+                builder);
+      writeBits(Last, BitPosPtr, AccPtr, Record.Payload, Record.PayloadLen,
+                builder);
+    }
+  });
+
+  if (Kind == kCoderSize) {
+    builder.CreateRet(builder.CreateLShr(
+        builder.CreateAdd(builder.CreateLoad(BitPosPtr), builder.getInt64(7)),
+        3));
+  } else {
+    builder.CreateRet(flushBits(Last, BitPosPtr, AccPtr, builder));
+  }
+
+  return Coder;
+}
+
+llvm::Function *
+tyr::pass::LLVMIRGenPass::getDictCoder(llvm::Type *ElementType,
+                                       StreamCoderKind Kind) const {
+  static const char *Prefixes[] = {"__tyr_dict_size_", "__tyr_dict_encode_",
+                                   "__tyr_dict_decode_",
+                                   "__tyr_dict_validate_"};
+  const std::string Name =
+      std::string(Prefixes[Kind]) + "i" +
+      std::to_string(ElementType->getIntegerBitWidth());
+  if (llvm::Function *Coder = m_parent_->getFunction(Name)) {
+    return Coder;
+  }
+
+  const llvm::DataLayout &DL = m_parent_->getDataLayout();
+  const uint32_t AddrSpace = DL.getProgramAddressSpace();
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+  llvm::Type *ArrayType = ElementType->getPointerTo(AddrSpace);
+  llvm::Type *BufType = llvm::Type::getInt8PtrTy(ctx, AddrSpace);
+  llvm::Type *Int64Ty = llvm::Type::getInt64Ty(ctx);
+
+  // Same shape as the XOR coders:
+  //   size(array, count)
+  //   encode(array, count, out)
+  //   decode(in, count, array)
+  //   validate(in, count, len)
+  llvm::FunctionType *CoderType;
+  if (Kind == kCoderSize) {
+    CoderType = llvm::FunctionType::get(Int64Ty, {ArrayType, Int64Ty}, false);
+  } else if (Kind == kCoderEncode) {
+    CoderType = llvm::FunctionType::get(Int64Ty, {ArrayType, Int64Ty, BufType},
+                                        false);
+  } else if (Kind == kCoderDecode) {
+    CoderType = llvm::FunctionType::get(Int64Ty, {BufType, Int64Ty, ArrayType},
+                                        false);
+  } else {
+    CoderType = llvm::FunctionType::get(Int64Ty, {BufType, Int64Ty, Int64Ty},
+                                        false);
+  }
+
+  llvm::Function *Coder = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name, CoderType));
+  Coder->setLinkage(llvm::GlobalValue::PrivateLinkage);
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Coder);
+  llvm::BasicBlock *DictBlock = llvm::BasicBlock::Create(ctx, "", Coder);
+  llvm::BasicBlock *RawBlock = llvm::BasicBlock::Create(ctx, "", Coder);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  auto arg_iter = Coder->arg_begin();
+  llvm::Value *First = &*arg_iter;
+  ++arg_iter;
+  llvm::Value *Count = &*arg_iter;
+  ++arg_iter;
+  llvm::Value *Last = Kind == kCoderSize ? nullptr : &*arg_iter;
+
+  // The stream is the number of dictionary entries, the entries themselves
+  // and then the bit packed index of each element. A dictionary size of 0
+  // means there were too many distinct values and the elements follow raw.
+  const uint64_t EltSize = DL.getTypeAllocSize(ElementType);
+  llvm::Value *Dict = builder.CreateBitCast(
+      createEntryAlloca(llvm::ArrayType::get(ElementType, kMaxDictSize),
+                        builder),
+      ArrayType);
+  llvm::Value *HeaderSize = builder.getInt64(sizeof(uint64_t));
+
+  llvm::Value *Invalid = builder.getInt64(kInvalidSize);
+
+  llvm::Value *DictSize, *IsDict;
+  if (Kind == kCoderValidate) {
+    insertCheck(builder.CreateICmpUGE(Last, HeaderSize), Invalid, builder);
+    DictSize = swapBytes(loadLength(First, builder), builder);
+    insertCheck(
+        builder.CreateICmpULE(DictSize, builder.getInt64(kMaxDictSize)),
+        Invalid, builder);
+    IsDict = builder.CreateICmpNE(DictSize, builder.getInt64(0));
+  } else if (Kind == kCoderDecode) {
+    DictSize = swapBytes(
+        builder.CreateAlignedLoad(
+            builder.CreateBitCast(First, Int64Ty->getPointerTo(AddrSpace)), 1),
+        builder);
+    // Don't trust it any further than the scratch dictionary
+    DictSize = createUMin(DictSize, builder.getInt64(kMaxDictSize), builder);
+    IsDict = builder.CreateICmpNE(DictSize, builder.getInt64(0));
+  } else {
+    DictSize = buildDict(First, Count, Dict, builder);
+    IsDict =
+        builder.CreateICmpULE(DictSize, builder.getInt64(kMaxDictSize));
+  }
+  llvm::Value *RawSize = builder.CreateMul(Count, builder.getInt64(EltSize));
+
+  if (Kind == kCoderEncode) {
+    builder.CreateAlignedStore(
+        swapBytes(builder.CreateSelect(IsDict, DictSize, builder.getInt64(0)),
+                  builder),
+        builder.CreateBitCast(Last, Int64Ty->getPointerTo(AddrSpace)), 1);
+  }
+  builder.CreateCondBr(IsDict, DictBlock, RawBlock);
+
+  // Too many distinct values, the elements follow as they are
+  builder.SetInsertPoint(RawBlock);
+  if (Kind == kCoderEncode) {
+    llvm::Value *RawOut = builder.CreateGEP(Last, HeaderSize);
+    builder.CreateMemCpy(RawOut, 0, First, 0, RawSize);
+    swapArrayBytes(builder.CreateBitCast(RawOut, ArrayType), Count, builder);
+  } else if (Kind == kCoderDecode) {
+    builder.CreateMemCpy(Last, 0, builder.CreateGEP(First, HeaderSize), 0,
+                         RawSize);
+    swapArrayBytes(Last, Count, builder);
+  } else if (Kind == kCoderValidate) {
+    // Divide rather than multiply so a huge count can't wrap around
+    llvm::Value *MaxCount = builder.CreateUDiv(
+        builder.CreateSub(Last, HeaderSize), builder.getInt64(EltSize));
+    insertCheck(builder.CreateICmpULE(Count, MaxCount), Invalid, builder);
+  }
+  builder.CreateRet(builder.CreateAdd(HeaderSize, RawSize));
+
+  builder.SetInsertPoint(DictBlock);
+  llvm::Value *IndexWidth = getDictIndexWidth(DictSize, builder);
+  llvm::Value *StreamSize =
+      builder.CreateLShr(builder.CreateAdd(builder.CreateMul(Count, IndexWidth),
+                                           builder.getInt64(7)),
+                         3);
+  llvm::Value *DictBytes =
+      builder.CreateMul(DictSize, builder.getInt64(EltSize));
+  llvm::Value *TotalSize = builder.CreateAdd(
+      HeaderSize, builder.CreateAdd(DictBytes, StreamSize));
+  if (Kind == kCoderSize) {
+    builder.CreateRet(TotalSize);
+    return Coder;
+  }
+  if (Kind == kCoderValidate) {
+    insertCheck(builder.CreateICmpULE(TotalSize, Last), Invalid, builder);
+  }
+
+  llvm::Value *Buf = Kind == kCoderEncode ? Last : First;
+  llvm::Value *DictBuf = builder.CreateBitCast(
+      builder.CreateGEP(Buf, HeaderSize), ArrayType);
+  llvm::Value *IndexBuf =
+      builder.CreateGEP(Buf, builder.CreateAdd(HeaderSize, DictBytes));
+  // Every element is at a fixed bit offset and touches at most two bytes of
+  // the index stream, the second one is clamped so we never step off the end
+  llvm::Value *LastByte = builder.CreateSub(StreamSize, builder.getInt64(1));
+
+  if (Kind == kCoderEncode) {
+    emitLoop(DictSize, builder, [&](llvm::Value *j) {
+      builder.CreateAlignedStore(
+          swapBytes(builder.CreateLoad(builder.CreateGEP(Dict, j)), builder),
+          builder.CreateGEP(DictBuf, j), 1);
+    });
+
+    builder.CreateMemSet(IndexBuf, builder.getInt8(0), StreamSize, 1);
+    emitLoop(Count, builder, [&](llvm::Value *i) {
+      llvm::Value *V = builder.CreateLoad(builder.CreateGEP(First, i));
+      llvm::Value *Index = findInDict(Dict, DictSize, V, builder);
+      llvm::Value *Bit = builder.CreateMul(i, IndexWidth);
+      llvm::Value *Shifted = builder.CreateShl(
+          Index, builder.CreateAnd(Bit, builder.getInt64(7)));
+      llvm::Value *Byte = builder.CreateLShr(Bit, 3);
+      llvm::Value *NextByte = createUMin(
+          builder.CreateAdd(Byte, builder.getInt64(1)), LastByte, builder);
+      llvm::Value *Ptrs[] = {builder.CreateGEP(IndexBuf, Byte),
+                             builder.CreateGEP(IndexBuf, NextByte)};
+      for (uint32_t k = 0; k < 2; ++k) {
+        llvm::Value *Part = builder.CreateTrunc(
+            builder.CreateLShr(Shifted, 8 * k), builder.getInt8Ty());
+        builder.CreateStore(builder.CreateOr(builder.CreateLoad(Ptrs[k]), Part),
+                            Ptrs[k]);
+      }
+    });
+  } else {
+    if (Kind == kCoderDecode) {
+      emitLoop(DictSize, builder, [&](llvm::Value *j) {
+        builder.CreateStore(
+            swapBytes(
+                builder.CreateAlignedLoad(builder.CreateGEP(DictBuf, j), 1),
+                builder),
+            builder.CreateGEP(Dict, j));
+      });
+    }
+
+    // No state is carried between elements, so this is a plain gather
+    llvm::Value *Mask = builder.CreateSub(
+        builder.CreateShl(builder.getInt64(1), IndexWidth),
+        builder.getInt64(1));
+    emitLoop(Count, builder, [&](llvm::Value *i) {
+      llvm::Value *Bit = builder.CreateMul(i, IndexWidth);
+      llvm::Value *Byte = builder.CreateLShr(Bit, 3);
+      llvm::Value *Lo = builder.CreateZExt(
+          builder.CreateLoad(builder.CreateGEP(IndexBuf, Byte)), Int64Ty);
+      llvm::Value *Hi = builder.CreateZExt(
+          builder.CreateLoad(builder.CreateGEP(
+              IndexBuf,
+              createUMin(builder.CreateAdd(Byte, builder.getInt64(1)), LastByte,
+                         builder))),
+          Int64Ty);
+      llvm::Value *Index = builder.CreateAnd(
+          builder.CreateLShr(builder.CreateOr(Lo, builder.CreateShl(Hi, 8)),
+                             builder.CreateAnd(Bit, builder.getInt64(7))),
+          Mask);
+      if (Kind == kCoderValidate) {
+        // The mask only rounds up to a power of two
+        insertCheck(builder.CreateICmpULT(Index, DictSize), Invalid, builder);
+      } else {
+        builder.CreateStore(builder.CreateLoad(builder.CreateGEP(Dict, Index)),
+                            builder.CreateGEP(Last, i));
+      }
+    });
+  }
+  builder.CreateRet(TotalSize);
+
+  return Coder;
+}
+
+llvm::Function *
+tyr::pass::LLVMIRGenPass::getChunkCopier(llvm::Type *ElementType,
+                                         bool Delta) const {
+  std::string TypeName;
+  llvm::raw_string_ostream TypeNameStream(TypeName);
+  ElementType->print(TypeNameStream);
+  const std::string Name = "__tyr_copy_chunk_" + TypeNameStream.str() +
+                           (Delta ? "_delta" : "");
+  if (llvm::Function *Copier = m_parent_->getFunction(Name)) {
+    return Copier;
+  }
+
+  const llvm::DataLayout &DL = m_parent_->getDataLayout();
+  const uint32_t AddrSpace = DL.getProgramAddressSpace();
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+  llvm::Type *ArrayType = ElementType->getPointerTo(AddrSpace);
+  llvm::StructType *ChunkCtxType = llvm::StructType::get(
+      ctx, {ArrayType, ArrayType, llvm::Type::getInt64Ty(ctx)});
+
+  // A tyr_parallel_fn, the context is {in, out, count} and the second arg is
+  // the chunk to copy
+  llvm::FunctionType *CopierType = llvm::FunctionType::get(
+      llvm::Type::getVoidTy(ctx),
+      {llvm::Type::getInt8PtrTy(ctx, AddrSpace), llvm::Type::getInt64Ty(ctx)},
+      false);
+
+  llvm::Function *Copier = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name, CopierType));
+  Copier->setLinkage(llvm::GlobalValue::PrivateLinkage);
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Copier);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  auto arg_iter = Copier->arg_begin();
+  llvm::Value *ChunkCtx = builder.CreateBitCast(
+      &*arg_iter, ChunkCtxType->getPointerTo(AddrSpace));
+  ++arg_iter;
+  llvm::Value *Chunk = &*arg_iter;
+
+  llvm::Value *In = builder.CreateLoad(builder.CreateStructGEP(ChunkCtx, 0));
+  llvm::Value *Out = builder.CreateLoad(builder.CreateStructGEP(ChunkCtx, 1));
+  llvm::Value *Count =
+      builder.CreateLoad(builder.CreateStructGEP(ChunkCtx, 2));
+
+  const uint64_t EltSize = DL.getTypeAllocSize(ElementType);
+  const uint64_t ChunkItems = kParallelChunkSize / EltSize;
+  llvm::Value *Lo = builder.CreateMul(Chunk, builder.getInt64(ChunkItems));
+  llvm::Value *Hi = createUMin(
+      builder.CreateAdd(Lo, builder.getInt64(ChunkItems)), Count, builder);
+  llvm::Value *NumItems = builder.CreateSub(Hi, Lo);
+  llvm::Value *ChunkOut = builder.CreateGEP(Out, Lo);
+
+  // Exactly what the sequential path writes for these items, a delta only
+  // looks back into the input so chunks don't depend on each other
+  if (Delta) {
+    emitLoop(NumItems, builder, [&](llvm::Value *i) {
+      llvm::Value *Index = builder.CreateAdd(Lo, i);
+      builder.CreateStore(loadWireElement(In, Index, Delta, builder),
+                          builder.CreateGEP(ChunkOut, i));
+    });
+  } else {
+    llvm::Value *ChunkSize =
+        builder.CreateMul(NumItems, builder.getInt64(EltSize));
+    builder.CreateMemCpy(ChunkOut, 0, builder.CreateGEP(In, Lo), 0, ChunkSize);
+  }
+  swapArrayBytes(ChunkOut, NumItems, builder);
+
+  builder.CreateRetVoid();
+
+  return Copier;
+}
+
+llvm::Value *
+tyr::pass::LLVMIRGenPass::getBitStorage(const tyr::ir::Field *f,
+                                        llvm::Value *Struct,
+                                        llvm::IRBuilder<> &builder) const {
+  const uint32_t AddrSpace =
+      m_parent_->getDataLayout().getProgramAddressSpace();
+  return builder.CreateBitCast(
+      builder.CreateStructGEP(Struct, f->storageField->offset),
+      builder.getInt8PtrTy(AddrSpace));
+}
+
+llvm::Value *
+tyr::pass::LLVMIRGenPass::loadField(const tyr::ir::Field *f,
+                                    llvm::Value *Struct,
+                                    llvm::IRBuilder<> &builder) const {
+  if (f->storageField != nullptr) {
+    return loadBits(getBitStorage(f, Struct, builder), f->bitOffset,
+                    f->type->getIntegerBitWidth(), builder);
+  }
+
+  if (f->isFrozen && (f->isRepeated || f->isStruct)) {
+    // The data is further along in the struct's own buffer
+    const uint32_t AddrSpace =
+        m_parent_->getDataLayout().getProgramAddressSpace();
+    llvm::Value *Offset =
+        builder.CreateLoad(builder.CreateStructGEP(Struct, f->offset));
+    return builder.CreateBitCast(
+        builder.CreateGEP(
+            builder.CreateBitCast(Struct, builder.getInt8PtrTy(AddrSpace)),
+            Offset),
+        f->type);
+  }
+
+  return builder.CreateLoad(builder.CreateStructGEP(Struct, f->offset));
+}
+
+void tyr::pass::LLVMIRGenPass::storeField(const tyr::ir::Field *f,
+                                          llvm::Value *Struct,
+                                          llvm::Value *Val,
+                                          llvm::IRBuilder<> &builder) const {
+  if (f->storageField != nullptr) {
+    storeBits(getBitStorage(f, Struct, builder), f->bitOffset,
+              f->type->getIntegerBitWidth(), Val, builder);
+    return;
+  }
+
+  builder.CreateStore(Val, builder.CreateStructGEP(Struct, f->offset));
+}
+
+llvm::Function *
+tyr::pass::LLVMIRGenPass::getSkipper(const tyr::ir::Field *f) const {
+  const std::string Name =
+      "__skip_" + std::string(f->parentType->getName()) + "_" + f->name;
+  if (llvm::Function *Skipper = m_parent_->getFunction(Name)) {
+    return Skipper;
+  }
+
+  const llvm::DataLayout &DL = m_parent_->getDataLayout();
+  const uint32_t AddrSpace = DL.getProgramAddressSpace();
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+
+  // Returns the number of bytes the field in the first arg takes up on the
+  // wire, without decoding any of it
+  llvm::FunctionType *SkipperType = llvm::FunctionType::get(
+      llvm::Type::getInt64Ty(ctx), {llvm::Type::getInt8PtrTy(ctx, AddrSpace)},
+      false);
+
+  llvm::Function *Skipper = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name, SkipperType));
+  Skipper->addFnAttr(llvm::Attribute::AlwaysInline);
+  Skipper->setLinkage(llvm::GlobalValue::PrivateLinkage);
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Skipper);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  llvm::Value *InBuf = &*Skipper->arg_begin();
+  llvm::Value *HeaderSize = builder.getInt64(sizeof(uint64_t));
+  // The buffer is trusted here (same as the deserializer), so the validators
+  // double as skippers with no real limit on the length
+  llvm::Value *NoLimit = builder.getInt64(kMaxValidatedSize);
+
+  llvm::Value *OutSize;
+  if (f->isStruct) {
+    OutSize = swapBytes(loadLength(InBuf, builder), builder);
+  } else if (f->isRepeated) {
+    llvm::Value *Count = swapBytes(loadLength(InBuf, builder), builder);
+    llvm::Value *DataPtr = builder.CreateGEP(InBuf, HeaderSize);
+    llvm::Type *ElementType = f->type->getPointerElementType();
+    llvm::Value *EltSize =
+        builder.getInt64(DL.getTypeAllocSize(ElementType));
+
+    llvm::Value *DataSize;
+    if (f->encoding & ir::kEncodingBitPacked) {
+      DataSize = getBitStreamSize(Count, ElementType->getIntegerBitWidth(),
+                                  builder);
+    } else if (f->encoding & ir::kEncodingVarint) {
+      DataSize = builder.CreateCall(getVarintValidator(),
+                                    {DataPtr, Count, NoLimit});
+    } else if (f->encoding & ir::kEncodingXor) {
+      DataSize = builder.CreateCall(getXorCoder(ElementType, kCoderValidate),
+                                    {DataPtr, Count, NoLimit});
+    } else if (f->encoding & ir::kEncodingDictionary) {
+      // The sizes all follow from the dictionary size, same as the decoder
+      llvm::Value *DictSize = createUMin(
+          swapBytes(loadLength(DataPtr, builder), builder),
+          builder.getInt64(kMaxDictSize), builder);
+      llvm::Value *StreamSize = builder.CreateLShr(
+          builder.CreateAdd(
+              builder.CreateMul(Count, getDictIndexWidth(DictSize, builder)),
+              builder.getInt64(7)),
+          3);
+      llvm::Value *DictBytes = builder.CreateAdd(
+          builder.CreateMul(DictSize, EltSize), StreamSize);
+      llvm::Value *RawBytes = builder.CreateMul(Count, EltSize);
+      DataSize = builder.CreateAdd(
+          HeaderSize,
+          builder.CreateSelect(
+              builder.CreateICmpEQ(DictSize, builder.getInt64(0)), RawBytes,
+              DictBytes));
+    } else {
+      DataSize = builder.CreateMul(Count, EltSize);
+    }
+    OutSize = builder.CreateAdd(HeaderSize, DataSize);
+  } else if (!f->isBitStorage && (f->encoding & ir::kEncodingVarint)) {
+    OutSize = builder.CreateCall(getVarintValidator(),
+                                 {InBuf, builder.getInt64(1), NoLimit});
+  } else {
+    OutSize = builder.getInt64(DL.getTypeAllocSize(f->type));
+  }
+
+  builder.CreateRet(OutSize);
+
+  return Skipper;
+}
+
+llvm::Function *
+tyr::pass::LLVMIRGenPass::getLazyLoader(const tyr::ir::Field *f) const {
+  const std::string Name =
+      "__load_" + std::string(f->parentType->getName()) + "_" + f->name;
+  if (llvm::Function *Loader = m_parent_->getFunction(Name)) {
+    return Loader;
+  }
+
+  const uint32_t AddrSpace =
+      m_parent_->getDataLayout().getProgramAddressSpace();
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+  llvm::Type *StructPtrType = f->parentType->getPointerTo(AddrSpace);
+  llvm::PointerType *BufType = llvm::Type::getInt8PtrTy(ctx, AddrSpace);
+
+  // Decodes the field if it's still pending, returns false if that failed
+  llvm::FunctionType *LoaderType = llvm::FunctionType::get(
+      llvm::Type::getInt1Ty(ctx), {StructPtrType}, false);
+
+  llvm::Function *Loader = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name, LoaderType));
+  Loader->setLinkage(llvm::GlobalValue::PrivateLinkage);
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Loader);
+  llvm::BasicBlock *IsPending = llvm::BasicBlock::Create(ctx, "", Loader);
+  llvm::BasicBlock *IsLoaded = llvm::BasicBlock::Create(ctx, "", Loader);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  llvm::Value *Self = &*Loader->arg_begin();
+  llvm::Value *PendingGEP =
+      builder.CreateStructGEP(Self, f->pendingField->offset);
+  llvm::Value *Pending = builder.CreateLoad(PendingGEP);
+  builder.CreateCondBr(builder.CreateIsNull(Pending), IsLoaded, IsPending);
+
+  builder.SetInsertPoint(IsLoaded);
+  builder.CreateRet(builder.getInt1(true));
+
+  // The getters can come before the field deserializer, so make sure it's at
+  // least declared
+  builder.SetInsertPoint(IsPending);
+  llvm::Function *Deserializer =
+      llvm::cast<llvm::Function>(m_parent_->getOrInsertFunction(
+          getDeserializerName(f),
+          llvm::FunctionType::get(builder.getInt64Ty(),
+                                  {StructPtrType, BufType}, false)));
+  llvm::Value *OutSize = builder.CreateCall(Deserializer, {Self, Pending});
+  insertCheck(builder.CreateICmpNE(OutSize, builder.getInt64(0)),
+              builder.getInt1(false), builder);
+  builder.CreateStore(llvm::ConstantPointerNull::get(BufType), PendingGEP);
+  builder.CreateRet(builder.getInt1(true));
+
+  return Loader;
+}
+
+void tyr::pass::LLVMIRGenPass::insertLazyLoad(
+    const tyr::ir::Field *f, llvm::Value *Self, llvm::Value *ReturnFail,
+    llvm::IRBuilder<> &builder) const {
+  if (f->pendingField == nullptr) {
+    return;
+  }
+  insertCheck(builder.CreateCall(getLazyLoader(f), {Self}), ReturnFail,
+              builder);
+}
+
+bool tyr::pass::LLVMIRGenPass::initField(const tyr::ir::Field *f,
+                                         llvm::Value *Struct,
+                                         llvm::Argument *Arg,
+                                         llvm::IRBuilder<> &builder) {
+  if (f->isBitStorage || f->isDirtyState) {
+    builder.CreateStore(llvm::ConstantAggregateZero::get(f->type),
+                        builder.CreateStructGEP(Struct, f->offset));
+  } else if (f->isMutable) {
+    // Initialize to zero (still works even if it's a pointer)
+    storeField(f, Struct,
+               builder.CreateTruncOrBitCast(builder.getInt64(0), f->type),
+               builder);
+  } else {
+    if (Arg == nullptr) {
+      llvm::errs() << "Arg was null on a field that is immutable (and "
+                      "therefore needs an initializer), aborting\n";
+      return false;
+    }
+    // Initialize to the value in the constructor
+    if (f->type->isPointerTy()) {
+      // Immutable repeated field, so need to alloc memory for it
+      // Get the field alloc size
+      llvm::Value *FieldAllocSize = getFieldAllocSize(f, Struct, builder);
+      // Do the allocation
+      llvm::Value *AllocdMem = builder.CreateCall(
+          m_parent_->getFunction(m_builtin_names_.lookup("malloc")),
+          FieldAllocSize);
+      llvm::Function *Constructor = builder.GetInsertBlock()->getParent();
+      // Check that it succeeded
+      llvm::BasicBlock *AllocSucceeded = insertNullCheck(
+          {AllocdMem},
+          builder.CreateIntToPtr(builder.getInt64(0), Struct->getType()),
+          builder, Constructor);
+
+      // Now we can do the memcpy
+      builder.SetInsertPoint(AllocSucceeded);
+      unsigned int FieldAlignment =
+          m_parent_->getDataLayout().getABITypeAlignment(f->type);
+      builder.CreateMemCpy(AllocdMem, FieldAlignment, Arg, FieldAlignment,
+                           FieldAllocSize, false);
+      builder.CreateStore(builder.CreateBitCast(AllocdMem, f->type),
+                          builder.CreateStructGEP(Struct, f->offset));
+    } else {
+      storeField(f, Struct, Arg, builder);
+    }
+  }
+
+  return true;
+}
+
+bool tyr::pass::LLVMIRGenPass::destroyField(const tyr::ir::Field *f,
+                                            llvm::Value *Struct,
+                                            llvm::IRBuilder<> &builder) {
+  llvm::Value *FieldGEP = builder.CreateStructGEP(Struct, f->offset);
+
+  const uint32_t AddrSpace =
+      m_parent_->getDataLayout().getProgramAddressSpace();
+
+  // Pending fields point into a buffer that belongs to the caller, and frozen
+  // ones into the struct itself
+  if (f->type->isPointerTy() && !f->isPending && !f->isFrozen) {
+    builder.CreateCall(m_parent_->getFunction(m_builtin_names_.lookup("free")),
+                       builder.CreateBitCast(builder.CreateLoad(FieldGEP),
+                                             builder.getInt8PtrTy(AddrSpace)));
+  }
+
+  return true;
+}
+
+bool tyr::pass::LLVMIRGenPass::getGetter(const ir::Field *f) const {
+  const uint32_t AddrSpace =
+      m_parent_->getDataLayout().getProgramAddressSpace();
+
+  llvm::Type *StructPtrType = f->parentType->getPointerTo(AddrSpace);
+
+  // Get an alias to the context
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+
+  std::string GetterName =
+      "get_" + std::string(f->parentType->getName()) + "_" + f->name;
+  // Getter returns bool, returns the thing by reference
+  llvm::FunctionType *GetterType = llvm::FunctionType::get(
+      llvm::Type::getInt1Ty(ctx),
+      {StructPtrType, f->type->getPointerTo(AddrSpace)}, false);
+
+  // Create the function
+  llvm::Function *Getter = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(GetterName, GetterType));
+  Getter->addFnAttr(llvm::Attribute::InlineHint);
+
+  llvm::BasicBlock *GetterBlock = llvm::BasicBlock::Create(ctx, "", Getter);
+  llvm::IRBuilder<> builder(GetterBlock);
+
+  // Get the first input to the function, the struct we're operating on
+  auto arg_iter = Getter->arg_begin();
+  llvm::Value *Self = &*arg_iter;
+  ++arg_iter;
+
+  // Make sure it's not NULL
+  llvm::BasicBlock *SelfIsNotNull = insertNullCheck(
+      {Self, &*arg_iter}, builder.getInt1(false), builder, Getter);
 
   // Handle if it's not null
   builder.SetInsertPoint(SelfIsNotNull);
-  llvm::Value *FieldGEP = builder.CreateStructGEP(Self, f->offset);
-  llvm::Value *FieldLoad = builder.CreateLoad(FieldGEP);
+  insertLazyLoad(f, Self, builder.getInt1(false), builder);
+  llvm::Value *FieldLoad = loadField(f, Self, builder);
 
   // Get the place where we're storing the result
   llvm::Value *OutVal = &*arg_iter;
 
-  // If it's not mutable alloc a new thing and copy it over
-  if (f->isStruct && !f->isMutable) {
+  // If it's not mutable alloc a new thing and copy it over. Frozen fields are
+  // handed out in place instead, they live as long as the struct does.
+  if (f->isStruct && !f->isMutable && !f->isFrozen) {
     // The serializer is just "serialize_<name>"
     std::string FieldSerializerName =
         "serialize_" + std::string(f->type->getStructName());
@@ -343,7 +2115,7 @@ bool tyr::pass::LLVMIRGenPass::getGetter(const ir::Field *f) const {
     builder.CreateStore(DeserializedField, OutVal);
     builder.CreateRet(builder.getInt1(true));
     return true;
-  } else if (f->isRepeated && !f->isMutable) {
+  } else if (f->isRepeated && !f->isMutable && !f->isFrozen) {
     llvm::Value *FieldAllocSize = getFieldAllocSize(f, Self, builder);
 
     llvm::Value *AllocdMem = builder.CreateCall(
@@ -413,8 +2185,8 @@ bool tyr::pass::LLVMIRGenPass::getItemGetter(const tyr::ir::Field *f) const {
 
   // Handle if it's not null
   builder.SetInsertPoint(SelfIsNotNull);
-  llvm::Value *FieldGEP = builder.CreateStructGEP(Self, f->offset);
-  llvm::Value *FieldLoad = builder.CreateLoad(FieldGEP);
+  insertLazyLoad(f, Self, builder.getInt1(false), builder);
+  llvm::Value *FieldLoad = loadField(f, Self, builder);
 
   llvm::Value *CountGEP = builder.CreateStructGEP(Self, f->countField->offset);
   llvm::Value *Count = builder.CreateLoad(CountGEP);
@@ -448,6 +2220,11 @@ bool tyr::pass::LLVMIRGenPass::getSetter(const tyr::ir::Field *f) const {
     return true;
   }
 
+  if (f->isFrozen && f->isCount) {
+    // The arrays of a frozen struct are sized once, when it's created
+    return true;
+  }
+
   const uint32_t AddrSpace =
       m_parent_->getDataLayout().getProgramAddressSpace();
 
@@ -495,9 +2272,39 @@ bool tyr::pass::LLVMIRGenPass::getSetter(const tyr::ir::Field *f) const {
   ++arg_iterator;
   llvm::Value *ToInsert = &*arg_iterator;
 
+  // Resizing an array changes all of it as far as a delta is concerned
+  markDirty(f->isCount ? f->countsFor : f, Self, builder);
+
   // GEP the field
   llvm::Value *FieldGEP = builder.CreateStructGEP(Self, f->offset);
-  if (f->isStruct) {
+  if (f->isFrozen && (f->isStruct || f->isRepeated)) {
+    // There's no room to grow into, so the new value has to be the same size
+    // as the old one and is copied over it in place
+    llvm::Value *FieldData = loadField(f, Self, builder);
+    llvm::Value *FieldSize;
+    if (f->isRepeated) {
+      ++arg_iterator;
+      llvm::Value *NumElts = &*arg_iterator;
+      insertCheck(builder.CreateICmpEQ(
+                      NumElts, builder.CreateLoad(builder.CreateStructGEP(
+                                   Self, f->countField->offset))),
+                  builder.getInt1(false), builder);
+      FieldSize = getFieldAllocSize(f, Self, builder);
+    } else {
+      builder.SetInsertPoint(insertNullCheck({ToInsert}, builder.getInt1(false),
+                                             builder, Setter));
+      llvm::Type *BufType = builder.getInt8PtrTy(AddrSpace);
+      FieldSize =
+          loadLength(builder.CreateBitCast(FieldData, BufType), builder);
+      insertCheck(
+          builder.CreateICmpEQ(
+              FieldSize,
+              loadLength(builder.CreateBitCast(ToInsert, BufType), builder)),
+          builder.getInt1(false), builder);
+    }
+    builder.CreateMemCpy(FieldData, 0, ToInsert, 0, FieldSize);
+    builder.CreateRet(builder.getInt1(true));
+  } else if (f->isStruct) {
     // If it's a struct we can just serialize the thing and then deserialize
     // into our field gep The serializer is just "serialize_<name>"
     std::string FieldSerializerName =
@@ -516,6 +2323,13 @@ bool tyr::pass::LLVMIRGenPass::getSetter(const tyr::ir::Field *f) const {
     builder.CreateStore(DeserializedField, FieldGEP);
     builder.CreateRet(builder.getInt1(true));
   } else if (f->isRepeated) {
+    // Whatever hadn't been decoded yet is being replaced anyway
+    if (f->pendingField != nullptr) {
+      builder.CreateStore(
+          llvm::ConstantPointerNull::get(builder.getInt8PtrTy(AddrSpace)),
+          builder.CreateStructGEP(Self, f->pendingField->offset));
+    }
+
     llvm::Value *PtrFieldCount =
         builder.CreateStructGEP(Self, f->countField->offset);
 
@@ -609,6 +2423,8 @@ bool tyr::pass::LLVMIRGenPass::getSetter(const tyr::ir::Field *f) const {
 
     // Otherwise, continue
     builder.SetInsertPoint(NewSizeIsNotZero);
+    // The elements that are kept have to be there to keep
+    insertLazyLoad(f->countsFor, Self, builder.getInt1(false), builder);
 
     // Store the new size
     llvm::Value *LoadedCount = builder.CreateLoad(FieldGEP);
@@ -642,7 +2458,7 @@ bool tyr::pass::LLVMIRGenPass::getSetter(const tyr::ir::Field *f) const {
     builder.CreateStore(ToInsert, FieldGEP);
     builder.CreateRet(builder.getInt1(true));
   } else {
-    builder.CreateStore(ToInsert, FieldGEP);
+    storeField(f, Self, ToInsert, builder);
     builder.CreateRet(builder.getInt1(true));
   }
 
@@ -693,8 +2509,8 @@ bool tyr::pass::LLVMIRGenPass::getItemSetter(const tyr::ir::Field *f) const {
 
   // Handle if it's not null
   builder.SetInsertPoint(SelfIsNotNull);
-  llvm::Value *FieldGEP = builder.CreateStructGEP(Self, f->offset);
-  llvm::Value *FieldLoad = builder.CreateLoad(FieldGEP);
+  insertLazyLoad(f, Self, builder.getInt1(false), builder);
+  llvm::Value *FieldLoad = loadField(f, Self, builder);
 
   llvm::Value *CountGEP = builder.CreateStructGEP(Self, f->countField->offset);
   llvm::Value *Count = builder.CreateLoad(CountGEP);
@@ -715,6 +2531,7 @@ bool tyr::pass::LLVMIRGenPass::getItemSetter(const tyr::ir::Field *f) const {
   llvm::Value *ValToSet = &*arg_iter;
 
   builder.SetInsertPoint(InBounds);
+  markDirtyItem(f, Self, IDX, builder);
   llvm::Value *ItemGEP = builder.CreateGEP(FieldLoad, IDX);
   builder.CreateStore(ValToSet, ItemGEP);
   builder.CreateRet(builder.getInt1(true));
@@ -733,8 +2550,14 @@ tyr::pass::LLVMIRGenPass::getDeserializerName(const tyr::ir::Field *f) const {
          f->name;
 }
 
+std::string
+tyr::pass::LLVMIRGenPass::getValidatorName(const tyr::ir::Field *f) const {
+  return "__validate_" + std::string(f->parentType->getName()) + "_" + f->name;
+}
+
 bool tyr::pass::LLVMIRGenPass::getSerializer(const tyr::ir::Field *f) const {
-  if (f->isCount) { // Don't serialize count fields
+  // Don't serialize count fields or fields that live in bit storage
+  if (f->isCount || f->storageField != nullptr || f->isPending) {
     return true;
   }
 
@@ -812,17 +2635,114 @@ bool tyr::pass::LLVMIRGenPass::getSerializer(const tyr::ir::Field *f) const {
     // Increment CurrentPtr so we can store the data
     CurrentPtr = builder.CreateGEP(OutBuf, OutSize);
 
-    llvm::Value *PtrFieldAllocSize = getFieldAllocSize(f, Self, builder);
-    unsigned int FieldAlignment =
-        m_parent_->getDataLayout().getABITypeAlignment(f->type);
-    builder.CreateMemCpy(CurrentPtr, 0, FieldData, FieldAlignment,
-                         PtrFieldAllocSize);
-
-    // Swap bytes in the CurrentPtr if necessary
-    CastedCurrentPtr = builder.CreateBitCast(CurrentPtr, FieldData->getType());
-    swapArrayBytes(CastedCurrentPtr, Count, builder);
+    const bool Delta = f->encoding & ir::kEncodingDelta;
+    llvm::Value *PtrFieldSerializedSize;
+    if (f->encoding & ir::kEncodingBitPacked) {
+      PtrFieldSerializedSize = getFieldSerializedSize(f, Self, builder);
+      packBitArray(FieldData, Count, CurrentPtr, Delta, builder);
+    } else if (f->encoding & ir::kEncodingVarint) {
+      llvm::Function *Writer = getVarintWriter();
+      llvm::Value *WrittenPtr =
+          createEntryAlloca(builder.getInt64Ty(), builder);
+      builder.CreateStore(builder.getInt64(0), WrittenPtr);
+      emitLoop(Count, builder, [&](llvm::Value *i) {
+        llvm::Value *Elt = loadWireElement(FieldData, i, Delta, builder);
+        llvm::Value *Written = builder.CreateLoad(WrittenPtr);
+        llvm::Value *EltSize = builder.CreateCall(
+            Writer, {toVarint(f, Elt, builder),
+                     builder.CreateGEP(CurrentPtr, Written)});
+        builder.CreateStore(builder.CreateAdd(Written, EltSize), WrittenPtr);
+      });
+      PtrFieldSerializedSize = builder.CreateLoad(WrittenPtr);
+    } else if (f->encoding & ir::kEncodingXor) {
+      PtrFieldSerializedSize = builder.CreateCall(
+          getXorCoder(f->type->getPointerElementType(), kCoderEncode),
+          {FieldData, Count, CurrentPtr});
+    } else if (f->encoding & ir::kEncodingDictionary) {
+      PtrFieldSerializedSize = builder.CreateCall(
+          getDictCoder(f->type->getPointerElementType(), kCoderEncode),
+          {FieldData, Count, CurrentPtr});
+    } else {
+      PtrFieldSerializedSize = getFieldSerializedSize(f, Self, builder);
+      CastedCurrentPtr =
+          builder.CreateBitCast(CurrentPtr, FieldData->getType());
+
+      // Only there when the parallel runtime has been linked in
+      llvm::Function *ParallelFor =
+          m_parent_->getFunction("tyr_parallel_for");
+      llvm::BasicBlock *Done = nullptr;
+      if (ParallelFor != nullptr) {
+        // Big fields are copied and swapped a chunk at a time on the thread
+        // pool, each chunk has a fixed place in the output so the bytes come
+        // out the same as below
+        llvm::BasicBlock *Parallel =
+            llvm::BasicBlock::Create(ctx, "", Serializer);
+        llvm::BasicBlock *Sequential =
+            llvm::BasicBlock::Create(ctx, "", Serializer);
+        Done = llvm::BasicBlock::Create(ctx, "", Serializer);
+        builder.CreateCondBr(
+            builder.CreateICmpUGE(PtrFieldSerializedSize,
+                                  builder.getInt64(kParallelCopyThreshold)),
+            Parallel, Sequential);
+
+        builder.SetInsertPoint(Parallel);
+        llvm::Type *ElementType = f->type->getPointerElementType();
+        llvm::StructType *ChunkCtxType = llvm::StructType::get(
+            ctx, {f->type, f->type, builder.getInt64Ty()});
+        llvm::Value *ChunkCtx = createEntryAlloca(ChunkCtxType, builder);
+        builder.CreateStore(FieldData, builder.CreateStructGEP(ChunkCtx, 0));
+        builder.CreateStore(CastedCurrentPtr,
+                            builder.CreateStructGEP(ChunkCtx, 1));
+        builder.CreateStore(Count, builder.CreateStructGEP(ChunkCtx, 2));
+
+        const uint64_t ChunkItems =
+            kParallelChunkSize /
+            m_parent_->getDataLayout().getTypeAllocSize(ElementType);
+        llvm::Value *NumChunks = builder.CreateUDiv(
+            builder.CreateAdd(Count, builder.getInt64(ChunkItems - 1)),
+            builder.getInt64(ChunkItems));
+
+        llvm::Function *Copier = getChunkCopier(ElementType, Delta);
+        builder.CreateCall(
+            ParallelFor,
+            {NumChunks, Copier,
+             builder.CreateBitCast(ChunkCtx, builder.getInt8PtrTy(AddrSpace))});
+        builder.CreateBr(Done);
+
+        builder.SetInsertPoint(Sequential);
+      }
+
+      if (Delta) {
+        emitLoop(Count, builder, [&](llvm::Value *i) {
+          builder.CreateStore(loadWireElement(FieldData, i, Delta, builder),
+                              builder.CreateGEP(CastedCurrentPtr, i));
+        });
+      } else {
+        unsigned int FieldAlignment =
+            m_parent_->getDataLayout().getABITypeAlignment(f->type);
+        builder.CreateMemCpy(CurrentPtr, 0, FieldData, FieldAlignment,
+                             PtrFieldSerializedSize);
+      }
+
+      // Swap bytes in the CurrentPtr if necessary
+      swapArrayBytes(CastedCurrentPtr, Count, builder);
+
+      if (Done != nullptr) {
+        builder.CreateBr(Done);
+        builder.SetInsertPoint(Done);
+      }
+    }
     // Increment the OutSize by the size of the pointer field
-    OutSize = builder.CreateAdd(OutSize, PtrFieldAllocSize);
+    OutSize = builder.CreateAdd(OutSize, PtrFieldSerializedSize);
+  } else if (f->isBitStorage) {
+    // The packed bits are laid out a byte at a time already, so they go on the
+    // wire exactly as they are
+    OutSize = getFieldAllocSize(f, Self, builder);
+    builder.CreateMemCpy(CurrentPtr, 0,
+                         builder.CreateStructGEP(Self, f->offset), 0, OutSize);
+  } else if (f->encoding & ir::kEncodingVarint) {
+    OutSize = builder.CreateCall(getVarintWriter(),
+                                 {toVarint(f, FieldData, builder), CurrentPtr});
   } else {
     // Just store the data
     llvm::Value *SwappedData = swapBytes(FieldData, builder);
@@ -838,7 +2758,8 @@ bool tyr::pass::LLVMIRGenPass::getSerializer(const tyr::ir::Field *f) const {
 }
 
 bool tyr::pass::LLVMIRGenPass::getDeserializer(const tyr::ir::Field *f) const {
-  if (f->isCount) { // Don't serialize count fields
+  // Don't deserialize count fields or fields that live in bit storage
+  if (f->isCount || f->storageField != nullptr || f->isPending) {
     return true;
   }
 
@@ -920,22 +2841,67 @@ bool tyr::pass::LLVMIRGenPass::getDeserializer(const tyr::ir::Field *f) const {
 
     // Malloc succeeded, so now handle it
     builder.SetInsertPoint(MallocSucceeded);
-    // Do the copy
-    unsigned int FieldAlignment =
-        m_parent_->getDataLayout().getABITypeAlignment(f->type);
-    builder.CreateMemCpy(FieldMem, FieldAlignment, CastedCurrentPtr, 0,
-                         PtrFieldAllocSize);
-
     llvm::Value *CastedFieldMem = builder.CreateBitCast(FieldMem, f->type);
 
-    // Swap the bytes in the array if necessary
-    swapArrayBytes(CastedFieldMem, Count, builder);
+    llvm::Value *PtrFieldSerializedSize;
+    if (f->encoding & ir::kEncodingBitPacked) {
+      unpackBitArray(CurrentPtr, Count, CastedFieldMem, builder);
+      PtrFieldSerializedSize = getFieldSerializedSize(f, Self, builder);
+    } else if (f->encoding & ir::kEncodingVarint) {
+      llvm::Function *Reader = getVarintReader();
+      llvm::Type *ElementType = f->type->getPointerElementType();
+      llvm::Value *ReadPtr = createEntryAlloca(builder.getInt64Ty(), builder);
+      llvm::Value *ValPtr = createEntryAlloca(builder.getInt64Ty(), builder);
+      builder.CreateStore(builder.getInt64(0), ReadPtr);
+      emitLoop(Count, builder, [&](llvm::Value *i) {
+        llvm::Value *Read = builder.CreateLoad(ReadPtr);
+        llvm::Value *EltSize = builder.CreateCall(
+            Reader, {builder.CreateGEP(CurrentPtr, Read), ValPtr});
+        builder.CreateStore(
+            fromVarint(f, builder.CreateLoad(ValPtr), ElementType, builder),
+            builder.CreateGEP(CastedFieldMem, i));
+        builder.CreateStore(builder.CreateAdd(Read, EltSize), ReadPtr);
+      });
+      PtrFieldSerializedSize = builder.CreateLoad(ReadPtr);
+    } else if (f->encoding & ir::kEncodingXor) {
+      PtrFieldSerializedSize = builder.CreateCall(
+          getXorCoder(f->type->getPointerElementType(), kCoderDecode),
+          {CurrentPtr, Count, CastedFieldMem});
+    } else if (f->encoding & ir::kEncodingDictionary) {
+      PtrFieldSerializedSize = builder.CreateCall(
+          getDictCoder(f->type->getPointerElementType(), kCoderDecode),
+          {CurrentPtr, Count, CastedFieldMem});
+    } else {
+      // Do the copy
+      unsigned int FieldAlignment =
+          m_parent_->getDataLayout().getABITypeAlignment(f->type);
+      builder.CreateMemCpy(FieldMem, FieldAlignment, CastedCurrentPtr, 0,
+                           PtrFieldAllocSize);
+
+      // Swap the bytes in the array if necessary
+      swapArrayBytes(CastedFieldMem, Count, builder);
+      PtrFieldSerializedSize = PtrFieldAllocSize;
+    }
+
+    if (f->encoding & ir::kEncodingDelta) {
+      prefixSumArray(CastedFieldMem, Count, builder);
+    }
 
     // And store it into Self
     builder.CreateStore(CastedFieldMem,
                         builder.CreateStructGEP(Self, f->offset));
 
-    OutSize = builder.CreateAdd(OutSize, PtrFieldAllocSize);
+    OutSize = builder.CreateAdd(OutSize, PtrFieldSerializedSize);
+  } else if (f->isBitStorage) {
+    OutSize = getFieldAllocSize(f, Self, builder);
+    builder.CreateMemCpy(builder.CreateStructGEP(Self, f->offset), 0,
+                         CurrentPtr, 0, OutSize);
+  } else if (f->encoding & ir::kEncodingVarint) {
+    llvm::Value *ValPtr = createEntryAlloca(builder.getInt64Ty(), builder);
+    OutSize = builder.CreateCall(getVarintReader(), {CurrentPtr, ValPtr});
+    storeField(f, Self,
+               fromVarint(f, builder.CreateLoad(ValPtr), f->type, builder),
+               builder);
   } else {
     // Just store the data
     llvm::Value *CastedCurrentPtr =
@@ -951,6 +2917,106 @@ bool tyr::pass::LLVMIRGenPass::getDeserializer(const tyr::ir::Field *f) const {
   return true;
 }
 
+bool tyr::pass::LLVMIRGenPass::getValidator(const tyr::ir::Field *f) const {
+  // Same fields as the deserializer
+  if (f->isCount || f->storageField != nullptr || f->isPending) {
+    return true;
+  }
+
+  const llvm::DataLayout &DL = m_parent_->getDataLayout();
+  const uint32_t AddrSpace = DL.getProgramAddressSpace();
+
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+
+  std::string Name = getValidatorName(f);
+
+  // This function is meant for internal use only, it checks that the field
+  // in the first arg fits in the number of bytes in the second. It returns
+  // the number of bytes the deserializer will read, or kInvalidSize.
+  llvm::FunctionType *ValidatorType = llvm::FunctionType::get(
+      llvm::Type::getInt64Ty(ctx),
+      {llvm::Type::getInt8PtrTy(ctx, AddrSpace), llvm::Type::getInt64Ty(ctx)},
+      false);
+
+  llvm::Function *Validator = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name, ValidatorType));
+  Validator->addFnAttr(llvm::Attribute::AlwaysInline);
+  Validator->setLinkage(llvm::GlobalValue::PrivateLinkage);
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Validator);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  auto arg_iter = Validator->arg_begin();
+  llvm::Value *InBuf = &*arg_iter;
+  ++arg_iter;
+  llvm::Value *Len = &*arg_iter;
+
+  llvm::Value *Invalid = builder.getInt64(kInvalidSize);
+  llvm::Value *HeaderSize = builder.getInt64(sizeof(uint64_t));
+
+  llvm::Value *OutSize;
+  if (f->isStruct) {
+    // The nested struct checks its own header against what's left
+    std::string FieldValidatorName =
+        "validate_" + std::string(f->type->getStructName());
+    insertCheck(builder.CreateCall(m_parent_->getFunction(FieldValidatorName),
+                                   {InBuf, Len}),
+                Invalid, builder);
+    OutSize = swapBytes(loadLength(InBuf, builder), builder);
+  } else if (f->type->isPointerTy()) {
+    insertCheck(builder.CreateICmpUGE(Len, HeaderSize), Invalid, builder);
+    llvm::Value *Count = swapBytes(loadLength(InBuf, builder), builder);
+    llvm::Value *DataPtr = builder.CreateGEP(InBuf, HeaderSize);
+    llvm::Value *Remaining = builder.CreateSub(Len, HeaderSize);
+
+    // Every check divides rather than multiplies by the count, it's the one
+    // number that can be anything at all
+    llvm::Type *ElementType = f->type->getPointerElementType();
+    const uint64_t EltSize = DL.getTypeAllocSize(ElementType);
+    llvm::Value *DataSize;
+    if (f->encoding & ir::kEncodingBitPacked) {
+      const uint32_t Width = ElementType->getIntegerBitWidth();
+      insertCheck(builder.CreateICmpULE(
+                      Count, builder.CreateUDiv(builder.CreateShl(Remaining, 3),
+                                                builder.getInt64(Width))),
+                  Invalid, builder);
+      DataSize = getBitStreamSize(Count, Width, builder);
+    } else if (f->encoding & ir::kEncodingVarint) {
+      DataSize = builder.CreateCall(getVarintValidator(),
+                                    {DataPtr, Count, Remaining});
+    } else if (f->encoding & ir::kEncodingXor) {
+      DataSize = builder.CreateCall(getXorCoder(ElementType, kCoderValidate),
+                                    {DataPtr, Count, Remaining});
+    } else if (f->encoding & ir::kEncodingDictionary) {
+      // Every element takes at least an index bit (or its full size when the
+      // elements go raw), which also keeps the sizes from wrapping around
+      insertCheck(builder.CreateICmpULE(Count, builder.CreateShl(Remaining, 3)),
+                  Invalid, builder);
+      DataSize = builder.CreateCall(getDictCoder(ElementType, kCoderValidate),
+                                    {DataPtr, Count, Remaining});
+    } else {
+      insertCheck(
+          builder.CreateICmpULE(
+              Count, builder.CreateUDiv(Remaining, builder.getInt64(EltSize))),
+          Invalid, builder);
+      DataSize = builder.CreateMul(Count, builder.getInt64(EltSize));
+    }
+    // The coders hand back kInvalidSize themselves
+    insertCheck(builder.CreateICmpNE(DataSize, Invalid), Invalid, builder);
+    OutSize = builder.CreateAdd(HeaderSize, DataSize);
+  } else if (!f->isBitStorage && (f->encoding & ir::kEncodingVarint)) {
+    OutSize = builder.CreateCall(getVarintValidator(),
+                                 {InBuf, builder.getInt64(1), Len});
+  } else {
+    OutSize = builder.getInt64(DL.getTypeAllocSize(f->type));
+    insertCheck(builder.CreateICmpULE(OutSize, Len), Invalid, builder);
+  }
+
+  builder.CreateRet(OutSize);
+
+  return true;
+}
+
 uint64_t
 tyr::pass::LLVMIRGenPass::getStructAllocSize(const tyr::ir::Struct *s) {
   const llvm::DataLayout &DL = m_parent_->getDataLayout();
@@ -958,6 +3024,10 @@ tyr::pass::LLVMIRGenPass::getStructAllocSize(const tyr::ir::Struct *s) {
 }
 
 bool tyr::pass::LLVMIRGenPass::getConstructor(const tyr::ir::Struct *s) {
+  if (s->isFrozen()) {
+    return getFrozenConstructor(s);
+  }
+
   llvm::ArrayRef<ir::FieldPtr> structFields = s->getFields();
 
   llvm::SmallVector<llvm::Type *, 0> NonMutFields;
@@ -1003,10 +3073,19 @@ bool tyr::pass::LLVMIRGenPass::getConstructor(const tyr::ir::Struct *s) {
   llvm::Value *StructOut =
       builder.CreatePointerCast(StructOutRaw, StructPtrType);
 
+  // Zero the bit storage first, the bit packed fields are inserted into it
+  for (auto &entry : structFields) {
+    if (entry->isBitStorage) {
+      initField(entry.get(), StructOut, nullptr, builder);
+    }
+  }
+
   // Initialize all the fields
   auto ArgIter = Constructor->arg_begin();
   for (auto &entry : structFields) {
-    if (!entry->isMutable) {
+    if (entry->isBitStorage) {
+      continue;
+    } else if (!entry->isMutable) {
       initField(entry.get(), StructOut, &*ArgIter, builder);
       // Only increment the argument iterator if it's not a mutable field
       // otherwise, the field is initialized to zero
@@ -1060,6 +3139,10 @@ bool tyr::pass::LLVMIRGenPass::getDestructor(const tyr::ir::Struct *s) {
 }
 
 bool tyr::pass::LLVMIRGenPass::getSerializer(const tyr::ir::Struct *s) {
+  if (s->isFrozen()) {
+    return getFrozenSerializer(s);
+  }
+
   llvm::ArrayRef<ir::FieldPtr> structFields = s->getFields();
   llvm::LLVMContext &ctx = m_parent_->getContext();
 
@@ -1085,8 +3168,10 @@ bool tyr::pass::LLVMIRGenPass::getSerializer(const tyr::ir::Struct *s) {
 
   auto arg_iter = Serializer->arg_begin();
   llvm::Value *Self = &*arg_iter;
-  llvm::cast<llvm::Argument>(Self)->addAttr(
-      llvm::Attribute::AttrKind::ReadOnly);
+  if (!s->isLazy()) {
+    llvm::cast<llvm::Argument>(Self)->addAttr(
+        llvm::Attribute::AttrKind::ReadOnly);
+  }
 
   // Check if the args are null
   llvm::BasicBlock *IsNotNull = insertNullCheck(
@@ -1096,14 +3181,15 @@ bool tyr::pass::LLVMIRGenPass::getSerializer(const tyr::ir::Struct *s) {
   // Not null, we can continue
   builder.SetInsertPoint(IsNotNull);
 
-  // Start out with enough space for an int64
-  llvm::Value *AllocSize = builder.getInt64(sizeof(uint64_t));
-  // add up the output memory
+  // Anything still pending has to be decoded before it can be encoded again
   for (auto &entry : structFields) {
-    AllocSize = builder.CreateAdd(
-        AllocSize, getFieldAllocSize(entry.get(), Self, builder));
+    insertLazyLoad(
+        entry.get(), Self,
+        llvm::ConstantPointerNull::get(builder.getInt8PtrTy(AddrSpace)),
+        builder);
   }
 
+  llvm::Value *AllocSize = getStructSerializedSize(s, Self, builder);
   llvm::Value *AllocdMem = builder.CreateCall(
       m_parent_->getFunction(m_builtin_names_.lookup("malloc")), AllocSize);
 
@@ -1113,49 +3199,439 @@ bool tyr::pass::LLVMIRGenPass::getSerializer(const tyr::ir::Struct *s) {
       Serializer);
   builder.SetInsertPoint(MallocSucceeded);
 
+  writeStruct(s, Self, AllocSize, AllocdMem, builder);
+  builder.CreateRet(AllocdMem);
+
+  return true;
+}
+
+llvm::Value *tyr::pass::LLVMIRGenPass::getStructSerializedSize(
+    const tyr::ir::Struct *s, llvm::Value *Self,
+    llvm::IRBuilder<> &builder) const {
+  if (s->isFrozen()) {
+    // A frozen struct starts with its size
+    return builder.CreateLoad(
+        builder.CreateStructGEP(Self, getSizeHeader(s)->offset));
+  }
+
+  // Start out with enough space for an int64 and the offset table
+  llvm::Value *Size =
+      builder.getInt64(sizeof(uint64_t) + getOffsetTableSize(s));
+  // add up the output memory
+  for (auto &entry : s->getFields()) {
+    Size = builder.CreateAdd(
+        Size, getFieldSerializedSize(entry.get(), Self, builder));
+  }
+  return Size;
+}
+
+void tyr::pass::LLVMIRGenPass::writeStruct(const tyr::ir::Struct *s,
+                                           llvm::Value *Self,
+                                           llvm::Value *Size,
+                                           llvm::Value *Out,
+                                           llvm::IRBuilder<> &builder) const {
+  if (s->isFrozen()) {
+    // The struct already is its serialized form
+    builder.CreateMemCpy(Out, 0, Self, sizeof(uint64_t), Size);
+    return;
+  }
+
   // Store the total size of the struct, swap the bytes in the total size if
   // necessary
-  builder.CreateStore(
-      swapBytes(AllocSize, builder),
-      builder.CreateBitCast(AllocdMem,
-                            builder.getInt64Ty()->getPointerTo(AddrSpace)));
+  storeLength(swapBytes(Size, builder), Out, builder);
+
+  llvm::Value *CurrentIDX =
+      builder.getInt64(sizeof(uint64_t) + getOffsetTableSize(s));
+  uint64_t TableIDX = sizeof(uint64_t);
+  for (auto &entry : s->getFields()) {
+    // count fields are handled already, bit packed ones by their storage
+    if (!isOnWire(entry.get())) {
+      continue;
+    }
+    if (s->isIndexed()) {
+      storeLength(swapBytes(CurrentIDX, builder),
+                  builder.CreateGEP(Out, builder.getInt64(TableIDX)), builder);
+      TableIDX += sizeof(uint64_t);
+    }
+    llvm::Function *EntrySerializer =
+        m_parent_->getFunction(getSerializerName(entry.get()));
+    llvm::Value *CurrentPtr = builder.CreateGEP(Out, CurrentIDX);
+    llvm::Value *OutSize =
+        builder.CreateCall(EntrySerializer, {Self, CurrentPtr});
+    CurrentIDX = builder.CreateAdd(CurrentIDX, OutSize);
+  }
+}
+
+bool tyr::pass::LLVMIRGenPass::getBase64Serializer(const tyr::ir::Struct *s) {
+  // Only generated when the base64 runtime has been linked in
+  llvm::Function *StreamInit = m_parent_->getFunction("tyr_b64_stream_init");
+  llvm::Function *StreamUpdate =
+      m_parent_->getFunction("tyr_b64_stream_update");
+  llvm::Function *StreamFinish =
+      m_parent_->getFunction("tyr_b64_stream_finish");
+  if (StreamInit == nullptr || StreamUpdate == nullptr ||
+      StreamFinish == nullptr) {
+    return true;
+  }
+
+  llvm::ArrayRef<ir::FieldPtr> structFields = s->getFields();
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+
+  const uint32_t AddrSpace =
+      m_parent_->getDataLayout().getProgramAddressSpace();
+
+  llvm::Twine Name = "serialize_" + s->getName() + "_base64_into";
+
+  llvm::StructType *GenStructType = s->getType();
+  llvm::Type *StructPtrType = GenStructType->getPointerTo(AddrSpace);
+
+  // Returns the encoded length, and only writes the output if it fits in cap
+  llvm::FunctionType *SerializerType = llvm::FunctionType::get(
+      llvm::Type::getInt64Ty(ctx),
+      {StructPtrType, llvm::Type::getInt8PtrTy(ctx, AddrSpace),
+       llvm::Type::getInt64Ty(ctx)},
+      false);
+
+  llvm::Function *Serializer = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name.str(), SerializerType));
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Serializer);
+  llvm::IRBuilder<> builder(EntryBlock);
 
-  llvm::Value *CurrentIDX = builder.getInt64(sizeof(uint64_t));
+  auto arg_iter = Serializer->arg_begin();
+  llvm::Value *Self = &*arg_iter++;
+  if (!s->isLazy()) {
+    llvm::cast<llvm::Argument>(Self)->addAttr(
+        llvm::Attribute::AttrKind::ReadOnly);
+  }
+  llvm::Value *Buf = &*arg_iter++;
+  llvm::Value *Cap = &*arg_iter;
+
+  llvm::Type *StreamType =
+      StreamInit->getFunctionType()->getParamType(0)->getPointerElementType();
+  llvm::Value *Stream = builder.CreateAlloca(StreamType);
+
+  llvm::BasicBlock *IsNotNull =
+      insertNullCheck({Self}, builder.getInt64(0), builder, Serializer);
+  builder.SetInsertPoint(IsNotNull);
+
+  for (auto &entry : structFields) {
+    insertLazyLoad(entry.get(), Self, builder.getInt64(0), builder);
+  }
+
+  // The size header isn't part of the text, but it is counted in the encoded
+  // length (its place is taken by 8 zero bytes at the end, which is what the
+  // runtime decoder expects)
+  const uint64_t TableSize = getOffsetTableSize(s);
+  llvm::Value *SerializedSize = builder.getInt64(sizeof(uint64_t) + TableSize);
+  llvm::DenseMap<const ir::Field *, llvm::Value *> FieldSizes;
+  if (s->isFrozen()) {
+    // which a frozen struct already starts with
+    SerializedSize = builder.CreateLoad(
+        builder.CreateStructGEP(Self, getSizeHeader(s)->offset));
+  } else {
+    for (auto &entry : structFields) {
+      llvm::Value *FieldSize =
+          getFieldSerializedSize(entry.get(), Self, builder);
+      FieldSizes[entry.get()] = FieldSize;
+      SerializedSize = builder.CreateAdd(SerializedSize, FieldSize);
+    }
+  }
+  llvm::Value *EncodedSize = builder.CreateMul(
+      builder.CreateUDiv(builder.CreateAdd(SerializedSize, builder.getInt64(2)),
+                         builder.getInt64(3)),
+      builder.getInt64(4));
+
+  llvm::BasicBlock *Fits = llvm::BasicBlock::Create(ctx, "", Serializer);
+  llvm::BasicBlock *TooSmall = llvm::BasicBlock::Create(ctx, "", Serializer);
+  builder.CreateCondBr(
+      builder.CreateAnd(builder.CreateIsNotNull(Buf),
+                        builder.CreateICmpUGE(Cap, EncodedSize)),
+      Fits, TooSmall);
+
+  builder.SetInsertPoint(TooSmall);
+  builder.CreateRet(EncodedSize);
+
+  // Each field is serialized into the back of the output buffer and encoded
+  // straight away. Starting the raw bytes at EncodedSize - SerializedSize
+  // keeps them ahead of the text the stream writes.
+  builder.SetInsertPoint(Fits);
+  builder.CreateCall(StreamInit, {Stream, Buf, EncodedSize});
+
+  llvm::Value *CurrentIDX = builder.CreateSub(EncodedSize, SerializedSize);
+  if (s->isFrozen()) {
+    // Everything after the size goes out as it is
+    llvm::Value *HeaderSize = builder.getInt64(sizeof(uint64_t));
+    builder.CreateCall(
+        StreamUpdate,
+        {Stream,
+         builder.CreateGEP(
+             builder.CreateBitCast(Self, builder.getInt8PtrTy(AddrSpace)),
+             HeaderSize),
+         builder.CreateSub(SerializedSize, HeaderSize)});
+    CurrentIDX = builder.CreateSub(EncodedSize, HeaderSize);
+  }
+  if (s->isIndexed()) {
+    // The offsets go out ahead of the fields, so they have to come from the
+    // sizes added up above rather than from what the serializers return
+    llvm::Value *Offset = builder.getInt64(sizeof(uint64_t) + TableSize);
+    llvm::Value *TableIDX = CurrentIDX;
+    for (auto &entry : structFields) {
+      if (!isOnWire(entry.get())) {
+        continue;
+      }
+      storeLength(swapBytes(Offset, builder), builder.CreateGEP(Buf, TableIDX),
+                  builder);
+      TableIDX =
+          builder.CreateAdd(TableIDX, builder.getInt64(sizeof(uint64_t)));
+      Offset = builder.CreateAdd(Offset, FieldSizes[entry.get()]);
+      if (entry->isRepeated) {
+        Offset = builder.CreateAdd(Offset, FieldSizes[entry->countField]);
+      }
+    }
+    builder.CreateCall(StreamUpdate,
+                       {Stream, builder.CreateGEP(Buf, CurrentIDX),
+                        builder.getInt64(TableSize)});
+    CurrentIDX = TableIDX;
+  }
   for (auto &entry : structFields) {
-    if (entry->isCount) { // count fields are handled already
+    // count fields are handled already, bit packed ones by their storage and
+    // frozen ones went out with the struct
+    if (!isOnWire(entry.get()) || entry->isFrozen) {
       continue;
     }
     llvm::Function *EntrySerializer =
         m_parent_->getFunction(getSerializerName(entry.get()));
-    llvm::Value *CurrentPtr = builder.CreateGEP(AllocdMem, CurrentIDX);
+    llvm::Value *CurrentPtr = builder.CreateGEP(Buf, CurrentIDX);
     llvm::Value *OutSize =
         builder.CreateCall(EntrySerializer, {Self, CurrentPtr});
+    builder.CreateCall(StreamUpdate, {Stream, CurrentPtr, OutSize});
     CurrentIDX = builder.CreateAdd(CurrentIDX, OutSize);
   }
 
-  builder.CreateRet(AllocdMem);
+  llvm::Value *Tail = builder.CreateGEP(Buf, CurrentIDX);
+  builder.CreateMemSet(Tail, builder.getInt8(0), sizeof(uint64_t), 1);
+  builder.CreateCall(StreamUpdate,
+                     {Stream, Tail, builder.getInt64(sizeof(uint64_t))});
+  builder.CreateCall(StreamFinish, {Stream});
+
+  builder.CreateRet(EncodedSize);
+
+  return true;
+}
+
+bool tyr::pass::LLVMIRGenPass::getFdSerializer(const tyr::ir::Struct *s) {
+  // Only generated when the file helpers have been linked in
+  llvm::Function *WriterInit = m_parent_->getFunction("tyr_fd_writer_init");
+  llvm::Function *WriterStage = m_parent_->getFunction("tyr_fd_writer_stage");
+  llvm::Function *WriterDirect =
+      m_parent_->getFunction("tyr_fd_writer_direct");
+  llvm::Function *WriterFinish =
+      m_parent_->getFunction("tyr_fd_writer_finish");
+  if (WriterInit == nullptr || WriterStage == nullptr ||
+      WriterDirect == nullptr || WriterFinish == nullptr) {
+    return true;
+  }
+
+  llvm::ArrayRef<ir::FieldPtr> structFields = s->getFields();
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+  const llvm::DataLayout &DL = m_parent_->getDataLayout();
+  const uint32_t AddrSpace = DL.getProgramAddressSpace();
+
+  llvm::Twine Name = "serialize_" + s->getName() + "_to_fd";
+
+  llvm::StructType *GenStructType = s->getType();
+  llvm::Type *StructPtrType = GenStructType->getPointerTo(AddrSpace);
+
+  // Returns whether the whole struct was written
+  llvm::FunctionType *SerializerType = llvm::FunctionType::get(
+      llvm::Type::getInt1Ty(ctx), {StructPtrType, llvm::Type::getInt32Ty(ctx)},
+      false);
+
+  llvm::Function *Serializer = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name.str(), SerializerType));
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Serializer);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  auto arg_iter = Serializer->arg_begin();
+  llvm::Value *Self = &*arg_iter++;
+  if (!s->isLazy()) {
+    llvm::cast<llvm::Argument>(Self)->addAttr(
+        llvm::Attribute::AttrKind::ReadOnly);
+  }
+  llvm::Value *Fd = &*arg_iter;
+
+  llvm::Type *WriterType =
+      WriterInit->getFunctionType()->getParamType(0)->getPointerElementType();
+  llvm::Value *Writer = createEntryAlloca(WriterType, builder);
+
+  llvm::BasicBlock *IsNotNull =
+      insertNullCheck({Self}, builder.getFalse(), builder, Serializer);
+  builder.SetInsertPoint(IsNotNull);
+
+  for (auto &entry : structFields) {
+    insertLazyLoad(entry.get(), Self, builder.getFalse(), builder);
+  }
+
+  builder.CreateCall(WriterInit, {Writer, Fd});
+
+  // Once the writer fails it has already let go of everything, so bailing out
+  // is all there is to do
+  auto Stage = [&](llvm::Value *Len) {
+    llvm::Value *Staged = builder.CreateCall(WriterStage, {Writer, Len});
+    insertCheck(builder.CreateIsNotNull(Staged), builder.getFalse(), builder);
+    return Staged;
+  };
+
+  if (s->isFrozen()) {
+    // The struct already is its serialized form
+    llvm::Value *Size = builder.CreateLoad(
+        builder.CreateStructGEP(Self, getSizeHeader(s)->offset));
+    llvm::Value *Raw =
+        builder.CreateBitCast(Self, builder.getInt8PtrTy(AddrSpace));
+    insertCheck(builder.CreateCall(WriterDirect, {Writer, Raw, Size}),
+                builder.getFalse(), builder);
+    builder.CreateRet(builder.CreateCall(WriterFinish, {Writer}));
+    return true;
+  }
+
+  // The size and the offset table go first, so every field's size is needed
+  // up front
+  const uint64_t TableSize = getOffsetTableSize(s);
+  llvm::Value *SerializedSize = builder.getInt64(sizeof(uint64_t) + TableSize);
+  llvm::DenseMap<const ir::Field *, llvm::Value *> FieldSizes;
+  for (auto &entry : structFields) {
+    llvm::Value *FieldSize = getFieldSerializedSize(entry.get(), Self, builder);
+    FieldSizes[entry.get()] = FieldSize;
+    SerializedSize = builder.CreateAdd(SerializedSize, FieldSize);
+  }
+
+  llvm::Value *Header =
+      Stage(builder.getInt64(sizeof(uint64_t) + TableSize));
+  storeLength(swapBytes(SerializedSize, builder), Header, builder);
+  if (s->isIndexed()) {
+    llvm::Value *Offset = builder.getInt64(sizeof(uint64_t) + TableSize);
+    uint64_t TableIDX = sizeof(uint64_t);
+    for (auto &entry : structFields) {
+      if (!isOnWire(entry.get())) {
+        continue;
+      }
+      storeLength(swapBytes(Offset, builder),
+                  builder.CreateGEP(Header, builder.getInt64(TableIDX)),
+                  builder);
+      TableIDX += sizeof(uint64_t);
+      Offset = builder.CreateAdd(Offset, FieldSizes[entry.get()]);
+      if (entry->isRepeated) {
+        Offset = builder.CreateAdd(Offset, FieldSizes[entry->countField]);
+      }
+    }
+  }
+
+  const uint32_t kCopyEncodings = ir::kEncodingBitPacked |
+                                  ir::kEncodingVarint | ir::kEncodingXor |
+                                  ir::kEncodingDictionary;
+  for (auto &entry : structFields) {
+    const ir::Field *f = entry.get();
+    if (!isOnWire(f)) {
+      continue;
+    }
+
+    if (!f->isRepeated || (f->encoding & kCopyEncodings)) {
+      // Anything encoded is written into the staging buffer by its serializer
+      llvm::Value *FieldSize = FieldSizes[f];
+      if (f->isRepeated) {
+        FieldSize = builder.CreateAdd(FieldSize, FieldSizes[f->countField]);
+      }
+      builder.CreateCall(m_parent_->getFunction(getSerializerName(f)),
+                         {Self, Stage(FieldSize)});
+      continue;
+    }
+
+    llvm::Value *Count = builder.CreateLoad(
+        builder.CreateStructGEP(Self, f->countField->offset));
+    llvm::Value *CountOut = builder.CreateBitCast(
+        Stage(FieldSizes[f->countField]),
+        f->countField->type->getPointerTo(AddrSpace));
+    builder.CreateStore(swapBytes(Count, builder), CountOut);
+
+    llvm::Value *FieldData =
+        builder.CreateLoad(builder.CreateStructGEP(Self, f->offset));
+    const bool Delta = f->encoding & ir::kEncodingDelta;
+    if (DL.isLittleEndian() && !Delta) {
+      // Already in wire order, so it goes out straight from the struct
+      insertCheck(
+          builder.CreateCall(
+              WriterDirect,
+              {Writer,
+               builder.CreateBitCast(FieldData,
+                                     builder.getInt8PtrTy(AddrSpace)),
+               FieldSizes[f]}),
+          builder.getFalse(), builder);
+      continue;
+    }
+
+    // Otherwise it's swapped (or delta encoded) a staging buffer at a time
+    llvm::Type *ElementType = f->type->getPointerElementType();
+    const uint64_t EltSize = DL.getTypeAllocSize(ElementType);
+    const uint64_t ChunkItems = kFdChunkSize / EltSize;
+    llvm::Value *NumChunks = builder.CreateUDiv(
+        builder.CreateAdd(Count, builder.getInt64(ChunkItems - 1)),
+        builder.getInt64(ChunkItems));
+    emitLoop(NumChunks, builder, [&](llvm::Value *Chunk) {
+      llvm::Value *Lo = builder.CreateMul(Chunk, builder.getInt64(ChunkItems));
+      llvm::Value *Hi = createUMin(
+          builder.CreateAdd(Lo, builder.getInt64(ChunkItems)), Count, builder);
+      llvm::Value *NumItems = builder.CreateSub(Hi, Lo);
+      llvm::Value *ChunkOut = builder.CreateBitCast(
+          Stage(builder.CreateMul(NumItems, builder.getInt64(EltSize))),
+          f->type);
+      emitLoop(NumItems, builder, [&](llvm::Value *i) {
+        builder.CreateStore(
+            loadWireElement(FieldData, builder.CreateAdd(Lo, i), Delta,
+                            builder),
+            builder.CreateGEP(ChunkOut, i));
+      });
+      swapArrayBytes(ChunkOut, NumItems, builder);
+    });
+  }
+
+  builder.CreateRet(builder.CreateCall(WriterFinish, {Writer}));
 
   return true;
 }
 
-bool tyr::pass::LLVMIRGenPass::getDeserializer(const tyr::ir::Struct *s) {
+bool tyr::pass::LLVMIRGenPass::getDeserializer(const tyr::ir::Struct *s,
+                                               bool Projected) {
+  if (s->isFrozen()) {
+    return getFrozenDeserializer(s, Projected);
+  }
+
   llvm::ArrayRef<ir::FieldPtr> structFields = s->getFields();
   llvm::LLVMContext &ctx = m_parent_->getContext();
 
   const uint32_t AddrSpace =
       m_parent_->getDataLayout().getProgramAddressSpace();
 
-  llvm::Twine Name = "deserialize_" + s->getName();
+  const std::string Name =
+      ("deserialize_" + s->getName() + (Projected ? "_fields" : "")).str();
 
   llvm::StructType *GenStructType = s->getType();
   llvm::PointerType *StructPtrType = GenStructType->getPointerTo(AddrSpace);
 
-  // constructor has parameters for all of the non-mutable fields
-  llvm::FunctionType *DeserializerType = llvm::FunctionType::get(
-      StructPtrType, {llvm::Type::getInt8PtrTy(ctx, AddrSpace)}, false);
+  // The projected version also takes the length of the buffer and a mask of
+  // the fields to read
+  llvm::SmallVector<llvm::Type *, 3> ArgTypes = {
+      llvm::Type::getInt8PtrTy(ctx, AddrSpace)};
+  if (Projected) {
+    ArgTypes.push_back(llvm::Type::getInt64Ty(ctx));
+    ArgTypes.push_back(llvm::Type::getInt64Ty(ctx));
+  }
+  llvm::FunctionType *DeserializerType =
+      llvm::FunctionType::get(StructPtrType, ArgTypes, false);
 
   llvm::Function *Deserializer = llvm::cast<llvm::Function>(
-      m_parent_->getOrInsertFunction(Name.str(), DeserializerType));
+      m_parent_->getOrInsertFunction(Name, DeserializerType));
   Deserializer->addFnAttr(llvm::Attribute::InlineHint);
 
   llvm::BasicBlock *EntryBlock =
@@ -1167,12 +3643,11 @@ bool tyr::pass::LLVMIRGenPass::getDeserializer(const tyr::ir::Struct *s) {
   llvm::Value *SerializedSelf = &*arg_iter;
   llvm::cast<llvm::Argument>(SerializedSelf)
       ->addAttr(llvm::Attribute::AttrKind::ReadOnly);
-
-  // Swap the bytes in the total size if necessary
-  llvm::Value *SerializedSize = swapBytes(
-      builder.CreateLoad(builder.CreateBitCast(
-          SerializedSelf, builder.getInt64Ty()->getPointerTo(AddrSpace))),
-      builder);
+  llvm::Value *Len = nullptr, *Mask = nullptr;
+  if (Projected) {
+    Len = &*++arg_iter;
+    Mask = &*++arg_iter;
+  }
 
   // Check if the args are invalid
   llvm::BasicBlock *IsNotNull = insertNullCheck(
@@ -1181,6 +3656,21 @@ bool tyr::pass::LLVMIRGenPass::getDeserializer(const tyr::ir::Struct *s) {
 
   builder.SetInsertPoint(IsNotNull);
 
+  if (Projected) {
+    // Skipping a field follows the lengths inside of it, so the whole buffer
+    // is checked up front the same as for deserialize_<name>_n
+    insertCheck(builder.CreateCall(
+                    m_parent_->getFunction("validate_" + s->getName().str()),
+                    {SerializedSelf, Len}),
+                llvm::ConstantPointerNull::get(StructPtrType), builder);
+  }
+
+  // Swap the bytes in the total size if necessary
+  llvm::Value *SerializedSize = swapBytes(
+      builder.CreateLoad(builder.CreateBitCast(
+          SerializedSelf, builder.getInt64Ty()->getPointerTo(AddrSpace))),
+      builder);
+
   // allocate a new thing
   const llvm::DataLayout &DL = m_parent_->getDataLayout();
   llvm::Value *StructAllocSize =
@@ -1198,29 +3688,119 @@ bool tyr::pass::LLVMIRGenPass::getDeserializer(const tyr::ir::Struct *s) {
   builder.SetInsertPoint(MallocSucceeded);
   llvm::Value *StructOut =
       builder.CreatePointerCast(StructOutRaw, StructPtrType);
+  // Zeroed so that whatever we've read so far can be freed if it goes wrong
+  builder.CreateMemSet(StructOutRaw, builder.getInt8(0), StructAllocSize, 0);
+
+  llvm::BasicBlock *Failed = llvm::BasicBlock::Create(ctx, "", Deserializer);
 
   // Now set all the fields
-  // We start at 8 because we already loaded the serialized size
-  llvm::Value *CurrentIDX = builder.getInt64(sizeof(uint64_t));
+  // We start after the serialized size (and offset table) we already loaded
+  const uint64_t HeaderSize = sizeof(uint64_t) + getOffsetTableSize(s);
+  llvm::Value *CurrentIDX = builder.getInt64(HeaderSize);
+  uint64_t TableIDX = sizeof(uint64_t);
   for (auto &entry : structFields) {
-    if (entry->isCount) { // count fields are handled already
+    // count fields are handled already, bit packed ones by their storage
+    if (!isOnWire(entry.get())) {
       continue;
     }
-    llvm::Function *EntryDeserializer =
-        m_parent_->getFunction(getDeserializerName(entry.get()));
-    llvm::Value *OutSize = builder.CreateCall(
-        EntryDeserializer,
-        {StructOut, builder.CreateGEP(SerializedSelf, CurrentIDX)});
-    CurrentIDX = builder.CreateAdd(CurrentIDX, OutSize);
+    llvm::Value *CurrentPtr = builder.CreateGEP(SerializedSelf, CurrentIDX);
+
+    // In an indexed struct the next offset says where this field ends, so
+    // nothing has to be walked to step over it
+    llvm::Value *EndIDX = nullptr;
+    if (s->isIndexed()) {
+      TableIDX += sizeof(uint64_t);
+      EndIDX = TableIDX < HeaderSize
+                   ? swapBytes(loadLength(builder.CreateGEP(
+                                              SerializedSelf,
+                                              builder.getInt64(TableIDX)),
+                                          builder),
+                               builder)
+                   : SerializedSize;
+    }
+
+    // Fields that weren't asked for are stepped over and left empty
+    const uint64_t FieldMask = Projected ? s->getFieldMask(entry.get()) : 0;
+    llvm::BasicBlock *SkipBlock = nullptr, *JoinBlock = nullptr;
+    llvm::Value *SkipSize = nullptr;
+    if (FieldMask != 0) {
+      llvm::BasicBlock *ReadBlock =
+          llvm::BasicBlock::Create(ctx, "", Deserializer);
+      SkipBlock = llvm::BasicBlock::Create(ctx, "", Deserializer);
+      JoinBlock = llvm::BasicBlock::Create(ctx, "", Deserializer);
+      builder.CreateCondBr(
+          builder.CreateICmpNE(
+              builder.CreateAnd(Mask, builder.getInt64(FieldMask)),
+              builder.getInt64(0)),
+          ReadBlock, SkipBlock);
+
+      builder.SetInsertPoint(SkipBlock);
+      if (!s->isIndexed()) {
+        SkipSize = builder.CreateCall(getSkipper(entry.get()), {CurrentPtr});
+      }
+      builder.CreateBr(JoinBlock);
+
+      builder.SetInsertPoint(ReadBlock);
+    }
+
+    llvm::Value *OutSize;
+    if (entry->pendingField != nullptr) {
+      // Only the count is read now, the rest waits for the first access
+      builder.CreateStore(
+          swapBytes(loadLength(CurrentPtr, builder), builder),
+          builder.CreateStructGEP(StructOut, entry->countField->offset));
+      builder.CreateStore(
+          CurrentPtr,
+          builder.CreateStructGEP(StructOut, entry->pendingField->offset));
+      OutSize = s->isIndexed()
+                    ? builder.CreateSub(EndIDX, CurrentIDX)
+                    : builder.CreateCall(getSkipper(entry.get()), {CurrentPtr});
+    } else {
+      llvm::Function *EntryDeserializer =
+          m_parent_->getFunction(getDeserializerName(entry.get()));
+      OutSize = builder.CreateCall(EntryDeserializer, {StructOut, CurrentPtr});
+    }
+    // Every field takes up at least a byte, 0 means an allocation failed
+    llvm::Value *ReadFailed =
+        builder.CreateICmpEQ(OutSize, builder.getInt64(0));
+    if (s->isIndexed()) {
+      // and what was read has to line up with the offset table
+      ReadFailed = builder.CreateOr(
+          ReadFailed,
+          builder.CreateICmpNE(builder.CreateAdd(CurrentIDX, OutSize), EndIDX));
+    }
+    llvm::BasicBlock *FieldRead =
+        llvm::BasicBlock::Create(ctx, "", Deserializer);
+    builder.CreateCondBr(ReadFailed, Failed, FieldRead);
+    builder.SetInsertPoint(FieldRead);
+
+    if (FieldMask != 0) {
+      builder.CreateBr(JoinBlock);
+      builder.SetInsertPoint(JoinBlock);
+      if (!s->isIndexed()) {
+        llvm::PHINode *Size = builder.CreatePHI(builder.getInt64Ty(), 2);
+        Size->addIncoming(OutSize, FieldRead);
+        Size->addIncoming(SkipSize, SkipBlock);
+        OutSize = Size;
+      }
+    }
+    CurrentIDX = s->isIndexed() ? EndIDX
+                                : builder.CreateAdd(CurrentIDX, OutSize);
   }
 
   // Check that the size of everything is OK
-  // Start out with enough space for an int64
-  llvm::Value *AllocSize = builder.getInt64(sizeof(uint64_t));
-  // add up the output memory
-  for (auto &entry : structFields) {
-    AllocSize = builder.CreateAdd(
-        AllocSize, getFieldAllocSize(entry.get(), StructOut, builder));
+  // Start out with enough space for an int64 and the offset table
+  llvm::Value *AllocSize = builder.getInt64(HeaderSize);
+  if (s->isLazy() || Projected) {
+    // Pending or skipped fields can't be sized without decoding them, so go
+    // by what was stepped over instead
+    AllocSize = CurrentIDX;
+  } else {
+    // add up the output memory
+    for (auto &entry : structFields) {
+      AllocSize = builder.CreateAdd(
+          AllocSize, getFieldSerializedSize(entry.get(), StructOut, builder));
+    }
   }
 
   // Make sure the serialized size matches (we have to throw it all away
@@ -1228,12 +3808,15 @@ bool tyr::pass::LLVMIRGenPass::getDeserializer(const tyr::ir::Struct *s) {
   llvm::Value *CheckSize = builder.CreateICmpEQ(SerializedSize, AllocSize);
   llvm::BasicBlock *SizeIsRight =
       llvm::BasicBlock::Create(ctx, "", Deserializer);
-  llvm::BasicBlock *SizeIsWrong =
-      llvm::BasicBlock::Create(ctx, "", Deserializer);
-  builder.CreateCondBr(CheckSize, SizeIsRight, SizeIsWrong);
+  builder.CreateCondBr(CheckSize, SizeIsRight, Failed);
 
-  // If it's wrong, return NULL
-  builder.SetInsertPoint(SizeIsWrong);
+  // If it's wrong, clean up and return NULL
+  builder.SetInsertPoint(Failed);
+  for (auto &entry : structFields) {
+    destroyField(entry.get(), StructOut, builder);
+  }
+  builder.CreateCall(m_parent_->getFunction(m_builtin_names_.lookup("free")),
+                     StructOutRaw);
   builder.CreateRet(llvm::ConstantPointerNull::get(StructPtrType));
 
   // We're OK, so return the thing
@@ -1243,6 +3826,1528 @@ bool tyr::pass::LLVMIRGenPass::getDeserializer(const tyr::ir::Struct *s) {
   return true;
 }
 
+bool tyr::pass::LLVMIRGenPass::getValidator(const tyr::ir::Struct *s) {
+  if (s->isFrozen()) {
+    return getFrozenValidator(s);
+  }
+
+  llvm::ArrayRef<ir::FieldPtr> structFields = s->getFields();
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+
+  const uint32_t AddrSpace =
+      m_parent_->getDataLayout().getProgramAddressSpace();
+
+  llvm::Twine Name = "validate_" + s->getName();
+
+  // Takes the buffer and its length, returns whether deserializing it would
+  // stay inside of it
+  llvm::FunctionType *ValidatorType = llvm::FunctionType::get(
+      llvm::Type::getInt1Ty(ctx),
+      {llvm::Type::getInt8PtrTy(ctx, AddrSpace), llvm::Type::getInt64Ty(ctx)},
+      false);
+
+  llvm::Function *Validator = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name.str(), ValidatorType));
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Validator);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  auto arg_iter = Validator->arg_begin();
+  llvm::Value *SerializedSelf = &*arg_iter;
+  llvm::cast<llvm::Argument>(SerializedSelf)
+      ->addAttr(llvm::Attribute::AttrKind::ReadOnly);
+  ++arg_iter;
+  llvm::Value *Len = &*arg_iter;
+
+  llvm::BasicBlock *IsNotNull = insertNullCheck(
+      {SerializedSelf}, builder.getInt1(false), builder, Validator);
+  builder.SetInsertPoint(IsNotNull);
+
+  llvm::Value *Invalid = builder.getInt1(false);
+  const uint64_t TableSize = getOffsetTableSize(s);
+  llvm::Value *HeaderSize = builder.getInt64(sizeof(uint64_t) + TableSize);
+  insertCheck(builder.CreateICmpUGE(Len, HeaderSize), Invalid, builder);
+  insertCheck(
+      builder.CreateICmpULE(Len, builder.getInt64(kMaxValidatedSize)),
+      Invalid, builder);
+
+  // Only what the header claims belongs to this struct, the rest of the
+  // buffer may well be something else
+  llvm::Value *SerializedSize =
+      swapBytes(loadLength(SerializedSelf, builder), builder);
+  insertCheck(builder.CreateAnd(builder.CreateICmpUGE(SerializedSize,
+                                                      HeaderSize),
+                                builder.CreateICmpULE(SerializedSize, Len)),
+              Invalid, builder);
+
+  // Walk the fields in the same order the deserializer reads them
+  llvm::Value *CurrentIDX = HeaderSize;
+  uint64_t TableIDX = sizeof(uint64_t);
+  for (auto &entry : structFields) {
+    if (!isOnWire(entry.get())) {
+      continue;
+    }
+    if (s->isIndexed()) {
+      // Readers trust the offset table to jump around, so it has to agree
+      // with where each field really starts
+      llvm::Value *Offset = swapBytes(
+          loadLength(
+              builder.CreateGEP(SerializedSelf, builder.getInt64(TableIDX)),
+              builder),
+          builder);
+      insertCheck(builder.CreateICmpEQ(Offset, CurrentIDX), Invalid, builder);
+      TableIDX += sizeof(uint64_t);
+    }
+    llvm::Function *EntryValidator =
+        m_parent_->getFunction(getValidatorName(entry.get()));
+    llvm::Value *OutSize = builder.CreateCall(
+        EntryValidator, {builder.CreateGEP(SerializedSelf, CurrentIDX),
+                         builder.CreateSub(SerializedSize, CurrentIDX)});
+    insertCheck(builder.CreateICmpNE(OutSize, builder.getInt64(kInvalidSize)),
+                Invalid, builder);
+    CurrentIDX = builder.CreateAdd(CurrentIDX, OutSize);
+  }
+
+  // Everything has to be accounted for, same as the deserializer's check
+  builder.CreateRet(builder.CreateICmpEQ(CurrentIDX, SerializedSize));
+
+  return true;
+}
+
+bool tyr::pass::LLVMIRGenPass::getBoundedDeserializer(
+    const tyr::ir::Struct *s) {
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+
+  const uint32_t AddrSpace =
+      m_parent_->getDataLayout().getProgramAddressSpace();
+
+  llvm::Twine Name = "deserialize_" + s->getName() + "_n";
+
+  llvm::PointerType *StructPtrType = s->getType()->getPointerTo(AddrSpace);
+
+  llvm::FunctionType *DeserializerType = llvm::FunctionType::get(
+      StructPtrType,
+      {llvm::Type::getInt8PtrTy(ctx, AddrSpace), llvm::Type::getInt64Ty(ctx)},
+      false);
+
+  llvm::Function *Deserializer = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name.str(), DeserializerType));
+
+  llvm::BasicBlock *EntryBlock =
+      llvm::BasicBlock::Create(ctx, "", Deserializer);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  auto arg_iter = Deserializer->arg_begin();
+  llvm::Value *SerializedSelf = &*arg_iter;
+  llvm::cast<llvm::Argument>(SerializedSelf)
+      ->addAttr(llvm::Attribute::AttrKind::ReadOnly);
+  ++arg_iter;
+  llvm::Value *Len = &*arg_iter;
+
+  // Nothing is allocated until the whole buffer checks out
+  insertCheck(builder.CreateCall(
+                  m_parent_->getFunction("validate_" + s->getName().str()),
+                  {SerializedSelf, Len}),
+              llvm::ConstantPointerNull::get(StructPtrType), builder);
+  builder.CreateRet(builder.CreateCall(
+      m_parent_->getFunction("deserialize_" + s->getName().str()),
+      {SerializedSelf}));
+
+  return true;
+}
+
+bool tyr::pass::LLVMIRGenPass::getDeltaSerializer(const tyr::ir::Struct *s) {
+  llvm::ArrayRef<ir::FieldPtr> structFields = s->getFields();
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+
+  const llvm::DataLayout &DL = m_parent_->getDataLayout();
+  const uint32_t AddrSpace = DL.getProgramAddressSpace();
+
+  llvm::Twine Name = "serialize_" + s->getName() + "_delta";
+
+  llvm::Type *StructPtrType = s->getType()->getPointerTo(AddrSpace);
+  llvm::PointerType *BufType = llvm::Type::getInt8PtrTy(ctx, AddrSpace);
+
+  llvm::FunctionType *SerializerType =
+      llvm::FunctionType::get(BufType, {StructPtrType}, false);
+
+  llvm::Function *Serializer = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name.str(), SerializerType));
+  Serializer->addFnAttr(llvm::Attribute::InlineHint);
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Serializer);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  llvm::Value *Self = &*Serializer->arg_begin();
+  llvm::Value *Null = llvm::ConstantPointerNull::get(BufType);
+  builder.SetInsertPoint(insertNullCheck({Self}, Null, builder, Serializer));
+
+  // Anything still pending has to be decoded before it can be encoded again
+  for (auto &entry : structFields) {
+    insertLazyLoad(entry.get(), Self, Null, builder);
+  }
+
+  const ir::Field *DirtyState = getDirtyState(s);
+  llvm::Value *Mask =
+      builder.CreateLoad(getDirtyWord(DirtyState, Self, 0, builder));
+
+  // Work out what goes out for each field, and how much space that takes.
+  // A field is either sent whole, sent as the range of items that were set,
+  // or not at all.
+  struct DeltaField {
+    const ir::Field *f;
+    llvm::Value *IsWhole;
+    llvm::Value *IsRange;
+    llvm::Value *Lo;
+    llvm::Value *NumItems;
+  };
+  llvm::SmallVector<DeltaField, 8> DeltaFields;
+  llvm::Value *WholeMask = builder.getInt64(0);
+  llvm::Value *RangeMask = builder.getInt64(0);
+  llvm::Value *AllocSize = builder.getInt64(kDeltaHeaderSize);
+  for (auto &entry : structFields) {
+    const ir::Field *f = entry.get();
+    if (!isOnWire(f)) {
+      continue;
+    }
+    DeltaField DF = {f, builder.CreateICmpNE(
+                            builder.CreateAnd(Mask, f->dirtyBit),
+                            builder.getInt64(0)),
+                     builder.getFalse(), nullptr, nullptr};
+    llvm::Value *PartSize = builder.getInt64(0);
+    if (f->isRepeated) {
+      llvm::Value *Lo = builder.CreateLoad(
+          getDirtyWord(DirtyState, Self, f->dirtyRange, builder));
+      llvm::Value *Hi = builder.CreateLoad(
+          getDirtyWord(DirtyState, Self, f->dirtyRange + 1, builder));
+      llvm::Value *Count = builder.CreateLoad(
+          builder.CreateStructGEP(Self, f->countField->offset));
+      llvm::Value *IsSet = builder.CreateICmpULT(Lo, Hi);
+      // The array may have been replaced by apply_<name>_delta since, in
+      // which case the range can't be trusted and the whole thing goes
+      DF.IsWhole = builder.CreateOr(
+          DF.IsWhole,
+          builder.CreateAnd(IsSet, builder.CreateICmpUGT(Hi, Count)));
+      DF.IsRange = builder.CreateAnd(IsSet, builder.CreateNot(DF.IsWhole));
+      DF.Lo = Lo;
+      DF.NumItems = builder.CreateSub(Hi, Lo);
+      const uint64_t EltSize =
+          DL.getTypeAllocSize(f->type->getPointerElementType());
+      PartSize = builder.CreateSelect(
+          DF.IsRange,
+          builder.CreateAdd(
+              builder.getInt64(2 * sizeof(uint64_t)),
+              builder.CreateMul(DF.NumItems, builder.getInt64(EltSize))),
+          builder.getInt64(0));
+      RangeMask = builder.CreateOr(
+          RangeMask, builder.CreateSelect(DF.IsRange,
+                                          builder.getInt64(f->dirtyBit),
+                                          builder.getInt64(0)));
+    }
+    WholeMask = builder.CreateOr(
+        WholeMask, builder.CreateSelect(DF.IsWhole,
+                                        builder.getInt64(f->dirtyBit),
+                                        builder.getInt64(0)));
+
+    // Only size up the whole field if it's going, nested structs have to be
+    // serialized to find out
+    llvm::BasicBlock *PartBlock = builder.GetInsertBlock();
+    llvm::BasicBlock *WholeBlock =
+        llvm::BasicBlock::Create(ctx, "", Serializer);
+    llvm::BasicBlock *SizedBlock =
+        llvm::BasicBlock::Create(ctx, "", Serializer);
+    builder.CreateCondBr(DF.IsWhole, WholeBlock, SizedBlock);
+
+    builder.SetInsertPoint(WholeBlock);
+    llvm::Value *WholeSize;
+    if (f->isStruct) {
+      const std::string NestedName =
+          f->type->getPointerElementType()->getStructName().str();
+      llvm::Function *FieldSerializer =
+          llvm::cast<llvm::Function>(m_parent_->getOrInsertFunction(
+              "serialize_" + NestedName,
+              llvm::FunctionType::get(BufType, {f->type}, false)));
+      llvm::Value *SerializedField =
+          builder.CreateCall(FieldSerializer, {loadField(f, Self, builder)});
+      builder.SetInsertPoint(
+          insertNullCheck({SerializedField}, Null, builder, Serializer));
+      WholeSize = swapBytes(loadLength(SerializedField, builder), builder);
+      builder.CreateCall(
+          m_parent_->getFunction(m_builtin_names_.lookup("free")),
+          {SerializedField});
+    } else {
+      WholeSize = getFieldSerializedSize(f, Self, builder);
+      if (f->isRepeated) {
+        WholeSize = builder.CreateAdd(
+            WholeSize, getFieldSerializedSize(f->countField, Self, builder));
+      }
+    }
+    llvm::BasicBlock *WholeEnd = builder.GetInsertBlock();
+    builder.CreateBr(SizedBlock);
+
+    builder.SetInsertPoint(SizedBlock);
+    llvm::PHINode *FieldSize = builder.CreatePHI(builder.getInt64Ty(), 2);
+    FieldSize->addIncoming(PartSize, PartBlock);
+    FieldSize->addIncoming(WholeSize, WholeEnd);
+    AllocSize = builder.CreateAdd(AllocSize, FieldSize);
+
+    DeltaFields.push_back(DF);
+  }
+
+  llvm::Value *AllocdMem = builder.CreateCall(
+      m_parent_->getFunction(m_builtin_names_.lookup("malloc")), AllocSize);
+  builder.SetInsertPoint(
+      insertNullCheck({AllocdMem}, Null, builder, Serializer));
+
+  // The header is the size and then which fields are whole and which are
+  // ranges
+  storeLength(swapBytes(AllocSize, builder), AllocdMem, builder);
+  storeLength(swapBytes(WholeMask, builder),
+              builder.CreateGEP(AllocdMem, builder.getInt64(8)), builder);
+  storeLength(swapBytes(RangeMask, builder),
+              builder.CreateGEP(AllocdMem, builder.getInt64(16)), builder);
+
+  llvm::Value *IDXPtr = createEntryAlloca(builder.getInt64Ty(), builder);
+  builder.CreateStore(builder.getInt64(kDeltaHeaderSize), IDXPtr);
+  for (const DeltaField &DF : DeltaFields) {
+    llvm::BasicBlock *WholeBlock =
+        llvm::BasicBlock::Create(ctx, "", Serializer);
+    llvm::BasicBlock *RangeBlock =
+        llvm::BasicBlock::Create(ctx, "", Serializer);
+    llvm::BasicBlock *NextBlock = llvm::BasicBlock::Create(ctx, "", Serializer);
+    llvm::BasicBlock *NotWholeBlock =
+        llvm::BasicBlock::Create(ctx, "", Serializer);
+    builder.CreateCondBr(DF.IsWhole, WholeBlock, NotWholeBlock);
+    builder.SetInsertPoint(NotWholeBlock);
+    builder.CreateCondBr(DF.IsRange, RangeBlock, NextBlock);
+
+    // The whole field, exactly as serialize_<name> would write it
+    builder.SetInsertPoint(WholeBlock);
+    llvm::Value *CurrentIDX = builder.CreateLoad(IDXPtr);
+    llvm::Value *OutSize =
+        builder.CreateCall(m_parent_->getFunction(getSerializerName(DF.f)),
+                           {Self, builder.CreateGEP(AllocdMem, CurrentIDX)});
+    builder.CreateStore(builder.CreateAdd(CurrentIDX, OutSize), IDXPtr);
+    builder.CreateBr(NextBlock);
+
+    // Or the first index and number of items, followed by the items
+    builder.SetInsertPoint(RangeBlock);
+    if (DF.f->isRepeated) {
+      CurrentIDX = builder.CreateLoad(IDXPtr);
+      llvm::Value *CurrentPtr = builder.CreateGEP(AllocdMem, CurrentIDX);
+      storeLength(swapBytes(DF.Lo, builder), CurrentPtr, builder);
+      storeLength(swapBytes(DF.NumItems, builder),
+                  builder.CreateGEP(CurrentPtr, builder.getInt64(8)), builder);
+      llvm::Value *ItemsPtr =
+          builder.CreateGEP(CurrentPtr, builder.getInt64(16));
+      llvm::Value *ItemsSize = builder.CreateMul(
+          DF.NumItems, builder.getInt64(DL.getTypeAllocSize(
+                           DF.f->type->getPointerElementType())));
+      builder.CreateMemCpy(
+          ItemsPtr, 0,
+          builder.CreateGEP(loadField(DF.f, Self, builder), DF.Lo), 0,
+          ItemsSize);
+      swapArrayBytes(builder.CreateBitCast(ItemsPtr, DF.f->type),
+                     DF.NumItems, builder);
+      builder.CreateStore(
+          builder.CreateAdd(
+              CurrentIDX,
+              builder.CreateAdd(builder.getInt64(16), ItemsSize)),
+          IDXPtr);
+    }
+    builder.CreateBr(NextBlock);
+
+    builder.SetInsertPoint(NextBlock);
+  }
+
+  // Whoever gets this is now up to date
+  builder.CreateStore(llvm::ConstantAggregateZero::get(DirtyState->type),
+                      builder.CreateStructGEP(Self, DirtyState->offset));
+  builder.CreateRet(AllocdMem);
+
+  return true;
+}
+
+bool tyr::pass::LLVMIRGenPass::getDeltaApplier(const tyr::ir::Struct *s) {
+  llvm::ArrayRef<ir::FieldPtr> structFields = s->getFields();
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+
+  const llvm::DataLayout &DL = m_parent_->getDataLayout();
+  const uint32_t AddrSpace = DL.getProgramAddressSpace();
+
+  llvm::Twine Name = "apply_" + s->getName() + "_delta";
+
+  llvm::Type *StructPtrType = s->getType()->getPointerTo(AddrSpace);
+  llvm::PointerType *BufType = llvm::Type::getInt8PtrTy(ctx, AddrSpace);
+
+  llvm::FunctionType *ApplierType = llvm::FunctionType::get(
+      llvm::Type::getInt1Ty(ctx),
+      {StructPtrType, BufType, llvm::Type::getInt64Ty(ctx)}, false);
+
+  llvm::Function *Applier = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name.str(), ApplierType));
+  Applier->addFnAttr(llvm::Attribute::InlineHint);
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Applier);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  auto arg_iter = Applier->arg_begin();
+  llvm::Value *Self = &*arg_iter;
+  ++arg_iter;
+  llvm::Value *Delta = &*arg_iter;
+  llvm::cast<llvm::Argument>(Delta)->addAttr(
+      llvm::Attribute::AttrKind::ReadOnly);
+  ++arg_iter;
+  llvm::Value *Len = &*arg_iter;
+
+  llvm::Value *Fail = builder.getFalse();
+  builder.SetInsertPoint(insertNullCheck({Self}, Fail, builder, Applier));
+  builder.SetInsertPoint(insertNullCheck({Delta}, Fail, builder, Applier));
+
+  // The ranges are applied on top of the decoded arrays
+  for (auto &entry : structFields) {
+    insertLazyLoad(entry.get(), Self, Fail, builder);
+  }
+
+  insertCheck(builder.CreateICmpUGE(Len, builder.getInt64(kDeltaHeaderSize)),
+              Fail, builder);
+  llvm::Value *DeltaSize = swapBytes(loadLength(Delta, builder), builder);
+  llvm::Value *WholeMask = swapBytes(
+      loadLength(builder.CreateGEP(Delta, builder.getInt64(8)), builder),
+      builder);
+  llvm::Value *RangeMask = swapBytes(
+      loadLength(builder.CreateGEP(Delta, builder.getInt64(16)), builder),
+      builder);
+  insertCheck(builder.CreateICmpULE(DeltaSize, Len), Fail, builder);
+
+  // Only bits of fields that exist, and ranges of repeated fields that aren't
+  // also being sent whole
+  uint64_t AllBits = 0, RepeatedBits = 0;
+  for (auto &entry : structFields) {
+    if (isOnWire(entry.get())) {
+      AllBits |= entry->dirtyBit;
+      RepeatedBits |= entry->isRepeated ? entry->dirtyBit : 0;
+    }
+  }
+  insertCheck(builder.CreateICmpEQ(builder.CreateAnd(WholeMask, ~AllBits),
+                                   builder.getInt64(0)),
+              Fail, builder);
+  insertCheck(builder.CreateICmpEQ(
+                  builder.CreateAnd(RangeMask, ~RepeatedBits),
+                  builder.getInt64(0)),
+              Fail, builder);
+  insertCheck(builder.CreateICmpEQ(builder.CreateAnd(WholeMask, RangeMask),
+                                   builder.getInt64(0)),
+              Fail, builder);
+
+  // Walks the fields in the delta, calling OnWhole or OnRange for each one
+  // that's in it. Either returns how many bytes the field took up.
+  llvm::Value *IDXPtr = createEntryAlloca(builder.getInt64Ty(), builder);
+  auto walkDelta = [&](const std::function<llvm::Value *(
+                           const ir::Field *, llvm::Value *)> &OnWhole,
+                       const std::function<llvm::Value *(
+                           const ir::Field *, llvm::Value *)> &OnRange) {
+    builder.CreateStore(builder.getInt64(kDeltaHeaderSize), IDXPtr);
+    for (auto &entry : structFields) {
+      const ir::Field *f = entry.get();
+      if (!isOnWire(f)) {
+        continue;
+      }
+      llvm::BasicBlock *WholeBlock = llvm::BasicBlock::Create(ctx, "", Applier);
+      llvm::BasicBlock *NotWholeBlock =
+          llvm::BasicBlock::Create(ctx, "", Applier);
+      llvm::BasicBlock *NextBlock = llvm::BasicBlock::Create(ctx, "", Applier);
+      builder.CreateCondBr(
+          builder.CreateICmpNE(builder.CreateAnd(WholeMask, f->dirtyBit),
+                               builder.getInt64(0)),
+          WholeBlock, NotWholeBlock);
+
+      builder.SetInsertPoint(WholeBlock);
+      llvm::Value *CurrentIDX = builder.CreateLoad(IDXPtr);
+      builder.CreateStore(
+          builder.CreateAdd(CurrentIDX, OnWhole(f, CurrentIDX)), IDXPtr);
+      builder.CreateBr(NextBlock);
+
+      builder.SetInsertPoint(NotWholeBlock);
+      if (f->isRepeated) {
+        llvm::BasicBlock *RangeBlock =
+            llvm::BasicBlock::Create(ctx, "", Applier);
+        builder.CreateCondBr(
+            builder.CreateICmpNE(builder.CreateAnd(RangeMask, f->dirtyBit),
+                                 builder.getInt64(0)),
+            RangeBlock, NextBlock);
+        builder.SetInsertPoint(RangeBlock);
+        CurrentIDX = builder.CreateLoad(IDXPtr);
+        builder.CreateStore(
+            builder.CreateAdd(CurrentIDX, OnRange(f, CurrentIDX)), IDXPtr);
+      }
+      builder.CreateBr(NextBlock);
+
+      builder.SetInsertPoint(NextBlock);
+    }
+  };
+
+  // Check everything first, so that a bad delta leaves the struct as it was
+  llvm::Value *Invalid = builder.getInt64(kInvalidSize);
+  walkDelta(
+      [&](const ir::Field *f, llvm::Value *CurrentIDX) {
+        llvm::Value *FieldSize = builder.CreateCall(
+            m_parent_->getFunction(getValidatorName(f)),
+            {builder.CreateGEP(Delta, CurrentIDX),
+             builder.CreateSub(DeltaSize, CurrentIDX)});
+        insertCheck(builder.CreateICmpNE(FieldSize, Invalid), Fail, builder);
+        return FieldSize;
+      },
+      [&](const ir::Field *f, llvm::Value *CurrentIDX) {
+        llvm::Value *Remaining = builder.CreateSub(DeltaSize, CurrentIDX);
+        insertCheck(
+            builder.CreateICmpUGE(Remaining, builder.getInt64(16)), Fail,
+            builder);
+        llvm::Value *CurrentPtr = builder.CreateGEP(Delta, CurrentIDX);
+        llvm::Value *Lo = swapBytes(loadLength(CurrentPtr, builder), builder);
+        llvm::Value *NumItems = swapBytes(
+            loadLength(builder.CreateGEP(CurrentPtr, builder.getInt64(8)),
+                       builder),
+            builder);
+        llvm::Value *Count = builder.CreateLoad(
+            builder.CreateStructGEP(Self, f->countField->offset));
+        const uint64_t EltSize =
+            DL.getTypeAllocSize(f->type->getPointerElementType());
+        // Divided rather than multiplied, so nothing can wrap around
+        insertCheck(builder.CreateICmpULE(NumItems, Count), Fail, builder);
+        insertCheck(
+            builder.CreateICmpULE(Lo, builder.CreateSub(Count, NumItems)),
+            Fail, builder);
+        insertCheck(
+            builder.CreateICmpULE(
+                NumItems,
+                builder.CreateUDiv(builder.CreateSub(Remaining,
+                                                     builder.getInt64(16)),
+                                   builder.getInt64(EltSize))),
+            Fail, builder);
+        return builder.CreateAdd(
+            builder.getInt64(16),
+            builder.CreateMul(NumItems, builder.getInt64(EltSize)));
+      });
+  insertCheck(builder.CreateICmpEQ(builder.CreateLoad(IDXPtr), DeltaSize),
+              Fail, builder);
+
+  // Then apply it
+  walkDelta(
+      [&](const ir::Field *f, llvm::Value *CurrentIDX) {
+        // The field deserializers expect to fill in an empty field
+        llvm::Value *FieldGEP = builder.CreateStructGEP(Self, f->offset);
+        if (f->isStruct) {
+          const std::string NestedName =
+              f->type->getPointerElementType()->getStructName().str();
+          llvm::Function *FieldDestructor =
+              llvm::cast<llvm::Function>(m_parent_->getOrInsertFunction(
+                  "destroy_" + NestedName,
+                  llvm::FunctionType::get(builder.getVoidTy(), {f->type},
+                                          false)));
+          llvm::Value *Old = builder.CreateLoad(FieldGEP);
+          llvm::BasicBlock *DestroyBlock =
+              llvm::BasicBlock::Create(ctx, "", Applier);
+          llvm::BasicBlock *EmptyBlock =
+              llvm::BasicBlock::Create(ctx, "", Applier);
+          builder.CreateCondBr(builder.CreateIsNull(Old), EmptyBlock,
+                               DestroyBlock);
+          builder.SetInsertPoint(DestroyBlock);
+          builder.CreateCall(FieldDestructor, {Old});
+          builder.CreateBr(EmptyBlock);
+          builder.SetInsertPoint(EmptyBlock);
+        } else if (f->isRepeated) {
+          builder.CreateCall(
+              m_parent_->getFunction(m_builtin_names_.lookup("free")),
+              builder.CreateBitCast(builder.CreateLoad(FieldGEP), BufType));
+        }
+        if (f->isStruct || f->isRepeated) {
+          builder.CreateStore(
+              llvm::ConstantPointerNull::get(
+                  llvm::cast<llvm::PointerType>(f->type)),
+              FieldGEP);
+        }
+        llvm::Value *FieldSize = builder.CreateCall(
+            m_parent_->getFunction(getDeserializerName(f)),
+            {Self, builder.CreateGEP(Delta, CurrentIDX)});
+        insertCheck(builder.CreateICmpNE(FieldSize, builder.getInt64(0)),
+                    Fail, builder);
+        return FieldSize;
+      },
+      [&](const ir::Field *f, llvm::Value *CurrentIDX) {
+        llvm::Value *CurrentPtr = builder.CreateGEP(Delta, CurrentIDX);
+        llvm::Value *Lo = swapBytes(loadLength(CurrentPtr, builder), builder);
+        llvm::Value *NumItems = swapBytes(
+            loadLength(builder.CreateGEP(CurrentPtr, builder.getInt64(8)),
+                       builder),
+            builder);
+        llvm::Value *ItemsSize = builder.CreateMul(
+            NumItems, builder.getInt64(DL.getTypeAllocSize(
+                          f->type->getPointerElementType())));
+        llvm::Value *Items =
+            builder.CreateGEP(loadField(f, Self, builder), Lo);
+        builder.CreateMemCpy(
+            Items, 0, builder.CreateGEP(CurrentPtr, builder.getInt64(16)), 0,
+            ItemsSize);
+        swapArrayBytes(Items, NumItems, builder);
+        return builder.CreateAdd(builder.getInt64(16), ItemsSize);
+      });
+  builder.CreateRet(builder.getTrue());
+
+  return true;
+}
+
+bool tyr::pass::LLVMIRGenPass::getBatchSerializer(const tyr::ir::Struct *s) {
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+
+  const llvm::DataLayout &DL = m_parent_->getDataLayout();
+  const uint32_t AddrSpace = DL.getProgramAddressSpace();
+
+  llvm::Twine Name = "serialize_" + s->getName() + "_batch";
+
+  llvm::Type *StructPtrType = s->getType()->getPointerTo(AddrSpace);
+  llvm::PointerType *BufType = llvm::Type::getInt8PtrTy(ctx, AddrSpace);
+
+  // Returns the size of the batch, and only writes it if it fits in cap
+  llvm::FunctionType *SerializerType = llvm::FunctionType::get(
+      llvm::Type::getInt64Ty(ctx),
+      {StructPtrType->getPointerTo(AddrSpace), llvm::Type::getInt64Ty(ctx),
+       BufType, llvm::Type::getInt64Ty(ctx)},
+      false);
+
+  llvm::Function *Serializer = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name.str(), SerializerType));
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Serializer);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  auto arg_iter = Serializer->arg_begin();
+  llvm::Value *Items = &*arg_iter++;
+  llvm::Value *Count = &*arg_iter++;
+  llvm::Value *Buf = &*arg_iter++;
+  llvm::Value *Cap = &*arg_iter;
+
+  llvm::Value *Fail = builder.getInt64(0);
+  builder.SetInsertPoint(insertNullCheck({Items}, Fail, builder, Serializer));
+
+  auto loadItem = [&](llvm::Value *i) {
+    llvm::Value *Item = builder.CreateLoad(builder.CreateGEP(Items, i));
+    insertCheck(builder.CreateIsNotNull(Item), Fail, builder);
+    return Item;
+  };
+
+  const uint64_t RecordSize = getFixedRecordSize(s, DL);
+  llvm::Value *Size;
+  if (RecordSize != 0) {
+    insertCheck(builder.CreateICmpULE(
+                    Count, builder.getInt64(kMaxValidatedSize / RecordSize)),
+                Fail, builder);
+    Size = builder.CreateAdd(
+        builder.getInt64(kBatchHeaderSize),
+        builder.CreateMul(Count, builder.getInt64(RecordSize)));
+  } else {
+    llvm::Value *SizePtr = createEntryAlloca(builder.getInt64Ty(), builder);
+    builder.CreateStore(builder.getInt64(kBatchHeaderSize), SizePtr);
+    emitLoop(Count, builder, [&](llvm::Value *i) {
+      llvm::Value *Item = loadItem(i);
+      for (auto &entry : s->getFields()) {
+        insertLazyLoad(entry.get(), Item, Fail, builder);
+      }
+      builder.CreateStore(
+          builder.CreateAdd(builder.CreateLoad(SizePtr),
+                            getStructSerializedSize(s, Item, builder)),
+          SizePtr);
+    });
+    Size = builder.CreateLoad(SizePtr);
+  }
+
+  // Only the size is wanted if it doesn't fit
+  insertCheck(builder.CreateAnd(builder.CreateIsNotNull(Buf),
+                                builder.CreateICmpULE(Size, Cap)),
+              Size, builder);
+
+  // One header for the lot: the size, number of records, fingerprint of the
+  // wire format and size of each record (0 when they differ)
+  storeLength(swapBytes(Size, builder), Buf, builder);
+  storeLength(swapBytes(Count, builder),
+              builder.CreateGEP(Buf, builder.getInt64(8)), builder);
+  storeLength(swapBytes(builder.getInt64(s->getFingerprint()), builder),
+              builder.CreateGEP(Buf, builder.getInt64(16)), builder);
+  storeLength(swapBytes(builder.getInt64(RecordSize), builder),
+              builder.CreateGEP(Buf, builder.getInt64(24)), builder);
+
+  if (RecordSize != 0) {
+    // Fixed size records are just the fields, with no header of their own
+    const bool IsCopy = isWireLayout(s, DL);
+    llvm::StructType *GenStructType = s->getType();
+    const unsigned StructAlign = DL.getABITypeAlignment(GenStructType);
+    emitLoop(Count, builder, [&](llvm::Value *i) {
+      llvm::Value *Item = loadItem(i);
+      llvm::Value *Out = builder.CreateGEP(
+          Buf, builder.CreateAdd(
+                   builder.getInt64(kBatchHeaderSize),
+                   builder.CreateMul(i, builder.getInt64(RecordSize))));
+      if (IsCopy) {
+        builder.CreateMemCpy(Out, 0, Item, StructAlign, RecordSize);
+        return;
+      }
+      uint64_t Offset = 0;
+      for (auto &entry : s->getFields()) {
+        if (!isOnWire(entry.get())) {
+          continue;
+        }
+        builder.CreateCall(
+            m_parent_->getFunction(getSerializerName(entry.get())),
+            {Item, builder.CreateGEP(Out, builder.getInt64(Offset))});
+        Offset += DL.getTypeAllocSize(entry->type);
+      }
+    });
+  } else {
+    // Anything else is written as serialize_<name> would, one after another
+    llvm::Value *IDXPtr = createEntryAlloca(builder.getInt64Ty(), builder);
+    builder.CreateStore(builder.getInt64(kBatchHeaderSize), IDXPtr);
+    emitLoop(Count, builder, [&](llvm::Value *i) {
+      llvm::Value *Item = loadItem(i);
+      llvm::Value *CurrentIDX = builder.CreateLoad(IDXPtr);
+      llvm::Value *ItemSize = getStructSerializedSize(s, Item, builder);
+      writeStruct(s, Item, ItemSize, builder.CreateGEP(Buf, CurrentIDX),
+                  builder);
+      builder.CreateStore(builder.CreateAdd(CurrentIDX, ItemSize), IDXPtr);
+    });
+  }
+  builder.CreateRet(Size);
+
+  return true;
+}
+
+bool tyr::pass::LLVMIRGenPass::getBatchDeserializer(const tyr::ir::Struct *s) {
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+
+  const llvm::DataLayout &DL = m_parent_->getDataLayout();
+  const uint32_t AddrSpace = DL.getProgramAddressSpace();
+
+  llvm::Twine Name = "deserialize_" + s->getName() + "_batch";
+
+  llvm::PointerType *StructPtrType = s->getType()->getPointerTo(AddrSpace);
+  llvm::PointerType *ArrayType = StructPtrType->getPointerTo(AddrSpace);
+  llvm::PointerType *BufType = llvm::Type::getInt8PtrTy(ctx, AddrSpace);
+
+  // Returns a malloc'd array of the structs and stores how many there are in
+  // the last argument
+  llvm::FunctionType *DeserializerType = llvm::FunctionType::get(
+      ArrayType,
+      {BufType, llvm::Type::getInt64Ty(ctx),
+       llvm::Type::getInt64PtrTy(ctx, AddrSpace)},
+      false);
+
+  llvm::Function *Deserializer = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name.str(), DeserializerType));
+
+  llvm::BasicBlock *EntryBlock =
+      llvm::BasicBlock::Create(ctx, "", Deserializer);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  auto arg_iter = Deserializer->arg_begin();
+  llvm::Value *Buf = &*arg_iter++;
+  llvm::cast<llvm::Argument>(Buf)->addAttr(
+      llvm::Attribute::AttrKind::ReadOnly);
+  llvm::Value *Len = &*arg_iter++;
+  llvm::Value *OutCount = &*arg_iter;
+
+  llvm::Value *Null = llvm::ConstantPointerNull::get(ArrayType);
+  builder.SetInsertPoint(insertNullCheck({Buf}, Null, builder, Deserializer));
+  builder.SetInsertPoint(
+      insertNullCheck({OutCount}, Null, builder, Deserializer));
+
+  insertCheck(builder.CreateICmpUGE(Len, builder.getInt64(kBatchHeaderSize)),
+              Null, builder);
+  llvm::Value *Size = swapBytes(loadLength(Buf, builder), builder);
+  llvm::Value *Count = swapBytes(
+      loadLength(builder.CreateGEP(Buf, builder.getInt64(8)), builder),
+      builder);
+  llvm::Value *Fingerprint = swapBytes(
+      loadLength(builder.CreateGEP(Buf, builder.getInt64(16)), builder),
+      builder);
+  llvm::Value *BatchRecordSize = swapBytes(
+      loadLength(builder.CreateGEP(Buf, builder.getInt64(24)), builder),
+      builder);
+  insertCheck(
+      builder.CreateAnd(
+          builder.CreateICmpUGE(Size, builder.getInt64(kBatchHeaderSize)),
+          builder.CreateICmpULE(Size, Len)),
+      Null, builder);
+
+  // A fingerprint of 0 is taken on trust
+  insertCheck(
+      builder.CreateOr(
+          builder.CreateICmpEQ(Fingerprint,
+                               builder.getInt64(s->getFingerprint())),
+          builder.CreateICmpEQ(Fingerprint, builder.getInt64(0))),
+      Null, builder);
+
+  const uint64_t RecordSize = getFixedRecordSize(s, DL);
+  insertCheck(
+      builder.CreateICmpEQ(BatchRecordSize, builder.getInt64(RecordSize)),
+      Null, builder);
+
+  // Nothing is allocated until the whole batch checks out
+  llvm::Value *Remaining =
+      builder.CreateSub(Size, builder.getInt64(kBatchHeaderSize));
+  llvm::Value *IDXPtr = createEntryAlloca(builder.getInt64Ty(), builder);
+  if (RecordSize != 0) {
+    insertCheck(
+        builder.CreateAnd(
+            builder.CreateICmpEQ(
+                Count,
+                builder.CreateUDiv(Remaining, builder.getInt64(RecordSize))),
+            builder.CreateICmpEQ(
+                builder.CreateURem(Remaining, builder.getInt64(RecordSize)),
+                builder.getInt64(0))),
+        Null, builder);
+  } else {
+    // Every record is at least its own size, which bounds the count
+    insertCheck(builder.CreateICmpULE(
+                    Count, builder.CreateUDiv(Remaining, builder.getInt64(8))),
+                Null, builder);
+    llvm::Function *Validator =
+        m_parent_->getFunction("validate_" + s->getName().str());
+    builder.CreateStore(builder.getInt64(kBatchHeaderSize), IDXPtr);
+    emitLoop(Count, builder, [&](llvm::Value *i) {
+      llvm::Value *CurrentIDX = builder.CreateLoad(IDXPtr);
+      llvm::Value *Record = builder.CreateGEP(Buf, CurrentIDX);
+      insertCheck(builder.CreateCall(
+                      Validator, {Record, builder.CreateSub(Size, CurrentIDX)}),
+                  Null, builder);
+      builder.CreateStore(
+          builder.CreateAdd(CurrentIDX,
+                            swapBytes(loadLength(Record, builder), builder)),
+          IDXPtr);
+    });
+    insertCheck(builder.CreateICmpEQ(builder.CreateLoad(IDXPtr), Size), Null,
+                builder);
+  }
+
+  const uint64_t PtrSize = DL.getTypeAllocSize(StructPtrType);
+  llvm::Value *ArrayRaw = builder.CreateCall(
+      m_parent_->getFunction(m_builtin_names_.lookup("malloc")),
+      builder.CreateMul(
+          builder.CreateSelect(
+              builder.CreateICmpEQ(Count, builder.getInt64(0)),
+              builder.getInt64(1), Count),
+          builder.getInt64(PtrSize)));
+  builder.SetInsertPoint(
+      insertNullCheck({ArrayRaw}, Null, builder, Deserializer));
+  llvm::Value *Array = builder.CreateBitCast(ArrayRaw, ArrayType);
+
+  // If an allocation fails part way, the structs made so far are destroyed
+  llvm::Value *DonePtr = createEntryAlloca(builder.getInt64Ty(), builder);
+  builder.CreateStore(builder.getInt64(0), DonePtr);
+  llvm::BasicBlock *Failed = llvm::BasicBlock::Create(ctx, "", Deserializer);
+  auto storeItem = [&](llvm::Value *i, llvm::Value *Item) {
+    llvm::BasicBlock *Succeeded =
+        llvm::BasicBlock::Create(ctx, "", Deserializer);
+    builder.CreateCondBr(builder.CreateIsNull(Item), Failed, Succeeded);
+    builder.SetInsertPoint(Succeeded);
+    builder.CreateStore(Item, builder.CreateGEP(Array, i));
+    builder.CreateStore(builder.CreateAdd(i, builder.getInt64(1)), DonePtr);
+  };
+
+  if (RecordSize != 0) {
+    const bool IsCopy = isWireLayout(s, DL);
+    const uint64_t StructAllocSize = getStructAllocSize(s);
+    llvm::StructType *GenStructType = s->getType();
+    const unsigned StructAlign = DL.getABITypeAlignment(GenStructType);
+    emitLoop(Count, builder, [&](llvm::Value *i) {
+      llvm::Value *Record = builder.CreateGEP(
+          Buf, builder.CreateAdd(
+                   builder.getInt64(kBatchHeaderSize),
+                   builder.CreateMul(i, builder.getInt64(RecordSize))));
+      llvm::Value *ItemRaw = builder.CreateCall(
+          m_parent_->getFunction(m_builtin_names_.lookup("malloc")),
+          builder.getInt64(StructAllocSize));
+      llvm::Value *Item = builder.CreateBitCast(ItemRaw, StructPtrType);
+      storeItem(i, Item);
+      if (IsCopy) {
+        builder.CreateMemCpy(ItemRaw, StructAlign, Record, 0, RecordSize);
+        return;
+      }
+      builder.CreateMemSet(ItemRaw, builder.getInt8(0), StructAllocSize, 0);
+      uint64_t Offset = 0;
+      for (auto &entry : s->getFields()) {
+        if (!isOnWire(entry.get())) {
+          continue;
+        }
+        builder.CreateCall(
+            m_parent_->getFunction(getDeserializerName(entry.get())),
+            {Item, builder.CreateGEP(Record, builder.getInt64(Offset))});
+        Offset += DL.getTypeAllocSize(entry->type);
+      }
+    });
+  } else {
+    llvm::Function *StructDeserializer =
+        m_parent_->getFunction("deserialize_" + s->getName().str());
+    builder.CreateStore(builder.getInt64(kBatchHeaderSize), IDXPtr);
+    emitLoop(Count, builder, [&](llvm::Value *i) {
+      llvm::Value *CurrentIDX = builder.CreateLoad(IDXPtr);
+      llvm::Value *Record = builder.CreateGEP(Buf, CurrentIDX);
+      storeItem(i, builder.CreateCall(StructDeserializer, {Record}));
+      builder.CreateStore(
+          builder.CreateAdd(CurrentIDX,
+                            swapBytes(loadLength(Record, builder), builder)),
+          IDXPtr);
+    });
+  }
+  builder.CreateStore(Count, OutCount);
+  builder.CreateRet(Array);
+
+  builder.SetInsertPoint(Failed);
+  llvm::Function *Destructor =
+      m_parent_->getFunction("destroy_" + s->getName().str());
+  emitLoop(builder.CreateLoad(DonePtr), builder, [&](llvm::Value *i) {
+    builder.CreateCall(Destructor,
+                       {builder.CreateLoad(builder.CreateGEP(Array, i))});
+  });
+  builder.CreateCall(m_parent_->getFunction(m_builtin_names_.lookup("free")),
+                     {ArrayRaw});
+  builder.CreateRet(Null);
+
+  return true;
+}
+
+llvm::Value *tyr::pass::LLVMIRGenPass::decodeWhole(
+    const tyr::ir::Struct *s, llvm::Value *Buf, llvm::Value *Size,
+    llvm::IRBuilder<> &builder) const {
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+  llvm::Function *Parent = builder.GetInsertBlock()->getParent();
+
+  // Without a size the buffer is trusted
+  llvm::Value *Struct =
+      Size == nullptr
+          ? builder.CreateCall(
+                m_parent_->getFunction("deserialize_" + s->getName().str()),
+                {Buf})
+          : builder.CreateCall(m_parent_->getFunction(
+                                   "deserialize_" + s->getName().str() + "_n"),
+                               {Buf, Size});
+  if (!s->isLazy()) {
+    return Struct;
+  }
+
+  // A lazy struct would still point into the buffer, so everything is decoded
+  // now and the buffer can go
+  llvm::Value *Null = llvm::ConstantPointerNull::get(
+      llvm::cast<llvm::PointerType>(Struct->getType()));
+  llvm::BasicBlock *Start = builder.GetInsertBlock();
+  llvm::BasicBlock *Load = llvm::BasicBlock::Create(ctx, "", Parent);
+  llvm::BasicBlock *Bad = llvm::BasicBlock::Create(ctx, "", Parent);
+  llvm::BasicBlock *Join = llvm::BasicBlock::Create(ctx, "", Parent);
+  builder.CreateCondBr(builder.CreateIsNotNull(Struct), Load, Join);
+
+  builder.SetInsertPoint(Load);
+  llvm::Value *Loaded = builder.getTrue();
+  for (auto &entry : s->getFields()) {
+    if (entry->pendingField != nullptr) {
+      Loaded = builder.CreateAnd(
+          Loaded, builder.CreateCall(getLazyLoader(entry.get()), {Struct}));
+    }
+  }
+  llvm::BasicBlock *Loads = builder.GetInsertBlock();
+  builder.CreateCondBr(Loaded, Join, Bad);
+
+  builder.SetInsertPoint(Bad);
+  builder.CreateCall(m_parent_->getFunction("destroy_" + s->getName().str()),
+                     {Struct});
+  builder.CreateBr(Join);
+
+  builder.SetInsertPoint(Join);
+  llvm::PHINode *Out = builder.CreatePHI(Struct->getType(), 3);
+  Out->addIncoming(Null, Start);
+  Out->addIncoming(Struct, Loads);
+  Out->addIncoming(Null, Bad);
+  return Out;
+}
+
+bool tyr::pass::LLVMIRGenPass::getEagerDeserializer(
+    const tyr::ir::Struct *s) {
+  if (!s->isLazy()) {
+    return true;
+  }
+
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+  const uint32_t AddrSpace =
+      m_parent_->getDataLayout().getProgramAddressSpace();
+  llvm::PointerType *StructPtrType = s->getType()->getPointerTo(AddrSpace);
+  llvm::PointerType *BufType = llvm::Type::getInt8PtrTy(ctx, AddrSpace);
+  llvm::Type *Int64Ty = llvm::Type::getInt64Ty(ctx);
+
+  // deserialize_<name>_eager(buf) and deserialize_<name>_eager_n(buf, len),
+  // for callers that free the buffer straight after
+  for (bool Bounded : {false, true}) {
+    llvm::FunctionType *DeserializerType =
+        Bounded ? llvm::FunctionType::get(StructPtrType, {BufType, Int64Ty},
+                                          false)
+                : llvm::FunctionType::get(StructPtrType, {BufType}, false);
+    llvm::Function *Deserializer =
+        llvm::cast<llvm::Function>(m_parent_->getOrInsertFunction(
+            ("deserialize_" + s->getName() + "_eager" + (Bounded ? "_n" : ""))
+                .str(),
+            DeserializerType));
+
+    llvm::IRBuilder<> builder(llvm::BasicBlock::Create(ctx, "", Deserializer));
+    auto arg_iter = Deserializer->arg_begin();
+    llvm::Value *Buf = &*arg_iter;
+    llvm::Value *Len = Bounded ? &*(++arg_iter) : nullptr;
+    builder.CreateRet(decodeWhole(s, Buf, Len, builder));
+  }
+
+  return true;
+}
+
+bool tyr::pass::LLVMIRGenPass::getDecoder(const tyr::ir::Struct *s) {
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+
+  const llvm::DataLayout &DL = m_parent_->getDataLayout();
+  const uint32_t AddrSpace = DL.getProgramAddressSpace();
+
+  llvm::PointerType *StructPtrType = s->getType()->getPointerTo(AddrSpace);
+  llvm::PointerType *BufType = llvm::Type::getInt8PtrTy(ctx, AddrSpace);
+  llvm::Type *Int64Ty = llvm::Type::getInt64Ty(ctx);
+
+  // {bytes of the message so far, its size, the buffer it goes into, whether
+  // the stream went bad, the largest message it takes, the size header until
+  // all of it is in}
+  llvm::StructType *DecoderType = llvm::StructType::create(
+      ctx,
+      {Int64Ty, Int64Ty, BufType, llvm::Type::getInt1Ty(ctx), Int64Ty,
+       llvm::ArrayType::get(llvm::Type::getInt8Ty(ctx), sizeof(uint64_t))},
+      (s->getName() + "_decoder").str());
+  llvm::PointerType *DecoderPtrType = DecoderType->getPointerTo(AddrSpace);
+  llvm::Function *Malloc =
+      m_parent_->getFunction(m_builtin_names_.lookup("malloc"));
+  llvm::Function *Free =
+      m_parent_->getFunction(m_builtin_names_.lookup("free"));
+
+  // create_<name>_decoder(max_size), the size header is the first thing a
+  // peer sends so it's what bounds the buffer
+  llvm::Function *Constructor =
+      llvm::cast<llvm::Function>(m_parent_->getOrInsertFunction(
+          ("create_" + s->getName() + "_decoder").str(),
+          llvm::FunctionType::get(DecoderPtrType, {Int64Ty}, false)));
+  llvm::IRBuilder<> builder(llvm::BasicBlock::Create(ctx, "", Constructor));
+  llvm::Value *MaxSize = &*Constructor->arg_begin();
+  llvm::Value *Raw = builder.CreateCall(
+      Malloc, builder.getInt64(DL.getTypeAllocSize(DecoderType)));
+  builder.SetInsertPoint(insertNullCheck(
+      {Raw}, llvm::ConstantPointerNull::get(DecoderPtrType), builder,
+      Constructor));
+  builder.CreateMemSet(Raw, builder.getInt8(0),
+                       DL.getTypeAllocSize(DecoderType), 0);
+  llvm::Value *NewDecoder = builder.CreatePointerCast(Raw, DecoderPtrType);
+  builder.CreateStore(
+      builder.CreateSelect(
+          builder.CreateICmpEQ(MaxSize, builder.getInt64(0)),
+          builder.getInt64(kDefaultMaxMessage),
+          createUMin(MaxSize, builder.getInt64(kMaxValidatedSize), builder)),
+      builder.CreateStructGEP(NewDecoder, kDecoderMax));
+  builder.CreateRet(NewDecoder);
+
+  // destroy_<name>_decoder, which frees a message that was cut off part way
+  llvm::Function *Destructor =
+      llvm::cast<llvm::Function>(m_parent_->getOrInsertFunction(
+          ("destroy_" + s->getName() + "_decoder").str(),
+          llvm::FunctionType::get(builder.getVoidTy(), {DecoderPtrType},
+                                  false)));
+  builder.SetInsertPoint(llvm::BasicBlock::Create(ctx, "", Destructor));
+  llvm::Value *Decoder = &*Destructor->arg_begin();
+  builder.SetInsertPoint(
+      insertNullCheck({Decoder}, nullptr, builder, Destructor));
+  builder.CreateCall(Free, {builder.CreateLoad(builder.CreateStructGEP(
+                               Decoder, kDecoderBuf))});
+  builder.CreateCall(Free, {builder.CreatePointerCast(Decoder, BufType)});
+  builder.CreateRetVoid();
+
+  // <name>_decoder_feed(decoder, buf, len, &consumed, &out)
+  llvm::Function *Feed =
+      llvm::cast<llvm::Function>(m_parent_->getOrInsertFunction(
+          (s->getName() + "_decoder_feed").str(),
+          llvm::FunctionType::get(
+              builder.getInt32Ty(),
+              {DecoderPtrType, BufType, Int64Ty,
+               Int64Ty->getPointerTo(AddrSpace),
+               StructPtrType->getPointerTo(AddrSpace)},
+              false)));
+
+  auto arg_iter = Feed->arg_begin();
+  Decoder = &*arg_iter++;
+  llvm::Value *In = &*arg_iter++;
+  llvm::cast<llvm::Argument>(In)->addAttr(llvm::Attribute::AttrKind::ReadOnly);
+  llvm::Value *Len = &*arg_iter++;
+  llvm::Value *Consumed = &*arg_iter++;
+  llvm::Value *Out = &*arg_iter;
+
+  llvm::Value *NeedMore = builder.getInt32(kDecodeNeedMore);
+  llvm::Value *Done = builder.getInt32(kDecodeDone);
+  llvm::Value *Error = builder.getInt32(kDecodeError);
+
+  builder.SetInsertPoint(llvm::BasicBlock::Create(ctx, "", Feed));
+  builder.SetInsertPoint(insertNullCheck({Decoder}, Error, builder, Feed));
+  builder.SetInsertPoint(insertNullCheck({Consumed}, Error, builder, Feed));
+  builder.SetInsertPoint(insertNullCheck({Out}, Error, builder, Feed));
+  builder.CreateStore(builder.getInt64(0), Consumed);
+  builder.CreateStore(llvm::ConstantPointerNull::get(StructPtrType), Out);
+  llvm::Value *FailedPtr = builder.CreateStructGEP(Decoder, kDecoderFailed);
+  insertCheck(builder.CreateNot(builder.CreateLoad(FailedPtr)), Error,
+              builder);
+  builder.SetInsertPoint(insertNullCheck({In}, Error, builder, Feed));
+
+  llvm::Value *HavePtr = builder.CreateStructGEP(Decoder, kDecoderHave);
+  llvm::Value *SizePtr = builder.CreateStructGEP(Decoder, kDecoderSize);
+  llvm::Value *BufPtr = builder.CreateStructGEP(Decoder, kDecoderBuf);
+  llvm::Value *Header = builder.CreatePointerCast(
+      builder.CreateStructGEP(Decoder, kDecoderHeader), BufType);
+  llvm::Value *PosPtr = createEntryAlloca(Int64Ty, builder);
+  builder.CreateStore(builder.getInt64(0), PosPtr);
+  llvm::Value *MaxMessage =
+      builder.CreateLoad(builder.CreateStructGEP(Decoder, kDecoderMax));
+
+  // Frozen structs are in the target's byte order, and have to be at least
+  // as big as the struct
+  const uint64_t MinSize = s->isFrozen()
+                               ? getStructAllocSize(s)
+                               : sizeof(uint64_t) + getOffsetTableSize(s);
+  auto readSize = [&](llvm::Value *Buf) {
+    llvm::Value *Size = loadLength(Buf, builder);
+    return s->isFrozen() ? Size : swapBytes(Size, builder);
+  };
+  auto sizeInRange = [&](llvm::Value *Size) {
+    return builder.CreateAnd(
+        builder.CreateICmpUGE(Size, builder.getInt64(MinSize)),
+        builder.CreateICmpULE(Size, MaxMessage));
+  };
+
+  llvm::BasicBlock *Fast = llvm::BasicBlock::Create(ctx, "", Feed);
+  llvm::BasicBlock *Slow = llvm::BasicBlock::Create(ctx, "", Feed);
+  llvm::BasicBlock *HeaderPart = llvm::BasicBlock::Create(ctx, "", Feed);
+  llvm::BasicBlock *GotHeader = llvm::BasicBlock::Create(ctx, "", Feed);
+  llvm::BasicBlock *Body = llvm::BasicBlock::Create(ctx, "", Feed);
+  llvm::BasicBlock *Complete = llvm::BasicBlock::Create(ctx, "", Feed);
+  llvm::BasicBlock *Partial = llvm::BasicBlock::Create(ctx, "", Feed);
+  llvm::BasicBlock *Failed = llvm::BasicBlock::Create(ctx, "", Feed);
+
+  // A whole message at the start of the input is decoded where it is
+  llvm::Value *Have = builder.CreateLoad(HavePtr);
+  llvm::Value *Empty = builder.CreateAnd(
+      builder.CreateICmpEQ(Have, builder.getInt64(0)),
+      builder.CreateICmpUGE(Len, builder.getInt64(sizeof(uint64_t))));
+  llvm::BasicBlock *PeekSize = llvm::BasicBlock::Create(ctx, "", Feed);
+  builder.CreateCondBr(Empty, PeekSize, Slow);
+
+  builder.SetInsertPoint(PeekSize);
+  llvm::Value *InSize = readSize(In);
+  builder.CreateCondBr(builder.CreateAnd(sizeInRange(InSize),
+                                         builder.CreateICmpULE(InSize, Len)),
+                       Fast, Slow);
+
+  builder.SetInsertPoint(Fast);
+  builder.CreateStore(InSize, PosPtr);
+  llvm::Value *FastStruct = decodeWhole(s, In, InSize, builder);
+  llvm::BasicBlock *FastDecoded = llvm::BasicBlock::Create(ctx, "", Feed);
+  builder.CreateCondBr(builder.CreateIsNotNull(FastStruct), FastDecoded,
+                       Failed);
+  builder.SetInsertPoint(FastDecoded);
+  builder.CreateStore(InSize, Consumed);
+  builder.CreateStore(FastStruct, Out);
+  builder.CreateRet(Done);
+
+  // Otherwise the size header comes first, then the rest goes straight into
+  // a buffer of the size it gives
+  builder.SetInsertPoint(Slow);
+  builder.CreateCondBr(
+      builder.CreateICmpULT(Have, builder.getInt64(sizeof(uint64_t))),
+      HeaderPart, Body);
+
+  builder.SetInsertPoint(HeaderPart);
+  llvm::Value *HeaderTake = createUMin(
+      builder.CreateSub(builder.getInt64(sizeof(uint64_t)), Have), Len,
+      builder);
+  builder.CreateMemCpy(builder.CreateGEP(Header, Have), 0, In, 0, HeaderTake);
+  Have = builder.CreateAdd(Have, HeaderTake);
+  builder.CreateStore(Have, HavePtr);
+  builder.CreateStore(HeaderTake, PosPtr);
+  builder.CreateCondBr(
+      builder.CreateICmpULT(Have, builder.getInt64(sizeof(uint64_t))),
+      Partial, GotHeader);
+
+  builder.SetInsertPoint(GotHeader);
+  llvm::Value *Size = readSize(Header);
+  llvm::BasicBlock *SizeOk = llvm::BasicBlock::Create(ctx, "", Feed);
+  builder.CreateCondBr(sizeInRange(Size), SizeOk, Failed);
+  builder.SetInsertPoint(SizeOk);
+  llvm::Value *Buf = builder.CreateCall(Malloc, Size);
+  llvm::BasicBlock *Allocated = llvm::BasicBlock::Create(ctx, "", Feed);
+  builder.CreateCondBr(builder.CreateIsNotNull(Buf), Allocated, Failed);
+  builder.SetInsertPoint(Allocated);
+  builder.CreateMemCpy(Buf, 0, Header, 0, sizeof(uint64_t));
+  builder.CreateStore(Size, SizePtr);
+  builder.CreateStore(Buf, BufPtr);
+  builder.CreateBr(Body);
+
+  builder.SetInsertPoint(Body);
+  Have = builder.CreateLoad(HavePtr);
+  Size = builder.CreateLoad(SizePtr);
+  Buf = builder.CreateLoad(BufPtr);
+  llvm::Value *Pos = builder.CreateLoad(PosPtr);
+  llvm::Value *Take = createUMin(builder.CreateSub(Size, Have),
+                                 builder.CreateSub(Len, Pos), builder);
+  builder.CreateMemCpy(builder.CreateGEP(Buf, Have), 0,
+                       builder.CreateGEP(In, Pos), 0, Take);
+  Have = builder.CreateAdd(Have, Take);
+  builder.CreateStore(Have, HavePtr);
+  builder.CreateStore(builder.CreateAdd(Pos, Take), PosPtr);
+  builder.CreateCondBr(builder.CreateICmpEQ(Have, Size), Complete, Partial);
+
+  // The decoder starts over for the next message whatever becomes of this one
+  builder.SetInsertPoint(Complete);
+  builder.CreateStore(builder.getInt64(0), HavePtr);
+  builder.CreateStore(builder.getInt64(0), SizePtr);
+  builder.CreateStore(llvm::ConstantPointerNull::get(BufType), BufPtr);
+  llvm::Value *Struct;
+  if (s->isFrozen()) {
+    // The buffer already is the struct once it checks out
+    llvm::Value *Valid = builder.CreateCall(
+        m_parent_->getFunction("validate_" + s->getName().str()), {Buf, Size});
+    Struct = builder.CreateSelect(
+        Valid, builder.CreatePointerCast(Buf, StructPtrType),
+        llvm::ConstantPointerNull::get(StructPtrType));
+    llvm::BasicBlock *Invalid = llvm::BasicBlock::Create(ctx, "", Feed);
+    llvm::BasicBlock *Checked = llvm::BasicBlock::Create(ctx, "", Feed);
+    builder.CreateCondBr(Valid, Checked, Invalid);
+    builder.SetInsertPoint(Invalid);
+    builder.CreateCall(Free, {Buf});
+    builder.CreateBr(Checked);
+    builder.SetInsertPoint(Checked);
+  } else {
+    Struct = decodeWhole(s, Buf, Size, builder);
+    builder.CreateCall(Free, {Buf});
+  }
+  builder.CreateStore(builder.CreateLoad(PosPtr), Consumed);
+  llvm::BasicBlock *Decoded = llvm::BasicBlock::Create(ctx, "", Feed);
+  builder.CreateCondBr(builder.CreateIsNotNull(Struct), Decoded, Failed);
+  builder.SetInsertPoint(Decoded);
+  builder.CreateStore(Struct, Out);
+  builder.CreateRet(Done);
+
+  builder.SetInsertPoint(Partial);
+  builder.CreateStore(builder.CreateLoad(PosPtr), Consumed);
+  builder.CreateRet(NeedMore);
+
+  // Past a bad message there's no telling where the next one starts
+  builder.SetInsertPoint(Failed);
+  builder.CreateStore(builder.getTrue(), FailedPtr);
+  builder.CreateStore(builder.CreateLoad(PosPtr), Consumed);
+  builder.CreateRet(Error);
+
+  return true;
+}
+
+bool tyr::pass::LLVMIRGenPass::getFrozenConstructor(const tyr::ir::Struct *s) {
+  llvm::ArrayRef<ir::FieldPtr> structFields = s->getFields();
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+  const llvm::DataLayout &DL = m_parent_->getDataLayout();
+
+  const uint32_t AddrSpace = DL.getProgramAddressSpace();
+
+  llvm::Twine ConstrName = "create_" + s->getName();
+
+  llvm::StructType *GenStructType = s->getType();
+  llvm::PointerType *StructPtrType = GenStructType->getPointerTo(AddrSpace);
+
+  // Nothing can be resized later, so every array and nested struct is passed
+  // in along with the non-mutable fields
+  llvm::SmallVector<const ir::Field *, 8> ArgFields;
+  llvm::SmallVector<llvm::Type *, 8> ArgTypes;
+  for (auto &entry : structFields) {
+    if (entry->isSizeHeader) {
+      continue;
+    }
+    if (!entry->isMutable || entry->isCount || entry->isRepeated ||
+        entry->isStruct) {
+      ArgFields.push_back(entry.get());
+      ArgTypes.push_back(entry->type);
+    }
+  }
+
+  llvm::FunctionType *ConstructorType =
+      llvm::FunctionType::get(StructPtrType, ArgTypes, false);
+  llvm::Function *Constructor = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(ConstrName.str(), ConstructorType));
+  Constructor->addFnAttr(llvm::Attribute::InlineHint);
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Constructor);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  llvm::DenseMap<const ir::Field *, llvm::Value *> Args;
+  auto ArgIter = Constructor->arg_begin();
+  for (const ir::Field *f : ArgFields) {
+    Args[f] = &*ArgIter++;
+  }
+
+  // Lay the data out after the struct, each piece aligned for its type and
+  // nested structs (and so the whole buffer) to 8 bytes
+  llvm::Type *BufType = builder.getInt8PtrTy(AddrSpace);
+  llvm::DenseMap<const ir::Field *, llvm::Value *> Offsets;
+  llvm::Value *Size = builder.getInt64(
+      llvm::alignTo(getStructAllocSize(s), sizeof(uint64_t)));
+  for (const ir::Field *f : ArgFields) {
+    if (f->isRepeated) {
+      llvm::Type *ElementType = f->type->getPointerElementType();
+      Size = alignUp(Size, DL.getABITypeAlignment(ElementType), builder);
+      Offsets[f] = Size;
+      Size = builder.CreateAdd(
+          Size, builder.CreateMul(Args[f->countField],
+                                  builder.getInt64(
+                                      DL.getTypeAllocSize(ElementType))));
+    } else if (f->isStruct) {
+      builder.SetInsertPoint(insertNullCheck(
+          {Args[f]}, llvm::ConstantPointerNull::get(StructPtrType), builder,
+          Constructor));
+      Size = alignUp(Size, sizeof(uint64_t), builder);
+      Offsets[f] = Size;
+      Size = builder.CreateAdd(
+          Size, loadLength(builder.CreateBitCast(Args[f], BufType), builder));
+    }
+  }
+  Size = alignUp(Size, sizeof(uint64_t), builder);
+
+  llvm::Value *StructOutRaw = builder.CreateCall(
+      m_parent_->getFunction(m_builtin_names_.lookup("malloc")), Size);
+  builder.SetInsertPoint(insertNullCheck(
+      {StructOutRaw}, llvm::ConstantPointerNull::get(StructPtrType), builder,
+      Constructor));
+  // Zeroed so the padding (and so the serialized form) is always the same
+  builder.CreateMemSet(StructOutRaw, builder.getInt8(0), Size, 0);
+  llvm::Value *StructOut =
+      builder.CreatePointerCast(StructOutRaw, StructPtrType);
+
+  builder.CreateStore(
+      Size, builder.CreateStructGEP(StructOut, getSizeHeader(s)->offset));
+  for (const ir::Field *f : ArgFields) {
+    if (!f->isRepeated && !f->isStruct) {
+      storeField(f, StructOut, Args[f], builder);
+      continue;
+    }
+    builder.CreateStore(Offsets[f],
+                        builder.CreateStructGEP(StructOut, f->offset));
+    llvm::Value *DataSize =
+        f->isRepeated
+            ? getFieldAllocSize(f, StructOut, builder)
+            : loadLength(builder.CreateBitCast(Args[f], BufType), builder);
+    builder.CreateMemCpy(builder.CreateGEP(StructOutRaw, Offsets[f]), 0,
+                         Args[f], 0, DataSize);
+  }
+
+  builder.CreateRet(StructOut);
+
+  return true;
+}
+
+bool tyr::pass::LLVMIRGenPass::getFrozenSerializer(const tyr::ir::Struct *s) {
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+
+  const uint32_t AddrSpace =
+      m_parent_->getDataLayout().getProgramAddressSpace();
+
+  llvm::Twine Name = "serialize_" + s->getName();
+
+  llvm::Type *StructPtrType = s->getType()->getPointerTo(AddrSpace);
+  llvm::FunctionType *SerializerType = llvm::FunctionType::get(
+      llvm::Type::getInt8PtrTy(ctx, AddrSpace), {StructPtrType}, false);
+
+  llvm::Function *Serializer = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name.str(), SerializerType));
+  Serializer->addFnAttr(llvm::Attribute::InlineHint);
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Serializer);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  llvm::Value *Self = &*Serializer->arg_begin();
+  llvm::cast<llvm::Argument>(Self)->addAttr(
+      llvm::Attribute::AttrKind::ReadOnly);
+
+  llvm::Value *Null =
+      llvm::ConstantPointerNull::get(builder.getInt8PtrTy(AddrSpace));
+  builder.SetInsertPoint(insertNullCheck({Self}, Null, builder, Serializer));
+
+  // The struct already is its serialized form, so it only has to be copied
+  llvm::Value *Size = builder.CreateLoad(
+      builder.CreateStructGEP(Self, getSizeHeader(s)->offset));
+  llvm::Value *AllocdMem = builder.CreateCall(
+      m_parent_->getFunction(m_builtin_names_.lookup("malloc")), Size);
+  builder.SetInsertPoint(
+      insertNullCheck({AllocdMem}, Null, builder, Serializer));
+  builder.CreateMemCpy(AllocdMem, sizeof(uint64_t), Self, sizeof(uint64_t),
+                       Size);
+  builder.CreateRet(AllocdMem);
+
+  return true;
+}
+
+bool tyr::pass::LLVMIRGenPass::getFrozenDeserializer(const tyr::ir::Struct *s,
+                                                     bool Projected) {
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+
+  const uint32_t AddrSpace =
+      m_parent_->getDataLayout().getProgramAddressSpace();
+
+  const std::string Name =
+      ("deserialize_" + s->getName() + (Projected ? "_fields" : "")).str();
+
+  llvm::PointerType *StructPtrType = s->getType()->getPointerTo(AddrSpace);
+
+  // Same signatures as for any other struct, but every field comes along in
+  // the one copy whatever the mask says
+  llvm::SmallVector<llvm::Type *, 3> ArgTypes = {
+      llvm::Type::getInt8PtrTy(ctx, AddrSpace)};
+  if (Projected) {
+    ArgTypes.push_back(llvm::Type::getInt64Ty(ctx));
+    ArgTypes.push_back(llvm::Type::getInt64Ty(ctx));
+  }
+  llvm::FunctionType *DeserializerType =
+      llvm::FunctionType::get(StructPtrType, ArgTypes, false);
+
+  llvm::Function *Deserializer = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name, DeserializerType));
+  Deserializer->addFnAttr(llvm::Attribute::InlineHint);
+
+  llvm::BasicBlock *EntryBlock =
+      llvm::BasicBlock::Create(ctx, "", Deserializer);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  auto arg_iter = Deserializer->arg_begin();
+  llvm::Value *SerializedSelf = &*arg_iter;
+  llvm::cast<llvm::Argument>(SerializedSelf)
+      ->addAttr(llvm::Attribute::AttrKind::ReadOnly);
+
+  llvm::Value *Null = llvm::ConstantPointerNull::get(StructPtrType);
+  builder.SetInsertPoint(
+      insertNullCheck({SerializedSelf}, Null, builder, Deserializer));
+
+  if (Projected) {
+    // The offsets in it are followed by the getters, so check them all
+    insertCheck(builder.CreateCall(
+                    m_parent_->getFunction("validate_" + s->getName().str()),
+                    {SerializedSelf, &*++arg_iter}),
+                Null, builder);
+  }
+
+  // Frozen structs are in the target's byte order, so nothing is swapped
+  llvm::Value *Size = loadLength(SerializedSelf, builder);
+  insertCheck(
+      builder.CreateICmpUGE(Size, builder.getInt64(getStructAllocSize(s))),
+      Null, builder);
+
+  llvm::Value *StructOutRaw = builder.CreateCall(
+      m_parent_->getFunction(m_builtin_names_.lookup("malloc")), Size);
+  builder.SetInsertPoint(
+      insertNullCheck({StructOutRaw}, Null, builder, Deserializer));
+  builder.CreateMemCpy(StructOutRaw, sizeof(uint64_t), SerializedSelf, 0,
+                       Size);
+  builder.CreateRet(builder.CreatePointerCast(StructOutRaw, StructPtrType));
+
+  return true;
+}
+
+bool tyr::pass::LLVMIRGenPass::getFrozenValidator(const tyr::ir::Struct *s) {
+  llvm::ArrayRef<ir::FieldPtr> structFields = s->getFields();
+  llvm::LLVMContext &ctx = m_parent_->getContext();
+  const llvm::DataLayout &DL = m_parent_->getDataLayout();
+
+  const uint32_t AddrSpace = DL.getProgramAddressSpace();
+
+  llvm::Twine Name = "validate_" + s->getName();
+
+  llvm::FunctionType *ValidatorType = llvm::FunctionType::get(
+      llvm::Type::getInt1Ty(ctx),
+      {llvm::Type::getInt8PtrTy(ctx, AddrSpace), llvm::Type::getInt64Ty(ctx)},
+      false);
+
+  llvm::Function *Validator = llvm::cast<llvm::Function>(
+      m_parent_->getOrInsertFunction(Name.str(), ValidatorType));
+
+  llvm::BasicBlock *EntryBlock = llvm::BasicBlock::Create(ctx, "", Validator);
+  llvm::IRBuilder<> builder(EntryBlock);
+
+  auto arg_iter = Validator->arg_begin();
+  llvm::Value *SerializedSelf = &*arg_iter;
+  llvm::cast<llvm::Argument>(SerializedSelf)
+      ->addAttr(llvm::Attribute::AttrKind::ReadOnly);
+  ++arg_iter;
+  llvm::Value *Len = &*arg_iter;
+
+  llvm::Value *Invalid = builder.getInt1(false);
+  builder.SetInsertPoint(
+      insertNullCheck({SerializedSelf}, Invalid, builder, Validator));
+
+  // The struct itself has to be there before any of it can be read
+  llvm::Value *StructSize = builder.getInt64(getStructAllocSize(s));
+  insertCheck(builder.CreateICmpUGE(Len, StructSize), Invalid, builder);
+  insertCheck(
+      builder.CreateICmpULE(Len, builder.getInt64(kMaxValidatedSize)),
+      Invalid, builder);
+
+  llvm::Value *Self = builder.CreatePointerCast(
+      SerializedSelf, s->getType()->getPointerTo(AddrSpace));
+  llvm::Value *Size = builder.CreateLoad(
+      builder.CreateStructGEP(Self, getSizeHeader(s)->offset));
+  insertCheck(builder.CreateAnd(builder.CreateICmpUGE(Size, StructSize),
+                                builder.CreateICmpULE(Size, Len)),
+              Invalid, builder);
+
+  // Every array and nested struct has to lie between the end of the struct
+  // and the end of the buffer, aligned the way the getters load it
+  for (auto &entry : structFields) {
+    if (!entry->isRepeated && !entry->isStruct) {
+      continue;
+    }
+    llvm::Value *Offset =
+        builder.CreateLoad(builder.CreateStructGEP(Self, entry->offset));
+    llvm::Type *DataType = entry->type->getPointerElementType();
+    const uint64_t Align = entry->isRepeated
+                               ? DL.getABITypeAlignment(DataType)
+                               : sizeof(uint64_t);
+    insertCheck(
+        builder.CreateAnd(
+            builder.CreateAnd(builder.CreateICmpUGE(Offset, StructSize),
+                              builder.CreateICmpULE(Offset, Size)),
+            builder.CreateICmpEQ(
+                builder.CreateAnd(Offset, builder.getInt64(Align - 1)),
+                builder.getInt64(0))),
+        Invalid, builder);
+
+    llvm::Value *Remaining = builder.CreateSub(Size, Offset);
+    if (entry->isRepeated) {
+      llvm::Value *Count = builder.CreateLoad(
+          builder.CreateStructGEP(Self, entry->countField->offset));
+      llvm::Value *MaxCount = builder.CreateUDiv(
+          Remaining, builder.getInt64(DL.getTypeAllocSize(DataType)));
+      insertCheck(builder.CreateICmpULE(Count, MaxCount), Invalid, builder);
+    } else {
+      llvm::Function *NestedValidator = llvm::cast<llvm::Function>(
+          m_parent_->getOrInsertFunction(
+              "validate_" + DataType->getStructName().str(), ValidatorType));
+      insertCheck(
+          builder.CreateCall(NestedValidator,
+                             {builder.CreateGEP(SerializedSelf, Offset),
+                              Remaining}),
+          Invalid, builder);
+    }
+  }
+
+  builder.CreateRet(builder.getInt1(true));
+
+  return true;
+}
+
 tyr::ir::Pass::Ptr tyr::pass::createLLVMIRGenPass(tyr::Module &Parent) {
   return llvm::make_unique<tyr::pass::LLVMIRGenPass>(
       Parent.getModule(), std::move(Parent.getBuiltins()));
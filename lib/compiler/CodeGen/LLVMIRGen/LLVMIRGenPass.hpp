@@ -54,6 +54,43 @@ public:
 private:
   llvm::Value *getFieldAllocSize(const ir::Field *f, llvm::Value *Struct,
                                  llvm::IRBuilder<> &builder) const;
+  llvm::Value *getFieldSerializedSize(const ir::Field *f, llvm::Value *Struct,
+                                      llvm::IRBuilder<> &builder) const;
+
+  llvm::Function *getVarintWriter() const;
+  llvm::Function *getVarintReader() const;
+  llvm::Function *getVarintValidator() const;
+
+  // The whole-array codecs are emitted once per element type as size,
+  // encode, decode and validate functions
+  enum StreamCoderKind {
+    kCoderSize = 0,
+    kCoderEncode,
+    kCoderDecode,
+    kCoderValidate
+  };
+  llvm::Function *getXorCoder(llvm::Type *ElementType,
+                              StreamCoderKind Kind) const;
+  llvm::Function *getDictCoder(llvm::Type *ElementType,
+                               StreamCoderKind Kind) const;
+
+  // Copies one chunk of a repeated field to the wire, run on the thread pool
+  // for big fields when the parallel runtime has been linked in
+  llvm::Function *getChunkCopier(llvm::Type *ElementType, bool Delta) const;
+
+  llvm::Value *getBitStorage(const ir::Field *f, llvm::Value *Struct,
+                             llvm::IRBuilder<> &builder) const;
+  llvm::Value *loadField(const ir::Field *f, llvm::Value *Struct,
+                         llvm::IRBuilder<> &builder) const;
+  void storeField(const ir::Field *f, llvm::Value *Struct, llvm::Value *Val,
+                  llvm::IRBuilder<> &builder) const;
+
+  // Lazy structs only decode a repeated field the first time it's used
+  llvm::Function *getSkipper(const ir::Field *f) const;
+  llvm::Function *getLazyLoader(const ir::Field *f) const;
+  void insertLazyLoad(const ir::Field *f, llvm::Value *Self,
+                      llvm::Value *ReturnFail,
+                      llvm::IRBuilder<> &builder) const;
 
   bool initField(const ir::Field *f, llvm::Value *Struct, llvm::Argument *Arg,
                  llvm::IRBuilder<> &builder);
@@ -67,15 +104,52 @@ private:
 
   std::string getSerializerName(const ir::Field *f) const;
   std::string getDeserializerName(const ir::Field *f) const;
+  std::string getValidatorName(const ir::Field *f) const;
 
   bool getSerializer(const ir::Field *f) const;
   bool getDeserializer(const ir::Field *f) const;
+  bool getValidator(const ir::Field *f) const;
 
   uint64_t getStructAllocSize(const ir::Struct *s);
   bool getConstructor(const ir::Struct *s);
   bool getDestructor(const ir::Struct *s);
   bool getSerializer(const ir::Struct *s);
-  bool getDeserializer(const ir::Struct *s);
+  // What serialize_<name> writes for Self and how big it is, the repeated
+  // fields of a lazy struct have to have been loaded first
+  llvm::Value *getStructSerializedSize(const ir::Struct *s, llvm::Value *Self,
+                                       llvm::IRBuilder<> &builder) const;
+  void writeStruct(const ir::Struct *s, llvm::Value *Self, llvm::Value *Size,
+                   llvm::Value *Out, llvm::IRBuilder<> &builder) const;
+  bool getBase64Serializer(const ir::Struct *s);
+  // Writes to a file descriptor without building the whole buffer first
+  bool getFdSerializer(const ir::Struct *s);
+  bool getDeserializer(const ir::Struct *s, bool Projected = false);
+  bool getValidator(const ir::Struct *s);
+  bool getBoundedDeserializer(const ir::Struct *s);
+
+  // A tracked struct can send just what changed since the last delta
+  bool getDeltaSerializer(const ir::Struct *s);
+  bool getDeltaApplier(const ir::Struct *s);
+
+  // Many structs in one buffer, behind a single header
+  bool getBatchSerializer(const ir::Struct *s);
+  bool getBatchDeserializer(const ir::Struct *s);
+
+  // A lazy struct decoded all at once, so it doesn't need the buffer after
+  bool getEagerDeserializer(const ir::Struct *s);
+
+  // Decodes a message that arrives in pieces, buffering it only when it
+  // doesn't come in whole
+  bool getDecoder(const ir::Struct *s);
+  llvm::Value *decodeWhole(const ir::Struct *s, llvm::Value *Buf,
+                           llvm::Value *Size, llvm::IRBuilder<> &builder) const;
+
+  // A frozen struct is its own serialized form, so it's created in one piece
+  // and copied whole
+  bool getFrozenConstructor(const ir::Struct *s);
+  bool getFrozenSerializer(const ir::Struct *s);
+  bool getFrozenDeserializer(const ir::Struct *s, bool Projected);
+  bool getFrozenValidator(const ir::Struct *s);
 
 private:
   llvm::Module *m_parent_ = nullptr;
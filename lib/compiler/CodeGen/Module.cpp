@@ -179,6 +179,9 @@ llvm::Type *tyr::Module::parseType(llvm::StringRef FieldType, bool IsRepeated) {
 namespace {
 const std::string TYR_FILE_HELPER_FILE = "tyr-rt-file.bc";
 const std::string TYR_BASE64_FILE = "tyr-rt-base64.bc";
+const std::string TYR_COMPRESS_FILE = "tyr-rt-compress.bc";
+const std::string TYR_PARALLEL_FILE = "tyr-rt-parallel.bc";
+const std::string TYR_ASYNC_FILE = "tyr-rt-async.bc";
 
 std::unique_ptr<llvm::Module>
 getModuleFromFile(llvm::LLVMContext &ctx, const llvm::StringRef filename,
@@ -208,7 +211,7 @@ bool tyr::Module::linkRuntimeModules(const llvm::StringRef Directory,
                                      uint32_t options) {
   llvm::Linker Linker{*m_parent_};
 
-  llvm::SmallVector<std::unique_ptr<llvm::Module>, 3> OutsideModules = {};
+  llvm::SmallVector<std::unique_ptr<llvm::Module>, 5> OutsideModules = {};
 
   if (rt::isFileEnabled(options)) { // link in the file helpers
     llvm::SmallVector<char, 0> path{Directory.begin(), Directory.end()};
@@ -230,6 +233,36 @@ bool tyr::Module::linkRuntimeModules(const llvm::StringRef Directory,
         getModuleFromFile(m_ctx_, Filename, m_parent_->getTargetTriple()));
   }
 
+  if (rt::isCompressEnabled(options)) { // link in the compressor
+    llvm::SmallVector<char, 0> path{Directory.begin(), Directory.end()};
+    llvm::sys::path::append(path, TYR_COMPRESS_FILE);
+    llvm::sys::fs::make_absolute(path);
+    const std::string Filename{path.begin(), path.end()};
+
+    OutsideModules.push_back(
+        getModuleFromFile(m_ctx_, Filename, m_parent_->getTargetTriple()));
+  }
+
+  if (rt::isParallelEnabled(options)) { // link in the thread pool
+    llvm::SmallVector<char, 0> path{Directory.begin(), Directory.end()};
+    llvm::sys::path::append(path, TYR_PARALLEL_FILE);
+    llvm::sys::fs::make_absolute(path);
+    const std::string Filename{path.begin(), path.end()};
+
+    OutsideModules.push_back(
+        getModuleFromFile(m_ctx_, Filename, m_parent_->getTargetTriple()));
+  }
+
+  if (rt::isAsyncEnabled(options)) { // link in the async file queue
+    llvm::SmallVector<char, 0> path{Directory.begin(), Directory.end()};
+    llvm::sys::path::append(path, TYR_ASYNC_FILE);
+    llvm::sys::fs::make_absolute(path);
+    const std::string Filename{path.begin(), path.end()};
+
+    OutsideModules.push_back(
+        getModuleFromFile(m_ctx_, Filename, m_parent_->getTargetTriple()));
+  }
+
   if (!OutsideModules.empty()) {
     for (auto &OM : OutsideModules) {
       bool LinkFailed = Linker.linkInModule(std::move(OM));
@@ -282,3 +315,15 @@ bool tyr::rt::isFileEnabled(uint32_t options) {
 bool tyr::rt::isB64Enabled(uint32_t options) {
   return (options & (0b1u << 1u)) >> 1u == 1u;
 }
+
+bool tyr::rt::isCompressEnabled(uint32_t options) {
+  return (options & (0b1u << 2u)) >> 2u == 1u;
+}
+
+bool tyr::rt::isParallelEnabled(uint32_t options) {
+  return (options & (0b1u << 3u)) >> 3u == 1u;
+}
+
+bool tyr::rt::isAsyncEnabled(uint32_t options) {
+  return (options & (0b1u << 4u)) >> 4u == 1u;
+}
@@ -77,6 +77,9 @@ llvm::ExecutionEngine *getExecutionEngine(llvm::Module *Parent);
 namespace rt {
 bool isFileEnabled(uint32_t options);
 bool isB64Enabled(uint32_t options);
+bool isCompressEnabled(uint32_t options);
+bool isParallelEnabled(uint32_t options);
+bool isAsyncEnabled(uint32_t options);
 } // namespace rt
 } // namespace tyr
 
@@ -27,12 +27,28 @@
 #include <llvm/IR/Type.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <algorithm>
+
 tyr::ir::Struct::Struct(llvm::StringRef name) : m_name_(name) {}
 
 void tyr::ir::Struct::setIsPacked(bool isPacked) { m_packed_ = isPacked; }
 
+void tyr::ir::Struct::setIsBitPacked(bool isBitPacked) {
+  m_bitpacked_ = isBitPacked;
+}
+
+void tyr::ir::Struct::setIsVarint(bool isVarint) { m_varint_ = isVarint; }
+
+void tyr::ir::Struct::setIsLazy(bool isLazy) { m_lazy_ = isLazy; }
+
+void tyr::ir::Struct::setIsIndexed(bool isIndexed) { m_indexed_ = isIndexed; }
+
+void tyr::ir::Struct::setIsFrozen(bool isFrozen) { m_frozen_ = isFrozen; }
+
+void tyr::ir::Struct::setIsTracked(bool isTracked) { m_tracked_ = isTracked; }
+
 void tyr::ir::Struct::addField(llvm::StringRef name, llvm::Type *type,
-                               bool isMutable) {
+                               bool isMutable, uint32_t encoding) {
   llvm::LLVMContext &ctx = type->getContext();
 
   // Insert the new field (and set the count field)
@@ -40,6 +56,7 @@ void tyr::ir::Struct::addField(llvm::StringRef name, llvm::Type *type,
   f.name = name;
   f.type = type;
   f.isMutable = isMutable;
+  f.encoding = encoding;
   f.isRepeated = false;
   f.isStruct =
       type->isPointerTy() && type->getPointerElementType()->isStructTy();
@@ -52,7 +69,7 @@ void tyr::ir::Struct::addField(llvm::StringRef name, llvm::Type *type,
 }
 
 void tyr::ir::Struct::addRepeatedField(llvm::StringRef name, llvm::Type *type,
-                                       bool isMutable) {
+                                       bool isMutable, uint32_t encoding) {
   llvm::LLVMContext &ctx = type->getContext();
 
   // Insert the count for the field first
@@ -76,6 +93,7 @@ void tyr::ir::Struct::addRepeatedField(llvm::StringRef name, llvm::Type *type,
   f.name = name;
   f.type = type;
   f.isMutable = isMutable;
+  f.encoding = encoding;
   f.isRepeated = true;
   f.isStruct = false;
   f.isCount = false;
@@ -96,7 +114,189 @@ uint64_t getFieldSize(const tyr::ir::Field *f, llvm::Module *Parent) {
 }
 } // namespace
 
+void tyr::ir::Struct::packBitFields(llvm::Module *Parent) {
+  llvm::LLVMContext &ctx = Parent->getContext();
+
+  // Every scalar integer field is packed back to back (in declaration order)
+  // into one byte array, so an int13 takes exactly 13 bits and a bool 1 bit
+  uint32_t NumBits = 0;
+  llvm::SmallVector<Field *, 8> Packed;
+  for (auto &entry : m_fields_) {
+    // Repeated odd width integers get the matching wire encoding, unless the
+    // field asked for one that can't be combined with it
+    llvm::Type *ElementType = entry->isRepeated
+                                  ? entry->type->getPointerElementType()
+                                  : entry->type;
+    if (entry->isRepeated && ElementType->isIntegerTy() &&
+        ElementType->getIntegerBitWidth() % 8 != 0 &&
+        !(entry->encoding & (kEncodingVarint | kEncodingDictionary))) {
+      entry->encoding |= kEncodingBitPacked;
+    }
+
+    if (!entry->type->isIntegerTy() || entry->isRepeated || entry->isCount ||
+        (entry->encoding & kEncodingVarint)) {
+      continue;
+    }
+    entry->bitOffset = NumBits;
+    NumBits += entry->type->getIntegerBitWidth();
+    Packed.push_back(entry.get());
+  }
+
+  if (Packed.empty()) {
+    return;
+  }
+
+  Field storage = {};
+  storage.name = "__bitfield";
+  storage.type = llvm::ArrayType::get(llvm::Type::getInt8Ty(ctx),
+                                      (NumBits + 7) / 8);
+  storage.isMutable = true;
+  storage.isRepeated = false;
+  storage.isStruct = false;
+  storage.isCount = false;
+  storage.isBitStorage = true;
+  storage.parentType = nullptr;
+  storage.offset = 0;
+
+  m_fields_.push_back(llvm::make_unique<Field>(storage));
+  Field *StoragePtr = m_fields_.rbegin()->get();
+
+  for (Field *f : Packed) {
+    f->storageField = StoragePtr;
+  }
+}
+
+void tyr::ir::Struct::markVarintFields() {
+  // Anything that fits in a byte can't get any smaller, and bit packed or
+  // dictionary fields are already as small as they get
+  for (auto &entry : m_fields_) {
+    llvm::Type *ElementType = entry->isRepeated
+                                  ? entry->type->getPointerElementType()
+                                  : entry->type;
+    if (!ElementType->isIntegerTy() || entry->isCount ||
+        entry->storageField != nullptr ||
+        (entry->encoding & (kEncodingBitPacked | kEncodingDictionary))) {
+      continue;
+    }
+    const uint32_t Width = ElementType->getIntegerBitWidth();
+    if (Width > 8 && Width <= 64) {
+      entry->encoding |= kEncodingVarint;
+    }
+  }
+}
+
+void tyr::ir::Struct::addPendingFields(llvm::Module *Parent) {
+  llvm::LLVMContext &ctx = Parent->getContext();
+  const uint32_t AddrSpace =
+      Parent->getDataLayout().getProgramAddressSpace();
+
+  llvm::SmallVector<Field *, 8> Repeated;
+  for (auto &entry : m_fields_) {
+    if (entry->isRepeated) {
+      Repeated.push_back(entry.get());
+    }
+  }
+
+  for (Field *f : Repeated) {
+    Field pending = {};
+    pending.name = f->name + "_pending";
+    pending.type = llvm::Type::getInt8PtrTy(ctx, AddrSpace);
+    pending.isMutable = true;
+    pending.isRepeated = false;
+    pending.isStruct = false;
+    pending.isCount = false;
+    pending.isPending = true;
+    pending.parentType = nullptr;
+    pending.offset = 0;
+
+    m_fields_.push_back(llvm::make_unique<Field>(pending));
+    f->pendingField = m_fields_.rbegin()->get();
+  }
+}
+
+void tyr::ir::Struct::freezeFields(llvm::Module *Parent) {
+  for (auto &entry : m_fields_) {
+    entry->isFrozen = true;
+  }
+
+  Field size = {};
+  size.name = m_name_ + "_size";
+  size.type = llvm::Type::getInt64Ty(Parent->getContext());
+  size.isMutable = false;
+  size.isRepeated = false;
+  size.isStruct = false;
+  size.isCount = false;
+  size.isFrozen = true;
+  size.isSizeHeader = true;
+  size.parentType = nullptr;
+  size.offset = 0;
+
+  m_fields_.push_back(llvm::make_unique<Field>(size));
+}
+
+void tyr::ir::Struct::addDirtyState(llvm::Module *Parent) {
+  // One word for the mask and two for each repeated field's range
+  uint32_t NumWords = 1;
+  for (auto &entry : m_fields_) {
+    if (entry->isRepeated) {
+      entry->dirtyRange = NumWords;
+      NumWords += 2;
+    }
+  }
+
+  Field dirty = {};
+  dirty.name = "__dirty";
+  dirty.type = llvm::ArrayType::get(
+      llvm::Type::getInt64Ty(Parent->getContext()), NumWords);
+  dirty.isMutable = true;
+  dirty.isRepeated = false;
+  dirty.isStruct = false;
+  dirty.isCount = false;
+  dirty.isDirtyState = true;
+  dirty.parentType = nullptr;
+  dirty.offset = 0;
+
+  m_fields_.push_back(llvm::make_unique<Field>(dirty));
+  Field *DirtyPtr = m_fields_.rbegin()->get();
+
+  for (auto &entry : m_fields_) {
+    if (entry.get() != DirtyPtr) {
+      entry->dirtyField = DirtyPtr;
+    }
+  }
+}
+
+void tyr::ir::Struct::markDirtyBits() {
+  // The mask bits are the field mask bits, so they depend on the final order
+  for (auto &entry : m_fields_) {
+    entry->dirtyBit = getFieldMask(entry.get());
+  }
+}
+
 void tyr::ir::Struct::finalizeFields(llvm::Module *Parent) {
+  // A bitpacked struct is always packed as well, otherwise the padding would
+  // eat most of what we saved
+  if (m_bitpacked_) {
+    m_packed_ = true;
+    packBitFields(Parent);
+  }
+
+  if (m_varint_) {
+    markVarintFields();
+  }
+
+  if (m_lazy_) {
+    addPendingFields(Parent);
+  }
+
+  if (m_frozen_) {
+    freezeFields(Parent);
+  }
+
+  if (m_tracked_) {
+    addDirtyState(Parent);
+  }
+
   // Order the entries by size of field
   std::sort(m_fields_.begin(), m_fields_.end(),
             [Parent](const std::unique_ptr<Field> &lhs,
@@ -105,8 +305,21 @@ void tyr::ir::Struct::finalizeFields(llvm::Module *Parent) {
                      getFieldSize(rhs.get(), Parent);
             });
 
+  // The size of a frozen struct has to come first, same as on the wire
+  std::stable_partition(
+      m_fields_.begin(), m_fields_.end(),
+      [](const std::unique_ptr<Field> &f) { return f->isSizeHeader; });
+
   llvm::SmallVector<llvm::Type *, 0> element_types;
   for (auto &entry : m_fields_) {
+    if (entry->storageField != nullptr) { // lives inside the storage field
+      continue;
+    }
+    if (entry->isFrozen && (entry->isRepeated || entry->isStruct)) {
+      // An offset into the struct's own buffer
+      element_types.push_back(llvm::Type::getInt64Ty(Parent->getContext()));
+      continue;
+    }
     element_types.push_back(entry->type);
   }
 
@@ -117,9 +330,23 @@ void tyr::ir::Struct::finalizeFields(llvm::Module *Parent) {
   uint32_t offset = 0;
   for (auto &entry : m_fields_) {
     entry->parentType = m_type_;
+    if (entry->storageField != nullptr) {
+      continue;
+    }
     entry->offset = offset;
     ++offset;
   }
+
+  // Bit packed fields share the element of their storage field
+  for (auto &entry : m_fields_) {
+    if (entry->storageField != nullptr) {
+      entry->offset = entry->storageField->offset;
+    }
+  }
+
+  if (m_tracked_) {
+    markDirtyBits();
+  }
 }
 
 llvm::ArrayRef<tyr::ir::FieldPtr> tyr::ir::Struct::getFields() const {
@@ -130,6 +357,69 @@ const llvm::StringRef tyr::ir::Struct::getName() const { return m_name_; }
 
 llvm::StructType *tyr::ir::Struct::getType() const { return m_type_; }
 
+bool tyr::ir::Struct::isBitPacked() const { return m_bitpacked_; }
+
+bool tyr::ir::Struct::isVarint() const { return m_varint_; }
+
+bool tyr::ir::Struct::isLazy() const { return m_lazy_; }
+
+bool tyr::ir::Struct::isIndexed() const { return m_indexed_; }
+
+bool tyr::ir::Struct::isFrozen() const { return m_frozen_; }
+
+bool tyr::ir::Struct::isTracked() const { return m_tracked_; }
+
+uint64_t tyr::ir::Struct::getFieldMask(const Field *f) const {
+  // Bit storage goes on the wire as one, so it stands for every field in it
+  if (f->isBitStorage) {
+    uint64_t Mask = 0;
+    for (auto &entry : m_fields_) {
+      if (entry->storageField == f) {
+        Mask |= getFieldMask(entry.get());
+      }
+    }
+    return Mask;
+  }
+
+  // Every field the user declared gets the next bit, in the order they're
+  // laid out. There are only 64 to go around.
+  uint32_t Bit = 0;
+  for (auto &entry : m_fields_) {
+    if (entry->isCount || entry->isBitStorage || entry->isPending ||
+        entry->isSizeHeader || entry->isDirtyState) {
+      continue;
+    }
+    if (entry.get() == f) {
+      return Bit < 64 ? 1ull << Bit : 0;
+    }
+    ++Bit;
+  }
+  return 0;
+}
+
+uint64_t tyr::ir::Struct::getFingerprint() const {
+  // 64 bit FNV-1a over a description of each field, in wire order
+  std::string Description;
+  llvm::raw_string_ostream os(Description);
+  os << m_name_ << (m_indexed_ ? " indexed" : "")
+     << (m_frozen_ ? " frozen" : "") << "\n";
+  for (auto &entry : m_fields_) {
+    if (entry->isPending || entry->isDirtyState) { // never on the wire
+      continue;
+    }
+    entry->type->print(os);
+    os << " " << entry->name << " " << entry->encoding << " "
+       << entry->isRepeated << " " << entry->bitOffset << "\n";
+  }
+  os.flush();
+
+  uint64_t Hash = 0xcbf29ce484222325ull;
+  for (unsigned char c : Description) {
+    Hash = (Hash ^ c) * 0x100000001b3ull;
+  }
+  return Hash;
+}
+
 llvm::raw_ostream &tyr::ir::operator<<(llvm::raw_ostream &os,
                                        const tyr::ir::Field &f) {
   os << (f.isMutable ? "isMutable " : "");
@@ -40,23 +40,77 @@ namespace tyr {
 namespace ir {
 using FieldPtr = std::unique_ptr<Field>;
 
+// Wire encodings that can be requested for a field, they are bit flags so that
+// compatible encodings can be combined
+enum FieldEncoding : uint32_t {
+  kEncodingNone = 0,
+  // Repeated integers are packed into a contiguous bitstream of their width
+  kEncodingBitPacked = 1u << 0u,
+  // Integers are written as LEB128 varints, 7 bits per byte
+  kEncodingVarint = 1u << 1u,
+  // The integer is signed, so varints are zigzag mapped first to keep small
+  // negative numbers small on the wire
+  kEncodingZigZag = 1u << 2u,
+  // Repeated integers are sent as the differences between neighbours, on top
+  // of whichever of the encodings above applies
+  kEncodingDelta = 1u << 3u,
+  // Repeated floats/doubles are sent as a Gorilla style stream of XORs with
+  // the previous value
+  kEncodingXor = 1u << 4u,
+  // Repeated integers with few distinct values are sent as a table of the
+  // values and a bit packed index per element
+  kEncodingDictionary = 1u << 5u,
+};
+
 class Struct {
 public:
   explicit Struct(llvm::StringRef name);
   virtual ~Struct() = default;
 
   void setIsPacked(bool isPacked);
-  void addField(llvm::StringRef name, llvm::Type *type, bool isMutable);
-  void addRepeatedField(llvm::StringRef name, llvm::Type *type, bool isMutable);
+  void setIsBitPacked(bool isBitPacked);
+  void setIsVarint(bool isVarint);
+  void setIsLazy(bool isLazy);
+  void setIsIndexed(bool isIndexed);
+  void setIsFrozen(bool isFrozen);
+  void setIsTracked(bool isTracked);
+  void addField(llvm::StringRef name, llvm::Type *type, bool isMutable,
+                uint32_t encoding = kEncodingNone);
+  void addRepeatedField(llvm::StringRef name, llvm::Type *type, bool isMutable,
+                        uint32_t encoding = kEncodingNone);
   void finalizeFields(llvm::Module *Parent);
 
   llvm::ArrayRef<FieldPtr> getFields() const;
   const llvm::StringRef getName() const;
   llvm::StructType *getType() const;
+  bool isBitPacked() const;
+  bool isVarint() const;
+  bool isLazy() const;
+  bool isIndexed() const;
+  bool isFrozen() const;
+  bool isTracked() const;
+  // The bit(s) standing for the field in a field mask, 0 if it has none
+  uint64_t getFieldMask(const Field *f) const;
+  // A hash of everything that decides the struct's wire format
+  uint64_t getFingerprint() const;
+
+private:
+  void packBitFields(llvm::Module *Parent);
+  void markVarintFields();
+  void addPendingFields(llvm::Module *Parent);
+  void freezeFields(llvm::Module *Parent);
+  void addDirtyState(llvm::Module *Parent);
+  void markDirtyBits();
 
 private:
   const std::string m_name_;
   bool m_packed_ = false;
+  bool m_bitpacked_ = false;
+  bool m_varint_ = false;
+  bool m_lazy_ = false;
+  bool m_indexed_ = false;
+  bool m_frozen_ = false;
+  bool m_tracked_ = false;
   llvm::StructType *m_type_ = nullptr;
 
   llvm::SmallVector<FieldPtr, 0> m_fields_;
@@ -67,6 +121,8 @@ struct Field {
   std::string name;
   llvm::Type *type;
   bool isMutable;
+  // Bitwise OR of FieldEncoding values, how the field goes on the wire
+  uint32_t encoding = kEncodingNone;
   // If it's a struct we have special handling
   bool isStruct;
   // Repeated fields
@@ -74,6 +130,28 @@ struct Field {
   bool isCount;
   Field *countField = nullptr;
   Field *countsFor = nullptr;
+  // Bit packed fields live inside of a shared byte array (the storage field)
+  // at bitOffset, and are not elements of the LLVM struct themselves
+  bool isBitStorage = false;
+  Field *storageField = nullptr;
+  uint32_t bitOffset = 0;
+  // Repeated fields of a lazy struct aren't decoded until they're first used,
+  // until then the pending field points at them in the serialized buffer
+  bool isPending = false;
+  Field *pendingField = nullptr;
+  // Fields of a frozen struct live in one buffer that starts with its size
+  // (the size header field). Repeated and struct fields hold the offset of
+  // their data from the start of the struct instead of a pointer to it.
+  bool isFrozen = false;
+  bool isSizeHeader = false;
+  // The setters of a tracked struct record what they change in its dirty
+  // state field: a mask of the fields set since the last delta, followed by
+  // the [lo, hi) range of items set in each repeated field (the pair starting
+  // at dirtyRange). dirtyBit is what the field sets in the mask.
+  bool isDirtyState = false;
+  Field *dirtyField = nullptr;
+  uint64_t dirtyBit = 0;
+  uint32_t dirtyRange = 0;
   // LLVM information
   llvm::StructType *parentType;
   uint32_t offset;
@@ -24,6 +24,8 @@
 
 #include "Module.hpp"
 
+#include <llvm/ADT/StringExtras.h>
+
 #include <sstream>
 
 tyr::Parser::Parser(tyr::Module &generator)
@@ -66,7 +68,7 @@ bool tyr::Parser::parseFile(std::istream &input) {
     }
 
     llvm::SmallVector<llvm::StringRef, 4> tokens;
-    lineRef.split(tokens, " ");
+    lineRef.split(tokens, " ", -1, false);
 
     if (!insideComment) {
       if (!parseLine(tokens)) {
@@ -82,17 +84,89 @@ bool tyr::Parser::parseFile(std::istream &input) {
 
 namespace {
 bool addField(tyr::Module &m, const llvm::StringRef StructName, bool IsMutable,
-              bool IsRepeated, llvm::StringRef FieldType,
+              bool IsRepeated, uint32_t Encoding, llvm::StringRef FieldType,
               llvm::StringRef FieldName) {
   llvm::Type *FT = m.parseType(FieldType, IsRepeated);
   if (FT == nullptr) {
     return false;
   }
 
+  if ((Encoding & tyr::ir::kEncodingBitPacked) &&
+      (!IsRepeated || !FT->getPointerElementType()->isIntegerTy())) {
+    llvm::errs() << "bitpacked fields must be repeated integers, use a "
+                    "bitpacked struct to pack scalars: "
+                 << FieldName << "\n";
+    return false;
+  }
+
+  llvm::Type *ElementType = IsRepeated ? FT->getPointerElementType() : FT;
+  if ((Encoding & tyr::ir::kEncodingVarint) &&
+      (!ElementType->isIntegerTy() ||
+       ElementType->getIntegerBitWidth() > 64 ||
+       (Encoding & tyr::ir::kEncodingBitPacked))) {
+    llvm::errs() << "varint fields must be (repeated) integers of at most 64 "
+                    "bits, and can't also be bitpacked: "
+                 << FieldName << "\n";
+    return false;
+  }
+
+  if ((Encoding & tyr::ir::kEncodingDelta) &&
+      (!IsRepeated || !ElementType->isIntegerTy())) {
+    llvm::errs() << "delta fields must be repeated integers: " << FieldName
+                 << "\n";
+    return false;
+  }
+
+  if ((Encoding & tyr::ir::kEncodingXor) &&
+      (!IsRepeated || !ElementType->isFloatingPointTy() ||
+       Encoding != tyr::ir::kEncodingXor)) {
+    llvm::errs() << "xor fields must be repeated floats or doubles, and can't "
+                    "use any other encoding: "
+                 << FieldName << "\n";
+    return false;
+  }
+
+  if ((Encoding & tyr::ir::kEncodingDictionary) &&
+      (!IsRepeated || !ElementType->isIntegerTy() ||
+       ElementType->getIntegerBitWidth() > 64 ||
+       Encoding != tyr::ir::kEncodingDictionary)) {
+    llvm::errs() << "dictionary fields must be repeated integers of at most 64 "
+                    "bits, and can't use any other encoding: "
+                 << FieldName << "\n";
+    return false;
+  }
+
+  // A frozen struct is used straight from its buffer, so everything in it has
+  // to be laid out the same as in memory
+  if (m.getOrCreateStruct(StructName)->isFrozen()) {
+    if (Encoding != tyr::ir::kEncodingNone) {
+      llvm::errs() << "fields of a frozen struct are stored as they are in "
+                      "memory, they can't have an encoding: "
+                   << FieldName << "\n";
+      return false;
+    }
+    if (ElementType->isPointerTy() &&
+        (IsRepeated || !m.getOrCreateStruct(ElementType->getPointerElementType()
+                                                ->getStructName())
+                            ->isFrozen())) {
+      llvm::errs() << "frozen structs can only hold (non-repeated) frozen "
+                      "structs: "
+                   << FieldName << "\n";
+      return false;
+    }
+  }
+
+  // Signed integers get zigzag mapped if they end up varint encoded
+  if (ElementType->isIntegerTy() && FieldType.startswith_lower("int")) {
+    Encoding |= tyr::ir::kEncodingZigZag;
+  }
+
   if (IsRepeated) {
-    m.getOrCreateStruct(StructName)->addRepeatedField(FieldName, FT, IsMutable);
+    m.getOrCreateStruct(StructName)
+        ->addRepeatedField(FieldName, FT, IsMutable, Encoding);
   } else {
-    m.getOrCreateStruct(StructName)->addField(FieldName, FT, IsMutable);
+    m.getOrCreateStruct(StructName)
+        ->addField(FieldName, FT, IsMutable, Encoding);
   }
 
   return true;
@@ -108,40 +182,92 @@ bool tyr::Parser::parseLine(const llvm::ArrayRef<llvm::StringRef> tokens) {
 
     const llvm::StringRef StructName = tokens[1];
     m_current_struct_ = m_module_.getOrCreateStruct(StructName);
-    m_current_struct_->setIsPacked(tokens.size() == 3 && tokens[2] == "packed");
+
+    // struct <name> <modifiers...> {
+    for (const llvm::StringRef &tok : tokens.drop_front(2)) {
+      if (tok == "packed") {
+        m_current_struct_->setIsPacked(true);
+      } else if (tok == "bitpacked") {
+        m_current_struct_->setIsBitPacked(true);
+      } else if (tok == "varint") {
+        m_current_struct_->setIsVarint(true);
+      } else if (tok == "lazy") {
+        m_current_struct_->setIsLazy(true);
+      } else if (tok == "indexed") {
+        m_current_struct_->setIsIndexed(true);
+      } else if (tok == "frozen") {
+        m_current_struct_->setIsFrozen(true);
+      } else if (tok == "tracked") {
+        m_current_struct_->setIsTracked(true);
+      } else if (tok != "{") {
+        llvm::errs() << "Unknown struct modifier: " << tok << "\n";
+        return false;
+      }
+    }
+
+    if (m_current_struct_->isFrozen() &&
+        (m_current_struct_->isBitPacked() || m_current_struct_->isVarint() ||
+         m_current_struct_->isLazy() || m_current_struct_->isIndexed() ||
+         m_current_struct_->isTracked())) {
+      llvm::errs() << "frozen structs can't also be bitpacked, varint, lazy, "
+                      "indexed or tracked: "
+                   << StructName << "\n";
+      return false;
+    }
     return true;
   }
 
   if (tokens[0] == "}") {
     m_current_struct_->finalizeFields(m_module_.getModule());
+    // A tracked struct marks changes in a 64 bit mask, one bit per field
+    if (m_current_struct_->isTracked()) {
+      for (auto &f : m_current_struct_->getFields()) {
+        if (f->dirtyField != nullptr && f->dirtyBit == 0 && !f->isCount &&
+            !f->isPending) {
+          llvm::errs() << "tracked structs can have at most 64 fields: "
+                       << m_current_struct_->getName() << "\n";
+          return false;
+        }
+      }
+    }
     m_current_struct_ = nullptr;
     return true;
   }
 
   bool IsMut = false;
   bool IsRepeated = false;
-  std::string FieldTy;
+  uint32_t Encoding = ir::kEncodingNone;
 
-  if (tokens[0] == "mutable" || tokens[1] == "mutable") {
-    IsMut = true;
-  }
-
-  if (tokens[0] == "repeated" || tokens[1] == "repeated") {
-    IsRepeated = true;
+  // <modifiers...> <type> <name>, where the name defaults to the type
+  llvm::ArrayRef<llvm::StringRef> rest = tokens;
+  for (; !rest.empty(); rest = rest.drop_front()) {
+    if (rest.front() == "mutable") {
+      IsMut = true;
+    } else if (rest.front() == "repeated") {
+      IsRepeated = true;
+    } else if (rest.front() == "bitpacked") {
+      Encoding |= ir::kEncodingBitPacked;
+    } else if (rest.front() == "varint") {
+      Encoding |= ir::kEncodingVarint;
+    } else if (rest.front() == "delta") {
+      Encoding |= ir::kEncodingDelta;
+    } else if (rest.front() == "xor") {
+      Encoding |= ir::kEncodingXor;
+    } else if (rest.front() == "dictionary") {
+      Encoding |= ir::kEncodingDictionary;
+    } else {
+      break;
+    }
   }
 
-  if (IsMut && IsRepeated) {
-    // mutable repeated <type>
-    FieldTy = tokens[2];
-  } else if (IsMut || IsRepeated) {
-    // mutable <type> or repeated <type>
-    FieldTy = tokens[1];
-  } else {
-    // <type>
-    FieldTy = tokens[0];
+  if (rest.empty() || rest.size() > 2) {
+    llvm::errs() << "Expected <modifiers> <type> <name>, got: "
+                 << llvm::join(tokens.begin(), tokens.end(), " ") << "\n";
+    return false;
   }
 
-  std::string FieldName = *tokens.rbegin();
+  const llvm::StringRef FieldTy = rest.front();
+  const llvm::StringRef FieldName = rest.back();
   return addField(m_module_, m_current_struct_->getName(), IsMut, IsRepeated,
-                  FieldTy, FieldName);
+                  Encoding, FieldTy, FieldName);
 }
@@ -36,11 +36,14 @@ class Struct;
 
 /*
  * This class is set up to handle things that look like
- * struct thing <packed> {
+ * struct thing <packed> <bitpacked> <varint> <lazy> <indexed> <tracked> {
  *   mutable repeated int8 bytes
  *   int16 someint
  *   mutable float myfloat
+ *   repeated dictionary int32 category
  * }
+ * where a frozen struct takes no modifiers other than packed
+ * struct thing <packed> frozen {
  */
 
 class Parser {
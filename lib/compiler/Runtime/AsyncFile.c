@@ -0,0 +1,584 @@
+//
+// tyr
+// Copyright (c) 2019 Aman LaChapelle
+// Full license at tyr/LICENSE.txt
+//
+
+/*
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+// syscall(), MAP_POPULATE and the io_uring syscall numbers aren't POSIX
+#define _GNU_SOURCE
+
+#include "AsyncFile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Building with TYR_NO_IO_URING defined always uses the worker threads, as do
+// kernel headers from before 5.6, which can't open, read or close files
+// through the ring (IORING_FEAT_RW_CUR_POS came in with those)
+#if defined(__linux__) && !defined(TYR_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_FEAT_RW_CUR_POS)
+#define TYR_IO_URING 1
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#endif
+
+#define TYR_ASYNC_DEFAULT_DEPTH 64
+#define TYR_ASYNC_MAX_DEPTH 4096
+#define TYR_ASYNC_THREADS 4
+// A single read or write never asks for more than this
+#define TYR_ASYNC_MAX_IO (1u << 30u)
+
+enum { TYR_ASYNC_WRITE, TYR_ASYNC_READ };
+enum { TYR_STEP_OPEN, TYR_STEP_IO, TYR_STEP_CLOSE };
+
+typedef struct tyr_async_op {
+  struct tyr_async_op *next;
+  int kind;
+  int step;
+  int fd;
+  bool ok;
+  char *filename;
+  uint8_t *buf;
+  uint64_t len;
+  uint64_t done;
+  bounded_deserializer_fn d;
+  void *user_data;
+  void *tyr_struct_ptr;
+} tyr_async_op;
+
+#ifdef TYR_IO_URING
+typedef struct tyr_ring {
+  int fd;
+  uint32_t to_submit;
+  uint32_t *sq_tail;
+  uint32_t *sq_mask;
+  uint32_t *sq_array;
+  struct io_uring_sqe *sqes;
+  uint32_t *cq_head;
+  uint32_t *cq_tail;
+  uint32_t *cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_map;
+  size_t sq_map_len;
+  void *cq_map;
+  size_t cq_map_len;
+  size_t sqes_len;
+} tyr_ring;
+#endif
+
+struct tyr_async {
+  uint32_t depth;
+  uint32_t pending; // submitted and not reaped yet
+  // Finished requests waiting to be reaped. The workers add to it under lock,
+  // with io_uring only the owning thread touches it.
+  tyr_async_op *done_head;
+  tyr_async_op *done_tail;
+#ifdef TYR_IO_URING
+  tyr_ring ring; // ring.fd is -1 when the workers are used instead
+  uint32_t inflight;
+#endif
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+  tyr_async_op *work_head;
+  tyr_async_op *work_tail;
+  pthread_t threads[TYR_ASYNC_THREADS];
+  uint32_t nthreads;
+  bool quit;
+};
+
+static void push_op(tyr_async_op **head, tyr_async_op **tail,
+                    tyr_async_op *op) {
+  op->next = NULL;
+  if (*tail == NULL) {
+    *head = op;
+  } else {
+    (*tail)->next = op;
+  }
+  *tail = op;
+}
+
+static tyr_async_op *pop_op(tyr_async_op **head, tyr_async_op **tail) {
+  tyr_async_op *op = *head;
+  if (op != NULL) {
+    *head = op->next;
+    if (*head == NULL) {
+      *tail = NULL;
+    }
+  }
+  return op;
+}
+
+// Reads get deserialized here, and the buffers go either way
+static void finish_op(tyr_async_op *op) {
+  if (op->ok && op->kind == TYR_ASYNC_READ) {
+    op->tyr_struct_ptr = op->d(op->buf, op->len);
+    if (op->tyr_struct_ptr == NULL) {
+      printf("Deserializing %s failed\n", op->filename);
+      op->ok = false;
+    }
+  }
+  free(op->buf);
+  op->buf = NULL;
+}
+
+// Sizes the read buffer once the file is open
+static bool prepare_read(tyr_async_op *op) {
+  struct stat st;
+  if (fstat(op->fd, &st) != 0 || st.st_size <= 0) {
+    printf("File %s is empty or can't be read\n", op->filename);
+    return false;
+  }
+  op->len = (uint64_t)st.st_size;
+  op->buf = (uint8_t *)malloc(op->len);
+  return op->buf != NULL;
+}
+
+static void run_blocking(tyr_async_op *op) {
+  const bool writing = op->kind == TYR_ASYNC_WRITE;
+  const int flags = writing ? O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC
+                             : O_RDONLY | O_CLOEXEC;
+  op->fd = open(op->filename, flags, 0644);
+  if (op->fd < 0) {
+    printf("Opening file %s failed with error code %d\n", op->filename, errno);
+    op->ok = false;
+    finish_op(op);
+    return;
+  }
+
+  op->ok = writing || prepare_read(op);
+  while (op->ok && op->done < op->len) {
+    uint64_t left = op->len - op->done;
+    size_t chunk = left < TYR_ASYNC_MAX_IO ? (size_t)left : TYR_ASYNC_MAX_IO;
+    ssize_t moved = writing ? write(op->fd, op->buf + op->done, chunk)
+                            : read(op->fd, op->buf + op->done, chunk);
+    if (moved < 0 && errno == EINTR) {
+      continue;
+    }
+    if (moved <= 0) {
+      printf("I/O on %s failed with error code %d\n", op->filename, errno);
+      op->ok = false;
+      break;
+    }
+    op->done += (uint64_t)moved;
+  }
+
+  if (close(op->fd) != 0) {
+    op->ok = false;
+  }
+  finish_op(op);
+}
+
+static void *async_worker(void *arg) {
+  tyr_async *q = (tyr_async *)arg;
+  pthread_mutex_lock(&q->lock);
+  while (true) {
+    while (!q->quit && q->work_head == NULL) {
+      pthread_cond_wait(&q->work_cond, &q->lock);
+    }
+    tyr_async_op *op = pop_op(&q->work_head, &q->work_tail);
+    if (op == NULL) {
+      break; // quitting and nothing left to do
+    }
+    pthread_mutex_unlock(&q->lock);
+    run_blocking(op);
+    pthread_mutex_lock(&q->lock);
+    push_op(&q->done_head, &q->done_tail, op);
+    pthread_cond_signal(&q->done_cond);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return NULL;
+}
+
+#ifdef TYR_IO_URING
+static bool ring_init(tyr_ring *r, uint32_t entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  memset(r, 0, sizeof(*r));
+  r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (r->fd < 0) {
+    r->fd = -1;
+    return false;
+  }
+  // Opening and closing files through the ring came in with the same kernel
+  // as this feature, older ones get the workers
+  if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+    close(r->fd);
+    r->fd = -1;
+    return false;
+  }
+
+  r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+  r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single && r->cq_map_len > r->sq_map_len) {
+    r->sq_map_len = r->cq_map_len;
+  }
+  r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  r->cq_map = single ? r->sq_map
+                     : mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, r->fd,
+                            IORING_OFF_CQ_RING);
+  r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_len,
+                                        PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, r->fd,
+                                        IORING_OFF_SQES);
+  if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED ||
+      r->sqes == MAP_FAILED) {
+    if (r->sqes != MAP_FAILED) {
+      munmap(r->sqes, r->sqes_len);
+    }
+    if (!single && r->cq_map != MAP_FAILED) {
+      munmap(r->cq_map, r->cq_map_len);
+    }
+    if (r->sq_map != MAP_FAILED) {
+      munmap(r->sq_map, r->sq_map_len);
+    }
+    close(r->fd);
+    r->fd = -1;
+    return false;
+  }
+
+  uint8_t *sq = (uint8_t *)r->sq_map;
+  uint8_t *cq = (uint8_t *)r->cq_map;
+  r->sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+  r->sq_mask = (uint32_t *)(sq + p.sq_off.ring_mask);
+  r->sq_array = (uint32_t *)(sq + p.sq_off.array);
+  r->cq_head = (uint32_t *)(cq + p.cq_off.head);
+  r->cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+  r->cq_mask = (uint32_t *)(cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return true;
+}
+
+static void ring_free(tyr_ring *r) {
+  munmap(r->sqes, r->sqes_len);
+  if (r->cq_map != r->sq_map) {
+    munmap(r->cq_map, r->cq_map_len);
+  }
+  munmap(r->sq_map, r->sq_map_len);
+  close(r->fd);
+}
+
+// Submits whatever has been queued, and waits for at least wait completions
+static bool ring_enter(tyr_ring *r, uint32_t wait) {
+  while (true) {
+    long submitted =
+        syscall(__NR_io_uring_enter, r->fd, r->to_submit, wait,
+                wait > 0 ? IORING_ENTER_GETEVENTS : 0u, NULL, 0);
+    if (submitted >= 0) {
+      r->to_submit -= (uint32_t)submitted;
+      return true;
+    }
+    if (errno != EINTR) {
+      printf("io_uring_enter failed with error code %d\n", errno);
+      return false;
+    }
+  }
+}
+
+// Queues the next step of op. A request only ever has one step in the ring
+// and there are no more requests than entries, so there's always room.
+static void ring_queue(tyr_ring *r, tyr_async_op *op) {
+  const uint32_t tail = *r->sq_tail;
+  const uint32_t idx = tail & *r->sq_mask;
+  struct io_uring_sqe *sqe = &r->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = (uint64_t)(uintptr_t)op;
+
+  if (op->step == TYR_STEP_OPEN) {
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)op->filename;
+    sqe->len = 0644; // the mode
+    sqe->open_flags = op->kind == TYR_ASYNC_WRITE
+                          ? O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC
+                          : O_RDONLY | O_CLOEXEC;
+  } else if (op->step == TYR_STEP_IO) {
+    const uint64_t left = op->len - op->done;
+    sqe->opcode =
+        op->kind == TYR_ASYNC_WRITE ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = op->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(op->buf + op->done);
+    sqe->len = left < TYR_ASYNC_MAX_IO ? (uint32_t)left : TYR_ASYNC_MAX_IO;
+    sqe->off = op->done;
+  } else {
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = op->fd;
+  }
+
+  r->sq_array[idx] = idx;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ++r->to_submit;
+}
+
+// Moves op on to its next step given how the last one went
+static void ring_advance(tyr_async *q, tyr_async_op *op, int32_t res) {
+  if (op->step == TYR_STEP_OPEN) {
+    if (res < 0) {
+      printf("Opening file %s failed with error code %d\n", op->filename,
+             -res);
+      op->ok = false;
+      finish_op(op);
+      --q->inflight;
+      push_op(&q->done_head, &q->done_tail, op);
+      return;
+    }
+    op->fd = res;
+    // fstat on an open file doesn't wait on the disk, so it's done here
+    // rather than as another trip through the ring
+    op->ok = op->kind == TYR_ASYNC_WRITE || prepare_read(op);
+    op->step = op->ok ? TYR_STEP_IO : TYR_STEP_CLOSE;
+  } else if (op->step == TYR_STEP_IO) {
+    if (res <= 0) {
+      printf("I/O on %s failed with error code %d\n", op->filename, -res);
+      op->ok = false;
+    } else {
+      op->done += (uint64_t)res;
+    }
+    if (!op->ok || op->done == op->len) {
+      op->step = TYR_STEP_CLOSE;
+    }
+  } else {
+    if (res < 0) {
+      op->ok = false;
+    }
+    finish_op(op);
+    --q->inflight;
+    push_op(&q->done_head, &q->done_tail, op);
+    return;
+  }
+  ring_queue(&q->ring, op);
+}
+
+static void ring_poll(tyr_async *q) {
+  tyr_ring *r = &q->ring;
+  uint32_t head = *r->cq_head;
+  const uint32_t tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+    tyr_async_op *op = (tyr_async_op *)(uintptr_t)cqe->user_data;
+    const int32_t res = cqe->res;
+    ++head;
+    ring_advance(q, op, res);
+  }
+  __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+#endif
+
+tyr_async *tyr_async_create(uint32_t depth) {
+  if (depth == 0) {
+    depth = TYR_ASYNC_DEFAULT_DEPTH;
+  } else if (depth > TYR_ASYNC_MAX_DEPTH) {
+    depth = TYR_ASYNC_MAX_DEPTH;
+  }
+
+  tyr_async *q = (tyr_async *)calloc(1, sizeof(tyr_async));
+  if (q == NULL) {
+    return NULL;
+  }
+  q->depth = depth;
+  if (pthread_mutex_init(&q->lock, NULL) != 0) {
+    free(q);
+    return NULL;
+  }
+  pthread_cond_init(&q->work_cond, NULL);
+  pthread_cond_init(&q->done_cond, NULL);
+
+#ifdef TYR_IO_URING
+  if (ring_init(&q->ring, depth)) {
+    return q;
+  }
+#endif
+
+  for (uint32_t i = 0; i < TYR_ASYNC_THREADS; ++i) {
+    if (pthread_create(&q->threads[q->nthreads], NULL, &async_worker, q) ==
+        0) {
+      ++q->nthreads;
+    }
+  }
+  if (q->nthreads == 0) {
+    printf("Starting the async file workers failed\n");
+    tyr_async_destroy(q);
+    return NULL;
+  }
+  return q;
+}
+
+static tyr_async_op *new_op(tyr_async *q, int kind, const char *filename,
+                            void *user_data) {
+  if (q->pending >= q->depth) {
+    return NULL;
+  }
+  tyr_async_op *op = (tyr_async_op *)calloc(1, sizeof(tyr_async_op));
+  if (op == NULL) {
+    return NULL;
+  }
+  op->filename = strdup(filename);
+  if (op->filename == NULL) {
+    free(op);
+    return NULL;
+  }
+  op->kind = kind;
+  op->step = TYR_STEP_OPEN;
+  op->fd = -1;
+  op->ok = true;
+  op->user_data = user_data;
+  return op;
+}
+
+static void free_op(tyr_async_op *op) {
+  free(op->buf);
+  free(op->filename);
+  free(op);
+}
+
+static void submit_op(tyr_async *q, tyr_async_op *op) {
+  ++q->pending;
+#ifdef TYR_IO_URING
+  if (q->ring.fd >= 0) {
+    ++q->inflight;
+    ring_queue(&q->ring, op);
+    // If this fails the entry stays queued and goes in with the next one
+    ring_enter(&q->ring, 0);
+    return;
+  }
+#endif
+  pthread_mutex_lock(&q->lock);
+  push_op(&q->work_head, &q->work_tail, op);
+  pthread_cond_signal(&q->work_cond);
+  pthread_mutex_unlock(&q->lock);
+}
+
+bool tyr_async_serialize_to_file(tyr_async *q, const char *filename,
+                                 serializer_fn s, void *tyr_struct_ptr,
+                                 void *user_data) {
+  tyr_async_op *op = new_op(q, TYR_ASYNC_WRITE, filename, user_data);
+  if (op == NULL) {
+    return false;
+  }
+  op->buf = s(tyr_struct_ptr);
+  if (op->buf == NULL) {
+    printf("Serializing struct failed, aborting\n");
+    free_op(op);
+    return false;
+  }
+  op->len = *(uint64_t *)op->buf;
+  submit_op(q, op);
+  return true;
+}
+
+bool tyr_async_deserialize_from_file(tyr_async *q, const char *filename,
+                                     bounded_deserializer_fn d,
+                                     void *user_data) {
+  tyr_async_op *op = new_op(q, TYR_ASYNC_READ, filename, user_data);
+  if (op == NULL) {
+    return false;
+  }
+  op->d = d;
+  submit_op(q, op);
+  return true;
+}
+
+static uint32_t take_done(tyr_async *q, tyr_async_result *results,
+                          uint32_t max) {
+  uint32_t n = 0;
+  tyr_async_op *op;
+  while (n < max && (op = pop_op(&q->done_head, &q->done_tail)) != NULL) {
+    results[n].user_data = op->user_data;
+    results[n].ok = op->ok;
+    results[n].tyr_struct_ptr = op->tyr_struct_ptr;
+    free_op(op);
+    ++n;
+  }
+  q->pending -= n;
+  return n;
+}
+
+uint32_t tyr_async_reap(tyr_async *q, tyr_async_result *results, uint32_t max,
+                        bool wait) {
+  if (max == 0) {
+    return 0;
+  }
+#ifdef TYR_IO_URING
+  if (q->ring.fd >= 0) {
+    ring_poll(q);
+    while (wait && q->done_head == NULL && q->inflight > 0) {
+      if (!ring_enter(&q->ring, 1)) {
+        break;
+      }
+      ring_poll(q);
+    }
+    // Hand the kernel the next steps of whatever just completed
+    if (q->ring.to_submit > 0) {
+      ring_enter(&q->ring, 0);
+    }
+    return take_done(q, results, max);
+  }
+#endif
+  pthread_mutex_lock(&q->lock);
+  while (wait && q->done_head == NULL && q->pending > 0) {
+    pthread_cond_wait(&q->done_cond, &q->lock);
+  }
+  const uint32_t n = take_done(q, results, max);
+  pthread_mutex_unlock(&q->lock);
+  return n;
+}
+
+uint32_t tyr_async_pending(tyr_async *q) { return q->pending; }
+
+void tyr_async_destroy(tyr_async *q) {
+  if (q == NULL) {
+    return;
+  }
+#ifdef TYR_IO_URING
+  if (q->ring.fd >= 0) {
+    while (q->inflight > 0 && ring_enter(&q->ring, 1)) {
+      ring_poll(q);
+    }
+    ring_free(&q->ring);
+  }
+#endif
+  pthread_mutex_lock(&q->lock);
+  q->quit = true;
+  pthread_cond_broadcast(&q->work_cond);
+  pthread_mutex_unlock(&q->lock);
+  for (uint32_t i = 0; i < q->nthreads; ++i) {
+    pthread_join(q->threads[i], NULL);
+  }
+
+  tyr_async_op *op;
+  while ((op = pop_op(&q->done_head, &q->done_tail)) != NULL) {
+    free_op(op);
+  }
+  pthread_cond_destroy(&q->done_cond);
+  pthread_cond_destroy(&q->work_cond);
+  pthread_mutex_destroy(&q->lock);
+  free(q);
+}
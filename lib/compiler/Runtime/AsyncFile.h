@@ -0,0 +1,132 @@
+//
+// tyr
+// Copyright (c) 2019 Aman LaChapelle
+// Full license at tyr/LICENSE.txt
+//
+
+/*
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+#ifndef TYR_ASYNC_FILE_H
+#define TYR_ASYNC_FILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint8_t *(*serializer_fn)(void *);
+typedef void *(*deserializer_fn)(uint8_t *);
+typedef void *(*bounded_deserializer_fn)(const uint8_t *, uint64_t);
+
+/**
+ * A queue of file reads and writes that run in the background. Requests are
+ * submitted with tyr_async_serialize_to_file and
+ * tyr_async_deserialize_from_file, which return straight away, and their
+ * results are collected later with tyr_async_reap. On Linux the file I/O is
+ * driven through io_uring, elsewhere (or if the kernel doesn't support it) a
+ * few worker threads do it with blocking calls instead.
+ *
+ * A queue belongs to one thread, the one that submits and reaps.
+ */
+typedef struct tyr_async tyr_async;
+
+/**
+ * The result of one finished request.
+ */
+typedef struct tyr_async_result {
+  void *user_data;      // as passed in when the request was submitted
+  bool ok;              // false if any step of the request failed
+  void *tyr_struct_ptr; // the struct that was read, NULL for writes
+} tyr_async_result;
+
+/**
+ * Creates a queue that holds up to \p depth requests at once, counting the
+ * finished ones that haven't been reaped yet.
+ *
+ * @param depth The most requests at a time, 0 for a default of 64
+ * @return The queue, or NULL if it couldn't be set up
+ */
+tyr_async *tyr_async_create(uint32_t depth);
+
+/**
+ * Serializes a tyr struct on the calling thread and writes it to a file in the
+ * background, creating or truncating the file. The struct can be changed or
+ * destroyed as soon as this returns.
+ *
+ * @param q The queue
+ * @param filename The file to write
+ * @param s The serializer for the tyr struct
+ * @param tyr_struct_ptr A pointer to the tyr struct
+ * @param user_data Handed back in the request's result
+ * @return false if the queue already holds \p depth requests that haven't
+ * been reaped or serializing failed, in which case nothing was submitted
+ */
+bool tyr_async_serialize_to_file(tyr_async *q, const char *filename,
+                                 serializer_fn s, void *tyr_struct_ptr,
+                                 void *user_data);
+
+/**
+ * Reads a file in the background and deserializes it. The whole file has to
+ * be one serialized struct, and \p d bounds checks it against the file's size.
+ *
+ * The caller is responsible for the struct handed back in the result. The
+ * queue frees what it read once \p d is done with it, so for a lazy struct
+ * \p d has to be deserialize_<struct_name>_eager_n.
+ *
+ * @param q The queue
+ * @param filename The file to read
+ * @param d The bounded deserializer, deserialize_<struct_name>_n
+ * @param user_data Handed back in the request's result
+ * @return false if the queue already holds \p depth requests that haven't
+ * been reaped, in which case nothing was submitted
+ */
+bool tyr_async_deserialize_from_file(tyr_async *q, const char *filename,
+                                     bounded_deserializer_fn d,
+                                     void *user_data);
+
+/**
+ * Collects the results of finished requests, in the order they finished.
+ *
+ * @param q The queue
+ * @param results Where to write the results
+ * @param max The most results to write
+ * @param wait Whether to block until at least one request has finished, if
+ * any are in flight
+ * @return The number of results written
+ */
+uint32_t tyr_async_reap(tyr_async *q, tyr_async_result *results, uint32_t max,
+                        bool wait);
+
+/**
+ * Returns the number of requests that have been submitted and not reaped yet.
+ */
+uint32_t tyr_async_pending(tyr_async *q);
+
+/**
+ * Waits for every request in flight, then frees the queue. Results that
+ * weren't reaped are dropped, so reap until tyr_async_pending is 0 first to
+ * get hold of every struct that was read.
+ *
+ * @param q The queue
+ */
+void tyr_async_destroy(tyr_async *q);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // TYR_ASYNC_FILE_H
@@ -23,86 +23,454 @@
 #include "Base64.h"
 
 #include <memory.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#define TYR_B64_X86 1
+#include <immintrin.h>
+#endif
+
 // We use the encoding from here: https://tools.ietf.org/html/rfc4648#section-5
 // so it's URL safe
-static inline uint8_t b64_index_to_char(uint32_t index) {
-  // 0-25 is capital letters, 26-51 is lowercase, 52-61 is numbers, 62 is '-'
-  // and 63 is '_', and I'm using 64 as '='
-  return (uint8_t)(
-      index + ('A' * (index < 26)) + (('a' - 26) * (index >= 26 & index < 52)) +
-      (('0' - 52) * (index >= 52 & index < 62)) + (('-' - 62) * (index == 62)) +
-      (('_' - 63) * (index == 63)) + (('=' - 64) * (index == 64)));
+static const uint8_t b64_alphabet[64] = {
+    'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
+    'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
+    'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm',
+    'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '-', '_'};
+
+// Maps a character back to its 6 bit index, 0xff marks characters outside of
+// the alphabet (including the '=' padding, which is handled separately)
+static const uint8_t b64_decode_table[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12,
+    0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0x3f,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24,
+    0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+    0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff,
+};
+
+// The encode kernels consume whole 3 byte groups and return how many input
+// bytes they used; the decode kernels consume whole 4 character groups
+// (without padding) and return how many characters they used. The vector
+// kernels stop early when they get near the end of a buffer and leave the rest
+// to the scalar kernels, the scalar decoder stops at the first group holding a
+// character outside of the alphabet.
+typedef uint64_t (*b64_kernel)(const uint8_t *in, uint64_t len, uint8_t *out);
+
+static uint64_t b64_encode_scalar(const uint8_t *in, uint64_t len,
+                                  uint8_t *out) {
+  uint64_t i = 0;
+  for (; len - i >= 3; i += 3) {
+    const uint32_t packed = ((uint32_t)in[i] << 16) |
+                            ((uint32_t)in[i + 1] << 8) | (uint32_t)in[i + 2];
+    out[0] = b64_alphabet[(packed >> 18) & 0x3f];
+    out[1] = b64_alphabet[(packed >> 12) & 0x3f];
+    out[2] = b64_alphabet[(packed >> 6) & 0x3f];
+    out[3] = b64_alphabet[packed & 0x3f];
+    out += 4;
+  }
+
+  return i;
+}
+
+static uint64_t b64_decode_scalar(const uint8_t *in, uint64_t len,
+                                  uint8_t *out) {
+  uint64_t i = 0;
+  for (; len - i >= 4; i += 4) {
+    const uint32_t a = b64_decode_table[in[i]];
+    const uint32_t b = b64_decode_table[in[i + 1]];
+    const uint32_t c = b64_decode_table[in[i + 2]];
+    const uint32_t d = b64_decode_table[in[i + 3]];
+    if ((a | b | c | d) > 0x3f) {
+      break;
+    }
+
+    const uint32_t packed = (a << 18) | (b << 12) | (c << 6) | d;
+    out[0] = (uint8_t)(packed >> 16);
+    out[1] = (uint8_t)(packed >> 8);
+    out[2] = (uint8_t)packed;
+    out += 3;
+  }
+
+  return i;
+}
+
+#ifdef TYR_B64_X86
+// Vector versions of the scalar kernels, following the approach from Muła and
+// Lemire, "Faster Base64 Encoding and Decoding Using AVX2 Instructions". The
+// 128 and 256 bit versions do the same thing per 128 bit lane.
+
+// Spreads 4 groups of 3 bytes out into 4 32 bit lanes of 6 bit indices
+#define TYR_B64_ENC_SHUFFLE                                                    \
+  1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10
+
+// Offsets from a reduced index to the character. Indices 0-25 reduce to 13,
+// 26-51 to 0, 52-61 to 1-10, 62 to 11 and 63 to 12.
+#define TYR_B64_ENC_OFFSETS                                                    \
+  71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -17, 32, 65, 0, 0
+
+// Gathers the 3 decoded bytes out of each 32 bit lane
+#define TYR_B64_DEC_SHUFFLE                                                    \
+  2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+
+__attribute__((target("ssse3"))) static inline __m128i
+b64_enc_translate_128(__m128i in) {
+  in = _mm_shuffle_epi8(in, _mm_setr_epi8(TYR_B64_ENC_SHUFFLE));
+  const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+  const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+  const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+  const __m128i indices = _mm_or_si128(t1, t3);
+
+  __m128i reduced = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+  reduced = _mm_or_si128(reduced, _mm_and_si128(less, _mm_set1_epi8(13)));
+  const __m128i offsets =
+      _mm_shuffle_epi8(_mm_setr_epi8(TYR_B64_ENC_OFFSETS), reduced);
+  return _mm_add_epi8(indices, offsets);
 }
 
-static inline uint32_t b64_char_to_index(uint8_t c) {
-  if ((c >= 'A') && (c <= 'Z')) {
-    return (uint32_t)(c - 'A');
-  } else if ((c >= 'a') && (c <= 'z')) {
-    return (uint32_t)(c - 'a' + 26);
-  } else if ((c >= '0') && (c <= '9')) {
-    return (uint32_t)(c - '0' + 52);
-  } else if (c == '-') {
-    return 62;
-  } else if (c == '_') {
-    return 63;
-  } else if (c == '=') {
-    return 64;
+__attribute__((target("ssse3"))) static uint64_t
+b64_encode_ssse3(const uint8_t *in, uint64_t len, uint8_t *out) {
+  uint64_t i = 0;
+  // Each load reads 16 bytes but only uses 12 of them
+  for (; len - i >= 16; i += 12) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    _mm_storeu_si128((__m128i *)out, b64_enc_translate_128(v));
+    out += 16;
   }
 
-  return 0;
+  return i;
+}
+
+// Bytes are compared as signed, so anything past 0x7f is never in range
+__attribute__((target("ssse3"))) static inline __m128i
+b64_in_range_128(__m128i in, char lo, char hi) {
+  return _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8((char)(lo - 1))),
+                       _mm_cmpgt_epi8(_mm_set1_epi8((char)(hi + 1)), in));
+}
+
+// Maps each character to its index, \p invalid gets a bit set for every
+// character that isn't in the alphabet
+__attribute__((target("ssse3"))) static inline __m128i
+b64_dec_translate_128(__m128i in, int *invalid) {
+  const __m128i upper = b64_in_range_128(in, 'A', 'Z');
+  const __m128i lower = b64_in_range_128(in, 'a', 'z');
+  const __m128i digit = b64_in_range_128(in, '0', '9');
+  const __m128i dash = _mm_cmpeq_epi8(in, _mm_set1_epi8('-'));
+  const __m128i under = _mm_cmpeq_epi8(in, _mm_set1_epi8('_'));
+
+  const __m128i valid = _mm_or_si128(
+      _mm_or_si128(upper, lower),
+      _mm_or_si128(digit, _mm_or_si128(dash, under)));
+  *invalid = _mm_movemask_epi8(valid) ^ 0xffff;
+
+  __m128i offsets = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+  offsets = _mm_or_si128(offsets,
+                         _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+  offsets = _mm_or_si128(offsets,
+                         _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+  offsets =
+      _mm_or_si128(offsets, _mm_and_si128(dash, _mm_set1_epi8(62 - '-')));
+  offsets =
+      _mm_or_si128(offsets, _mm_and_si128(under, _mm_set1_epi8(63 - '_')));
+  return _mm_add_epi8(in, offsets);
+}
+
+__attribute__((target("ssse3"))) static uint64_t
+b64_decode_ssse3(const uint8_t *in, uint64_t len, uint8_t *out) {
+  uint64_t i = 0;
+  // Each store writes 16 bytes but only 12 of them are output, so keep a group
+  // of slack at the end
+  for (; len - i >= 20; i += 16) {
+    int invalid = 0;
+    const __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    const __m128i indices = b64_dec_translate_128(v, &invalid);
+    if (invalid) {
+      break;
+    }
+
+    const __m128i merged =
+        _mm_maddubs_epi16(indices, _mm_set1_epi32(0x01400140));
+    const __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    _mm_storeu_si128((__m128i *)out,
+                     _mm_shuffle_epi8(packed,
+                                      _mm_setr_epi8(TYR_B64_DEC_SHUFFLE)));
+    out += 12;
+  }
+
+  return i;
+}
+
+__attribute__((target("avx2"))) static uint64_t
+b64_encode_avx2(const uint8_t *in, uint64_t len, uint8_t *out) {
+  const __m256i shuffle =
+      _mm256_setr_epi8(TYR_B64_ENC_SHUFFLE, TYR_B64_ENC_SHUFFLE);
+  const __m256i lut =
+      _mm256_setr_epi8(TYR_B64_ENC_OFFSETS, TYR_B64_ENC_OFFSETS);
+
+  uint64_t i = 0;
+  // The upper lane is loaded from 12 bytes in, so we read 28 bytes and use 24
+  for (; len - i >= 28; i += 24) {
+    const __m128i lo = _mm_loadu_si128((const __m128i *)(in + i));
+    const __m128i hi = _mm_loadu_si128((const __m128i *)(in + i + 12));
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+    v = _mm256_shuffle_epi8(v, shuffle);
+    const __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+    const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    const __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+    const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    const __m256i indices = _mm256_or_si256(t1, t3);
+
+    __m256i reduced = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    reduced = _mm256_or_si256(reduced,
+                              _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    _mm256_storeu_si256(
+        (__m256i *)out,
+        _mm256_add_epi8(indices, _mm256_shuffle_epi8(lut, reduced)));
+    out += 32;
+  }
+
+  return i;
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+b64_in_range_256(__m256i in, char lo, char hi) {
+  return _mm256_and_si256(
+      _mm256_cmpgt_epi8(in, _mm256_set1_epi8((char)(lo - 1))),
+      _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(hi + 1)), in));
+}
+
+__attribute__((target("avx2"))) static uint64_t
+b64_decode_avx2(const uint8_t *in, uint64_t len, uint8_t *out) {
+  const __m256i gather =
+      _mm256_setr_epi8(TYR_B64_DEC_SHUFFLE, TYR_B64_DEC_SHUFFLE);
+
+  uint64_t i = 0;
+  // Each store writes 32 bytes but only 24 of them are output, so keep two
+  // groups of slack at the end
+  for (; len - i >= 40; i += 32) {
+    const __m256i in_v = _mm256_loadu_si256((const __m256i *)(in + i));
+
+    const __m256i upper = b64_in_range_256(in_v, 'A', 'Z');
+    const __m256i lower = b64_in_range_256(in_v, 'a', 'z');
+    const __m256i digit = b64_in_range_256(in_v, '0', '9');
+    const __m256i dash = _mm256_cmpeq_epi8(in_v, _mm256_set1_epi8('-'));
+    const __m256i under = _mm256_cmpeq_epi8(in_v, _mm256_set1_epi8('_'));
+
+    const __m256i valid = _mm256_or_si256(
+        _mm256_or_si256(upper, lower),
+        _mm256_or_si256(digit, _mm256_or_si256(dash, under)));
+    if (_mm256_movemask_epi8(valid) != -1) {
+      break;
+    }
+
+    __m256i offsets = _mm256_and_si256(upper, _mm256_set1_epi8(-'A'));
+    offsets = _mm256_or_si256(
+        offsets, _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+    offsets = _mm256_or_si256(
+        offsets, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+    offsets = _mm256_or_si256(
+        offsets, _mm256_and_si256(dash, _mm256_set1_epi8(62 - '-')));
+    offsets = _mm256_or_si256(
+        offsets, _mm256_and_si256(under, _mm256_set1_epi8(63 - '_')));
+    const __m256i indices = _mm256_add_epi8(in_v, offsets);
+
+    const __m256i merged =
+        _mm256_maddubs_epi16(indices, _mm256_set1_epi32(0x01400140));
+    __m256i packed = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+    packed = _mm256_shuffle_epi8(packed, gather);
+    // Close the 4 byte hole at the end of the lower lane
+    packed = _mm256_permutevar8x32_epi32(
+        packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+    _mm256_storeu_si256((__m256i *)out, packed);
+    out += 24;
+  }
+
+  return i;
+}
+#endif // TYR_B64_X86
+
+static b64_kernel b64_resolve_encoder(void) {
+#ifdef TYR_B64_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return b64_encode_avx2;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    return b64_encode_ssse3;
+  }
+#endif
+  return b64_encode_scalar;
+}
+
+static b64_kernel b64_resolve_decoder(void) {
+#ifdef TYR_B64_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return b64_decode_avx2;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    return b64_decode_ssse3;
+  }
+#endif
+  return b64_decode_scalar;
+}
+
+// The CPU doesn't change, so each kernel is picked on first use and kept.
+// Threads racing on the first use all store the same pointer.
+static _Atomic(b64_kernel) b64_encoder;
+static _Atomic(b64_kernel) b64_decoder;
+
+static b64_kernel b64_select_encoder(void) {
+  b64_kernel k = atomic_load_explicit(&b64_encoder, memory_order_relaxed);
+  if (k == NULL) {
+    k = b64_resolve_encoder();
+    atomic_store_explicit(&b64_encoder, k, memory_order_relaxed);
+  }
+  return k;
+}
+
+static b64_kernel b64_select_decoder(void) {
+  b64_kernel k = atomic_load_explicit(&b64_decoder, memory_order_relaxed);
+  if (k == NULL) {
+    k = b64_resolve_decoder();
+    atomic_store_explicit(&b64_decoder, k, memory_order_relaxed);
+  }
+  return k;
+}
+
+// Encodes the last 1 or 2 bytes of a buffer into a padded group
+static void b64_encode_padded(const uint8_t *in, uint64_t len, uint8_t *out) {
+  const uint32_t packed =
+      ((uint32_t)in[0] << 16) | (len > 1 ? (uint32_t)in[1] << 8 : 0);
+  out[0] = b64_alphabet[(packed >> 18) & 0x3f];
+  out[1] = b64_alphabet[(packed >> 12) & 0x3f];
+  out[2] = len > 1 ? b64_alphabet[(packed >> 6) & 0x3f] : '=';
+  out[3] = '=';
+}
+
+uint64_t tyr_b64_encoded_len(uint64_t len) {
+  return (len / 3 + (len % 3 != 0)) * 4;
+}
+
+void tyr_b64_stream_init(tyr_b64_stream *stream, uint8_t *out, uint64_t cap) {
+  memset(stream, 0, sizeof(tyr_b64_stream));
+  stream->out = out;
+  stream->cap = cap;
+}
+
+bool tyr_b64_stream_update(tyr_b64_stream *stream, const uint8_t *chunk,
+                           uint64_t len) {
+  if (stream->overflow) {
+    return false;
+  }
+
+  const uint64_t groups = (stream->carry_len + len) / 3;
+  if (stream->cap - stream->len < groups * 4) {
+    stream->overflow = true;
+    return false;
+  }
+
+  // Top up a group left over from the last chunk
+  if (stream->carry_len != 0) {
+    while (stream->carry_len < 3 && len != 0) {
+      stream->carry[stream->carry_len++] = *chunk++;
+      --len;
+    }
+    if (stream->carry_len < 3) {
+      return true;
+    }
+    b64_encode_scalar(stream->carry, 3, stream->out + stream->len);
+    stream->len += 4;
+    stream->carry_len = 0;
+  }
+
+  uint8_t *out = stream->out + stream->len;
+  uint64_t done = b64_select_encoder()(chunk, len, out);
+  done += b64_encode_scalar(chunk + done, len - done, out + done / 3 * 4);
+  stream->len += done / 3 * 4;
+
+  memcpy(stream->carry, chunk + done, len - done);
+  stream->carry_len = (uint8_t)(len - done);
+
+  return true;
+}
+
+uint64_t tyr_b64_stream_finish(tyr_b64_stream *stream) {
+  if (stream->overflow) {
+    return 0;
+  }
+
+  if (stream->carry_len != 0) {
+    if (stream->cap - stream->len < 4) {
+      stream->overflow = true;
+      return 0;
+    }
+    b64_encode_padded(stream->carry, stream->carry_len,
+                      stream->out + stream->len);
+    stream->len += 4;
+    stream->carry_len = 0;
+  }
+
+  return stream->len;
 }
 
 uint8_t *tyr_serialize_to_base64(serializer_fn s, void *tyr_struct_ptr) {
-  const uint8_t *serialized = s(tyr_struct_ptr);
+  uint8_t *serialized = s(tyr_struct_ptr);
   if (serialized == NULL) {
     printf("Serializing struct failed, aborting\n");
     return NULL;
   }
 
-  const uint8_t *serialized_ptr = serialized + sizeof(uint64_t);
-
   // First 64 bits are the length of the whole buffer (including the first 64
   // bits)
-  uint64_t serialized_len = *((uint64_t *)serialized);
+  const uint64_t serialized_len = *((uint64_t *)serialized);
+  const uint64_t b64_len = tyr_b64_encoded_len(serialized_len);
 
-  const uint64_t num_pad = (3 - (serialized_len % 3)) % 3;
-  const uint64_t packed_size = serialized_len / 3 + (serialized_len % 3 != 0);
-  const uint64_t b64_len = packed_size * 4;
-
-  uint8_t *b64_str = calloc(b64_len + sizeof(uint64_t), sizeof(uint8_t));
+  uint8_t *b64_str = malloc(b64_len + sizeof(uint64_t));
+  if (b64_str == NULL) {
+    printf("Allocating the base64 buffer failed, aborting\n");
+    free(serialized);
+    return NULL;
+  }
 
   // Set the beginning to be the total size of the buffer
   *(uint64_t *)b64_str = b64_len;
 
-  // Now we have a byte string, so we need to b64 encode it
-  // Pack each 3 8bit item into a 32bit int, then unpack it into 6 bit indices
-  size_t str_iter = 0;
-  size_t b64_iter = 0;
-  uint8_t *b64_ptr = b64_str + sizeof(uint64_t);
-  uint32_t packed = 0;
-  for (size_t i = 0; i < packed_size; ++i) {
-    packed = 0;
-    // Parse the chars one at a time and pack them into a uint32_t
-    for (int8_t j = 2; j >= 0; --j) {
-      packed |=
-          ((str_iter < serialized_len) * (uint32_t)(serialized_ptr[str_iter]))
-          << (8 * j);
-      ++str_iter;
-    }
+  // We encode serialized_len bytes starting after the size header, the last
+  // 8 of those are always zero. They don't carry anything, but the decoder
+  // relies on them to recover the size header.
+  const uint8_t zeros[sizeof(uint64_t)] = {0};
+  tyr_b64_stream stream;
+  tyr_b64_stream_init(&stream, b64_str + sizeof(uint64_t), b64_len);
+  tyr_b64_stream_update(&stream, serialized + sizeof(uint64_t),
+                        serialized_len - sizeof(uint64_t));
+  tyr_b64_stream_update(&stream, zeros, sizeof(uint64_t));
+  tyr_b64_stream_finish(&stream);
 
-    for (int8_t k = 3; k >= 0; --k) {
-      // If we've gotten into the padding bits then use a 64 value to indicate
-      // to the converter to give us a padding character
-      uint32_t masked = (b64_iter >= (b64_len - num_pad))
-                            ? 64
-                            : ((packed & (0b111111 << (k * 6))) >> (k * 6));
-      b64_ptr[b64_iter] = b64_index_to_char(masked);
-      ++b64_iter;
-    }
-  }
+  free(serialized);
 
   return b64_str;
 }
@@ -110,7 +478,7 @@ uint8_t *tyr_serialize_to_base64(serializer_fn s, void *tyr_struct_ptr) {
 void *tyr_deserialize_from_base64(deserializer_fn d,
                                   const uint8_t *b64_serialized_object) {
   const uint64_t b64_len = *(uint64_t *)b64_serialized_object;
-  if (b64_len % 4 != 0) {
+  if (b64_len % 4 != 0 || b64_len == 0) {
     printf("String length is not a multiple of 4, b64 decoding failed\n");
     return NULL;
   }
@@ -119,44 +487,45 @@ void *tyr_deserialize_from_base64(deserializer_fn d,
 
   uint8_t *decoded_serialized =
       malloc(str_len * sizeof(uint8_t) + sizeof(uint64_t));
-  memset(decoded_serialized, 0, str_len * sizeof(uint8_t) + sizeof(uint64_t));
+  if (decoded_serialized == NULL) {
+    printf("Allocating the decode buffer failed, aborting\n");
+    return NULL;
+  }
   uint8_t *decoded_serialized_ptr = decoded_serialized + sizeof(uint64_t);
-
-  uint32_t packed = 0;
-  uint64_t b64_iter = 0;
   const uint8_t *b64_ptr = b64_serialized_object + sizeof(uint64_t);
-  uint64_t decoded_iter = 0;
-  uint8_t num_pad = 0;
-  for (size_t i = 0; i < b64_len; i += 4) {
-    packed = 0;
-    for (int8_t j = 3; j >= 0; --j) {
-      uint32_t b64_index = b64_char_to_index(b64_ptr[b64_iter]);
-      if (b64_index == 64) {
-        ++num_pad;
-        continue;
-      }
-      packed |= ((b64_index != 64) * b64_index)
-                << (6 * j); // Do nothing if b64_index is 0 or 64
-      ++b64_iter;
-    }
 
-    for (int8_t k = 2; k >= 0; --k) {
-      decoded_serialized_ptr[decoded_iter] =
-          (uint8_t)((packed & (0xff << (8 * k))) >> (8 * k));
-      ++decoded_iter;
-    }
+  // Everything but the last group is unpadded, so it can go through the
+  // kernels as-is
+  const uint64_t body_len = b64_len - 4;
+  uint64_t done =
+      b64_select_decoder()(b64_ptr, body_len, decoded_serialized_ptr);
+  done += b64_decode_scalar(b64_ptr + done, body_len - done,
+                            decoded_serialized_ptr + done / 4 * 3);
+
+  const uint8_t *last = b64_ptr + body_len;
+  const uint8_t num_pad = (last[3] == '=') + (last[3] == '=' && last[2] == '=');
+  uint8_t group[4] = {last[0], last[1], last[2], last[3]};
+  for (uint8_t i = 0; i < num_pad; ++i) {
+    group[3 - i] = 'A';
   }
 
+  uint8_t last_out[3];
+  if (done != body_len || b64_decode_scalar(group, 4, last_out) != 4) {
+    printf("Invalid base64 character, b64 decoding failed\n");
+    free(decoded_serialized);
+    return NULL;
+  }
+  memcpy(decoded_serialized_ptr + body_len / 4 * 3, last_out, 3);
+
   const uint64_t real_str_len = str_len - num_pad;
   *(uint64_t *)decoded_serialized = real_str_len;
 
   void *deserialized = d(decoded_serialized);
+  free(decoded_serialized);
   if (deserialized == NULL) {
     printf("Deserializing struct failed, aborting\n");
     return NULL;
   }
 
-  free(decoded_serialized);
-
   return deserialized;
 }
@@ -27,6 +27,7 @@
 extern "C" {
 #endif // __cplusplus
 
+#include <stdbool.h>
 #include <stdint.h>
 
 typedef uint8_t *(*serializer_fn)(void *);
@@ -52,7 +53,8 @@ uint8_t *tyr_serialize_to_base64(serializer_fn s, void *tyr_struct_ptr);
 
 /**
  * Deserialized a tyr struct from a base64url array. The caller is responsible
- * for memory returned from this function.
+ * for memory returned from this function. The decoded bytes only live until
+ * this returns, so pass deserialize_<struct_name>_eager for a lazy struct.
  *
  * @param d The deserializer function to use.
  * @param b64_serialized_object The base64url encoded and serialized object that
@@ -62,6 +64,63 @@ uint8_t *tyr_serialize_to_base64(serializer_fn s, void *tyr_struct_ptr);
 void *tyr_deserialize_from_base64(deserializer_fn d,
                                   const uint8_t *b64_serialized_object);
 
+/**
+ * Incremental base64url encoder state. Treat the members as private, they are
+ * only exposed so the state can live on the stack.
+ */
+typedef struct tyr_b64_stream {
+  uint8_t *out;
+  uint64_t cap;
+  uint64_t len;
+  uint8_t carry[3];
+  uint8_t carry_len;
+  bool overflow;
+} tyr_b64_stream;
+
+/**
+ * @param len The number of bytes to encode
+ * @return The number of base64url characters (including padding) that \p len
+ * bytes encode to.
+ */
+uint64_t tyr_b64_encoded_len(uint64_t len);
+
+/**
+ * Starts a new base64url stream that writes into \p out. The output is plain
+ * text, it is neither length prefixed nor NUL terminated.
+ *
+ * @param stream The stream state to initialize
+ * @param out Where to write the encoded characters
+ * @param cap The capacity of \p out
+ */
+void tyr_b64_stream_init(tyr_b64_stream *stream, uint8_t *out, uint64_t cap);
+
+/**
+ * Encodes the next \p len bytes of the stream. Chunks can be any size, up to
+ * 2 trailing bytes are held back until the next call or
+ * tyr_b64_stream_finish.
+ *
+ * The chunks may live in the output buffer itself: if a stream of n bytes is
+ * laid out starting tyr_b64_encoded_len(n) - n bytes into \p out, the encoder
+ * never overwrites a byte before reading it. This allows encoding in place.
+ *
+ * @param stream The stream to write to
+ * @param chunk The bytes to encode
+ * @param len The number of bytes in \p chunk
+ * @return false if the output capacity was exceeded, after which the stream
+ * only reports failure.
+ */
+bool tyr_b64_stream_update(tyr_b64_stream *stream, const uint8_t *chunk,
+                           uint64_t len);
+
+/**
+ * Flushes the held back bytes along with any padding.
+ *
+ * @param stream The stream to finish
+ * @return The total number of characters written to the output, or 0 if the
+ * output capacity was exceeded.
+ */
+uint64_t tyr_b64_stream_finish(tyr_b64_stream *stream);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
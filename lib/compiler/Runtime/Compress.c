@@ -0,0 +1,280 @@
+//
+// tyr
+// Copyright (c) 2019 Aman LaChapelle
+// Full license at tyr/LICENSE.txt
+//
+
+/*
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+#include "Compress.h"
+
+#include <memory.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// The block format is a sequence of (literal run, back reference) pairs in the
+// style of LZ4. Each pair starts with a token byte whose high nibble is the
+// literal run length and whose low nibble is the match length minus
+// TYR_MIN_MATCH. A nibble of 15 means more length bytes follow, each adding up
+// to 255 and stopping at the first byte that isn't 255. The literals come next,
+// then a little endian 16 bit offset back into the output, then the extra
+// match length bytes. The final pair only has literals.
+#define TYR_MIN_MATCH 4
+#define TYR_MAX_OFFSET 65535
+#define TYR_HASH_BITS 12
+// Keep the last few bytes as literals so the compressor never reads a 4 byte
+// window past the end of the input.
+#define TYR_LAST_LITERALS 5
+#define TYR_MIN_INPUT 12
+
+static inline uint32_t read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(uint32_t));
+  return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+  return (v * 2654435761u) >> (32 - TYR_HASH_BITS);
+}
+
+static inline uint8_t *write_length(uint8_t *op, uint64_t len) {
+  while (len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+// Reads the extra length bytes that follow a nibble of 15, returns false if
+// they run off the end of the block.
+static inline bool read_length(const uint8_t **ip, const uint8_t *end,
+                               uint64_t *len) {
+  uint8_t b;
+  do {
+    if (*ip >= end) {
+      return false;
+    }
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+  return true;
+}
+
+static uint8_t *write_sequence(uint8_t *op, const uint8_t *literals,
+                               uint64_t lit_len, uint64_t offset,
+                               uint64_t match_len) {
+  uint8_t *token = op++;
+  *token = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+  if (lit_len >= 15) {
+    op = write_length(op, lit_len - 15);
+  }
+
+  memcpy(op, literals, lit_len);
+  op += lit_len;
+
+  if (match_len == 0) { // final literal run
+    return op;
+  }
+
+  *op++ = (uint8_t)(offset & 0xff);
+  *op++ = (uint8_t)(offset >> 8);
+
+  const uint64_t ml = match_len - TYR_MIN_MATCH;
+  *token |= (uint8_t)(ml >= 15 ? 15 : ml);
+  if (ml >= 15) {
+    op = write_length(op, ml - 15);
+  }
+
+  return op;
+}
+
+uint64_t tyr_compress_bound(uint64_t src_len) {
+  return src_len + src_len / 255 + 16;
+}
+
+uint64_t tyr_compress_block(const uint8_t *src, uint64_t src_len, uint8_t *dst,
+                            uint64_t dst_cap) {
+  if (dst_cap < tyr_compress_bound(src_len)) {
+    printf("Compression buffer too small, aborting\n");
+    return 0;
+  }
+
+  uint8_t *op = dst;
+  uint64_t anchor = 0;
+
+  if (src_len >= TYR_MIN_INPUT) {
+    uint64_t table[1u << TYR_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    const uint64_t match_limit = src_len - TYR_LAST_LITERALS;
+    const uint64_t search_limit = match_limit - TYR_MIN_MATCH;
+    uint64_t ip = 0;
+    while (ip < search_limit) {
+      const uint32_t seq = read32(src + ip);
+      const uint32_t h = hash32(seq);
+      const uint64_t candidate = table[h];
+      table[h] = ip;
+
+      if (candidate >= ip || ip - candidate > TYR_MAX_OFFSET ||
+          read32(src + candidate) != seq) {
+        ++ip;
+        continue;
+      }
+
+      uint64_t match_len = TYR_MIN_MATCH;
+      while (ip + match_len < match_limit &&
+             src[candidate + match_len] == src[ip + match_len]) {
+        ++match_len;
+      }
+
+      op = write_sequence(op, src + anchor, ip - anchor, ip - candidate,
+                          match_len);
+      ip += match_len;
+      anchor = ip;
+    }
+  }
+
+  op = write_sequence(op, src + anchor, src_len - anchor, 0, 0);
+  return (uint64_t)(op - dst);
+}
+
+uint64_t tyr_decompress_block(const uint8_t *src, uint64_t src_len,
+                              uint8_t *dst, uint64_t dst_len) {
+  const uint8_t *ip = src;
+  const uint8_t *const src_end = src + src_len;
+  uint8_t *op = dst;
+  uint8_t *const dst_end = dst + dst_len;
+
+  while (ip < src_end) {
+    const uint8_t token = *ip++;
+
+    uint64_t lit_len = token >> 4;
+    if (lit_len == 15 && !read_length(&ip, src_end, &lit_len)) {
+      return 0;
+    }
+    if (lit_len > (uint64_t)(src_end - ip) ||
+        lit_len > (uint64_t)(dst_end - op)) {
+      return 0;
+    }
+    memcpy(op, ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+
+    if (ip == src_end) { // final literal run
+      break;
+    }
+
+    if (src_end - ip < 2) {
+      return 0;
+    }
+    const uint64_t offset = (uint64_t)ip[0] | ((uint64_t)ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (uint64_t)(op - dst)) {
+      return 0;
+    }
+
+    uint64_t match_len = token & 0xf;
+    if (match_len == 15 && !read_length(&ip, src_end, &match_len)) {
+      return 0;
+    }
+    match_len += TYR_MIN_MATCH;
+    if (match_len > (uint64_t)(dst_end - op)) {
+      return 0;
+    }
+
+    // Matches may overlap the bytes they produce, so copy forwards one byte at
+    // a time
+    const uint8_t *match = op - offset;
+    for (uint64_t i = 0; i < match_len; ++i) {
+      op[i] = match[i];
+    }
+    op += match_len;
+  }
+
+  if (op != dst_end) {
+    return 0;
+  }
+
+  return dst_len;
+}
+
+uint8_t *tyr_serialize_compressed(serializer_fn s, void *tyr_struct_ptr) {
+  uint8_t *serialized = s(tyr_struct_ptr);
+  if (serialized == NULL) {
+    printf("Serializing struct failed, aborting\n");
+    return NULL;
+  }
+
+  // First 64 bits are the length of the whole buffer
+  const uint64_t serialized_len = *((uint64_t *)serialized);
+
+  const uint64_t header_len = 2 * sizeof(uint64_t);
+  const uint64_t bound = tyr_compress_bound(serialized_len);
+  uint8_t *compressed = malloc(header_len + bound);
+  if (compressed == NULL) {
+    printf("Allocating the compression buffer failed, aborting\n");
+    free(serialized);
+    return NULL;
+  }
+
+  const uint64_t compressed_len = tyr_compress_block(
+      serialized, serialized_len, compressed + header_len, bound);
+  free(serialized);
+  if (compressed_len == 0) {
+    free(compressed);
+    return NULL;
+  }
+
+  *(uint64_t *)compressed = header_len + compressed_len;
+  *(uint64_t *)(compressed + sizeof(uint64_t)) = serialized_len;
+
+  // Give back the slack from the worst case bound
+  uint8_t *shrunk = realloc(compressed, header_len + compressed_len);
+  return shrunk == NULL ? compressed : shrunk;
+}
+
+void *tyr_deserialize_compressed(deserializer_fn d, const uint8_t *compressed) {
+  const uint64_t header_len = 2 * sizeof(uint64_t);
+  const uint64_t total_len = *(uint64_t *)compressed;
+  const uint64_t serialized_len = *(uint64_t *)(compressed + sizeof(uint64_t));
+  if (total_len < header_len || serialized_len < sizeof(uint64_t)) {
+    printf("Invalid compressed buffer header, aborting\n");
+    return NULL;
+  }
+
+  uint8_t *serialized = malloc(serialized_len);
+  if (serialized == NULL) {
+    printf("Allocating the decompression buffer failed, aborting\n");
+    return NULL;
+  }
+
+  if (tyr_decompress_block(compressed + header_len, total_len - header_len,
+                           serialized, serialized_len) != serialized_len) {
+    printf("Decompressing struct failed, aborting\n");
+    free(serialized);
+    return NULL;
+  }
+
+  void *deserialized = d(serialized);
+  free(serialized);
+  if (deserialized == NULL) {
+    printf("Deserializing struct failed, aborting\n");
+    return NULL;
+  }
+
+  return deserialized;
+}
@@ -0,0 +1,107 @@
+//
+// tyr
+// Copyright (c) 2019 Aman LaChapelle
+// Full license at tyr/LICENSE.txt
+//
+
+/*
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+#ifndef TYR_COMPRESS_H
+#define TYR_COMPRESS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdint.h>
+
+typedef uint8_t *(*serializer_fn)(void *);
+typedef void *(*deserializer_fn)(uint8_t *);
+
+/**
+ * Returns the largest number of bytes that tyr_compress_block can produce for
+ * an input of \p src_len bytes. Incompressible input grows by a little under
+ * 0.5%.
+ *
+ * @param src_len The length of the uncompressed input
+ * @return The worst case compressed size of the input
+ */
+uint64_t tyr_compress_bound(uint64_t src_len);
+
+/**
+ * Compresses \p src into \p dst with a small LZ77-style block compressor
+ * (literal runs and back references of at most 64KiB). No framing is written,
+ * the caller has to keep track of the uncompressed length.
+ *
+ * @param src The bytes to compress
+ * @param src_len The number of bytes in \p src
+ * @param dst Where to write the compressed block
+ * @param dst_cap The capacity of \p dst, tyr_compress_bound(src_len) is
+ * always enough
+ * @return The number of bytes written to \p dst, or 0 if \p dst was too small
+ */
+uint64_t tyr_compress_block(const uint8_t *src, uint64_t src_len, uint8_t *dst,
+                            uint64_t dst_cap);
+
+/**
+ * Decompresses a block written by tyr_compress_block. Every literal run and
+ * back reference is bounds checked, so corrupt input fails instead of reading
+ * or writing out of bounds.
+ *
+ * @param src The compressed block
+ * @param src_len The number of bytes in \p src
+ * @param dst Where to write the uncompressed bytes
+ * @param dst_len The exact uncompressed length
+ * @return The number of bytes written to \p dst, or 0 if the block is corrupt
+ */
+uint64_t tyr_decompress_block(const uint8_t *src, uint64_t src_len,
+                              uint8_t *dst, uint64_t dst_len);
+
+/**
+ * Serializes \p tyr_struct_ptr to a raw byte string then compresses it. The
+ * result starts with its own 64 bit total length (like every other tyr
+ * buffer), followed by the 64 bit uncompressed length and the compressed
+ * block.
+ *
+ * Does NOT free the memory associated with the struct, if that is desired, the
+ * caller should call destroy_<struct_name> on the struct pointer once this
+ * function terminates successfully.  The caller is responsible for memory
+ * returned from this function.
+ *
+ * @param s The serializer function to use
+ * @param tyr_struct_ptr A pointer to a tyr struct, must correspond to the
+ * serializer provided in \p s
+ * @return The struct in \p tyr_struct_ptr serialized and compressed.
+ */
+uint8_t *tyr_serialize_compressed(serializer_fn s, void *tyr_struct_ptr);
+
+/**
+ * Deserializes a tyr struct from a buffer created by tyr_serialize_compressed.
+ * The caller is responsible for memory returned from this function. It's
+ * decompressed into a scratch buffer that doesn't outlive the call, so a lazy
+ * struct has to go through deserialize_<struct_name>_eager.
+ *
+ * @param d The deserializer function to use.
+ * @param compressed The compressed and serialized object that we want to
+ * deserialize.
+ * @return An initialized tyr-generated struct that corresponds to \p d
+ */
+void *tyr_deserialize_compressed(deserializer_fn d, const uint8_t *compressed);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // TYR_COMPRESS_H
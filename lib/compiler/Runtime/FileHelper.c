@@ -20,12 +20,20 @@
     limitations under the License.
  */
 
+// mmap and friends are POSIX, not C11
+#define _POSIX_C_SOURCE 200809L
+
 #include "FileHelper.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 bool tyr_serialize_to_file(const char *filename, serializer_fn s,
@@ -87,3 +95,690 @@ void *tyr_deserialize_from_file(const char *filename, deserializer_fn d) {
 
   return deserialized;
 }
+
+bool tyr_map_file(const char *filename, tyr_mapped_file *mapped) {
+  if (mapped == NULL) {
+    return false;
+  }
+  mapped->data = NULL;
+  mapped->len = 0;
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    printf("Opening file %s failed with error code %d\n", filename, errno);
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    printf("File %s is empty or can't be read\n", filename);
+    close(fd);
+    return false;
+  }
+
+  void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping holds its own reference to the file
+  close(fd);
+  if (data == MAP_FAILED) {
+    printf("Mapping file %s failed with error code %d\n", filename, errno);
+    return false;
+  }
+
+  // Both are only hints, so failing them doesn't matter. Sequential makes the
+  // readahead more aggressive and drops pages behind us, WILLNEED starts
+  // reading in now rather than on the first fault.
+  posix_madvise(data, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+  posix_madvise(data, (size_t)st.st_size, POSIX_MADV_WILLNEED);
+
+  mapped->data = (const uint8_t *)data;
+  mapped->len = (uint64_t)st.st_size;
+  return true;
+}
+
+void tyr_unmap_file(tyr_mapped_file *mapped) {
+  if (mapped == NULL || mapped->data == NULL) {
+    return;
+  }
+  munmap((void *)mapped->data, (size_t)mapped->len);
+  mapped->data = NULL;
+  mapped->len = 0;
+}
+
+void *tyr_deserialize_from_mapped_file(const char *filename,
+                                       bounded_deserializer_fn d) {
+  tyr_mapped_file mapped;
+  if (!tyr_map_file(filename, &mapped)) {
+    return NULL;
+  }
+
+  void *deserialized = d(mapped.data, mapped.len);
+  if (deserialized == NULL) {
+    printf("Deserializing struct failed, aborting\n");
+  }
+
+  tyr_unmap_file(&mapped);
+  return deserialized;
+}
+
+// Pieces no bigger than this are copied into the staging buffer rather than
+// getting an iovec of their own
+#define TYR_FD_COPY_LIMIT 512
+
+void tyr_fd_writer_init(tyr_fd_writer *writer, int fd) {
+  writer->fd = fd;
+  writer->failed = false;
+  writer->nsegments = 0;
+  writer->staged = 0;
+  writer->spill = NULL;
+}
+
+// Writes out every segment and empties the writer, whether or not that worked
+static void fd_writer_flush(tyr_fd_writer *writer) {
+  struct iovec iov[TYR_FD_MAX_SEGMENTS];
+  uint32_t first = 0;
+  for (uint32_t i = 0; i < writer->nsegments; ++i) {
+    iov[i].iov_base = (void *)writer->segments[i].data;
+    iov[i].iov_len = (size_t)writer->segments[i].len;
+  }
+
+  while (!writer->failed && first < writer->nsegments) {
+    ssize_t written =
+        writev(writer->fd, iov + first, (int)(writer->nsegments - first));
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      printf("Write failed with error code %d, aborting\n", errno);
+      writer->failed = true;
+      break;
+    }
+
+    // Skip what went out, a short write can stop part way into a segment
+    size_t left = (size_t)written;
+    while (first < writer->nsegments && left >= iov[first].iov_len) {
+      left -= iov[first].iov_len;
+      ++first;
+    }
+    if (first < writer->nsegments) {
+      iov[first].iov_base = (uint8_t *)iov[first].iov_base + left;
+      iov[first].iov_len -= left;
+    }
+  }
+
+  free(writer->spill);
+  writer->spill = NULL;
+  writer->nsegments = 0;
+  writer->staged = 0;
+}
+
+// The caller makes sure there's room for another segment
+static void fd_writer_append(tyr_fd_writer *writer, const uint8_t *data,
+                             uint64_t len) {
+  if (writer->nsegments > 0) {
+    tyr_fd_segment *last = &writer->segments[writer->nsegments - 1];
+    if (last->data + last->len == data) {
+      last->len += len;
+      return;
+    }
+  }
+  writer->segments[writer->nsegments].data = data;
+  writer->segments[writer->nsegments].len = len;
+  writer->nsegments++;
+}
+
+uint8_t *tyr_fd_writer_stage(tyr_fd_writer *writer, uint64_t len) {
+  if (writer->failed) {
+    return NULL;
+  }
+
+  if (len > TYR_FD_STAGE_SIZE) {
+    // Only ever one spill buffer, it goes with the flush
+    fd_writer_flush(writer);
+    if (writer->failed) {
+      return NULL;
+    }
+    writer->spill = (uint8_t *)malloc(len);
+    if (writer->spill == NULL) {
+      writer->failed = true;
+      return NULL;
+    }
+    fd_writer_append(writer, writer->spill, len);
+    return writer->spill;
+  }
+
+  if (writer->staged + len > TYR_FD_STAGE_SIZE ||
+      writer->nsegments == TYR_FD_MAX_SEGMENTS || writer->spill != NULL) {
+    fd_writer_flush(writer);
+    if (writer->failed) {
+      return NULL;
+    }
+  }
+
+  uint8_t *staged = writer->stage + writer->staged;
+  writer->staged += len;
+  fd_writer_append(writer, staged, len);
+  return staged;
+}
+
+bool tyr_fd_writer_direct(tyr_fd_writer *writer, const uint8_t *data,
+                          uint64_t len) {
+  if (writer->failed) {
+    return false;
+  }
+  if (len == 0) {
+    return true;
+  }
+
+  if (len <= TYR_FD_COPY_LIMIT) {
+    uint8_t *staged = tyr_fd_writer_stage(writer, len);
+    if (staged == NULL) {
+      return false;
+    }
+    memcpy(staged, data, len);
+    return true;
+  }
+
+  if (writer->nsegments == TYR_FD_MAX_SEGMENTS) {
+    fd_writer_flush(writer);
+    if (writer->failed) {
+      return false;
+    }
+  }
+  fd_writer_append(writer, data, len);
+  return true;
+}
+
+bool tyr_fd_writer_finish(tyr_fd_writer *writer) {
+  fd_writer_flush(writer);
+  return !writer->failed;
+}
+
+bool tyr_serialize_to_file_streaming(const char *filename, fd_serializer_fn s,
+                                     void *tyr_struct_ptr) {
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    printf("Open failed with error code %d, aborting\n", errno);
+    return false;
+  }
+
+  bool written = s(tyr_struct_ptr, fd);
+  if (!written) {
+    printf("Serializing struct to %s failed\n", filename);
+  }
+
+  if (close(fd) != 0) {
+    printf("Closing %s failed with error code %d\n", filename, errno);
+    return false;
+  }
+  return written;
+}
+
+#define TYR_LOG_BUFFER_SIZE (256 * 1024)
+#define TYR_LOG_SYNC_INTERVAL (64 * 1024)
+#define TYR_LOG_FRAME_SIZE 16
+// A sync marker is a frame whose length is all ones followed by these bytes
+#define TYR_LOG_SYNC_LEN UINT64_MAX
+#define TYR_LOG_MARKER_SIZE 16
+#define TYR_LOG_SYNC_SIZE (8 + TYR_LOG_MARKER_SIZE)
+
+static const uint8_t log_magic[8] = {'T', 'Y', 'R', 'L', 'O', 'G', 0, 1};
+static const uint8_t log_marker[TYR_LOG_MARKER_SIZE] = {
+    0xd3, 0x4b, 0x1f, 0x8e, 0x62, 0xa7, 0x05, 0xc9,
+    0x7a, 0x30, 0xee, 0x91, 0x5d, 0x24, 0xb8, 0x6f};
+
+struct tyr_log {
+  int fd;
+  bool failed;
+  uint64_t buffered;
+  uint64_t since_sync;
+  // Group commit: records are numbered as they're committed, and synced is
+  // the last one known to be on disk. One committer at a time (the one that
+  // set syncing) writes out everything buffered and syncs it for the rest.
+  pthread_mutex_t lock;
+  pthread_cond_t synced_cond;
+  uint64_t committed;
+  uint64_t synced;
+  bool syncing;
+  uint8_t buffer[TYR_LOG_BUFFER_SIZE];
+};
+
+static void store_le64(uint8_t *out, uint64_t v) {
+  for (int i = 0; i < 8; ++i) {
+    out[i] = (uint8_t)(v >> (8 * i));
+  }
+}
+
+static uint64_t load_le64(const uint8_t *in) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; ++i) {
+    v |= (uint64_t)in[i] << (8 * i);
+  }
+  return v;
+}
+
+static uint64_t log_checksum(const uint8_t *data, uint64_t len) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (uint64_t i = 0; i < len; ++i) {
+    hash = (hash ^ data[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+static bool write_all(int fd, const uint8_t *data, uint64_t len) {
+  while (len > 0) {
+    ssize_t written = write(fd, data, (size_t)len);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      printf("Write failed with error code %d, aborting\n", errno);
+      return false;
+    }
+    data += written;
+    len -= (uint64_t)written;
+  }
+  return true;
+}
+
+// Copies into the buffer, the caller makes sure it fits
+static void log_buffer(tyr_log *log, const uint8_t *data, uint64_t len) {
+  memcpy(log->buffer + log->buffered, data, len);
+  log->buffered += len;
+}
+
+static void log_buffer_sync(tyr_log *log) {
+  uint8_t sync[TYR_LOG_SYNC_SIZE];
+  store_le64(sync, TYR_LOG_SYNC_LEN);
+  memcpy(sync + 8, log_marker, TYR_LOG_MARKER_SIZE);
+  log_buffer(log, sync, TYR_LOG_SYNC_SIZE);
+  log->since_sync = 0;
+}
+
+// Syncs the data without the metadata a reader doesn't need where the
+// system has fdatasync (it's optional in POSIX, macOS doesn't have it)
+static int log_sync_fd(int fd) {
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+  return fdatasync(fd);
+#else
+  return fsync(fd);
+#endif
+}
+
+tyr_log *tyr_log_open(const char *filename) {
+  int fd = open(filename, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    printf("Opening log %s failed with error code %d\n", filename, errno);
+    return NULL;
+  }
+
+  struct stat st;
+  uint8_t magic[sizeof(log_magic)];
+  if (fstat(fd, &st) != 0 ||
+      (st.st_size > 0 &&
+       (pread(fd, magic, sizeof(magic), 0) != (ssize_t)sizeof(magic) ||
+        memcmp(magic, log_magic, sizeof(magic)) != 0))) {
+    printf("%s is not a tyr log\n", filename);
+    close(fd);
+    return NULL;
+  }
+
+  tyr_log *log = (tyr_log *)malloc(sizeof(tyr_log));
+  if (log == NULL) {
+    close(fd);
+    return NULL;
+  }
+  if (pthread_mutex_init(&log->lock, NULL) != 0) {
+    free(log);
+    close(fd);
+    return NULL;
+  }
+  if (pthread_cond_init(&log->synced_cond, NULL) != 0) {
+    pthread_mutex_destroy(&log->lock);
+    free(log);
+    close(fd);
+    return NULL;
+  }
+  log->fd = fd;
+  log->failed = false;
+  log->buffered = 0;
+  log->committed = 0;
+  log->synced = 0;
+  log->syncing = false;
+
+  if (st.st_size == 0) {
+    log_buffer(log, log_magic, sizeof(log_magic));
+  }
+  // Whatever the last session left at the end might be torn, so this one
+  // starts with a marker to resync on
+  log_buffer_sync(log);
+  return log;
+}
+
+bool tyr_log_flush(tyr_log *log) {
+  if (log->failed) {
+    return false;
+  }
+  if (log->buffered > 0) {
+    log->failed = !write_all(log->fd, log->buffer, log->buffered);
+    log->buffered = 0;
+  }
+  return !log->failed;
+}
+
+bool tyr_log_append(tyr_log *log, const uint8_t *record, uint64_t len) {
+  if (log->failed || (record == NULL && len > 0) ||
+      len == TYR_LOG_SYNC_LEN) {
+    return false;
+  }
+
+  uint8_t frame[TYR_LOG_FRAME_SIZE];
+  store_le64(frame, len);
+  store_le64(frame + 8, log_checksum(record, len));
+
+  uint64_t needed = TYR_LOG_FRAME_SIZE + len;
+  const bool sync = log->since_sync >= TYR_LOG_SYNC_INTERVAL;
+  if (sync) {
+    needed += TYR_LOG_SYNC_SIZE;
+  }
+  if (log->buffered + needed > TYR_LOG_BUFFER_SIZE && !tyr_log_flush(log)) {
+    return false;
+  }
+  if (sync) {
+    log_buffer_sync(log);
+  }
+
+  log_buffer(log, frame, TYR_LOG_FRAME_SIZE);
+  if (len <= TYR_LOG_BUFFER_SIZE - log->buffered) {
+    log_buffer(log, record, len);
+  } else {
+    // Too big to gather, the frame and the record go out in one writev
+    struct iovec iov[2] = {{log->buffer, (size_t)log->buffered},
+                           {(void *)record, (size_t)len}};
+    uint64_t left = log->buffered + len;
+    log->buffered = 0;
+    int first = 0;
+    while (left > 0) {
+      ssize_t written = writev(log->fd, iov + first, 2 - first);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        printf("Write failed with error code %d, aborting\n", errno);
+        log->failed = true;
+        return false;
+      }
+      left -= (uint64_t)written;
+      size_t done = (size_t)written;
+      while (first < 2 && done >= iov[first].iov_len) {
+        done -= iov[first].iov_len;
+        ++first;
+      }
+      if (first < 2) {
+        iov[first].iov_base = (uint8_t *)iov[first].iov_base + done;
+        iov[first].iov_len -= done;
+      }
+    }
+  }
+  log->since_sync += TYR_LOG_FRAME_SIZE + len;
+  return true;
+}
+
+bool tyr_log_append_struct(tyr_log *log, serializer_fn s,
+                           void *tyr_struct_ptr) {
+  uint8_t *serialized = s(tyr_struct_ptr);
+  if (serialized == NULL) {
+    printf("Serializing struct failed, aborting\n");
+    return false;
+  }
+
+  bool appended = tyr_log_append(log, serialized, *(uint64_t *)serialized);
+  free(serialized);
+  return appended;
+}
+
+bool tyr_log_commit(tyr_log *log, const uint8_t *record, uint64_t len) {
+  pthread_mutex_lock(&log->lock);
+  if (!tyr_log_append(log, record, len)) {
+    pthread_mutex_unlock(&log->lock);
+    return false;
+  }
+
+  const uint64_t ticket = ++log->committed;
+  while (log->synced < ticket && !log->failed) {
+    if (log->syncing) {
+      // Someone else is syncing, the next batch is ours or comes after it
+      pthread_cond_wait(&log->synced_cond, &log->lock);
+      continue;
+    }
+
+    // Write out everything committed so far, then sync without holding the
+    // lock so the others can keep adding to the next batch meanwhile
+    log->syncing = true;
+    const uint64_t batch = log->committed;
+    bool written = tyr_log_flush(log);
+    pthread_mutex_unlock(&log->lock);
+    bool durable = written && log_sync_fd(log->fd) == 0;
+    if (written && !durable) {
+      printf("Syncing log failed with error code %d\n", errno);
+    }
+    pthread_mutex_lock(&log->lock);
+    if (durable) {
+      log->synced = batch;
+    } else {
+      log->failed = true;
+    }
+    log->syncing = false;
+    pthread_cond_broadcast(&log->synced_cond);
+  }
+
+  const bool durable = log->synced >= ticket;
+  pthread_mutex_unlock(&log->lock);
+  return durable;
+}
+
+bool tyr_log_commit_struct(tyr_log *log, serializer_fn s,
+                           void *tyr_struct_ptr) {
+  uint8_t *serialized = s(tyr_struct_ptr);
+  if (serialized == NULL) {
+    printf("Serializing struct failed, aborting\n");
+    return false;
+  }
+
+  bool committed = tyr_log_commit(log, serialized, *(uint64_t *)serialized);
+  free(serialized);
+  return committed;
+}
+
+bool tyr_log_close(tyr_log *log) {
+  if (log == NULL) {
+    return false;
+  }
+  bool flushed = tyr_log_flush(log);
+  if (close(log->fd) != 0) {
+    flushed = false;
+  }
+  pthread_cond_destroy(&log->synced_cond);
+  pthread_mutex_destroy(&log->lock);
+  free(log);
+  return flushed;
+}
+
+// Where the first sync marker at or after pos ends, or len if there isn't one
+static uint64_t log_resync(const uint8_t *data, uint64_t len, uint64_t pos) {
+  for (; pos + TYR_LOG_SYNC_SIZE <= len; ++pos) {
+    if (load_le64(data + pos) == TYR_LOG_SYNC_LEN &&
+        memcmp(data + pos + 8, log_marker, TYR_LOG_MARKER_SIZE) == 0) {
+      return pos + TYR_LOG_SYNC_SIZE;
+    }
+  }
+  return len;
+}
+
+uint64_t tyr_log_iterate(const char *filename, tyr_log_fn fn, void *ctx) {
+  tyr_mapped_file mapped;
+  if (!tyr_map_file(filename, &mapped)) {
+    return 0;
+  }
+
+  const uint8_t *data = mapped.data;
+  const uint64_t len = mapped.len;
+  if (len < sizeof(log_magic) ||
+      memcmp(data, log_magic, sizeof(log_magic)) != 0) {
+    printf("%s is not a tyr log\n", filename);
+    tyr_unmap_file(&mapped);
+    return 0;
+  }
+
+  uint64_t visited = 0;
+  uint64_t pos = sizeof(log_magic);
+  while (pos + 8 <= len) {
+    const uint64_t record_len = load_le64(data + pos);
+    if (record_len == TYR_LOG_SYNC_LEN && pos + TYR_LOG_SYNC_SIZE <= len &&
+        memcmp(data + pos + 8, log_marker, TYR_LOG_MARKER_SIZE) == 0) {
+      pos += TYR_LOG_SYNC_SIZE;
+      continue;
+    }
+
+    const uint64_t left = len - pos;
+    if (left < TYR_LOG_FRAME_SIZE ||
+        record_len > left - TYR_LOG_FRAME_SIZE ||
+        load_le64(data + pos + 8) !=
+            log_checksum(data + pos + TYR_LOG_FRAME_SIZE, record_len)) {
+      printf("Corrupt record at offset %llu of %s, skipping to the next sync "
+             "marker\n",
+             (unsigned long long)pos, filename);
+      pos = log_resync(data, len, pos + 1);
+      continue;
+    }
+
+    ++visited;
+    if (!fn(ctx, data + pos + TYR_LOG_FRAME_SIZE, record_len)) {
+      break;
+    }
+    pos += TYR_LOG_FRAME_SIZE + record_len;
+  }
+
+  tyr_unmap_file(&mapped);
+  return visited;
+}
+
+#define TYR_STREAM_INITIAL_SIZE (64u * 1024u)
+#define TYR_STREAM_DEFAULT_MAX (64u * 1024u * 1024u)
+
+// The unread bytes are buf[start, end). They're moved back to the front
+// before each read so reads always get as much room as there is.
+struct tyr_stream_reader {
+  int fd;
+  bool failed;
+  uint64_t max_record;
+  uint64_t cap;
+  uint64_t start;
+  uint64_t end;
+  uint8_t *buf;
+};
+
+tyr_stream_reader *tyr_stream_reader_create(int fd, uint64_t max_record) {
+  tyr_stream_reader *r =
+      (tyr_stream_reader *)malloc(sizeof(tyr_stream_reader));
+  if (r == NULL) {
+    return NULL;
+  }
+  r->fd = fd;
+  r->failed = false;
+  r->max_record = max_record == 0 ? TYR_STREAM_DEFAULT_MAX : max_record;
+  r->cap = TYR_STREAM_INITIAL_SIZE;
+  r->start = 0;
+  r->end = 0;
+  r->buf = (uint8_t *)malloc(r->cap);
+  if (r->buf == NULL) {
+    free(r);
+    return NULL;
+  }
+  return r;
+}
+
+tyr_stream_status tyr_stream_reader_next(tyr_stream_reader *r,
+                                         const uint8_t **record,
+                                         uint64_t *len) {
+  while (!r->failed) {
+    const uint64_t avail = r->end - r->start;
+    uint64_t needed = sizeof(uint64_t);
+    if (avail >= sizeof(uint64_t)) {
+      uint64_t size;
+      memcpy(&size, r->buf + r->start, sizeof(size));
+      if (size < sizeof(uint64_t) || size > r->max_record) {
+        printf("Stream record of %llu bytes is out of range\n",
+               (unsigned long long)size);
+        r->failed = true;
+        break;
+      }
+      if (avail >= size) {
+        *record = r->buf + r->start;
+        *len = size;
+        r->start += size;
+        return TYR_STREAM_RECORD;
+      }
+      needed = size;
+    }
+
+    if (r->start > 0) {
+      memmove(r->buf, r->buf + r->start, avail);
+      r->start = 0;
+      r->end = avail;
+    }
+    if (needed > r->cap) {
+      uint64_t cap = r->cap * 2 > r->max_record ? r->max_record : r->cap * 2;
+      cap = cap < needed ? needed : cap;
+      uint8_t *buf = (uint8_t *)realloc(r->buf, cap);
+      if (buf == NULL) {
+        r->failed = true;
+        break;
+      }
+      r->buf = buf;
+      r->cap = cap;
+    }
+
+    ssize_t got = read(r->fd, r->buf + r->end, (size_t)(r->cap - r->end));
+    if (got > 0) {
+      r->end += (uint64_t)got;
+    } else if (got == 0) {
+      if (avail == 0) {
+        return TYR_STREAM_END;
+      }
+      printf("Stream ended part way through a record\n");
+      r->failed = true;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return TYR_STREAM_AGAIN;
+    } else if (errno != EINTR) {
+      printf("Read failed with error code %d\n", errno);
+      r->failed = true;
+    }
+  }
+  return TYR_STREAM_ERROR;
+}
+
+tyr_stream_status tyr_stream_reader_next_struct(tyr_stream_reader *r,
+                                                bounded_deserializer_fn d,
+                                                void **out) {
+  *out = NULL;
+  const uint8_t *record;
+  uint64_t len;
+  tyr_stream_status status = tyr_stream_reader_next(r, &record, &len);
+  if (status != TYR_STREAM_RECORD) {
+    return status;
+  }
+  *out = d(record, len);
+  if (*out == NULL) {
+    printf("Deserializing stream record failed\n");
+    return TYR_STREAM_ERROR;
+  }
+  return TYR_STREAM_RECORD;
+}
+
+void tyr_stream_reader_destroy(tyr_stream_reader *r) {
+  if (r == NULL) {
+    return;
+  }
+  free(r->buf);
+  free(r);
+}
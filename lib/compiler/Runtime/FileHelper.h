@@ -32,6 +32,17 @@ extern "C" {
 
 typedef uint8_t *(*serializer_fn)(void *);
 typedef void *(*deserializer_fn)(uint8_t *);
+typedef void *(*bounded_deserializer_fn)(const uint8_t *, uint64_t);
+
+typedef bool (*fd_serializer_fn)(void *, int);
+
+/**
+ * A read-only mapping of a whole file, from tyr_map_file.
+ */
+typedef struct tyr_mapped_file {
+  const uint8_t *data;
+  uint64_t len;
+} tyr_mapped_file;
 
 /**
  * Serializes the tyr struct and stores it into a file. Does NOT free the memory
@@ -50,7 +61,8 @@ bool tyr_serialize_to_file(const char *filename, serializer_fn s,
 /**
  * Deserializes a tyr struct from a file and returns it - allocating memory for
  * the struct with malloc. The caller is responsible for memory returned from
- * this function.
+ * this function. The file is read into a buffer that's freed before this
+ * returns, so a lazy struct needs deserialize_<struct_name>_eager here.
  *
  * @param filename The name of the file to read from.
  * @param d The deserializer function for the tyr struct
@@ -58,6 +70,299 @@ bool tyr_serialize_to_file(const char *filename, serializer_fn s,
  */
 void *tyr_deserialize_from_file(const char *filename, deserializer_fn d);
 
+/**
+ * Maps a whole file read-only into memory instead of reading it, and hints to
+ * the kernel that it will be read front to back soon. The mapping can be
+ * handed to validate_<struct_name>, deserialize_<struct_name>_n or used as a
+ * zero-copy view (a frozen struct, or the buffer behind a lazy struct) for as
+ * long as it stays mapped.
+ *
+ * @param filename The name of the file to map
+ * @param mapped Where to store the mapping, release it with tyr_unmap_file
+ * @return true on success, false if the file can't be opened, is empty or
+ * can't be mapped
+ */
+bool tyr_map_file(const char *filename, tyr_mapped_file *mapped);
+
+/**
+ * Releases a mapping made by tyr_map_file. Nothing pointing into it can be
+ * used afterwards.
+ *
+ * @param mapped The mapping to release, it's reset to empty
+ */
+void tyr_unmap_file(tyr_mapped_file *mapped);
+
+/**
+ * Deserializes a tyr struct straight out of a mapping of the file, so the file
+ * is never copied into a buffer of its own first. The file's size bounds the
+ * deserializer so a truncated or corrupt file fails instead of being read past
+ * its end. The mapping is released before returning, so a lazy struct needs
+ * deserialize_<struct_name>_eager_n (or map the file with tyr_map_file to keep
+ * it lazy). The caller is responsible for memory returned from this function.
+ *
+ * @param filename The name of the file to read from.
+ * @param d The bounded deserializer for the tyr struct,
+ * deserialize_<struct_name>_n
+ * @return NULL on failure, the initialized struct on success
+ */
+void *tyr_deserialize_from_mapped_file(const char *filename,
+                                       bounded_deserializer_fn d);
+
+// How much of a serialized struct a tyr_fd_writer copies before it writes, and
+// how many pieces it gathers into one writev
+#define TYR_FD_STAGE_SIZE 65536
+#define TYR_FD_MAX_SEGMENTS 64
+
+typedef struct tyr_fd_segment {
+  const uint8_t *data;
+  uint64_t len;
+} tyr_fd_segment;
+
+/**
+ * Gathers a serialized struct into writev calls. serialize_<struct_name>_to_fd
+ * keeps one on its stack: the header and anything that has to be encoded or
+ * byte swapped go through the staging buffer, while repeated fields that are
+ * already in wire order are written straight out of the struct. Treat the
+ * members as private, they are only exposed so the writer can live on the
+ * stack.
+ */
+typedef struct tyr_fd_writer {
+  int fd;
+  bool failed;
+  uint32_t nsegments;
+  uint64_t staged;
+  uint8_t *spill;
+  tyr_fd_segment segments[TYR_FD_MAX_SEGMENTS];
+  uint8_t stage[TYR_FD_STAGE_SIZE];
+} tyr_fd_writer;
+
+/**
+ * Starts a writer on \p fd, which is written from its current position.
+ *
+ * @param writer The writer to start
+ * @param fd An open file descriptor
+ */
+void tyr_fd_writer_init(tyr_fd_writer *writer, int fd);
+
+/**
+ * Reserves the next \p len bytes of output in the staging buffer, which the
+ * caller fills in before the next call. Anything bigger than the staging
+ * buffer gets a buffer of its own, which is freed once it has been written.
+ *
+ * @param writer The writer
+ * @param len The number of bytes to reserve
+ * @return Where to put the bytes, or NULL if a write or an allocation failed.
+ * After a failure the writer holds nothing and only reports failure.
+ */
+uint8_t *tyr_fd_writer_stage(tyr_fd_writer *writer, uint64_t len);
+
+/**
+ * Adds \p len bytes at \p data as the next bytes of output without copying
+ * them (small pieces are copied into the staging buffer instead). They have to
+ * stay put until tyr_fd_writer_finish.
+ *
+ * @param writer The writer
+ * @param data The bytes to write
+ * @param len The number of bytes at \p data
+ * @return false if a write failed, as for tyr_fd_writer_stage
+ */
+bool tyr_fd_writer_direct(tyr_fd_writer *writer, const uint8_t *data,
+                          uint64_t len);
+
+/**
+ * Writes out whatever is left.
+ *
+ * @param writer The writer
+ * @return true if every byte was written
+ */
+bool tyr_fd_writer_finish(tyr_fd_writer *writer);
+
+/**
+ * Serializes a tyr struct into a file without building the serialized struct
+ * in memory first, see serialize_<struct_name>_to_fd. The file is created or
+ * truncated. Does NOT free the memory associated with the struct.
+ *
+ * @param filename The name of the file to write into
+ * @param s The fd serializer for the tyr struct,
+ * serialize_<struct_name>_to_fd
+ * @param tyr_struct_ptr A pointer to the tyr struct
+ * @return true on success, false on failure
+ */
+bool tyr_serialize_to_file_streaming(const char *filename, fd_serializer_fn s,
+                                     void *tyr_struct_ptr);
+
+/**
+ * An append-only log of records, each a serialized tyr struct or any other
+ * bytes. The file starts with an 8 byte magic number, then each record is
+ * framed by its 64 bit length and a 64 bit FNV-1a checksum of its bytes (all
+ * little endian). A sync marker goes in ahead of the first record of every
+ * session and then about every 64KiB, so a reader that hits a torn or corrupt
+ * record can skip ahead to the next one and carry on.
+ */
+typedef struct tyr_log tyr_log;
+
+/**
+ * Called with each intact record of a log in turn. \p record points into a
+ * read-only mapping of the log and is only valid during the call.
+ *
+ * @return false to stop iterating
+ */
+typedef bool (*tyr_log_fn)(void *ctx, const uint8_t *record, uint64_t len);
+
+/**
+ * Opens a log for appending, creating it if it doesn't exist yet.
+ *
+ * @param filename The log file
+ * @return The log, or NULL if it couldn't be opened or isn't a tyr log
+ */
+tyr_log *tyr_log_open(const char *filename);
+
+/**
+ * Appends a record to the log. Records are gathered in memory and written out
+ * together once enough of them have built up (or on tyr_log_flush), big ones
+ * go straight out.
+ *
+ * @param log The log
+ * @param record The bytes of the record
+ * @param len The number of bytes in \p record
+ * @return false if a write failed, after which the log only reports failure
+ */
+bool tyr_log_append(tyr_log *log, const uint8_t *record, uint64_t len);
+
+/**
+ * Serializes a tyr struct and appends it to the log as one record. Does NOT
+ * free the memory associated with the struct.
+ *
+ * @param log The log
+ * @param s The serializer for the tyr struct
+ * @param tyr_struct_ptr A pointer to the tyr struct
+ * @return false if serializing or a write failed
+ */
+bool tyr_log_append_struct(tyr_log *log, serializer_fn s, void *tyr_struct_ptr);
+
+/**
+ * Appends a record to the log and waits until it's synced to disk. Any number
+ * of threads can commit to the same log at once: whichever gets there first
+ * writes out every record committed so far and syncs them all with one
+ * fdatasync (fsync where there is none) while the rest wait for it, and the
+ * records committed in the meantime go out together in the next sync. Don't
+ * mix with tyr_log_append or tyr_log_flush from other threads.
+ *
+ * @param log The log
+ * @param record The bytes of the record
+ * @param len The number of bytes in \p record
+ * @return true once the record is on disk, false if a write or sync failed
+ */
+bool tyr_log_commit(tyr_log *log, const uint8_t *record, uint64_t len);
+
+/**
+ * Serializes a tyr struct and commits it to the log as one record, see
+ * tyr_log_commit. Does NOT free the memory associated with the struct.
+ *
+ * @param log The log
+ * @param s The serializer for the tyr struct
+ * @param tyr_struct_ptr A pointer to the tyr struct
+ * @return true once the record is on disk
+ */
+bool tyr_log_commit_struct(tyr_log *log, serializer_fn s, void *tyr_struct_ptr);
+
+/**
+ * Writes every record appended so far to the file. It's handed to the OS but
+ * not synced to disk.
+ *
+ * @param log The log
+ * @return false if a write failed
+ */
+bool tyr_log_flush(tyr_log *log);
+
+/**
+ * Flushes and closes the log and frees it.
+ *
+ * @param log The log
+ * @return false if any write failed
+ */
+bool tyr_log_close(tyr_log *log);
+
+/**
+ * Maps a log and calls \p fn for each intact record in the order they were
+ * appended. A record that's cut short or fails its checksum is skipped along
+ * with everything up to the next sync marker. Records are only valid during
+ * the call, the log is unmapped before this returns. A lazy struct decoded in
+ * \p fn has to use deserialize_<struct_name>_eager_n to outlive it.
+ *
+ * @param filename The log file
+ * @param fn Called with each record
+ * @param ctx Passed through to \p fn
+ * @return The number of records passed to \p fn
+ */
+uint64_t tyr_log_iterate(const char *filename, tyr_log_fn fn, void *ctx);
+
+/**
+ * Reads consecutive serialized structs off a file descriptor, such as a pipe
+ * or a socket. Bytes are read in as big a chunk as will fit into one buffer
+ * that's reused for the whole stream, and each struct's size header tells
+ * where it ends, so a stream of small records costs one read for many of them
+ * and nothing is allocated per record.
+ */
+typedef struct tyr_stream_reader tyr_stream_reader;
+
+typedef enum tyr_stream_status {
+  TYR_STREAM_RECORD, // the next record was returned
+  TYR_STREAM_AGAIN,  // the fd is non-blocking and has nothing more for now
+  TYR_STREAM_END,    // the stream ended after a whole record
+  TYR_STREAM_ERROR,  // reading failed or the stream is malformed
+} tyr_stream_status;
+
+/**
+ * Creates a reader for \p fd. The reader doesn't take ownership of the fd.
+ *
+ * @param fd The file descriptor to read from, blocking or not
+ * @param max_record The largest record to accept, 0 for 64MiB. The buffer
+ * starts at 64KiB and only grows as far as the biggest record needs.
+ * @return The reader, or NULL if allocating it failed
+ */
+tyr_stream_reader *tyr_stream_reader_create(int fd, uint64_t max_record);
+
+/**
+ * Returns the next serialized struct in the stream, reading more from the fd
+ * only when the buffer doesn't hold the whole of it yet. The record points
+ * into the reader's buffer (so it might not be aligned) and is only valid
+ * until the next call.
+ *
+ * @param r The reader
+ * @param record Set to the start of the record
+ * @param len Set to the length of the record
+ * @return TYR_STREAM_RECORD if a record was returned. On TYR_STREAM_AGAIN,
+ * call again once the fd is readable. TYR_STREAM_ERROR means a read failed,
+ * the stream ended part way through a record or a size header was out of
+ * range, and every call after it fails too.
+ */
+tyr_stream_status tyr_stream_reader_next(tyr_stream_reader *r,
+                                         const uint8_t **record, uint64_t *len);
+
+/**
+ * Like tyr_stream_reader_next, but hands the record to a bounded deserializer
+ * and returns the struct instead. The next call reuses the record's bytes, so
+ * lazy structs have to be read with deserialize_<struct_name>_eager_n.
+ *
+ * @param r The reader
+ * @param d The bounded deserializer, deserialize_<struct_name>_n
+ * @param out Set to the struct, or NULL if there wasn't one
+ * @return As tyr_stream_reader_next, except that a record \p d rejects is
+ * also TYR_STREAM_ERROR. That one only costs the record, the next call
+ * carries on after it.
+ */
+tyr_stream_status tyr_stream_reader_next_struct(tyr_stream_reader *r,
+                                                bounded_deserializer_fn d,
+                                                void **out);
+
+/**
+ * Frees the reader. Doesn't close the fd.
+ *
+ * @param r The reader
+ */
+void tyr_stream_reader_destroy(tyr_stream_reader *r);
+
 #ifdef __cplusplus
 };
 #endif // __cplusplus
@@ -0,0 +1,356 @@
+//
+// tyr
+// Copyright (c) 2019 Aman LaChapelle
+// Full license at tyr/LICENSE.txt
+//
+
+/*
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+// pthreads and sysconf are POSIX, not C11
+#define _POSIX_C_SOURCE 200809L
+
+#include "Parallel.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Indices are handed out in blocks of this many so the deque locks stay off
+// the per-item path. Ranges no bigger than one block aren't worth waking the
+// pool for.
+#define TYR_GRAIN 16
+#define TYR_MAX_THREADS 256
+
+// What's left of one thread's share of the current range. The owner takes
+// blocks from the front and thieves take half of the rest from the back.
+typedef struct tyr_deque {
+  pthread_mutex_t lock;
+  uint64_t lo;
+  uint64_t hi;
+} tyr_deque;
+
+typedef struct tyr_pool {
+  pthread_mutex_t submit; // held for the whole of a range, one at a time
+  pthread_mutex_t lock;   // guards everything below except the deques
+  pthread_cond_t wake;
+  pthread_cond_t done;
+  pthread_t *threads;
+  tyr_deque *deques;
+  uint32_t nthreads;
+  uint32_t busy; // workers that haven't finished the current range
+  uint64_t generation;
+  bool running;
+  bool quit;
+  tyr_parallel_fn fn;
+  void *ctx;
+} tyr_pool;
+
+static tyr_pool pool = {
+    .submit = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+// Set on the pool's threads and on a submitter while it runs its share, so
+// nested ranges run serially instead of waiting on themselves.
+static _Thread_local bool in_pool = false;
+
+static bool take_front(tyr_deque *d, uint64_t *lo, uint64_t *hi) {
+  bool found = false;
+  pthread_mutex_lock(&d->lock);
+  if (d->lo < d->hi) {
+    *lo = d->lo;
+    *hi = d->hi - d->lo > TYR_GRAIN ? d->lo + TYR_GRAIN : d->hi;
+    d->lo = *hi;
+    found = true;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return found;
+}
+
+// Moves half of the first non-empty deque after self's into self's deque.
+// Returns false once every deque has looked empty, which can be early if a
+// thief is between taking a block and storing it, but then that thief is
+// still working on it.
+static bool steal(uint32_t self) {
+  for (uint32_t k = 1; k < pool.nthreads; ++k) {
+    tyr_deque *victim = &pool.deques[(self + k) % pool.nthreads];
+
+    uint64_t lo = 0, hi = 0;
+    pthread_mutex_lock(&victim->lock);
+    const uint64_t left = victim->hi - victim->lo;
+    if (left > 0) {
+      const uint64_t take = left > TYR_GRAIN ? left / 2 : left;
+      hi = victim->hi;
+      lo = hi - take;
+      victim->hi = lo;
+    }
+    pthread_mutex_unlock(&victim->lock);
+
+    if (lo < hi) {
+      tyr_deque *own = &pool.deques[self];
+      pthread_mutex_lock(&own->lock);
+      own->lo = lo;
+      own->hi = hi;
+      pthread_mutex_unlock(&own->lock);
+      return true;
+    }
+  }
+  return false;
+}
+
+static void run_range(uint32_t self, tyr_parallel_fn fn, void *ctx) {
+  uint64_t lo, hi;
+  do {
+    while (take_front(&pool.deques[self], &lo, &hi)) {
+      for (uint64_t i = lo; i < hi; ++i) {
+        fn(ctx, i);
+      }
+    }
+  } while (steal(self));
+}
+
+static void *worker_main(void *arg) {
+  const uint32_t self = (uint32_t)(uintptr_t)arg;
+  uint64_t seen = 0;
+  in_pool = true;
+
+  pthread_mutex_lock(&pool.lock);
+  for (;;) {
+    while (!pool.quit && pool.generation == seen) {
+      pthread_cond_wait(&pool.wake, &pool.lock);
+    }
+    if (pool.quit) {
+      break;
+    }
+    seen = pool.generation;
+    tyr_parallel_fn fn = pool.fn;
+    void *ctx = pool.ctx;
+    pthread_mutex_unlock(&pool.lock);
+
+    run_range(self, fn, ctx);
+
+    pthread_mutex_lock(&pool.lock);
+    if (--pool.busy == 0) {
+      pthread_cond_signal(&pool.done);
+    }
+  }
+  pthread_mutex_unlock(&pool.lock);
+  return NULL;
+}
+
+bool tyr_parallel_init(uint32_t nthreads) {
+  pthread_mutex_lock(&pool.lock);
+  if (pool.running) {
+    pthread_mutex_unlock(&pool.lock);
+    return false;
+  }
+
+  if (nthreads == 0) {
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = cores > 0 ? (uint32_t)cores : 1;
+  }
+  if (nthreads > TYR_MAX_THREADS) {
+    nthreads = TYR_MAX_THREADS;
+  }
+
+  pool.deques = (tyr_deque *)calloc(nthreads, sizeof(tyr_deque));
+  pool.threads = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+  if (pool.deques == NULL || pool.threads == NULL) {
+    free(pool.deques);
+    free(pool.threads);
+    pool.deques = NULL;
+    pool.threads = NULL;
+    pthread_mutex_unlock(&pool.lock);
+    return false;
+  }
+
+  for (uint32_t t = 0; t < nthreads; ++t) {
+    pthread_mutex_init(&pool.deques[t].lock, NULL);
+  }
+
+  // The caller is thread 0, the workers wait on pool.lock until we're done
+  pool.nthreads = 1;
+  for (uint32_t t = 1; t < nthreads; ++t) {
+    if (pthread_create(&pool.threads[t], NULL, worker_main,
+                       (void *)(uintptr_t)t) != 0) {
+      break;
+    }
+    pool.nthreads = t + 1;
+  }
+
+  pool.running = true;
+  pthread_mutex_unlock(&pool.lock);
+  return true;
+}
+
+void tyr_parallel_shutdown(void) {
+  pthread_mutex_lock(&pool.submit);
+  pthread_mutex_lock(&pool.lock);
+  if (!pool.running) {
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&pool.submit);
+    return;
+  }
+  pool.quit = true;
+  pthread_cond_broadcast(&pool.wake);
+  pthread_mutex_unlock(&pool.lock);
+
+  for (uint32_t t = 1; t < pool.nthreads; ++t) {
+    pthread_join(pool.threads[t], NULL);
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  for (uint32_t t = 0; t < pool.nthreads; ++t) {
+    pthread_mutex_destroy(&pool.deques[t].lock);
+  }
+  free(pool.deques);
+  free(pool.threads);
+  pool.deques = NULL;
+  pool.threads = NULL;
+  pool.nthreads = 0;
+  pool.generation = 0;
+  pool.running = false;
+  pool.quit = false;
+  pthread_mutex_unlock(&pool.lock);
+  pthread_mutex_unlock(&pool.submit);
+}
+
+uint32_t tyr_parallel_threads(void) {
+  pthread_mutex_lock(&pool.lock);
+  bool running = pool.running;
+  pthread_mutex_unlock(&pool.lock);
+
+  if (!running) {
+    tyr_parallel_init(0);
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  const uint32_t nthreads = pool.nthreads;
+  pthread_mutex_unlock(&pool.lock);
+  return nthreads > 0 ? nthreads : 1;
+}
+
+void tyr_parallel_for(uint64_t n, tyr_parallel_fn fn, void *ctx) {
+  if (n == 0 || fn == NULL) {
+    return;
+  }
+
+  if (in_pool || n <= TYR_GRAIN || tyr_parallel_threads() < 2) {
+    for (uint64_t i = 0; i < n; ++i) {
+      fn(ctx, i);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&pool.submit);
+  pthread_mutex_lock(&pool.lock);
+  if (!pool.running) { // shut down since we looked
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&pool.submit);
+    for (uint64_t i = 0; i < n; ++i) {
+      fn(ctx, i);
+    }
+    return;
+  }
+
+  // Deal the range out in contiguous slices, the first n % nthreads slices
+  // get one extra index
+  const uint32_t nthreads = pool.nthreads;
+  const uint64_t share = n / nthreads, extra = n % nthreads;
+  uint64_t lo = 0;
+  for (uint32_t t = 0; t < nthreads; ++t) {
+    const uint64_t hi = lo + share + (t < extra ? 1 : 0);
+    pthread_mutex_lock(&pool.deques[t].lock);
+    pool.deques[t].lo = lo;
+    pool.deques[t].hi = hi;
+    pthread_mutex_unlock(&pool.deques[t].lock);
+    lo = hi;
+  }
+
+  pool.fn = fn;
+  pool.ctx = ctx;
+  pool.busy = nthreads - 1;
+  pool.generation++;
+  pthread_cond_broadcast(&pool.wake);
+  pthread_mutex_unlock(&pool.lock);
+
+  in_pool = true;
+  run_range(0, fn, ctx);
+  in_pool = false;
+
+  pthread_mutex_lock(&pool.lock);
+  while (pool.busy > 0) {
+    pthread_cond_wait(&pool.done, &pool.lock);
+  }
+  pthread_mutex_unlock(&pool.lock);
+  pthread_mutex_unlock(&pool.submit);
+}
+
+typedef struct tyr_deserialize_many_ctx {
+  bounded_deserializer_fn d;
+  uint8_t *const *bufs;
+  const uint64_t *lens;
+  void **out;
+} tyr_deserialize_many_ctx;
+
+static void deserialize_one(void *ctx, uint64_t i) {
+  tyr_deserialize_many_ctx *c = (tyr_deserialize_many_ctx *)ctx;
+  c->out[i] = c->bufs[i] == NULL ? NULL : c->d(c->bufs[i], c->lens[i]);
+}
+
+uint64_t tyr_deserialize_many(bounded_deserializer_fn d, uint8_t *const *bufs,
+                              const uint64_t *lens, uint64_t n, void **out) {
+  if (d == NULL || bufs == NULL || lens == NULL || out == NULL) {
+    return 0;
+  }
+
+  tyr_deserialize_many_ctx ctx = {d, bufs, lens, out};
+  tyr_parallel_for(n, deserialize_one, &ctx);
+
+  uint64_t deserialized = 0;
+  for (uint64_t i = 0; i < n; ++i) {
+    deserialized += out[i] != NULL ? 1 : 0;
+  }
+  return deserialized;
+}
+
+typedef struct tyr_serialize_many_ctx {
+  serializer_fn s;
+  void *const *structs;
+  uint8_t **out;
+} tyr_serialize_many_ctx;
+
+static void serialize_one(void *ctx, uint64_t i) {
+  tyr_serialize_many_ctx *c = (tyr_serialize_many_ctx *)ctx;
+  c->out[i] = c->structs[i] == NULL ? NULL : c->s(c->structs[i]);
+}
+
+uint64_t tyr_serialize_many(serializer_fn s, void *const *structs, uint64_t n,
+                            uint8_t **out) {
+  if (s == NULL || structs == NULL || out == NULL) {
+    return 0;
+  }
+
+  tyr_serialize_many_ctx ctx = {s, structs, out};
+  tyr_parallel_for(n, serialize_one, &ctx);
+
+  uint64_t serialized = 0;
+  for (uint64_t i = 0; i < n; ++i) {
+    serialized += out[i] != NULL ? 1 : 0;
+  }
+  return serialized;
+}
@@ -0,0 +1,119 @@
+//
+// tyr
+// Copyright (c) 2019 Aman LaChapelle
+// Full license at tyr/LICENSE.txt
+//
+
+/*
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+#ifndef TYR_PARALLEL_H
+#define TYR_PARALLEL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint8_t *(*serializer_fn)(void *);
+typedef void *(*deserializer_fn)(uint8_t *);
+typedef void *(*bounded_deserializer_fn)(const uint8_t *, uint64_t);
+
+/**
+ * A unit of work for tyr_parallel_for, called once for every index.
+ */
+typedef void (*tyr_parallel_fn)(void *ctx, uint64_t i);
+
+/**
+ * Starts the shared thread pool with \p nthreads threads (counting the thread
+ * that submits work). Passing 0 uses one thread per online core. The pool is
+ * otherwise started with the default size the first time it's used, so this
+ * only needs calling to pick a different size.
+ *
+ * @param nthreads The number of threads to run work on, 0 for one per core
+ * @return true if the pool was started, false if it was already running or
+ * allocating it failed. If fewer threads could be created than asked for the
+ * pool runs with the ones that were.
+ */
+bool tyr_parallel_init(uint32_t nthreads);
+
+/**
+ * Stops the shared thread pool and joins its threads. The next parallel call
+ * starts it again.
+ */
+void tyr_parallel_shutdown(void);
+
+/**
+ * Returns the number of threads the shared pool runs work on, starting it if
+ * it isn't running yet.
+ */
+uint32_t tyr_parallel_threads(void);
+
+/**
+ * Calls \p fn for every index in [0, n) on the shared thread pool and returns
+ * once they have all finished. The range is dealt out to the threads in
+ * contiguous blocks, and a thread that runs out of work steals half of what
+ * another thread has left, so uneven items still keep every core busy. Only
+ * one range runs at a time, concurrent callers wait their turn, and calls made
+ * from inside \p fn run serially on the calling thread.
+ *
+ * @param n The number of indices
+ * @param fn The work to do for each index
+ * @param ctx Passed through to \p fn
+ */
+void tyr_parallel_for(uint64_t n, tyr_parallel_fn fn, void *ctx);
+
+/**
+ * Deserializes \p n independent buffers in parallel, out[i] is the struct
+ * deserialized from bufs[i]. Each buffer is bounds checked against its length
+ * so \p d has to be a deserialize_<struct_name>_n function. Every struct is
+ * allocated by the thread that deserializes it with the generated code's
+ * malloc, a thread caching malloc keeps them from contending on one heap.
+ *
+ * The caller is responsible for the structs written to \p out.
+ *
+ * @param d The bounded deserializer to use
+ * @param bufs The serialized structs
+ * @param lens The length of each buffer in \p bufs
+ * @param n The number of buffers
+ * @param out Where to write the structs, out[i] is NULL if bufs[i] was
+ * malformed or allocating it failed
+ * @return The number of buffers that were deserialized
+ */
+uint64_t tyr_deserialize_many(bounded_deserializer_fn d, uint8_t *const *bufs,
+                              const uint64_t *lens, uint64_t n, void **out);
+
+/**
+ * Serializes \p n structs in parallel, out[i] is the buffer serialize_ returned
+ * for structs[i]. Does NOT free the memory associated with the structs.
+ *
+ * The caller is responsible for the buffers written to \p out.
+ *
+ * @param s The serializer function to use
+ * @param structs The structs to serialize, must correspond to \p s
+ * @param n The number of structs
+ * @param out Where to write the buffers, out[i] is NULL if serializing
+ * structs[i] failed
+ * @return The number of structs that were serialized
+ */
+uint64_t tyr_serialize_many(serializer_fn s, void *const *structs, uint64_t n,
+                            uint8_t **out);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // TYR_PARALLEL_H
@@ -22,6 +22,11 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
 #include <llvm/IR/Verifier.h>
 
 // For JIT
@@ -29,6 +34,7 @@
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
 #include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Support/DynamicLibrary.h>
 #include <llvm/Support/TargetRegistry.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Transforms/IPO/PassManagerBuilder.h>
@@ -204,4 +210,1823 @@ TEST(CodeGen, code_correct) {
   free(serialized);
 }
 
+TEST(CodeGen, bitpacked_correct) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  tyr::ir::Struct *s = m.getOrCreateStruct("test");
+  s->setIsBitPacked(true);
+
+  s->addField("src", m.parseType("int13", false), false);
+  s->addField("sink", m.parseType("int13", false), false);
+  s->addField("flag", m.parseType("bool", false), true);
+  s->addField("weight", m.parseType("float", false), true);
+
+  s->finalizeFields(m.getModule());
+
+  // 27 bits of integers fit in 4 bytes, plus the float
+  const llvm::DataLayout &DL = m.getModule()->getDataLayout();
+  EXPECT_EQ(DL.getTypeAllocSize(s->getType()), 8);
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  auto constructor = (void *(*)(uint16_t, uint16_t))engine->getFunctionAddress(
+      "create_test");
+  auto get_src = (bool (*)(void *, uint16_t *))engine->getFunctionAddress(
+      "get_test_src");
+  auto get_sink = (bool (*)(void *, uint16_t *))engine->getFunctionAddress(
+      "get_test_sink");
+  auto get_flag =
+      (bool (*)(void *, bool *))engine->getFunctionAddress("get_test_flag");
+  auto set_flag =
+      (bool (*)(void *, bool))engine->getFunctionAddress("set_test_flag");
+  auto set_weight =
+      (bool (*)(void *, float))engine->getFunctionAddress("set_test_weight");
+  auto get_weight =
+      (bool (*)(void *, float *))engine->getFunctionAddress("get_test_weight");
+  auto destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_test");
+  auto serializer =
+      (uint8_t * (*)(void *)) engine->getFunctionAddress("serialize_test");
+  auto deserializer =
+      (void *(*)(uint8_t *))engine->getFunctionAddress("deserialize_test");
+
+  void *test_struct = constructor(8191, 4097);
+  EXPECT_TRUE(set_flag(test_struct, true));
+  EXPECT_TRUE(set_weight(test_struct, 0.5f));
+
+  uint16_t src = 0, sink = 0;
+  bool flag = false;
+  float weight = 0;
+  EXPECT_TRUE(get_src(test_struct, &src));
+  EXPECT_TRUE(get_sink(test_struct, &sink));
+  EXPECT_TRUE(get_flag(test_struct, &flag));
+  EXPECT_EQ(src, 8191);
+  EXPECT_EQ(sink, 4097);
+  EXPECT_TRUE(flag);
+
+  // Clearing the flag must not touch its neighbours
+  EXPECT_TRUE(set_flag(test_struct, false));
+  EXPECT_TRUE(get_flag(test_struct, &flag));
+  EXPECT_TRUE(get_sink(test_struct, &sink));
+  EXPECT_FALSE(flag);
+  EXPECT_EQ(sink, 4097);
+
+  uint8_t *serialized = serializer(test_struct);
+  // size header + 4 bytes of packed bits + the float
+  EXPECT_EQ(*(uint64_t *)serialized, 16);
+
+  void *deserialized_struct = deserializer(serialized);
+  EXPECT_TRUE(deserialized_struct != nullptr);
+
+  EXPECT_TRUE(get_src(deserialized_struct, &src));
+  EXPECT_TRUE(get_sink(deserialized_struct, &sink));
+  EXPECT_TRUE(get_flag(deserialized_struct, &flag));
+  EXPECT_TRUE(get_weight(deserialized_struct, &weight));
+  EXPECT_EQ(src, 8191);
+  EXPECT_EQ(sink, 4097);
+  EXPECT_FALSE(flag);
+  EXPECT_FLOAT_EQ(weight, 0.5f);
+
+  destructor(deserialized_struct);
+  destructor(test_struct);
+  free(serialized);
+}
+
+TEST(CodeGen, bitpacked_array_correct) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  tyr::ir::Struct *s = m.getOrCreateStruct("test");
+  s->addRepeatedField("ids", m.parseType("int11", true), true,
+                      tyr::ir::kEncodingBitPacked);
+
+  s->finalizeFields(m.getModule());
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  auto constructor = (void *(*)())engine->getFunctionAddress("create_test");
+  auto getter = (bool (*)(void *, uint16_t **))engine->getFunctionAddress(
+      "get_test_ids");
+  auto setter = (bool (*)(void *, uint16_t *,
+                          uint64_t))engine->getFunctionAddress("set_test_ids");
+  auto count_getter = (bool (*)(void *, uint64_t *))engine->getFunctionAddress(
+      "get_test_ids_count");
+  auto destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_test");
+  auto serializer =
+      (uint8_t * (*)(void *)) engine->getFunctionAddress("serialize_test");
+  auto deserializer =
+      (void *(*)(uint8_t *))engine->getFunctionAddress("deserialize_test");
+
+  // 4 full groups of 8 and a tail of 5
+  const int num_ids = 37;
+  uint16_t test_data[num_ids];
+  for (int i = 0; i < num_ids; ++i) {
+    test_data[i] = (uint16_t)(rand() & 0x7ff);
+  }
+
+  void *test_struct = constructor();
+  EXPECT_TRUE(setter(test_struct, test_data, num_ids));
+
+  uint8_t *serialized = serializer(test_struct);
+  // size header + count + 37 * 11 bits rounded up to bytes
+  EXPECT_EQ(*(uint64_t *)serialized, 8 + 8 + (num_ids * 11 + 7) / 8);
+
+  void *deserialized_struct = deserializer(serialized);
+  EXPECT_TRUE(deserialized_struct != nullptr);
+
+  uint16_t *deserialized_data = nullptr;
+  uint64_t deserialized_count = 0;
+  EXPECT_TRUE(getter(deserialized_struct, &deserialized_data));
+  EXPECT_TRUE(count_getter(deserialized_struct, &deserialized_count));
+  EXPECT_EQ(deserialized_count, num_ids);
+  for (int i = 0; i < num_ids; ++i) {
+    EXPECT_EQ(deserialized_data[i], test_data[i]);
+  }
+
+  destructor(deserialized_struct);
+  destructor(test_struct);
+  free(serialized);
+}
+
+TEST(CodeGen, bitpacked_keeps_encoding) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  // A bitpacked struct only bit packs repeated fields that didn't ask for an
+  // encoding of their own
+  tyr::ir::Struct *s = m.getOrCreateStruct("test");
+  s->setIsBitPacked(true);
+  s->addRepeatedField("codes", m.parseType("uint11", true), true,
+                      tyr::ir::kEncodingDictionary);
+  s->addRepeatedField("small", m.parseType("uint13", true), true,
+                      tyr::ir::kEncodingVarint);
+
+  s->finalizeFields(m.getModule());
+
+  for (const tyr::ir::FieldPtr &f : s->getFields()) {
+    EXPECT_FALSE(f->encoding & tyr::ir::kEncodingBitPacked) << f->name;
+  }
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  auto constructor = (void *(*)())engine->getFunctionAddress("create_test");
+  auto get_codes = (bool (*)(void *, uint16_t **))engine->getFunctionAddress(
+      "get_test_codes");
+  auto set_codes =
+      (bool (*)(void *, uint16_t *, uint64_t))engine->getFunctionAddress(
+          "set_test_codes");
+  auto get_small = (bool (*)(void *, uint16_t **))engine->getFunctionAddress(
+      "get_test_small");
+  auto set_small =
+      (bool (*)(void *, uint16_t *, uint64_t))engine->getFunctionAddress(
+          "set_test_small");
+  auto destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_test");
+  auto serializer =
+      (uint8_t * (*)(void *)) engine->getFunctionAddress("serialize_test");
+  auto deserializer =
+      (void *(*)(uint8_t *))engine->getFunctionAddress("deserialize_test");
+
+  const int num = 100;
+  uint16_t test_codes[num];
+  uint16_t test_small[num];
+  for (int i = 0; i < num; ++i) {
+    test_codes[i] = 0x5a5;
+    test_small[i] = (uint16_t)(i & 0x7f);
+  }
+
+  void *test_struct = constructor();
+  EXPECT_TRUE(set_codes(test_struct, test_codes, num));
+  EXPECT_TRUE(set_small(test_struct, test_small, num));
+
+  uint8_t *serialized = serializer(test_struct);
+  // A single dictionary value needs 1 bit indices, and every small value fits
+  // in one varint byte. Bit packed they would take 11 and 13 bits each.
+  EXPECT_EQ(*(uint64_t *)serialized,
+            8 + (16 + 2 + (num + 7) / 8) + (8 + num));
+
+  void *deserialized_struct = deserializer(serialized);
+  EXPECT_TRUE(deserialized_struct != nullptr);
+
+  uint16_t *codes = nullptr;
+  uint16_t *small = nullptr;
+  EXPECT_TRUE(get_codes(deserialized_struct, &codes));
+  EXPECT_TRUE(get_small(deserialized_struct, &small));
+  for (int i = 0; i < num; ++i) {
+    EXPECT_EQ(codes[i], test_codes[i]);
+    EXPECT_EQ(small[i], test_small[i]);
+  }
+
+  destructor(deserialized_struct);
+  destructor(test_struct);
+  free(serialized);
+}
+
+TEST(CodeGen, varint_correct) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  tyr::ir::Struct *s = m.getOrCreateStruct("test");
+  s->addField("delta", m.parseType("int64", false), true,
+              tyr::ir::kEncodingVarint | tyr::ir::kEncodingZigZag);
+  s->addField("id", m.parseType("uint64", false), true,
+              tyr::ir::kEncodingVarint);
+  s->addRepeatedField("ids", m.parseType("uint32", true), true,
+                      tyr::ir::kEncodingVarint);
+
+  s->finalizeFields(m.getModule());
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  auto constructor = (void *(*)())engine->getFunctionAddress("create_test");
+  auto get_delta = (bool (*)(void *, int64_t *))engine->getFunctionAddress(
+      "get_test_delta");
+  auto set_delta =
+      (bool (*)(void *, int64_t))engine->getFunctionAddress("set_test_delta");
+  auto get_id =
+      (bool (*)(void *, uint64_t *))engine->getFunctionAddress("get_test_id");
+  auto set_id =
+      (bool (*)(void *, uint64_t))engine->getFunctionAddress("set_test_id");
+  auto get_ids = (bool (*)(void *, uint32_t **))engine->getFunctionAddress(
+      "get_test_ids");
+  auto set_ids = (bool (*)(void *, uint32_t *,
+                           uint64_t))engine->getFunctionAddress("set_test_ids");
+  auto destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_test");
+  auto serializer =
+      (uint8_t * (*)(void *)) engine->getFunctionAddress("serialize_test");
+  auto deserializer =
+      (void *(*)(uint8_t *))engine->getFunctionAddress("deserialize_test");
+
+  // 1, 1, 2, 3 and 5 bytes as varints
+  uint32_t test_ids[] = {0, 127, 128, 16384, 0xffffffff};
+
+  void *test_struct = constructor();
+  EXPECT_TRUE(set_delta(test_struct, -3));
+  EXPECT_TRUE(set_id(test_struct, 300));
+  EXPECT_TRUE(set_ids(test_struct, test_ids, 5));
+
+  uint8_t *serialized = serializer(test_struct);
+  // size header + zigzag(-3) + 300 + count + the ids
+  EXPECT_EQ(*(uint64_t *)serialized, 8 + 1 + 2 + 8 + 12);
+
+  void *deserialized_struct = deserializer(serialized);
+  EXPECT_TRUE(deserialized_struct != nullptr);
+
+  int64_t delta = 0;
+  uint64_t id = 0;
+  uint32_t *ids = nullptr;
+  EXPECT_TRUE(get_delta(deserialized_struct, &delta));
+  EXPECT_TRUE(get_id(deserialized_struct, &id));
+  EXPECT_TRUE(get_ids(deserialized_struct, &ids));
+  EXPECT_EQ(delta, -3);
+  EXPECT_EQ(id, 300);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(ids[i], test_ids[i]);
+  }
+  destructor(deserialized_struct);
+  free(serialized);
+
+  // The extremes take the full 10 bytes
+  EXPECT_TRUE(set_delta(test_struct, INT64_MIN));
+  EXPECT_TRUE(set_id(test_struct, UINT64_MAX));
+
+  serialized = serializer(test_struct);
+  EXPECT_EQ(*(uint64_t *)serialized, 8 + 10 + 10 + 8 + 12);
+
+  deserialized_struct = deserializer(serialized);
+  EXPECT_TRUE(deserialized_struct != nullptr);
+  EXPECT_TRUE(get_delta(deserialized_struct, &delta));
+  EXPECT_TRUE(get_id(deserialized_struct, &id));
+  EXPECT_EQ(delta, INT64_MIN);
+  EXPECT_EQ(id, UINT64_MAX);
+
+  destructor(deserialized_struct);
+  destructor(test_struct);
+  free(serialized);
+}
+
+TEST(CodeGen, delta_correct) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  tyr::ir::Struct *s = m.getOrCreateStruct("test");
+  s->addRepeatedField("ts", m.parseType("uint64", true), true,
+                      tyr::ir::kEncodingDelta | tyr::ir::kEncodingVarint);
+  s->addRepeatedField("raw", m.parseType("uint32", true), true,
+                      tyr::ir::kEncodingDelta);
+  s->addRepeatedField("packed", m.parseType("uint11", true), true,
+                      tyr::ir::kEncodingDelta | tyr::ir::kEncodingBitPacked);
+
+  s->finalizeFields(m.getModule());
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  auto constructor = (void *(*)())engine->getFunctionAddress("create_test");
+  auto get_ts = (bool (*)(void *, uint64_t **))engine->getFunctionAddress(
+      "get_test_ts");
+  auto set_ts = (bool (*)(void *, uint64_t *,
+                          uint64_t))engine->getFunctionAddress("set_test_ts");
+  auto get_raw = (bool (*)(void *, uint32_t **))engine->getFunctionAddress(
+      "get_test_raw");
+  auto set_raw = (bool (*)(void *, uint32_t *,
+                           uint64_t))engine->getFunctionAddress("set_test_raw");
+  auto get_packed = (bool (*)(void *, uint16_t **))engine->getFunctionAddress(
+      "get_test_packed");
+  auto set_packed =
+      (bool (*)(void *, uint16_t *, uint64_t))engine->getFunctionAddress(
+          "set_test_packed");
+  auto destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_test");
+  auto serializer =
+      (uint8_t * (*)(void *)) engine->getFunctionAddress("serialize_test");
+  auto deserializer =
+      (void *(*)(uint8_t *))engine->getFunctionAddress("deserialize_test");
+
+  // 4 full groups of 8 and a tail of 5
+  const int num = 37;
+  uint64_t test_ts[num];
+  uint32_t test_raw[num];
+  uint16_t test_packed[num];
+  for (int i = 0; i < num; ++i) {
+    test_ts[i] = 1600000000000 + 1000 * i;
+    // Not sorted, so some of the differences are negative
+    test_raw[i] = (uint32_t)rand();
+    test_packed[i] = (uint16_t)(rand() & 0x7ff);
+  }
+
+  void *test_struct = constructor();
+  EXPECT_TRUE(set_ts(test_struct, test_ts, num));
+  EXPECT_TRUE(set_raw(test_struct, test_raw, num));
+  EXPECT_TRUE(set_packed(test_struct, test_packed, num));
+
+  uint8_t *serialized = serializer(test_struct);
+  // The first timestamp takes 6 bytes and every step of 1000 takes 2
+  EXPECT_EQ(*(uint64_t *)serialized,
+            8 + 8 + 6 + 2 * (num - 1) + 8 + 4 * num + 8 + (num * 11 + 7) / 8);
+
+  void *deserialized_struct = deserializer(serialized);
+  EXPECT_TRUE(deserialized_struct != nullptr);
+
+  uint64_t *ts = nullptr;
+  uint32_t *raw = nullptr;
+  uint16_t *packed = nullptr;
+  EXPECT_TRUE(get_ts(deserialized_struct, &ts));
+  EXPECT_TRUE(get_raw(deserialized_struct, &raw));
+  EXPECT_TRUE(get_packed(deserialized_struct, &packed));
+  for (int i = 0; i < num; ++i) {
+    EXPECT_EQ(ts[i], test_ts[i]);
+    EXPECT_EQ(raw[i], test_raw[i]);
+    EXPECT_EQ(packed[i], test_packed[i]);
+  }
+
+  destructor(deserialized_struct);
+  destructor(test_struct);
+  free(serialized);
+}
+
+TEST(CodeGen, xor_correct) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  tyr::ir::Struct *s = m.getOrCreateStruct("test");
+  s->addRepeatedField("temps", m.parseType("double", true), true,
+                      tyr::ir::kEncodingXor);
+  s->addRepeatedField("noise", m.parseType("float", true), true,
+                      tyr::ir::kEncodingXor);
+
+  s->finalizeFields(m.getModule());
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  auto constructor = (void *(*)())engine->getFunctionAddress("create_test");
+  auto get_temps = (bool (*)(void *, double **))engine->getFunctionAddress(
+      "get_test_temps");
+  auto set_temps = (bool (*)(void *, double *,
+                             uint64_t))engine->getFunctionAddress(
+      "set_test_temps");
+  auto get_noise = (bool (*)(void *, float **))engine->getFunctionAddress(
+      "get_test_noise");
+  auto set_noise = (bool (*)(void *, float *,
+                             uint64_t))engine->getFunctionAddress(
+      "set_test_noise");
+  auto destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_test");
+  auto serializer =
+      (uint8_t * (*)(void *)) engine->getFunctionAddress("serialize_test");
+  auto deserializer =
+      (void *(*)(uint8_t *))engine->getFunctionAddress("deserialize_test");
+
+  const int num = 100;
+  double test_temps[num];
+  float test_noise[num];
+  for (int i = 0; i < num; ++i) {
+    // A slowly changing series with plenty of repeats
+    test_temps[i] = 20.0 + 0.25 * (i / 10);
+    test_noise[i] = (float)rand() / RAND_MAX - 0.5f;
+  }
+  // The awkward values still have to come back bit for bit
+  test_noise[1] = -0.0f;
+  test_noise[2] = NAN;
+  test_noise[3] = INFINITY;
+
+  void *test_struct = constructor();
+  EXPECT_TRUE(set_temps(test_struct, test_temps, num));
+  EXPECT_TRUE(set_noise(test_struct, test_noise, num));
+
+  uint8_t *serialized = serializer(test_struct);
+  // The series should be well under a quarter of its raw size, the noise
+  // barely compresses but mustn't grow by more than the control bits
+  uint64_t serialized_size = *(uint64_t *)serialized;
+  EXPECT_LT(serialized_size,
+            8 + 8 + sizeof(test_temps) / 4 + 8 + sizeof(test_noise) + 2 * num);
+
+  void *deserialized_struct = deserializer(serialized);
+  EXPECT_TRUE(deserialized_struct != nullptr);
+
+  double *temps = nullptr;
+  float *noise = nullptr;
+  EXPECT_TRUE(get_temps(deserialized_struct, &temps));
+  EXPECT_TRUE(get_noise(deserialized_struct, &noise));
+  EXPECT_EQ(memcmp(temps, test_temps, sizeof(test_temps)), 0);
+  EXPECT_EQ(memcmp(noise, test_noise, sizeof(test_noise)), 0);
+
+  destructor(deserialized_struct);
+  destructor(test_struct);
+  free(serialized);
+}
+
+TEST(CodeGen, dictionary_correct) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  tyr::ir::Struct *s = m.getOrCreateStruct("test");
+  s->addRepeatedField("category", m.parseType("int32", true), true,
+                      tyr::ir::kEncodingDictionary);
+  s->addRepeatedField("constant", m.parseType("uint16", true), true,
+                      tyr::ir::kEncodingDictionary);
+  s->addRepeatedField("unique", m.parseType("uint64", true), true,
+                      tyr::ir::kEncodingDictionary);
+
+  s->finalizeFields(m.getModule());
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  auto constructor = (void *(*)())engine->getFunctionAddress("create_test");
+  auto get_category = (bool (*)(void *, int32_t **))engine->getFunctionAddress(
+      "get_test_category");
+  auto set_category =
+      (bool (*)(void *, int32_t *, uint64_t))engine->getFunctionAddress(
+          "set_test_category");
+  auto get_constant =
+      (bool (*)(void *, uint16_t **))engine->getFunctionAddress(
+          "get_test_constant");
+  auto set_constant =
+      (bool (*)(void *, uint16_t *, uint64_t))engine->getFunctionAddress(
+          "set_test_constant");
+  auto get_unique = (bool (*)(void *, uint64_t **))engine->getFunctionAddress(
+      "get_test_unique");
+  auto set_unique =
+      (bool (*)(void *, uint64_t *, uint64_t))engine->getFunctionAddress(
+          "set_test_unique");
+  auto destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_test");
+  auto serializer =
+      (uint8_t * (*)(void *)) engine->getFunctionAddress("serialize_test");
+  auto deserializer =
+      (void *(*)(uint8_t *))engine->getFunctionAddress("deserialize_test");
+
+  const int num = 1000;
+  const int num_unique = 300;
+  int32_t categories[] = {-7, 3, 1 << 30, 0, 42};
+  int32_t test_category[num];
+  uint16_t test_constant[num];
+  uint64_t test_unique[num_unique];
+  for (int i = 0; i < num; ++i) {
+    test_category[i] = categories[rand() % 5];
+    test_constant[i] = 0xbeef;
+  }
+  for (int i = 0; i < num_unique; ++i) {
+    test_unique[i] = (uint64_t)i * 0x9e3779b97f4a7c15;
+  }
+
+  void *test_struct = constructor();
+  EXPECT_TRUE(set_category(test_struct, test_category, num));
+  EXPECT_TRUE(set_constant(test_struct, test_constant, num));
+  EXPECT_TRUE(set_unique(test_struct, test_unique, num_unique));
+
+  uint8_t *serialized = serializer(test_struct);
+  // Each field has its count and dictionary size. Five categories need 3 bit
+  // indices, a single value still gets 1 bit ones, and 300 distinct values
+  // are too many so they go raw.
+  EXPECT_EQ(*(uint64_t *)serialized, 8 + (16 + 5 * 4 + (num * 3 + 7) / 8) +
+                                         (16 + 2 + (num + 7) / 8) +
+                                         (16 + 8 * num_unique));
+
+  void *deserialized_struct = deserializer(serialized);
+  EXPECT_TRUE(deserialized_struct != nullptr);
+
+  int32_t *category = nullptr;
+  uint16_t *constant = nullptr;
+  uint64_t *unique = nullptr;
+  EXPECT_TRUE(get_category(deserialized_struct, &category));
+  EXPECT_TRUE(get_constant(deserialized_struct, &constant));
+  EXPECT_TRUE(get_unique(deserialized_struct, &unique));
+  for (int i = 0; i < num; ++i) {
+    EXPECT_EQ(category[i], test_category[i]);
+    EXPECT_EQ(constant[i], test_constant[i]);
+  }
+  for (int i = 0; i < num_unique; ++i) {
+    EXPECT_EQ(unique[i], test_unique[i]);
+  }
+
+  destructor(deserialized_struct);
+  destructor(test_struct);
+  free(serialized);
+}
+
+TEST(CodeGen, validate_correct) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  tyr::ir::Struct *s = m.getOrCreateStruct("test");
+  s->addField("id", m.parseType("uint64", false), true,
+              tyr::ir::kEncodingVarint);
+  s->addRepeatedField("raw", m.parseType("int16", true), true);
+  s->addRepeatedField("temps", m.parseType("double", true), true,
+                      tyr::ir::kEncodingXor);
+  s->addRepeatedField("category", m.parseType("int32", true), true,
+                      tyr::ir::kEncodingDictionary);
+
+  s->finalizeFields(m.getModule());
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  auto constructor = (void *(*)())engine->getFunctionAddress("create_test");
+  auto set_id =
+      (bool (*)(void *, uint64_t))engine->getFunctionAddress("set_test_id");
+  auto get_id =
+      (bool (*)(void *, uint64_t *))engine->getFunctionAddress("get_test_id");
+  auto set_raw = (bool (*)(void *, int16_t *,
+                           uint64_t))engine->getFunctionAddress("set_test_raw");
+  auto set_temps = (bool (*)(void *, double *,
+                             uint64_t))engine->getFunctionAddress(
+      "set_test_temps");
+  auto set_category =
+      (bool (*)(void *, int32_t *, uint64_t))engine->getFunctionAddress(
+          "set_test_category");
+  auto destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_test");
+  auto serializer =
+      (uint8_t * (*)(void *)) engine->getFunctionAddress("serialize_test");
+  auto validator = (bool (*)(const uint8_t *,
+                             uint64_t))engine->getFunctionAddress(
+      "validate_test");
+  auto bounded_deserializer =
+      (void *(*)(const uint8_t *, uint64_t))engine->getFunctionAddress(
+          "deserialize_test_n");
+
+  const int num = 50;
+  int16_t test_raw[num];
+  double test_temps[num];
+  int32_t test_category[num];
+  for (int i = 0; i < num; ++i) {
+    test_raw[i] = (int16_t)(i * 37);
+    test_temps[i] = 20.0 + 0.5 * (i / 5);
+    test_category[i] = i % 3;
+  }
+
+  void *test_struct = constructor();
+  EXPECT_TRUE(set_id(test_struct, 1234567));
+  EXPECT_TRUE(set_raw(test_struct, test_raw, num));
+  EXPECT_TRUE(set_temps(test_struct, test_temps, num));
+  EXPECT_TRUE(set_category(test_struct, test_category, num));
+
+  uint8_t *serialized = serializer(test_struct);
+  uint64_t serialized_size = *(uint64_t *)serialized;
+
+  // Anything after the struct is left alone
+  EXPECT_TRUE(validator(serialized, serialized_size));
+  EXPECT_TRUE(validator(serialized, serialized_size + 1));
+  void *deserialized_struct =
+      bounded_deserializer(serialized, serialized_size);
+  EXPECT_TRUE(deserialized_struct != nullptr);
+  uint64_t id = 0;
+  EXPECT_TRUE(get_id(deserialized_struct, &id));
+  EXPECT_EQ(id, 1234567u);
+  destructor(deserialized_struct);
+
+  EXPECT_FALSE(validator(nullptr, serialized_size));
+  EXPECT_FALSE(validator(serialized, 7));
+  EXPECT_FALSE(validator(serialized, serialized_size - 1));
+  EXPECT_TRUE(bounded_deserializer(serialized, serialized_size - 1) ==
+              nullptr);
+
+  // Cutting the struct short anywhere has to be caught by the fields, even
+  // when the header agrees with the length
+  std::vector<uint8_t> copy(serialized, serialized + serialized_size);
+  for (uint64_t len = 8; len < serialized_size; ++len) {
+    std::vector<uint8_t> truncated(copy.begin(), copy.begin() + len);
+    *(uint64_t *)truncated.data() = len;
+    EXPECT_FALSE(validator(truncated.data(), len)) << len;
+  }
+
+  // Garbage mustn't take it out of bounds either, whatever it decides
+  for (uint64_t i = 8; i < serialized_size; ++i) {
+    copy[i] ^= 0xff;
+    void *garbage = bounded_deserializer(copy.data(), copy.size());
+    if (garbage != nullptr) {
+      destructor(garbage);
+    }
+    copy[i] ^= 0xff;
+  }
+
+  destructor(test_struct);
+  free(serialized);
+}
+
+TEST(CodeGen, validate_dictionary_count) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  tyr::ir::Struct *s = m.getOrCreateStruct("test");
+  s->addRepeatedField("category", m.parseType("int32", true), true,
+                      tyr::ir::kEncodingDictionary);
+
+  s->finalizeFields(m.getModule());
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  auto validator = (bool (*)(const uint8_t *,
+                             uint64_t))engine->getFunctionAddress(
+      "validate_test");
+  auto bounded_deserializer =
+      (void *(*)(const uint8_t *, uint64_t))engine->getFunctionAddress(
+          "deserialize_test_n");
+
+  // Size header, count, a one entry dictionary and the index stream for 8
+  // elements, which all point at that entry
+  uint8_t payload[8 + 8 + 8 + 4 + 1] = {};
+  const uint64_t payload_size = sizeof(payload);
+  const uint64_t count = 8;
+  const uint64_t dict_size = 1;
+  memcpy(payload, &payload_size, 8);
+  memcpy(payload + 8, &count, 8);
+  memcpy(payload + 16, &dict_size, 8);
+  EXPECT_TRUE(validator(payload, payload_size));
+
+  // A few bytes can't stand for more elements than they have index bits
+  const uint64_t huge_counts[] = {9, 1ull << 32u, 1ull << 55u, ~0ull};
+  for (uint64_t huge : huge_counts) {
+    memcpy(payload + 8, &huge, 8);
+    EXPECT_FALSE(validator(payload, payload_size)) << huge;
+    EXPECT_TRUE(bounded_deserializer(payload, payload_size) == nullptr);
+  }
+}
+
+TEST(CodeGen, lazy_correct) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  tyr::ir::Struct *s = m.getOrCreateStruct("test");
+  s->setIsLazy(true);
+  s->addField("idx", m.parseType("int32", false), true);
+  s->addRepeatedField("x", m.parseType("float", true), true);
+  s->addRepeatedField("temps", m.parseType("double", true), true,
+                      tyr::ir::kEncodingXor);
+  s->addRepeatedField("ids", m.parseType("uint32", true), true,
+                      tyr::ir::kEncodingVarint);
+  s->addRepeatedField("category", m.parseType("int32", true), true,
+                      tyr::ir::kEncodingDictionary);
+
+  s->finalizeFields(m.getModule());
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  auto constructor = (void *(*)())engine->getFunctionAddress("create_test");
+  auto set_idx =
+      (bool (*)(void *, int32_t))engine->getFunctionAddress("set_test_idx");
+  auto get_idx =
+      (bool (*)(void *, int32_t *))engine->getFunctionAddress("get_test_idx");
+  auto set_x = (bool (*)(void *, float *, uint64_t))engine->getFunctionAddress(
+      "set_test_x");
+  auto get_x_item = (bool (*)(void *, uint64_t,
+                              float *))engine->getFunctionAddress(
+      "get_test_x_item");
+  auto set_x_item =
+      (bool (*)(void *, uint64_t, float))engine->getFunctionAddress(
+          "set_test_x_item");
+  auto set_temps = (bool (*)(void *, double *,
+                             uint64_t))engine->getFunctionAddress(
+      "set_test_temps");
+  auto get_temps = (bool (*)(void *, double **))engine->getFunctionAddress(
+      "get_test_temps");
+  auto get_temps_count =
+      (bool (*)(void *, uint64_t *))engine->getFunctionAddress(
+          "get_test_temps_count");
+  auto set_ids = (bool (*)(void *, uint32_t *,
+                           uint64_t))engine->getFunctionAddress("set_test_ids");
+  auto get_ids = (bool (*)(void *, uint32_t **))engine->getFunctionAddress(
+      "get_test_ids");
+  auto set_category =
+      (bool (*)(void *, int32_t *, uint64_t))engine->getFunctionAddress(
+          "set_test_category");
+  auto get_category_item =
+      (bool (*)(void *, uint64_t, int32_t *))engine->getFunctionAddress(
+          "get_test_category_item");
+  auto destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_test");
+  auto serializer =
+      (uint8_t * (*)(void *)) engine->getFunctionAddress("serialize_test");
+  auto deserializer =
+      (void *(*)(uint8_t *))engine->getFunctionAddress("deserialize_test");
+
+  const int num = 200;
+  float test_x[num];
+  double test_temps[num];
+  uint32_t test_ids[num];
+  int32_t test_category[num];
+  for (int i = 0; i < num; ++i) {
+    test_x[i] = (float)i / 3;
+    test_temps[i] = 20.0 + 0.25 * (i / 10);
+    test_ids[i] = (uint32_t)i * 1021;
+    test_category[i] = i % 7;
+  }
+
+  void *test_struct = constructor();
+  EXPECT_TRUE(set_idx(test_struct, -12));
+  EXPECT_TRUE(set_x(test_struct, test_x, num));
+  EXPECT_TRUE(set_temps(test_struct, test_temps, num));
+  EXPECT_TRUE(set_ids(test_struct, test_ids, num));
+  EXPECT_TRUE(set_category(test_struct, test_category, num));
+
+  uint8_t *serialized = serializer(test_struct);
+  uint64_t serialized_size = *(uint64_t *)serialized;
+
+  // Nothing is decoded yet, but the scalars and counts are all there
+  void *deserialized_struct = deserializer(serialized);
+  EXPECT_TRUE(deserialized_struct != nullptr);
+  int32_t idx = 0;
+  uint64_t count = 0;
+  EXPECT_TRUE(get_idx(deserialized_struct, &idx));
+  EXPECT_EQ(idx, -12);
+  EXPECT_TRUE(get_temps_count(deserialized_struct, &count));
+  EXPECT_EQ(count, (uint64_t)num);
+
+  // Each access decodes (only) its own field
+  float x = 0;
+  EXPECT_TRUE(get_x_item(deserialized_struct, 5, &x));
+  EXPECT_EQ(x, test_x[5]);
+  EXPECT_FALSE(get_x_item(deserialized_struct, num, &x));
+  double *temps = nullptr;
+  EXPECT_TRUE(get_temps(deserialized_struct, &temps));
+  EXPECT_EQ(memcmp(temps, test_temps, sizeof(test_temps)), 0);
+
+  // Writing into an element decodes the rest of the field first
+  EXPECT_TRUE(set_x_item(deserialized_struct, 0, 42.f));
+  EXPECT_TRUE(get_x_item(deserialized_struct, 1, &x));
+  EXPECT_EQ(x, test_x[1]);
+
+  // Serializing picks up whatever is still pending
+  test_x[0] = 42.f;
+  EXPECT_TRUE(set_x(test_struct, test_x, num));
+  uint8_t *expected = serializer(test_struct);
+  uint8_t *reserialized = serializer(deserialized_struct);
+  EXPECT_EQ(memcmp(reserialized, expected, serialized_size), 0);
+
+  uint32_t *ids = nullptr;
+  EXPECT_TRUE(get_ids(deserialized_struct, &ids));
+  EXPECT_EQ(memcmp(ids, test_ids, sizeof(test_ids)), 0);
+  int32_t category = 0;
+  EXPECT_TRUE(get_category_item(deserialized_struct, num - 1, &category));
+  EXPECT_EQ(category, test_category[num - 1]);
+
+  // Never touching a field is fine too
+  void *untouched_struct = deserializer(serialized);
+  EXPECT_TRUE(untouched_struct != nullptr);
+  destructor(untouched_struct);
+
+  // The eager deserializers are done with the buffer when they return
+  auto eager_deserializer = (void *(*)(uint8_t *))engine->getFunctionAddress(
+      "deserialize_test_eager");
+  auto eager_bounded_deserializer =
+      (void *(*)(const uint8_t *, uint64_t))engine->getFunctionAddress(
+          "deserialize_test_eager_n");
+  for (int bounded = 0; bounded < 2; ++bounded) {
+    std::vector<uint8_t> copy(serialized, serialized + serialized_size);
+    void *eager_struct =
+        bounded ? eager_bounded_deserializer(copy.data(), copy.size())
+                : eager_deserializer(copy.data());
+    EXPECT_TRUE(eager_struct != nullptr);
+    std::fill(copy.begin(), copy.end(), 0xff);
+    EXPECT_TRUE(get_ids(eager_struct, &ids));
+    EXPECT_EQ(memcmp(ids, test_ids, sizeof(test_ids)), 0);
+    EXPECT_TRUE(get_category_item(eager_struct, num - 1, &category));
+    EXPECT_EQ(category, test_category[num - 1]);
+    EXPECT_TRUE(get_x_item(eager_struct, 7, &x));
+    EXPECT_EQ(x, test_x[7]);
+    destructor(eager_struct);
+  }
+  EXPECT_TRUE(eager_bounded_deserializer(serialized, serialized_size - 1) ==
+              nullptr);
+
+  destructor(deserialized_struct);
+  destructor(test_struct);
+  free(reserialized);
+  free(expected);
+  free(serialized);
+}
+
+TEST(CodeGen, fields_correct) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  tyr::ir::Struct *s = m.getOrCreateStruct("test");
+  s->setIsBitPacked(true);
+  s->addField("src", m.parseType("int13", false), true);
+  s->addField("visited", m.parseType("bool", false), true);
+  s->addRepeatedField("x", m.parseType("float", true), true);
+  s->addRepeatedField("temps", m.parseType("double", true), true,
+                      tyr::ir::kEncodingXor);
+  s->addRepeatedField("ids", m.parseType("uint32", true), true,
+                      tyr::ir::kEncodingVarint);
+
+  s->finalizeFields(m.getModule());
+
+  uint64_t src_mask = 0, x_mask = 0, temps_mask = 0, ids_mask = 0;
+  for (auto &f : s->getFields()) {
+    if (f->name == "src") {
+      src_mask = s->getFieldMask(f.get());
+    } else if (f->name == "x") {
+      x_mask = s->getFieldMask(f.get());
+    } else if (f->name == "temps") {
+      temps_mask = s->getFieldMask(f.get());
+    } else if (f->name == "ids") {
+      ids_mask = s->getFieldMask(f.get());
+    }
+  }
+  EXPECT_NE(src_mask, 0u);
+  EXPECT_EQ(src_mask & x_mask, 0u);
+  EXPECT_EQ(temps_mask & ids_mask, 0u);
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  auto constructor = (void *(*)())engine->getFunctionAddress("create_test");
+  auto set_src =
+      (bool (*)(void *, uint16_t))engine->getFunctionAddress("set_test_src");
+  auto get_src =
+      (bool (*)(void *, uint16_t *))engine->getFunctionAddress("get_test_src");
+  auto set_x = (bool (*)(void *, float *, uint64_t))engine->getFunctionAddress(
+      "set_test_x");
+  auto get_x =
+      (bool (*)(void *, float **))engine->getFunctionAddress("get_test_x");
+  auto set_temps = (bool (*)(void *, double *,
+                             uint64_t))engine->getFunctionAddress(
+      "set_test_temps");
+  auto get_temps_count =
+      (bool (*)(void *, uint64_t *))engine->getFunctionAddress(
+          "get_test_temps_count");
+  auto set_ids = (bool (*)(void *, uint32_t *,
+                           uint64_t))engine->getFunctionAddress("set_test_ids");
+  auto get_ids = (bool (*)(void *, uint32_t **))engine->getFunctionAddress(
+      "get_test_ids");
+  auto get_ids_count =
+      (bool (*)(void *, uint64_t *))engine->getFunctionAddress(
+          "get_test_ids_count");
+  auto destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_test");
+  auto serializer =
+      (uint8_t * (*)(void *)) engine->getFunctionAddress("serialize_test");
+  auto projected_deserializer =
+      (void *(*)(const uint8_t *, uint64_t, uint64_t))
+          engine->getFunctionAddress("deserialize_test_fields");
+
+  const int num = 100;
+  float test_x[num];
+  double test_temps[num];
+  uint32_t test_ids[num];
+  for (int i = 0; i < num; ++i) {
+    test_x[i] = (float)i * 1.5f;
+    test_temps[i] = 20.0 + 0.25 * (i / 10);
+    test_ids[i] = (uint32_t)i * 977;
+  }
+
+  void *test_struct = constructor();
+  EXPECT_TRUE(set_src(test_struct, 4321));
+  EXPECT_TRUE(set_x(test_struct, test_x, num));
+  EXPECT_TRUE(set_temps(test_struct, test_temps, num));
+  EXPECT_TRUE(set_ids(test_struct, test_ids, num));
+
+  uint8_t *serialized = serializer(test_struct);
+  uint64_t serialized_size = *(uint64_t *)serialized;
+
+  void *projected =
+      projected_deserializer(serialized, serialized_size, x_mask | ids_mask);
+  EXPECT_TRUE(projected != nullptr);
+  float *x = nullptr;
+  uint32_t *ids = nullptr;
+  uint64_t count = 1;
+  uint16_t src = 1;
+  EXPECT_TRUE(get_x(projected, &x));
+  EXPECT_EQ(memcmp(x, test_x, sizeof(test_x)), 0);
+  EXPECT_TRUE(get_ids(projected, &ids));
+  EXPECT_EQ(memcmp(ids, test_ids, sizeof(test_ids)), 0);
+  // Everything else is left empty
+  EXPECT_TRUE(get_temps_count(projected, &count));
+  EXPECT_EQ(count, 0u);
+  EXPECT_TRUE(get_src(projected, &src));
+  EXPECT_EQ(src, 0);
+  destructor(projected);
+
+  projected = projected_deserializer(serialized, serialized_size, src_mask);
+  EXPECT_TRUE(projected != nullptr);
+  EXPECT_TRUE(get_src(projected, &src));
+  EXPECT_EQ(src, 4321);
+  EXPECT_TRUE(get_ids_count(projected, &count));
+  EXPECT_EQ(count, 0u);
+  destructor(projected);
+
+  // The buffer has to be at least as long as the header says
+  EXPECT_TRUE(projected_deserializer(serialized, serialized_size - 1,
+                                     x_mask) == nullptr);
+  EXPECT_TRUE(projected_deserializer(serialized, 4, x_mask) == nullptr);
+
+  // and the lengths of the fields that get skipped have to fit in it as well
+  for (uint64_t len = 8; len < serialized_size; ++len) {
+    std::vector<uint8_t> truncated(serialized, serialized + len);
+    *(uint64_t *)truncated.data() = len;
+    EXPECT_TRUE(projected_deserializer(truncated.data(), len, src_mask) ==
+                nullptr)
+        << len;
+  }
+
+  destructor(test_struct);
+  free(serialized);
+}
+
+TEST(CodeGen, indexed_correct) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  tyr::ir::Struct *s = m.getOrCreateStruct("test");
+  s->setIsIndexed(true);
+  s->setIsLazy(true);
+  s->addField("idx", m.parseType("int32", false), true);
+  s->addRepeatedField("x", m.parseType("float", true), true);
+  s->addRepeatedField("temps", m.parseType("double", true), true,
+                      tyr::ir::kEncodingXor);
+  s->addRepeatedField("ids", m.parseType("uint32", true), true,
+                      tyr::ir::kEncodingVarint);
+
+  s->finalizeFields(m.getModule());
+
+  uint64_t x_mask = 0, ids_mask = 0, all_mask = 0;
+  for (auto &f : s->getFields()) {
+    if (f->name == "x") {
+      x_mask = s->getFieldMask(f.get());
+    } else if (f->name == "ids") {
+      ids_mask = s->getFieldMask(f.get());
+    }
+    all_mask |= s->getFieldMask(f.get());
+  }
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  auto constructor = (void *(*)())engine->getFunctionAddress("create_test");
+  auto set_idx =
+      (bool (*)(void *, int32_t))engine->getFunctionAddress("set_test_idx");
+  auto get_idx =
+      (bool (*)(void *, int32_t *))engine->getFunctionAddress("get_test_idx");
+  auto set_x = (bool (*)(void *, float *, uint64_t))engine->getFunctionAddress(
+      "set_test_x");
+  auto get_x =
+      (bool (*)(void *, float **))engine->getFunctionAddress("get_test_x");
+  auto set_temps = (bool (*)(void *, double *,
+                             uint64_t))engine->getFunctionAddress(
+      "set_test_temps");
+  auto get_temps = (bool (*)(void *, double **))engine->getFunctionAddress(
+      "get_test_temps");
+  auto get_temps_count =
+      (bool (*)(void *, uint64_t *))engine->getFunctionAddress(
+          "get_test_temps_count");
+  auto set_ids = (bool (*)(void *, uint32_t *,
+                           uint64_t))engine->getFunctionAddress("set_test_ids");
+  auto get_ids = (bool (*)(void *, uint32_t **))engine->getFunctionAddress(
+      "get_test_ids");
+  auto destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_test");
+  auto serializer =
+      (uint8_t * (*)(void *)) engine->getFunctionAddress("serialize_test");
+  auto deserializer =
+      (void *(*)(uint8_t *))engine->getFunctionAddress("deserialize_test");
+  auto projected_deserializer =
+      (void *(*)(const uint8_t *, uint64_t, uint64_t))
+          engine->getFunctionAddress("deserialize_test_fields");
+  auto validator = (bool (*)(const uint8_t *, uint64_t))
+                       engine->getFunctionAddress("validate_test");
+
+  const int num = 100;
+  float test_x[num];
+  double test_temps[num];
+  uint32_t test_ids[num];
+  for (int i = 0; i < num; ++i) {
+    test_x[i] = (float)i * 1.5f;
+    test_temps[i] = 20.0 + 0.25 * (i / 10);
+    test_ids[i] = (uint32_t)i * 977;
+  }
+
+  void *test_struct = constructor();
+  EXPECT_TRUE(set_idx(test_struct, 7));
+  EXPECT_TRUE(set_x(test_struct, test_x, num));
+  EXPECT_TRUE(set_temps(test_struct, test_temps, num));
+  EXPECT_TRUE(set_ids(test_struct, test_ids, num));
+
+  uint8_t *serialized = serializer(test_struct);
+  uint64_t serialized_size = *(uint64_t *)serialized;
+  EXPECT_TRUE(validator(serialized, serialized_size));
+
+  // One offset per field follows the size header, and each repeated field
+  // starts with its count
+  const uint64_t *table = (uint64_t *)(serialized + sizeof(uint64_t));
+  EXPECT_EQ(table[0], 5 * sizeof(uint64_t));
+  int num_counts = 0;
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_LT(table[i], serialized_size);
+    if (i > 0) {
+      EXPECT_GT(table[i], table[i - 1]);
+    }
+    num_counts += *(uint64_t *)(serialized + table[i]) == (uint64_t)num;
+  }
+  EXPECT_EQ(num_counts, 3);
+
+  void *deserialized_struct = deserializer(serialized);
+  EXPECT_TRUE(deserialized_struct != nullptr);
+  int32_t idx = 0;
+  double *temps = nullptr;
+  uint32_t *ids = nullptr;
+  EXPECT_TRUE(get_idx(deserialized_struct, &idx));
+  EXPECT_EQ(idx, 7);
+  EXPECT_TRUE(get_temps(deserialized_struct, &temps));
+  EXPECT_EQ(memcmp(temps, test_temps, sizeof(test_temps)), 0);
+  EXPECT_TRUE(get_ids(deserialized_struct, &ids));
+  EXPECT_EQ(memcmp(ids, test_ids, sizeof(test_ids)), 0);
+  uint8_t *reserialized = serializer(deserialized_struct);
+  EXPECT_EQ(memcmp(reserialized, serialized, serialized_size), 0);
+  destructor(deserialized_struct);
+
+  void *projected =
+      projected_deserializer(serialized, serialized_size, x_mask | ids_mask);
+  EXPECT_TRUE(projected != nullptr);
+  float *x = nullptr;
+  uint64_t count = 1;
+  EXPECT_TRUE(get_x(projected, &x));
+  EXPECT_EQ(memcmp(x, test_x, sizeof(test_x)), 0);
+  EXPECT_TRUE(get_ids(projected, &ids));
+  EXPECT_EQ(memcmp(ids, test_ids, sizeof(test_ids)), 0);
+  EXPECT_TRUE(get_temps_count(projected, &count));
+  EXPECT_EQ(count, 0u);
+  destructor(projected);
+
+  // A field that doesn't end where the next one starts is caught
+  uint64_t *offset = (uint64_t *)(serialized + sizeof(uint64_t)) + 1;
+  *offset += 1;
+  EXPECT_FALSE(validator(serialized, serialized_size));
+  EXPECT_TRUE(projected_deserializer(serialized, serialized_size, all_mask) ==
+              nullptr);
+  *offset -= 1;
+  EXPECT_TRUE(validator(serialized, serialized_size));
+
+  destructor(test_struct);
+  free(reserialized);
+  free(serialized);
+}
+
+TEST(CodeGen, frozen_correct) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  tyr::ir::Struct *s = m.getOrCreateStruct("test");
+  s->setIsFrozen(true);
+  s->addField("idx", m.parseType("int32", false), false);
+  s->addField("stamp", m.parseType("int64", false), true);
+  s->addRepeatedField("xy", m.parseType("double", true), false);
+  s->addRepeatedField("ids", m.parseType("uint16", true), true);
+
+  s->finalizeFields(m.getModule());
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  // Arrays are passed to the constructor even when they're mutable
+  auto constructor =
+      (void *(*)(int32_t, uint64_t, double *, uint64_t, uint16_t *))
+          engine->getFunctionAddress("create_test");
+  auto get_idx =
+      (bool (*)(void *, int32_t *))engine->getFunctionAddress("get_test_idx");
+  auto set_stamp =
+      (bool (*)(void *, int64_t))engine->getFunctionAddress("set_test_stamp");
+  auto get_stamp = (bool (*)(void *, int64_t *))engine->getFunctionAddress(
+      "get_test_stamp");
+  auto get_xy =
+      (bool (*)(void *, double **))engine->getFunctionAddress("get_test_xy");
+  auto get_ids = (bool (*)(void *, uint16_t **))engine->getFunctionAddress(
+      "get_test_ids");
+  auto set_ids = (bool (*)(void *, uint16_t *,
+                           uint64_t))engine->getFunctionAddress("set_test_ids");
+  auto set_ids_item =
+      (bool (*)(void *, uint64_t, uint16_t))engine->getFunctionAddress(
+          "set_test_ids_item");
+  auto destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_test");
+  auto serializer =
+      (uint8_t * (*)(void *)) engine->getFunctionAddress("serialize_test");
+  auto deserializer =
+      (void *(*)(uint8_t *))engine->getFunctionAddress("deserialize_test");
+  auto validator = (bool (*)(const uint8_t *, uint64_t))
+                       engine->getFunctionAddress("validate_test");
+
+  double test_xy[4] = {1.5, -2.25, 1e300, 0};
+  uint16_t test_ids[3] = {7, 65535, 0};
+
+  void *test_struct = constructor(-4, 4, test_xy, 3, test_ids);
+  EXPECT_TRUE(test_struct != nullptr);
+  EXPECT_TRUE(set_stamp(test_struct, 1234567890123));
+
+  // The struct is its own serialized form
+  uint8_t *serialized = serializer(test_struct);
+  uint64_t serialized_size = *(uint64_t *)serialized;
+  EXPECT_EQ(serialized_size % sizeof(uint64_t), 0u);
+  EXPECT_EQ(memcmp(serialized, test_struct, serialized_size), 0);
+  EXPECT_TRUE(validator(serialized, serialized_size));
+
+  // so a valid buffer can be used without deserializing it
+  void *in_place = serialized;
+  int32_t idx = 0;
+  int64_t stamp = 0;
+  double *xy = nullptr;
+  uint16_t *ids = nullptr;
+  EXPECT_TRUE(get_idx(in_place, &idx));
+  EXPECT_EQ(idx, -4);
+  EXPECT_TRUE(get_stamp(in_place, &stamp));
+  EXPECT_EQ(stamp, 1234567890123);
+  EXPECT_TRUE(get_xy(in_place, &xy));
+  EXPECT_EQ(memcmp(xy, test_xy, sizeof(test_xy)), 0);
+  EXPECT_LT((uint64_t)((uint8_t *)xy - serialized), serialized_size);
+
+  // Arrays can be written in place but not resized
+  EXPECT_TRUE(set_ids_item(in_place, 2, 99));
+  test_ids[0] = 8;
+  EXPECT_TRUE(set_ids(in_place, test_ids, 3));
+  EXPECT_FALSE(set_ids(in_place, test_ids, 2));
+  EXPECT_TRUE(get_ids(in_place, &ids));
+  EXPECT_EQ(ids[0], 8);
+  EXPECT_EQ(ids[2], 0);
+
+  void *deserialized_struct = deserializer(serialized);
+  EXPECT_TRUE(deserialized_struct != nullptr);
+  EXPECT_EQ(memcmp(deserialized_struct, serialized, serialized_size), 0);
+  destructor(deserialized_struct);
+
+  // Arrays have to stay inside the buffer
+  EXPECT_FALSE(validator(serialized, serialized_size - 1));
+  *(uint64_t *)serialized = serialized_size - sizeof(uint64_t);
+  EXPECT_FALSE(validator(serialized, serialized_size));
+  *(uint64_t *)serialized = serialized_size;
+  EXPECT_TRUE(validator(serialized, serialized_size));
+
+  destructor(test_struct);
+  free(serialized);
+}
+
+TEST(CodeGen, tracked_correct) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  tyr::ir::Struct *s = m.getOrCreateStruct("test");
+  s->setIsTracked(true);
+  s->addField("id", m.parseType("int32", false), false);
+  s->addField("tick", m.parseType("int64", false), true);
+  s->addRepeatedField("vals", m.parseType("int32", true), true);
+
+  s->finalizeFields(m.getModule());
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  auto constructor =
+      (void *(*)(int32_t))engine->getFunctionAddress("create_test");
+  auto set_tick =
+      (bool (*)(void *, int64_t))engine->getFunctionAddress("set_test_tick");
+  auto get_tick = (bool (*)(void *, int64_t *))engine->getFunctionAddress(
+      "get_test_tick");
+  auto set_vals = (bool (*)(void *, int32_t *, uint64_t))
+                      engine->getFunctionAddress("set_test_vals");
+  auto set_vals_item =
+      (bool (*)(void *, uint64_t, int32_t))engine->getFunctionAddress(
+          "set_test_vals_item");
+  auto get_vals = (bool (*)(void *, int32_t **))engine->getFunctionAddress(
+      "get_test_vals");
+  auto destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_test");
+  auto serializer =
+      (uint8_t * (*)(void *)) engine->getFunctionAddress("serialize_test");
+  auto deserializer =
+      (void *(*)(uint8_t *))engine->getFunctionAddress("deserialize_test");
+  auto delta_serializer =
+      (uint8_t * (*)(void *))
+          engine->getFunctionAddress("serialize_test_delta");
+  auto apply_delta = (bool (*)(void *, const uint8_t *, uint64_t))
+                         engine->getFunctionAddress("apply_test_delta");
+
+  int32_t test_vals[6] = {1, 2, 3, 4, 5, 6};
+
+  void *test_struct = constructor(17);
+  EXPECT_TRUE(test_struct != nullptr);
+  EXPECT_TRUE(set_vals(test_struct, test_vals, 6));
+
+  // Start the replica off from a full copy
+  uint8_t *serialized = serializer(test_struct);
+  void *replica = deserializer(serialized);
+  EXPECT_TRUE(replica != nullptr);
+  free(serialized);
+  free(delta_serializer(test_struct));
+
+  // Nothing changed, so it's just the header
+  uint8_t *delta = delta_serializer(test_struct);
+  EXPECT_EQ(*(uint64_t *)delta, 3 * sizeof(uint64_t));
+  EXPECT_TRUE(apply_delta(replica, delta, *(uint64_t *)delta));
+  free(delta);
+
+  // A scalar goes out on its own
+  EXPECT_TRUE(set_tick(test_struct, -12345));
+  delta = delta_serializer(test_struct);
+  uint64_t delta_size = *(uint64_t *)delta;
+  EXPECT_EQ(delta_size, 3 * sizeof(uint64_t) + sizeof(int64_t));
+  EXPECT_FALSE(apply_delta(replica, delta, delta_size - 1));
+  EXPECT_TRUE(apply_delta(replica, delta, delta_size));
+  int64_t tick = 0;
+  EXPECT_TRUE(get_tick(replica, &tick));
+  EXPECT_EQ(tick, -12345);
+  free(delta);
+
+  // Items only send the range of them that was set
+  EXPECT_TRUE(set_vals_item(test_struct, 3, 40));
+  EXPECT_TRUE(set_vals_item(test_struct, 1, 20));
+  delta = delta_serializer(test_struct);
+  delta_size = *(uint64_t *)delta;
+  EXPECT_EQ(delta_size, 5 * sizeof(uint64_t) + 3 * sizeof(int32_t));
+  EXPECT_TRUE(apply_delta(replica, delta, delta_size));
+  int32_t *vals = nullptr;
+  EXPECT_TRUE(get_vals(replica, &vals));
+  EXPECT_EQ(vals[1], 20);
+  EXPECT_EQ(vals[2], 3);
+  EXPECT_EQ(vals[3], 40);
+
+  // A range past the end of the replica's array is rejected
+  ((uint64_t *)delta)[3] = 4;
+  EXPECT_FALSE(apply_delta(replica, delta, delta_size));
+  free(delta);
+
+  // and so are fields that don't exist
+  uint64_t bad_delta[3] = {3 * sizeof(uint64_t), 1ull << 63u, 0};
+  EXPECT_FALSE(apply_delta(replica, (uint8_t *)bad_delta, sizeof(bad_delta)));
+
+  // Resizing sends the whole array
+  EXPECT_TRUE(set_vals(test_struct, test_vals, 2));
+  delta = delta_serializer(test_struct);
+  EXPECT_TRUE(apply_delta(replica, delta, *(uint64_t *)delta));
+  EXPECT_TRUE(get_vals(replica, &vals));
+  EXPECT_EQ(vals[0], 1);
+  EXPECT_EQ(vals[1], 2);
+  free(delta);
+
+  destructor(replica);
+  destructor(test_struct);
+}
+
+TEST(CodeGen, batch_correct) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  // One struct of plain scalars and one with an array
+  tyr::ir::Struct *fixed = m.getOrCreateStruct("edge");
+  fixed->setIsPacked(true);
+  fixed->addField("src", m.parseType("uint32", false), false);
+  fixed->addField("weight", m.parseType("double", false), false);
+  fixed->finalizeFields(m.getModule());
+
+  tyr::ir::Struct *var = m.getOrCreateStruct("test");
+  var->addField("idx", m.parseType("int32", false), false);
+  var->addRepeatedField("vals", m.parseType("int16", true), true);
+  var->finalizeFields(m.getModule());
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  auto edge_constructor = (void *(*)(uint32_t, double))
+                              engine->getFunctionAddress("create_edge");
+  auto get_src =
+      (bool (*)(void *, uint32_t *))engine->getFunctionAddress("get_edge_src");
+  auto get_weight = (bool (*)(void *, double *))engine->getFunctionAddress(
+      "get_edge_weight");
+  auto edge_destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_edge");
+  auto edge_batch_serializer =
+      (uint64_t(*)(void **, uint64_t, uint8_t *, uint64_t))
+          engine->getFunctionAddress("serialize_edge_batch");
+  auto edge_batch_deserializer =
+      (void **(*)(const uint8_t *, uint64_t, uint64_t *))
+          engine->getFunctionAddress("deserialize_edge_batch");
+
+  auto test_constructor =
+      (void *(*)(int32_t))engine->getFunctionAddress("create_test");
+  auto set_vals = (bool (*)(void *, int16_t *, uint64_t))
+                      engine->getFunctionAddress("set_test_vals");
+  auto get_vals_item =
+      (bool (*)(void *, uint64_t, int16_t *))engine->getFunctionAddress(
+          "get_test_vals_item");
+  auto test_destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_test");
+  auto test_batch_serializer =
+      (uint64_t(*)(void **, uint64_t, uint8_t *, uint64_t))
+          engine->getFunctionAddress("serialize_test_batch");
+  auto test_batch_deserializer =
+      (void **(*)(const uint8_t *, uint64_t, uint64_t *))
+          engine->getFunctionAddress("deserialize_test_batch");
+
+  void *edges[3];
+  for (uint32_t i = 0; i < 3; ++i) {
+    edges[i] = edge_constructor(i + 1, i * 0.5);
+  }
+
+  // Fixed size records are 12 bytes each, after the 32 byte header
+  uint64_t batch_size = edge_batch_serializer(edges, 3, nullptr, 0);
+  EXPECT_EQ(batch_size, 32u + 3 * 12);
+  std::vector<uint8_t> batch(batch_size);
+  EXPECT_EQ(edge_batch_serializer(edges, 3, batch.data(), batch_size),
+            batch_size);
+
+  uint64_t n = 0;
+  void **out = edge_batch_deserializer(batch.data(), batch_size, &n);
+  EXPECT_TRUE(out != nullptr);
+  EXPECT_EQ(n, 3u);
+  for (uint32_t i = 0; i < 3; ++i) {
+    uint32_t src = 0;
+    double weight = -1;
+    EXPECT_TRUE(get_src(out[i], &src));
+    EXPECT_TRUE(get_weight(out[i], &weight));
+    EXPECT_EQ(src, i + 1);
+    EXPECT_EQ(weight, i * 0.5);
+    edge_destructor(out[i]);
+    edge_destructor(edges[i]);
+  }
+  free(out);
+
+  // Truncated batches and other structs' batches are rejected
+  EXPECT_TRUE(edge_batch_deserializer(batch.data(), batch_size - 1, &n) ==
+              nullptr);
+  EXPECT_TRUE(test_batch_deserializer(batch.data(), batch_size, &n) ==
+              nullptr);
+
+  int16_t test_vals[3] = {-1, 2, -3};
+  void *tests[2] = {test_constructor(7), test_constructor(8)};
+  EXPECT_TRUE(set_vals(tests[1], test_vals, 3));
+
+  batch_size = test_batch_serializer(tests, 2, nullptr, 0);
+  batch.resize(batch_size);
+  EXPECT_EQ(test_batch_serializer(tests, 2, batch.data(), batch_size),
+            batch_size);
+  out = test_batch_deserializer(batch.data(), batch_size, &n);
+  EXPECT_TRUE(out != nullptr);
+  EXPECT_EQ(n, 2u);
+  int16_t val = 0;
+  EXPECT_TRUE(get_vals_item(out[1], 2, &val));
+  EXPECT_EQ(val, -3);
+  for (int i = 0; i < 2; ++i) {
+    test_destructor(out[i]);
+    test_destructor(tests[i]);
+  }
+  free(out);
+}
+
+// Stands in for the runtime's tyr_parallel_for, running the chunks backwards
+// so any dependence between them shows up
+uint64_t parallel_for_calls = 0;
+void reverse_parallel_for(uint64_t n, void (*fn)(void *, uint64_t),
+                          void *ctx) {
+  ++parallel_for_calls;
+  for (uint64_t i = n; i > 0; --i) {
+    fn(ctx, i - 1);
+  }
+}
+
+TEST(CodeGen, parallel_correct) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  tyr::ir::Struct *s = m.getOrCreateStruct("test");
+  s->addRepeatedField("vals", m.parseType("int32", true), true);
+  s->addRepeatedField("ts", m.parseType("uint64", true), true,
+                      tyr::ir::kEncodingDelta);
+
+  s->finalizeFields(m.getModule());
+
+  // What linking in the parallel runtime declares
+  llvm::Type *Int8PtrTy = llvm::Type::getInt8PtrTy(ctx);
+  llvm::Type *Int64Ty = llvm::Type::getInt64Ty(ctx);
+  llvm::FunctionType *ChunkFnType = llvm::FunctionType::get(
+      llvm::Type::getVoidTy(ctx), {Int8PtrTy, Int64Ty}, false);
+  m.getModule()->getOrInsertFunction(
+      "tyr_parallel_for",
+      llvm::FunctionType::get(
+          llvm::Type::getVoidTy(ctx),
+          {Int64Ty, ChunkFnType->getPointerTo(), Int8PtrTy}, false));
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::sys::DynamicLibrary::AddSymbol("tyr_parallel_for",
+                                       (void *)&reverse_parallel_for);
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  auto constructor = (void *(*)())engine->getFunctionAddress("create_test");
+  auto set_vals = (bool (*)(void *, int32_t *, uint64_t))
+                      engine->getFunctionAddress("set_test_vals");
+  auto set_ts = (bool (*)(void *, uint64_t *,
+                          uint64_t))engine->getFunctionAddress("set_test_ts");
+  auto get_ts = (bool (*)(void *, uint64_t **))engine->getFunctionAddress(
+      "get_test_ts");
+  auto destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_test");
+  auto serializer =
+      (uint8_t * (*)(void *)) engine->getFunctionAddress("serialize_test");
+  auto deserializer =
+      (void *(*)(uint8_t *))engine->getFunctionAddress("deserialize_test");
+
+  // Not a whole number of chunks, so the last one is short
+  const uint64_t num = 300001;
+  std::vector<int32_t> test_vals(num);
+  std::vector<uint64_t> test_ts(num);
+  for (uint64_t i = 0; i < num; ++i) {
+    test_vals[i] = (int32_t)rand();
+    test_ts[i] = 1600000000000 + 1000 * i + (rand() & 0xff);
+  }
+
+  void *test_struct = constructor();
+  EXPECT_TRUE(set_vals(test_struct, test_vals.data(), num));
+  EXPECT_TRUE(set_ts(test_struct, test_ts.data(), num));
+
+  uint8_t *serialized = serializer(test_struct);
+  EXPECT_EQ(parallel_for_calls, 2u);
+  EXPECT_EQ(*(uint64_t *)serialized, 8 + 8 + 4 * num + 8 + 8 * num);
+
+  // Same bytes the sequential path writes
+  EXPECT_EQ(memcmp(serialized + 16, test_vals.data(), 4 * num), 0);
+  const uint64_t *wire_ts = (uint64_t *)(serialized + 24 + 4 * num);
+  for (uint64_t i = 0; i < num; ++i) {
+    EXPECT_EQ(wire_ts[i], test_ts[i] - (i > 0 ? test_ts[i - 1] : 0));
+  }
+
+  void *deserialized_struct = deserializer(serialized);
+  EXPECT_TRUE(deserialized_struct != nullptr);
+  uint64_t *ts = nullptr;
+  EXPECT_TRUE(get_ts(deserialized_struct, &ts));
+  EXPECT_TRUE(std::equal(test_ts.begin(), test_ts.end(), ts));
+  destructor(deserialized_struct);
+  free(serialized);
+
+  // Small fields stay on the calling thread
+  EXPECT_TRUE(set_vals(test_struct, test_vals.data(), 16));
+  EXPECT_TRUE(set_ts(test_struct, test_ts.data(), 16));
+  serialized = serializer(test_struct);
+  EXPECT_EQ(parallel_for_calls, 2u);
+  EXPECT_EQ(memcmp(serialized + 16, test_vals.data(), 4 * 16), 0);
+
+  destructor(test_struct);
+  free(serialized);
+}
+
+
+TEST(CodeGen, decoder_correct) {
+  llvm::LLVMContext ctx;
+  tyr::Module m{"test_module", ctx};
+  m.setDefaultBuiltins();
+
+  // A lazy struct, which can't keep pointing into the decoder's buffer, and
+  // a frozen one, which is decoded into its own memory
+  tyr::ir::Struct *lazy = m.getOrCreateStruct("msg");
+  lazy->setIsLazy(true);
+  lazy->addField("idx", m.parseType("int32", false), true);
+  lazy->addRepeatedField("vals", m.parseType("int32", true), true);
+  lazy->finalizeFields(m.getModule());
+
+  tyr::ir::Struct *frozen = m.getOrCreateStruct("frz");
+  frozen->setIsFrozen(true);
+  frozen->addField("idx", m.parseType("int32", false), false);
+  frozen->addRepeatedField("xy", m.parseType("double", true), false);
+  frozen->finalizeFields(m.getModule());
+
+  tyr::PassManager PM;
+  PM.registerPass(tyr::pass::createLLVMIRGenPass(m));
+  EXPECT_TRUE(PM.runOnModule(m));
+
+  EXPECT_FALSE(llvm::verifyModule(*(m.getModule()), &llvm::errs()));
+
+  llvm::ExecutionEngine *engine = tyr::getExecutionEngine(m.getModule());
+  EXPECT_TRUE(engine != nullptr);
+
+  using feed_fn = int (*)(void *, const uint8_t *, uint64_t, uint64_t *,
+                          void **);
+  auto msg_constructor =
+      (void *(*)())engine->getFunctionAddress("create_msg");
+  auto set_idx =
+      (bool (*)(void *, int32_t))engine->getFunctionAddress("set_msg_idx");
+  auto get_idx =
+      (bool (*)(void *, int32_t *))engine->getFunctionAddress("get_msg_idx");
+  auto set_vals = (bool (*)(void *, int32_t *, uint64_t))
+                      engine->getFunctionAddress("set_msg_vals");
+  auto get_vals_count = (bool (*)(void *, uint64_t *))
+                            engine->getFunctionAddress("get_msg_vals_count");
+  auto get_vals_item = (bool (*)(void *, uint64_t, int32_t *))
+                           engine->getFunctionAddress("get_msg_vals_item");
+  auto msg_destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_msg");
+  auto msg_serializer =
+      (uint8_t * (*)(void *)) engine->getFunctionAddress("serialize_msg");
+  auto create_decoder =
+      (void *(*)(uint64_t))engine->getFunctionAddress("create_msg_decoder");
+  auto feed = (feed_fn)engine->getFunctionAddress("msg_decoder_feed");
+  auto destroy_decoder =
+      (void (*)(void *))engine->getFunctionAddress("destroy_msg_decoder");
+
+  // Two messages back to back
+  std::vector<uint8_t> stream;
+  for (int32_t idx = 0; idx < 2; ++idx) {
+    std::vector<int32_t> vals(1000 + idx, idx - 7);
+    void *msg = msg_constructor();
+    EXPECT_TRUE(set_idx(msg, idx));
+    EXPECT_TRUE(set_vals(msg, vals.data(), vals.size()));
+    uint8_t *serialized = msg_serializer(msg);
+    stream.insert(stream.end(), serialized,
+                  serialized + *(uint64_t *)serialized);
+    free(serialized);
+    msg_destructor(msg);
+  }
+
+  auto check_msg = [&](void *msg, int32_t idx) {
+    int32_t got_idx = -1;
+    uint64_t count = 0;
+    int32_t last = 0;
+    EXPECT_TRUE(get_idx(msg, &got_idx));
+    EXPECT_TRUE(get_vals_count(msg, &count));
+    EXPECT_TRUE(get_vals_item(msg, count - 1, &last));
+    EXPECT_EQ(got_idx, idx);
+    EXPECT_EQ(count, 1000u + idx);
+    EXPECT_EQ(last, idx - 7);
+  };
+
+  // Fed in pieces of every size from 1 to 13 bytes, which never line up with
+  // the messages
+  void *decoder = create_decoder(0);
+  EXPECT_TRUE(decoder != nullptr);
+  int32_t decoded = 0;
+  uint64_t pos = 0, piece = 0;
+  while (pos < stream.size()) {
+    uint64_t len = std::min<uint64_t>(piece % 13 + 1, stream.size() - pos);
+    ++piece;
+    while (len > 0) {
+      uint64_t consumed = 0;
+      void *out = nullptr;
+      int status = feed(decoder, stream.data() + pos, len, &consumed, &out);
+      EXPECT_NE(status, 2);
+      pos += consumed;
+      len -= consumed;
+      if (status == 1) {
+        check_msg(out, decoded++);
+        msg_destructor(out);
+      } else {
+        EXPECT_EQ(len, 0u);
+      }
+    }
+  }
+  EXPECT_EQ(decoded, 2);
+
+  // Whole messages are decoded straight from the input, one per call
+  uint64_t consumed = 0;
+  void *out = nullptr;
+  EXPECT_EQ(feed(decoder, stream.data(), stream.size(), &consumed, &out), 1);
+  check_msg(out, 0);
+  msg_destructor(out);
+  const uint64_t first_size = consumed;
+  EXPECT_EQ(first_size, *(uint64_t *)stream.data());
+  EXPECT_EQ(feed(decoder, stream.data() + first_size,
+                 stream.size() - first_size, &consumed, &out),
+            1);
+  EXPECT_EQ(first_size + consumed, stream.size());
+  check_msg(out, 1);
+  msg_destructor(out);
+
+  // A message cut off part way is freed with the decoder
+  EXPECT_EQ(feed(decoder, stream.data(), 100, &consumed, &out), 0);
+  EXPECT_EQ(consumed, 100u);
+  destroy_decoder(decoder);
+
+  // Once a size header is out of range there's no finding the next message
+  decoder = create_decoder(0);
+  const uint64_t bad_header = 3;
+  EXPECT_EQ(feed(decoder, (const uint8_t *)&bad_header, 4, &consumed, &out),
+            0);
+  EXPECT_EQ(feed(decoder, (const uint8_t *)&bad_header + 4, 4, &consumed,
+                 &out),
+            2);
+  EXPECT_EQ(feed(decoder, stream.data(), stream.size(), &consumed, &out), 2);
+  EXPECT_TRUE(out == nullptr);
+  destroy_decoder(decoder);
+
+  // A peer can't get anything allocated past the limit just by sending a big
+  // size header, and real messages over it are turned away as well
+  const uint64_t huge_header = 1ull << 40u;
+  decoder = create_decoder(first_size - 1);
+  EXPECT_EQ(feed(decoder, (const uint8_t *)&huge_header, 8, &consumed, &out),
+            2);
+  destroy_decoder(decoder);
+  decoder = create_decoder(first_size - 1);
+  EXPECT_EQ(feed(decoder, stream.data(), stream.size(), &consumed, &out), 2);
+  EXPECT_TRUE(out == nullptr);
+  destroy_decoder(decoder);
+  decoder = create_decoder(first_size - 1);
+  EXPECT_EQ(feed(decoder, stream.data(), 8, &consumed, &out), 2);
+  destroy_decoder(decoder);
+  decoder = create_decoder(first_size);
+  EXPECT_EQ(feed(decoder, stream.data(), first_size, &consumed, &out), 1);
+  check_msg(out, 0);
+  msg_destructor(out);
+  destroy_decoder(decoder);
+
+  auto frz_constructor = (void *(*)(int32_t, uint64_t, double *))
+                             engine->getFunctionAddress("create_frz");
+  auto get_xy =
+      (bool (*)(void *, double **))engine->getFunctionAddress("get_frz_xy");
+  auto frz_destructor =
+      (void (*)(void *))engine->getFunctionAddress("destroy_frz");
+  auto frz_serializer =
+      (uint8_t * (*)(void *)) engine->getFunctionAddress("serialize_frz");
+  auto create_frz_decoder =
+      (void *(*)(uint64_t))engine->getFunctionAddress("create_frz_decoder");
+  auto frz_feed = (feed_fn)engine->getFunctionAddress("frz_decoder_feed");
+  auto destroy_frz_decoder =
+      (void (*)(void *))engine->getFunctionAddress("destroy_frz_decoder");
+
+  double test_xy[3] = {0.5, -1, 1e10};
+  void *frz = frz_constructor(9, 3, test_xy);
+  uint8_t *serialized = frz_serializer(frz);
+  const uint64_t frz_size = *(uint64_t *)serialized;
+  frz_destructor(frz);
+
+  decoder = create_frz_decoder(0);
+  EXPECT_EQ(frz_feed(decoder, serialized, 5, &consumed, &out), 0);
+  EXPECT_EQ(frz_feed(decoder, serialized + 5, frz_size - 5, &consumed, &out),
+            1);
+  EXPECT_EQ(consumed, frz_size - 5);
+  double *xy = nullptr;
+  EXPECT_TRUE(get_xy(out, &xy));
+  EXPECT_TRUE(std::equal(test_xy, test_xy + 3, xy));
+  frz_destructor(out);
+
+  // A frozen struct whose arrays point outside of it is rejected at the end
+  std::vector<uint8_t> corrupt(serialized, serialized + frz_size);
+  std::fill(corrupt.end() - 8, corrupt.end(), 0xff);
+  std::fill(corrupt.begin() + 8, corrupt.begin() + 24, 0xff);
+  EXPECT_EQ(frz_feed(decoder, corrupt.data(), 8, &consumed, &out), 0);
+  EXPECT_EQ(frz_feed(decoder, corrupt.data() + 8, frz_size - 8, &consumed,
+                     &out),
+            2);
+  destroy_frz_decoder(decoder);
+  free(serialized);
+}
+
 } // namespace
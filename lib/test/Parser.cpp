@@ -44,4 +44,177 @@ TEST(Parser, basic_C) {
   Parser p{m};
   EXPECT_TRUE(p.parseFile(is));
 }
+
+TEST(Parser, bitpacked) {
+  llvm::LLVMContext ctx;
+  Module m{"bitpacked_test", ctx};
+  m.setDefaultBuiltins();
+
+  std::string struct_def = "struct edge bitpacked {\n"
+                           "  int13 src\n"
+                           "  int13 sink\n"
+                           "  mutable bool visited\n"
+                           "}";
+
+  std::istringstream is(struct_def);
+  Parser p{m};
+  EXPECT_TRUE(p.parseFile(is));
+
+  ir::Struct *s = m.getOrCreateStruct("edge");
+  EXPECT_TRUE(s->isBitPacked());
+  for (auto &f : s->getFields()) {
+    EXPECT_TRUE(f->isBitStorage || f->storageField != nullptr);
+  }
+}
+
+TEST(Parser, unknown_modifier) {
+  llvm::LLVMContext ctx;
+  Module m{"unknown_modifier_test", ctx};
+  m.setDefaultBuiltins();
+
+  std::string struct_def = "struct test_struct {\n"
+                           "  mutable sparkly int16 int_field\n"
+                           "}";
+
+  std::istringstream is(struct_def);
+  Parser p{m};
+  EXPECT_FALSE(p.parseFile(is));
+}
+TEST(Parser, varint) {
+  llvm::LLVMContext ctx;
+  Module m{"varint_test", ctx};
+  m.setDefaultBuiltins();
+
+  std::string struct_def = "struct counters varint {\n"
+                           "  int64 delta\n"
+                           "  uint32 id\n"
+                           "  int8 small\n"
+                           "  float ratio\n"
+                           "}";
+
+  std::istringstream is(struct_def);
+  Parser p{m};
+  EXPECT_TRUE(p.parseFile(is));
+
+  for (auto &f : m.getOrCreateStruct("counters")->getFields()) {
+    const bool IsVarint = f->encoding & ir::kEncodingVarint;
+    const bool IsZigZag = f->encoding & ir::kEncodingZigZag;
+    EXPECT_EQ(IsVarint, f->name == "delta" || f->name == "id");
+    EXPECT_EQ(IsZigZag, f->name == "delta" || f->name == "small");
+  }
+}
+
+TEST(Parser, lazy) {
+  llvm::LLVMContext ctx;
+  Module m{"lazy_test", ctx};
+  m.setDefaultBuiltins();
+
+  std::string struct_def = "struct record lazy {\n"
+                           "  int32 idx\n"
+                           "  mutable repeated float x\n"
+                           "  mutable repeated xor double y\n"
+                           "}";
+
+  std::istringstream is(struct_def);
+  Parser p{m};
+  EXPECT_TRUE(p.parseFile(is));
+
+  ir::Struct *s = m.getOrCreateStruct("record");
+  EXPECT_TRUE(s->isLazy());
+  for (auto &f : s->getFields()) {
+    EXPECT_EQ(f->pendingField != nullptr, f->isRepeated);
+  }
+}
+
+TEST(Parser, indexed) {
+  llvm::LLVMContext ctx;
+  Module m{"indexed_test", ctx};
+  m.setDefaultBuiltins();
+
+  std::string struct_def = "struct record indexed lazy {\n"
+                           "  int32 idx\n"
+                           "  mutable repeated float x\n"
+                           "}";
+
+  std::istringstream is(struct_def);
+  Parser p{m};
+  EXPECT_TRUE(p.parseFile(is));
+
+  ir::Struct *s = m.getOrCreateStruct("record");
+  EXPECT_TRUE(s->isIndexed());
+  EXPECT_TRUE(s->isLazy());
+}
+
+TEST(Parser, frozen) {
+  llvm::LLVMContext ctx;
+  Module m{"frozen_test", ctx};
+  m.setDefaultBuiltins();
+
+  std::string struct_def = "struct point frozen {\n"
+                           "  int32 id\n"
+                           "  repeated double xy\n"
+                           "}\n"
+                           "struct track frozen {\n"
+                           "  point origin\n"
+                           "  mutable repeated float speed\n"
+                           "}";
+
+  std::istringstream is(struct_def);
+  Parser p{m};
+  EXPECT_TRUE(p.parseFile(is));
+
+  ir::Struct *s = m.getOrCreateStruct("track");
+  EXPECT_TRUE(s->isFrozen());
+  EXPECT_TRUE(s->getFields()[0]->isSizeHeader);
+  for (auto &f : s->getFields()) {
+    EXPECT_TRUE(f->isFrozen);
+  }
+
+  // Encodings, and anything that isn't itself frozen, can't go in one
+  for (const char *bad : {"struct bad frozen {\n  repeated varint int32 x\n}",
+                          "struct bad frozen lazy {\n  int32 x\n}",
+                          "struct plain {\n  int32 x\n}\n"
+                          "struct bad frozen {\n  plain x\n}"}) {
+    llvm::LLVMContext bad_ctx;
+    Module bad_m{"frozen_bad_test", bad_ctx};
+    bad_m.setDefaultBuiltins();
+    std::istringstream bad_is(bad);
+    Parser bad_p{bad_m};
+    EXPECT_FALSE(bad_p.parseFile(bad_is));
+  }
+}
+
+TEST(Parser, tracked) {
+  llvm::LLVMContext ctx;
+  Module m{"tracked_test", ctx};
+  m.setDefaultBuiltins();
+
+  std::string struct_def = "struct state tracked {\n"
+                           "  mutable int64 tick\n"
+                           "  mutable repeated float load\n"
+                           "}";
+
+  std::istringstream is(struct_def);
+  Parser p{m};
+  EXPECT_TRUE(p.parseFile(is));
+
+  ir::Struct *s = m.getOrCreateStruct("state");
+  EXPECT_TRUE(s->isTracked());
+  for (auto &f : s->getFields()) {
+    if (f->isDirtyState) {
+      continue;
+    }
+    EXPECT_TRUE(f->dirtyField != nullptr);
+    EXPECT_TRUE(f->isCount || f->dirtyBit != 0);
+  }
+
+  // A frozen struct is written in place, so there's nothing to track
+  llvm::LLVMContext bad_ctx;
+  Module bad_m{"tracked_bad_test", bad_ctx};
+  bad_m.setDefaultBuiltins();
+  std::istringstream bad_is("struct bad frozen tracked {\n  int32 x\n}");
+  Parser bad_p{bad_m};
+  EXPECT_FALSE(bad_p.parseFile(bad_is));
+}
+
 } // namespace
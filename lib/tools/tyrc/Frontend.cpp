@@ -49,6 +49,9 @@ enum SupportedBindingLanguages {
 enum RuntimeOptions {
   kEnableFileHelper = 0,
   kEnableBase64 = 1,
+  kEnableCompress = 2,
+  kEnableParallel = 3,
+  kEnableAsync = 4,
 };
 
 cl::OptionCategory
@@ -81,7 +84,13 @@ cl::bits<RuntimeOptions>
                 cl::values(clEnumValN(kEnableFileHelper, "file-utils",
                                       "Enable the file utilities"),
                            clEnumValN(kEnableBase64, "base64",
-                                      "Enable the base64 utilities")),
+                                      "Enable the base64 utilities"),
+                           clEnumValN(kEnableCompress, "compress",
+                                      "Enable the compression utilities"),
+                           clEnumValN(kEnableParallel, "parallel",
+                                      "Enable the parallel batch utilities"),
+                           clEnumValN(kEnableAsync, "async-file",
+                                      "Enable the asynchronous file queue")),
                 cl::ZeroOrMore, cl::cat(tyrCompilerOptions));
 
 cl::OptionCategory
@@ -22,12 +22,20 @@
 
 #include "path.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <numeric>
 #include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
 const int NUM_ELTS = 512;
@@ -214,6 +222,143 @@ bool check_graph_file() {
   return true;
 }
 
+bool check_graph_mapped_file() {
+  // The mapping is exactly the file, so it validates as it is
+  tyr_mapped_file mapped;
+  assert(tyr_map_file("serialized_graph.tsf", &mapped));
+  assert(mapped.len == *(const uint64_t *)mapped.data);
+  assert(validate_graph(mapped.data, mapped.len));
+  tyr_unmap_file(&mapped);
+  assert(mapped.data == nullptr && mapped.len == 0);
+
+  graph_t *deserialized = (graph_t *)tyr_deserialize_from_mapped_file(
+      "serialized_graph.tsf", (bounded_deserializer_fn)&deserialize_graph_n);
+  assert(deserialized != nullptr);
+
+  edge_t **out_edges = nullptr;
+  get_graph_edge(deserialized, &out_edges);
+  for (int i = 0; i < 14; ++i) {
+    uint16_t src, sink;
+    get_edge_src(out_edges[i], &src);
+    get_edge_sink(out_edges[i], &sink);
+    assert(src == i && sink == i + 1);
+  }
+
+  destroy_graph(deserialized);
+
+  assert(!tyr_map_file("no_such_graph.tsf", &mapped));
+
+  return true;
+}
+
+bool check_path_fd() {
+  const int num_elts = 1 << 20;
+  std::vector<float> x(num_elts), y(num_elts);
+  std::iota(x.begin(), x.end(), 0.f);
+  std::iota(y.begin(), y.end(), 1.f);
+
+  path_t *data = create_path(5);
+  set_path_x(data, x.data(), x.size());
+  set_path_y(data, y.data(), y.size());
+
+  // Written straight from the struct, it has to match the usual buffer
+  assert(tyr_serialize_to_file_streaming(
+      "serialized_path.tsf", (fd_serializer_fn)&serialize_path_to_fd, data));
+  uint8_t *serialized = serialize_path(data);
+  const uint64_t serialized_len = *(uint64_t *)serialized;
+
+  std::ifstream file("serialized_path.tsf", std::ios::binary);
+  std::vector<uint8_t> written((std::istreambuf_iterator<char>(file)),
+                               std::istreambuf_iterator<char>());
+  assert(written.size() == serialized_len);
+  assert(memcmp(written.data(), serialized, serialized_len) == 0);
+
+  free(serialized);
+  destroy_path(data);
+
+  return true;
+}
+
+bool sum_log_edges(void *ctx, const uint8_t *record, uint64_t len) {
+  edge_t *edge = (edge_t *)deserialize_edge_n(record, len);
+  assert(edge != nullptr);
+  uint16_t src, sink;
+  get_edge_src(edge, &src);
+  get_edge_sink(edge, &sink);
+  assert(sink == src + 1);
+  *(uint64_t *)ctx += src;
+  destroy_edge(edge);
+  return true;
+}
+
+bool check_edge_log() {
+  std::remove("edges.tlog");
+
+  // Two sessions, the second appends to what the first left
+  uint64_t expected = 0;
+  for (int session = 0; session < 2; ++session) {
+    tyr_log *log = tyr_log_open("edges.tlog");
+    assert(log != nullptr);
+    for (int i = 0; i < 10000; ++i) {
+      edge_t *edge = create_edge(i, i + 1);
+      assert(tyr_log_append_struct(log, (serializer_fn)&serialize_edge, edge));
+      destroy_edge(edge);
+      expected += i;
+    }
+    assert(tyr_log_flush(log));
+    assert(tyr_log_close(log));
+  }
+
+  uint64_t sum = 0;
+  assert(tyr_log_iterate("edges.tlog", &sum_log_edges, &sum) == 20000);
+  assert(sum == expected);
+
+  // A corrupt record costs the records up to the next sync marker, not the
+  // rest of the log
+  std::fstream file("edges.tlog",
+                    std::ios::in | std::ios::out | std::ios::binary);
+  file.seekp(1000);
+  file.put(0x7f);
+  file.close();
+  sum = 0;
+  const uint64_t recovered =
+      tyr_log_iterate("edges.tlog", &sum_log_edges, &sum);
+  assert(recovered < 20000 && recovered > 17000);
+
+  return true;
+}
+
+bool check_edge_log_commit() {
+  std::remove("edges_durable.tlog");
+  tyr_log *log = tyr_log_open("edges_durable.tlog");
+  assert(log != nullptr);
+
+  // Every commit is synced by the time it returns, whichever thread did it
+  std::vector<std::thread> threads;
+  std::atomic<uint64_t> expected{0};
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([log, t, &expected] {
+      for (int i = 0; i < 50; ++i) {
+        edge_t *edge = create_edge(t * 50 + i, t * 50 + i + 1);
+        assert(tyr_log_commit_struct(log, (serializer_fn)&serialize_edge,
+                                     edge));
+        destroy_edge(edge);
+        expected += t * 50 + i;
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  uint64_t sum = 0;
+  assert(tyr_log_iterate("edges_durable.tlog", &sum_log_edges, &sum) == 400);
+  assert(sum == expected);
+  assert(tyr_log_close(log));
+
+  return true;
+}
+
 uint8_t *get_b64_graph() {
   std::vector<node_t *> nodes;
   for (int i = 0; i < 15; ++i) {
@@ -267,6 +412,11 @@ uint8_t *get_b64_graph() {
   uint8_t *serialized = tyr_serialize_to_base64(&serialize_graph, g);
 
   const uint64_t b64_len = *(uint64_t *)serialized;
+  std::vector<uint8_t> into(b64_len);
+  assert(serialize_graph_base64_into(g, into.data(), into.size()) == b64_len);
+  assert(memcmp(into.data(), serialized + sizeof(uint64_t), b64_len) == 0);
+  // Too small a buffer is left alone
+  assert(serialize_graph_base64_into(g, into.data(), b64_len - 1) == b64_len);
 
   destroy_graph(g);
   return serialized;
@@ -309,6 +459,433 @@ bool check_graph_b64(uint8_t *serialized) {
   return true;
 }
 
+// The original one-group-at-a-time encoder, kept as a reference for the
+// vectorized runtime encoder.
+std::vector<uint8_t> reference_b64_encode(const uint8_t *serialized) {
+  static const char alphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+  const uint64_t serialized_len = *(uint64_t *)serialized;
+  const uint8_t *serialized_ptr = serialized + sizeof(uint64_t);
+  // The encoded body is followed by 8 zero bytes
+  const uint64_t body_len = serialized_len - sizeof(uint64_t);
+
+  const uint64_t num_pad = (3 - (serialized_len % 3)) % 3;
+  const uint64_t packed_size = serialized_len / 3 + (serialized_len % 3 != 0);
+
+  std::vector<uint8_t> out;
+  out.reserve(packed_size * 4);
+  uint64_t str_iter = 0;
+  for (uint64_t i = 0; i < packed_size; ++i) {
+    uint32_t packed = 0;
+    for (int8_t j = 2; j >= 0; --j) {
+      const uint32_t byte = str_iter < body_len ? serialized_ptr[str_iter] : 0;
+      packed |= byte << (8 * j);
+      ++str_iter;
+    }
+
+    for (int8_t k = 3; k >= 0; --k) {
+      out.push_back(alphabet[(packed >> (k * 6)) & 0x3f]);
+    }
+  }
+
+  for (uint64_t i = 0; i < num_pad; ++i) {
+    out[out.size() - 1 - i] = '=';
+  }
+
+  return out;
+}
+
+bool check_b64_throughput() {
+  const int num_elts = 1 << 20;
+  std::vector<float> x(num_elts), y(num_elts);
+  std::iota(x.begin(), x.end(), 0.f);
+  std::iota(y.begin(), y.end(), 1.f);
+
+  path_t *data = create_path(5);
+  set_path_x(data, x.data(), x.size());
+  set_path_y(data, y.data(), y.size());
+
+  uint8_t *serialized = serialize_path(data);
+  const double mb = *(uint64_t *)serialized / 1e6;
+
+  auto ref_start = std::chrono::high_resolution_clock::now();
+  std::vector<uint8_t> expected = reference_b64_encode(serialized);
+  auto ref_stop = std::chrono::high_resolution_clock::now();
+
+  auto enc_start = std::chrono::high_resolution_clock::now();
+  uint8_t *b64 = tyr_serialize_to_base64(&serialize_path, data);
+  auto enc_stop = std::chrono::high_resolution_clock::now();
+  free(serialized);
+
+  assert(*(uint64_t *)b64 == expected.size());
+  assert(memcmp(b64 + sizeof(uint64_t), expected.data(), expected.size()) ==
+         0);
+
+  // Straight from the struct into a caller provided buffer
+  const uint64_t into_len = serialize_path_base64_into(data, nullptr, 0);
+  assert(into_len == expected.size());
+  std::vector<uint8_t> into(into_len);
+  auto into_start = std::chrono::high_resolution_clock::now();
+  assert(serialize_path_base64_into(data, into.data(), into.size()) ==
+         into_len);
+  auto into_stop = std::chrono::high_resolution_clock::now();
+  assert(into == expected);
+  destroy_path(data);
+
+  auto dec_start = std::chrono::high_resolution_clock::now();
+  path_t *deserialized =
+      (path_t *)tyr_deserialize_from_base64(&deserialize_path, b64);
+  auto dec_stop = std::chrono::high_resolution_clock::now();
+  free(b64);
+
+  uint64_t x_count;
+  assert(get_path_x_count(deserialized, &x_count));
+  assert(x_count == x.size());
+  float x_, y_;
+  for (uint64_t i = 0; i < x_count; ++i) {
+    get_path_x_item(deserialized, i, &x_);
+    get_path_y_item(deserialized, i, &y_);
+    assert(x_ == x[i] && y_ == y[i]);
+  }
+  destroy_path(deserialized);
+
+  std::cout << "Base64 encode throughput (MB/s), reference: "
+            << mb / std::chrono::duration<double>(ref_stop - ref_start).count()
+            << ", runtime: "
+            << mb / std::chrono::duration<double>(enc_stop - enc_start).count()
+            << ", fused: "
+            << mb /
+                   std::chrono::duration<double>(into_stop - into_start).count()
+            << std::endl;
+  std::cout << "Base64 decode + deserialize throughput (MB/s): "
+            << mb / std::chrono::duration<double>(dec_stop - dec_start).count()
+            << std::endl;
+
+  return true;
+}
+
+uint8_t *get_compressed_graph() {
+  std::vector<node_t *> nodes;
+  for (int i = 0; i < 15; ++i) {
+    std::array<uint64_t, 3> data_vec{1, 1, 1};
+    nodes.push_back(create_node(i, data_vec.size(), data_vec.data()));
+  }
+
+  std::vector<edge_t *> edges;
+  for (int i = 0; i < 14; ++i) {
+    edges.push_back(create_edge(i, i + 1));
+  }
+
+  graph_t *g = create_graph();
+  set_graph_node(g, nodes.data(), nodes.size());
+  set_graph_edge(g, edges.data(), edges.size());
+
+  uint8_t *raw = serialize_graph(g);
+  const uint64_t raw_len = *(uint64_t *)raw;
+  free(raw);
+
+  uint8_t *compressed = tyr_serialize_compressed(&serialize_graph, g);
+
+  // The node payloads are all the same so this should shrink a fair bit
+  const uint64_t compressed_len = *(uint64_t *)compressed;
+  assert(compressed_len < raw_len);
+
+  destroy_graph(g);
+  return compressed;
+}
+
+bool check_graph_compressed(uint8_t *compressed) {
+  const uint64_t compressed_len = *(uint64_t *)compressed;
+
+  // A block cut short, one that doesn't decompress to the length in its
+  // header and a header that's too short all have to be turned away
+  std::vector<uint8_t> broken(compressed, compressed + compressed_len);
+  *(uint64_t *)broken.data() = compressed_len - 1;
+  assert(tyr_deserialize_compressed(&deserialize_graph, broken.data()) ==
+         nullptr);
+  *(uint64_t *)broken.data() = compressed_len;
+  *(uint64_t *)(broken.data() + sizeof(uint64_t)) += 1;
+  assert(tyr_deserialize_compressed(&deserialize_graph, broken.data()) ==
+         nullptr);
+  *(uint64_t *)broken.data() = sizeof(uint64_t);
+  assert(tyr_deserialize_compressed(&deserialize_graph, broken.data()) ==
+         nullptr);
+
+  graph_t *deserialized =
+      (graph_t *)tyr_deserialize_compressed(&deserialize_graph, compressed);
+  free(compressed);
+  assert(deserialized != nullptr);
+
+  edge_t **out_edges = nullptr;
+  get_graph_edge(deserialized, &out_edges);
+  for (int i = 0; i < 14; ++i) {
+    uint16_t src, sink;
+    get_edge_src(out_edges[i], &src);
+    get_edge_sink(out_edges[i], &sink);
+    assert(src == i && sink == i + 1);
+  }
+
+  node_t **out_nodes = nullptr;
+  get_graph_node(deserialized, &out_nodes);
+  for (int i = 0; i < 15; ++i) {
+    uint16_t id;
+    uint64_t data_count;
+    uint64_t *data;
+
+    get_node_id(out_nodes[i], &id);
+    assert(id == i);
+    get_node_data_count(out_nodes[i], &data_count);
+    assert(data_count == 3);
+    get_node_data(out_nodes[i], &data);
+    for (int j = 0; j < 3; ++j) {
+      assert(data[j] == 1);
+    }
+  }
+
+  destroy_graph(deserialized);
+
+  return true;
+}
+
+bool check_parallel_nodes() {
+  const int num_nodes = 1 << 14;
+  std::vector<node_t *> nodes;
+  for (int i = 0; i < num_nodes; ++i) {
+    std::vector<uint64_t> data(i % 61, i);
+    nodes.push_back(create_node(i % 2048, data.size(), data.data()));
+  }
+
+  std::vector<uint8_t *> bufs(num_nodes);
+  auto ser_start = std::chrono::high_resolution_clock::now();
+  assert(tyr_serialize_many(&serialize_node, (void *const *)nodes.data(),
+                            num_nodes, bufs.data()) == num_nodes);
+  auto ser_stop = std::chrono::high_resolution_clock::now();
+
+  std::vector<uint64_t> lens(num_nodes);
+  for (int i = 0; i < num_nodes; ++i) {
+    lens[i] = *(uint64_t *)bufs[i];
+    destroy_node(nodes[i]);
+  }
+
+  // A truncated buffer has to come back as NULL without touching the others
+  lens[7] -= 1;
+
+  std::vector<void *> out(num_nodes);
+  auto des_start = std::chrono::high_resolution_clock::now();
+  assert(tyr_deserialize_many(
+             (bounded_deserializer_fn)&deserialize_node_n, bufs.data(),
+             lens.data(), num_nodes, out.data()) == num_nodes - 1);
+  auto des_stop = std::chrono::high_resolution_clock::now();
+  assert(out[7] == nullptr);
+
+  for (int i = 0; i < num_nodes; ++i) {
+    free(bufs[i]);
+    if (i == 7) {
+      continue;
+    }
+
+    node_t *n = (node_t *)out[i];
+    uint16_t id;
+    uint64_t data_count;
+    get_node_id(n, &id);
+    get_node_data_count(n, &data_count);
+    assert(id == i % 2048 && data_count == (uint64_t)(i % 61));
+    for (uint64_t j = 0; j < data_count; ++j) {
+      uint64_t item;
+      get_node_data_item(n, j, &item);
+      assert(item == (uint64_t)i);
+    }
+    destroy_node(n);
+  }
+
+  std::cout << "Parallel serialize/deserialize of " << num_nodes
+            << " nodes on " << tyr_parallel_threads() << " threads (s): "
+            << std::chrono::duration<double>(ser_stop - ser_start).count()
+            << ", "
+            << std::chrono::duration<double>(des_stop - des_start).count()
+            << std::endl;
+
+  tyr_parallel_shutdown();
+  return true;
+}
+
+bool check_node_stream() {
+  int fds[2];
+  assert(pipe(fds) == 0);
+
+  // The writer pushes the records through in pieces that don't line up with
+  // them, one of them bigger than the reader's starting buffer
+  const int num_nodes = 500;
+  std::thread writer([&fds] {
+    std::vector<uint8_t> stream;
+    for (int i = 0; i < num_nodes; ++i) {
+      std::vector<uint64_t> data(i == 250 ? 20000 : i % 37, i);
+      node_t *n = create_node(i, data.size(), data.data());
+      uint8_t *serialized = serialize_node(n);
+      stream.insert(stream.end(), serialized,
+                    serialized + *(uint64_t *)serialized);
+      free(serialized);
+      destroy_node(n);
+    }
+    size_t piece = 1;
+    for (size_t off = 0; off < stream.size(); off += piece) {
+      piece = std::min(piece * 3 % 4093, stream.size() - off);
+      assert(write(fds[1], stream.data() + off, piece) == (ssize_t)piece);
+    }
+    close(fds[1]);
+  });
+
+  tyr_stream_reader *r = tyr_stream_reader_create(fds[0], 0);
+  assert(r != nullptr);
+  void *out;
+  for (int i = 0; i < num_nodes; ++i) {
+    assert(tyr_stream_reader_next_struct(
+               r, (bounded_deserializer_fn)&deserialize_node_n, &out) ==
+           TYR_STREAM_RECORD);
+    node_t *n = (node_t *)out;
+    uint16_t id;
+    uint64_t data_count, last;
+    get_node_id(n, &id);
+    get_node_data_count(n, &data_count);
+    assert(id == i);
+    assert(data_count == (i == 250 ? 20000u : (uint64_t)(i % 37)));
+    if (data_count > 0) {
+      get_node_data_item(n, data_count - 1, &last);
+      assert(last == (uint64_t)i);
+    }
+    destroy_node(n);
+  }
+  assert(tyr_stream_reader_next_struct(
+             r, (bounded_deserializer_fn)&deserialize_node_n, &out) ==
+         TYR_STREAM_END);
+  writer.join();
+  tyr_stream_reader_destroy(r);
+  close(fds[0]);
+
+  // Ending part way through a record is an error
+  assert(pipe(fds) == 0);
+  node_t *n = create_node(1, 0, nullptr);
+  uint8_t *serialized = serialize_node(n);
+  destroy_node(n);
+  assert(write(fds[1], serialized, *(uint64_t *)serialized - 1) > 0);
+  free(serialized);
+  close(fds[1]);
+  r = tyr_stream_reader_create(fds[0], 0);
+  const uint8_t *record;
+  uint64_t len;
+  assert(tyr_stream_reader_next(r, &record, &len) == TYR_STREAM_ERROR);
+  tyr_stream_reader_destroy(r);
+  close(fds[0]);
+
+  return true;
+}
+
+bool check_node_decoder() {
+  std::vector<uint64_t> data(3000, 42);
+  node_t *n = create_node(17, data.size(), data.data());
+  uint8_t *serialized = serialize_node(n);
+  const uint64_t size = *(uint64_t *)serialized;
+  destroy_node(n);
+
+  // As if it came off a non-blocking socket 1000 bytes at a time
+  node_decoder_t *decoder = create_node_decoder(0);
+  assert(decoder != nullptr);
+  node_t *out = nullptr;
+  for (uint64_t pos = 0; pos < size;) {
+    const uint64_t len = std::min<uint64_t>(1000, size - pos);
+    uint64_t consumed = 0;
+    const tyr_decode_status status =
+        node_decoder_feed(decoder, serialized + pos, len, &consumed, &out);
+    assert(consumed == len);
+    pos += consumed;
+    assert(status == (pos == size ? TYR_DECODE_DONE : TYR_DECODE_NEED_MORE));
+  }
+  destroy_node_decoder(decoder);
+  free(serialized);
+
+  uint16_t id;
+  uint64_t data_count;
+  get_node_id(out, &id);
+  get_node_data_count(out, &data_count);
+  assert(id == 17 && data_count == data.size());
+  destroy_node(out);
+  return true;
+}
+
+bool check_async_nodes() {
+  const int num_files = 64;
+  tyr_async *q = tyr_async_create(16);
+  assert(q != nullptr);
+
+  // Keep the queue full, reaping whenever it won't take another write
+  tyr_async_result results[16];
+  int written = 0;
+  for (int i = 0; i < num_files; ++i) {
+    std::vector<uint64_t> data(i + 1, i);
+    node_t *n = create_node(i, data.size(), data.data());
+    const std::string name = "node_async_" + std::to_string(i) + ".tyr";
+    while (!tyr_async_serialize_to_file(q, name.c_str(), &serialize_node, n,
+                                        (void *)(intptr_t)i)) {
+      const uint32_t done = tyr_async_reap(q, results, 16, true);
+      for (uint32_t r = 0; r < done; ++r) {
+        assert(results[r].ok && results[r].tyr_struct_ptr == nullptr);
+      }
+      written += done;
+    }
+    // The struct isn't needed once the write has been submitted
+    destroy_node(n);
+  }
+  while (tyr_async_pending(q) > 0) {
+    const uint32_t done = tyr_async_reap(q, results, 16, true);
+    for (uint32_t r = 0; r < done; ++r) {
+      assert(results[r].ok);
+    }
+    written += done;
+  }
+  assert(written == num_files);
+
+  for (int i = 0; i < num_files; ++i) {
+    const std::string name = "node_async_" + std::to_string(i) + ".tyr";
+    assert(tyr_async_deserialize_from_file(
+        q, name.c_str(), (bounded_deserializer_fn)&deserialize_node_n,
+        (void *)(intptr_t)i));
+    if (tyr_async_pending(q) == 16) {
+      break;
+    }
+  }
+  assert(!tyr_async_deserialize_from_file(
+      q, "node_async_0.tyr", (bounded_deserializer_fn)&deserialize_node_n,
+      nullptr));
+
+  int read = 0;
+  while (tyr_async_pending(q) > 0) {
+    const uint32_t done = tyr_async_reap(q, results, 16, true);
+    for (uint32_t r = 0; r < done; ++r) {
+      assert(results[r].ok);
+      const intptr_t i = (intptr_t)results[r].user_data;
+      node_t *n = (node_t *)results[r].tyr_struct_ptr;
+      uint16_t id;
+      uint64_t data_count;
+      get_node_id(n, &id);
+      get_node_data_count(n, &data_count);
+      assert(id == i && data_count == (uint64_t)(i + 1));
+      destroy_node(n);
+    }
+    read += done;
+  }
+  assert(read == 16);
+
+  // A missing file only fails its own request
+  assert(tyr_async_deserialize_from_file(
+      q, "node_async_missing.tyr",
+      (bounded_deserializer_fn)&deserialize_node_n, nullptr));
+  assert(tyr_async_reap(q, results, 16, true) == 1 && !results[0].ok);
+
+  tyr_async_destroy(q);
+  return true;
+}
+
 int main() {
 
   std::vector<float> x, y;
@@ -321,9 +898,22 @@ int main() {
   uint8_t *serialized_graph = get_serialized_graph();
   assert(check_graph(serialized_graph));
   assert(check_graph_file());
+  assert(check_graph_mapped_file());
+  assert(check_path_fd());
+  assert(check_edge_log());
+  assert(check_edge_log_commit());
+  assert(check_node_stream());
+  assert(check_node_decoder());
 
   uint8_t *b64_graph = get_b64_graph();
   assert(check_graph_b64(b64_graph));
+  assert(check_b64_throughput());
+
+  uint8_t *compressed_graph = get_compressed_graph();
+  assert(check_graph_compressed(compressed_graph));
+
+  assert(check_parallel_nodes());
+  assert(check_async_nodes());
 
   std::cout << "Test succeeded" << std::endl;
 